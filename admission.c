@@ -0,0 +1,167 @@
+/* Implementation of `admission.h`, see that file for documentation and
+ * types
+ */
+
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+
+#include "admission.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+#include "alloc.h"
+
+bool parse_admission(const char* str, struct Admission* admission) {
+	memset(admission, 0, sizeof(*admission));
+	unsigned long retry_secs = 1;
+
+	const char* option = str;
+	while (*option != '\0') {
+		size_t len = strcspn(option, ",");
+
+		if (len > 9 && strncmp(option, "inflight=", 9) == 0) {
+			admission->max_in_flight = (uint32_t) strtoul(option + 9, NULL, 10);
+		} else if (len > 6 && strncmp(option, "queue=", 6) == 0) {
+			admission->max_queue = (uint32_t) strtoul(option + 6, NULL, 10);
+		} else if (len > 6 && strncmp(option, "delay=", 6) == 0) {
+			admission->max_delay_us = (uint64_t) strtoul(option + 6, NULL, 10) *
+			                          1000;
+		} else if (len > 4 && strncmp(option, "lag=", 4) == 0) {
+			admission->max_lag_us = (uint64_t) strtoul(option + 4, NULL, 10) *
+			                        1000;
+		} else if (len > 6 && strncmp(option, "retry=", 6) == 0) {
+			retry_secs = strtoul(option + 6, NULL, 10);
+		} else if (len == 5 && strncmp(option, "pause", 5) == 0) {
+			admission->pause = true;
+		} else {
+			return false;
+		}
+
+		option += len;
+		if (*option == ',') {
+			option++;
+		}
+	}
+
+	/* Render the 503 response once, so that shedding is cheap */
+	admission->response = malloc(128);
+	sprintf(admission->response, "HTTP/1.1 503 Service Unavailable\r\n"
+	                             "Retry-After: %lu\r\nContent-Length: 0\r\n"
+	                             "Connection: close\r\n\r\n", retry_secs);
+	admission->response_len = strlen(admission->response);
+
+	return true;
+}
+
+void free_admission(struct Admission* admission) {
+	free(admission->response);
+	memset(admission, 0, sizeof(*admission));
+}
+
+/* Get the number of connections waiting in the accept queue of `listener`,
+ * or 0 if that's not known
+ */
+static uint32_t admission_queue_len(Socket listener) {
+	#ifdef __linux__
+	/* For listening sockets, `tcpi_unacked` is the accept queue length */
+	struct tcp_info tcp_info;
+	socklen_t len = sizeof(tcp_info);
+	memset(&tcp_info, 0, sizeof(tcp_info));
+	if (getsockopt(listener, IPPROTO_TCP, TCP_INFO, &tcp_info, &len) == 0) {
+		return tcp_info.tcpi_unacked;
+	}
+	#endif
+
+	return 0;
+}
+
+enum AdmissionResult admission_check(struct Admission* admission,
+                                     Socket listener) {
+	uint32_t in_flight = __atomic_load_n(&admission->in_flight,
+	                                     __ATOMIC_RELAXED);
+	uint64_t lag_us = __atomic_load_n(&admission->lag_us, __ATOMIC_RELAXED);
+	if ((admission->max_in_flight != 0 &&
+	     in_flight >= admission->max_in_flight) ||
+	    (admission->max_lag_us != 0 && lag_us > admission->max_lag_us)) {
+		return admission->pause ? Pause : Shed;
+	}
+
+	/* Each connection in the queue has to wait for about one connection to
+	 * be served, so the queueing delay is estimated from the lag
+	 */
+	if (admission->max_queue != 0 || admission->max_delay_us != 0) {
+		uint32_t queued = admission_queue_len(listener);
+		if (admission->max_queue != 0 && queued > admission->max_queue) {
+			return Shed;
+		}
+		if (admission->max_delay_us != 0 &&
+		    queued * lag_us > admission->max_delay_us) {
+			return Shed;
+		}
+	}
+
+	return Admit;
+}
+
+void admission_shed(struct Admission* admission, Socket incoming) {
+	int32_t flags = 0;
+	#ifdef __linux__
+	flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+	#endif
+
+	send(incoming, admission->response, (int) admission->response_len, flags);
+
+	/* Discard the request that was already received, so that closing the
+	 * connection doesn't reset it before the client got the response
+	 */
+	char discard[1024];
+	recv(incoming, discard, sizeof(discard), flags);
+	close_socket(incoming);
+
+	uint64_t shed = __atomic_add_fetch(&admission->shed, 1, __ATOMIC_RELAXED);
+	if ((shed & (shed - 1)) == 0) {
+		char buf[64];
+		sprintf(buf, "Overloaded, shed %lu connections so far",
+		        (unsigned long) shed);
+		warn(buf);
+	}
+}
+
+void admission_begin(struct Admission* admission) {
+	__atomic_add_fetch(&admission->in_flight, 1, __ATOMIC_RELAXED);
+}
+
+/* Add a sample to the exponentially weighted moving average of the lag,
+ * with a weight of 1/8. The old value's share is rounded down, so that it
+ * decays to 0.
+ */
+static void admission_record_lag(struct Admission* admission,
+                                 uint64_t lag_us) {
+	uint64_t old = __atomic_load_n(&admission->lag_us, __ATOMIC_RELAXED);
+	uint64_t new;
+	do {
+		new = old - (old + 7) / 8 + lag_us / 8;
+	} while (!__atomic_compare_exchange_n(&admission->lag_us, &old, new, false,
+	                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void admission_end(struct Admission* admission, uint64_t service_us) {
+	__atomic_sub_fetch(&admission->in_flight, 1, __ATOMIC_RELAXED);
+	admission_record_lag(admission, service_us);
+}
+
+int32_t admission_timeout(const struct Admission* admission) {
+	return __atomic_load_n(&admission->lag_us, __ATOMIC_RELAXED) > 0 ?
+	       SERV_ADMISSION_DECAY_MS : -1;
+}
+
+void admission_decay(struct Admission* admission) {
+	admission_record_lag(admission, 0);
+}
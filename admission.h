@@ -0,0 +1,115 @@
+/* Admission control and load shedding. Before a connection is served, the
+ * server checks the number of requests in flight, the length of the accept
+ * queue of the listener, the estimated time connections spend in that queue
+ * and the lag (how long serving a connection keeps the accept loop or a worker
+ * busy). Past the configured thresholds, connections
+ * are shed cheaply, with a pre-rendered "503 Service Unavailable" response,
+ * or by not accepting them for a moment, so that the latency of the admitted
+ * requests stays bounded.
+ */
+
+#ifndef C_HTTP_SERVER_ADMISSION_H
+#define C_HTTP_SERVER_ADMISSION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "socket.h"
+
+/* How long accepting pauses when shedding by not accepting, in
+ * milliseconds
+ */
+#define SERV_ADMISSION_PAUSE_MS 10
+
+/* How often the lag decays while no connection arrives, in milliseconds */
+#define SERV_ADMISSION_DECAY_MS 100
+
+/* The thresholds and state of the admission control (`-A`). A threshold of 0
+ * means no limit.
+ */
+struct Admission {
+	/* The maximum number of requests in flight */
+	uint32_t max_in_flight;
+	/* The maximum number of connections waiting in a listener's accept
+	 * queue
+	 */
+	uint32_t max_queue;
+	/* The maximum estimated queueing delay, in microseconds */
+	uint64_t max_delay_us;
+	/* The maximum lag, in microseconds */
+	uint64_t max_lag_us;
+	/* Whether connections are left in the accept queue instead of getting a
+	 * 503 response when there are too many requests in flight or the lag is
+	 * too high
+	 */
+	bool pause;
+	/* The pre-rendered 503 response */
+	char* response;
+	size_t response_len;
+
+	/* The number of requests in flight */
+	uint32_t in_flight;
+	/* The moving average of the lag, in microseconds */
+	uint64_t lag_us;
+	/* The number of shed connections */
+	uint64_t shed;
+};
+
+/* Parse the admission control thresholds from a string "OPTION[,OPTION...]",
+ * where the options are "inflight=N" (requests in flight), "queue=N"
+ * (connections in a listener's accept queue), "delay=MS" (estimated queueing
+ * delay), "lag=MS" (the average time serving a connection takes),
+ * "retry=SECONDS" (the `Retry-After` of the 503 response, default 1) and
+ * "pause" (stop accepting instead of responding with 503, see
+ * `admission_check`). Returns false if the string is invalid. The admission
+ * control should be freed with `free_admission` after use.
+ */
+bool parse_admission(const char* str, struct Admission* admission);
+
+/* Free the memory allocated by `parse_admission` */
+void free_admission(struct Admission* admission);
+
+/* The decision of the admission control for a new connection */
+enum AdmissionResult {
+	/* Accept and serve the connection */
+	Admit,
+	/* Accept the connection and respond with the pre-rendered 503 */
+	Shed,
+	/* Leave the connection in the accept queue for now */
+	Pause
+};
+
+/* Decide what to do with a new connection on the listener `listener`. Past
+ * the in-flight or lag thresholds, connections are shed or (with "pause")
+ * left in the accept queue until the load goes down. Past the queue length or
+ * queueing delay thresholds, connections are always shed, since that is what
+ * shortens the queue.
+ */
+enum AdmissionResult admission_check(struct Admission* admission,
+                                     Socket listener);
+
+/* Shed the connection `incoming` with the pre-rendered 503 response, and
+ * close it
+ */
+void admission_shed(struct Admission* admission, Socket incoming);
+
+/* Record the start of a request */
+void admission_begin(struct Admission* admission);
+
+/* Record the end of a request that took `service_us` microseconds to serve,
+ * as a sample of the lag
+ */
+void admission_end(struct Admission* admission, uint64_t service_us);
+
+/* Get the timeout (in milliseconds) after which the accept loop should call
+ * `admission_decay` if no connection arrives, or -1 if there is no lag
+ */
+int32_t admission_timeout(const struct Admission* admission);
+
+/* Let the lag decay while no connection arrives or is accepted, as if an
+ * idle server served a connection instantly
+ */
+void admission_decay(struct Admission* admission);
+
+#endif
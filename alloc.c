@@ -0,0 +1,222 @@
+/* Implementation of `alloc.h`, see that file for documentation and types */
+
+#include "alloc.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+
+/* The number of requests received */
+static uint64_t alloc_requests = 0;
+
+void alloc_count_request(void) {
+	__atomic_fetch_add(&alloc_requests, 1, __ATOMIC_RELAXED);
+}
+
+#ifdef SERV_ALLOC_STATS
+
+/* Marks allocations made by the wrappers */
+#define SERV_ALLOC_MAGIC 0xa110ca7edUL
+
+/* The header in front of each allocation, keeping the (maximum) alignment of
+ * `malloc`
+ */
+union AllocHeader {
+	struct {
+		struct AllocSite* site;
+		size_t size;
+		unsigned long magic;
+	} info;
+	long double align;
+};
+
+/* The list of call sites that allocated memory */
+static struct AllocSite* alloc_sites = NULL;
+
+/* The totals over all sites */
+static uint64_t alloc_live_bytes = 0;
+static uint64_t alloc_peak_bytes = 0;
+static uint64_t alloc_allocs = 0;
+
+/* Raise `*peak` to `value` if that's higher */
+static void alloc_raise(uint64_t* peak, uint64_t value) {
+	uint64_t old = __atomic_load_n(peak, __ATOMIC_RELAXED);
+	while (value > old &&
+	       !__atomic_compare_exchange_n(peak, &old, value, true,
+	                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+/* Count the allocation of `size` bytes at `site`, adding the site to the list
+ * on its first allocation
+ */
+static void alloc_count(struct AllocSite* site, size_t size) {
+	uint32_t registered = 0;
+	if (__atomic_load_n(&site->registered, __ATOMIC_ACQUIRE) == 0 &&
+	    __atomic_compare_exchange_n(&site->registered, &registered, 1, false,
+	                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+		struct AllocSite* head = __atomic_load_n(&alloc_sites,
+		                                         __ATOMIC_RELAXED);
+		do {
+			site->next = head;
+		} while (!__atomic_compare_exchange_n(&alloc_sites, &head, site, true,
+		                                      __ATOMIC_RELEASE,
+		                                      __ATOMIC_RELAXED));
+	}
+
+	__atomic_fetch_add(&site->live, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&site->allocs, 1, __ATOMIC_RELAXED);
+	alloc_raise(&site->peak_bytes,
+	            __atomic_add_fetch(&site->live_bytes, size, __ATOMIC_RELAXED));
+
+	__atomic_fetch_add(&alloc_allocs, 1, __ATOMIC_RELAXED);
+	alloc_raise(&alloc_peak_bytes,
+	            __atomic_add_fetch(&alloc_live_bytes, size, __ATOMIC_RELAXED));
+}
+
+/* Count that the allocation with the header `header` was freed */
+static void alloc_uncount(const union AllocHeader* header) {
+	struct AllocSite* site = header->info.site;
+	__atomic_fetch_sub(&site->live, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_sub(&site->live_bytes, header->info.size, __ATOMIC_RELAXED);
+	__atomic_fetch_sub(&alloc_live_bytes, header->info.size, __ATOMIC_RELAXED);
+}
+
+/* Fill in the header of a new allocation and return the memory after it */
+static void* alloc_init(union AllocHeader* header, size_t size,
+                        struct AllocSite* site) {
+	if (header == NULL) {
+		return NULL;
+	}
+
+	header->info.site = site;
+	header->info.size = size;
+	header->info.magic = SERV_ALLOC_MAGIC;
+	alloc_count(site, size);
+	return header + 1;
+}
+
+/* The real allocation functions are called with their names in parentheses,
+ * which stops the macros from expanding
+ */
+
+void* alloc_malloc(size_t size, struct AllocSite* site) {
+	return alloc_init((malloc)(sizeof(union AllocHeader) + size), size, site);
+}
+
+void* alloc_calloc(size_t num, size_t size, struct AllocSite* site) {
+	if (size != 0 && num > ((size_t) -1 - sizeof(union AllocHeader)) / size) {
+		return NULL;
+	}
+
+	size_t total = num * size;
+	union AllocHeader* header = (malloc)(sizeof(union AllocHeader) + total);
+	if (header != NULL) {
+		memset(header + 1, 0, total);
+	}
+	return alloc_init(header, total, site);
+}
+
+void* alloc_realloc(void* ptr, size_t size, struct AllocSite* site) {
+	if (ptr == NULL) {
+		return alloc_malloc(size, site);
+	}
+
+	union AllocHeader* header = (union AllocHeader*) ptr - 1;
+	if (header->info.magic != SERV_ALLOC_MAGIC) {
+		return (realloc)(ptr, size);
+	}
+
+	union AllocHeader old = *header;
+	header = (realloc)(header, sizeof(union AllocHeader) + size);
+	if (header == NULL) {
+		return NULL;
+	}
+
+	/* The memory now counts as allocated by the `realloc` call */
+	alloc_uncount(&old);
+	return alloc_init(header, size, site);
+}
+
+void alloc_free(void* ptr) {
+	if (ptr == NULL) {
+		return;
+	}
+
+	/* Memory allocated by libraries is freed as usual */
+	union AllocHeader* header = (union AllocHeader*) ptr - 1;
+	if (header->info.magic != SERV_ALLOC_MAGIC) {
+		(free)(ptr);
+		return;
+	}
+
+	alloc_uncount(header);
+	header->info.magic = 0;
+	(free)(header);
+}
+
+/* Order sites by their live bytes, the most first */
+static int alloc_compare_sites(const void* a, const void* b) {
+	uint64_t a_bytes = (*(struct AllocSite* const*) a)->live_bytes;
+	uint64_t b_bytes = (*(struct AllocSite* const*) b)->live_bytes;
+	return a_bytes < b_bytes ? 1 : a_bytes > b_bytes ? -1 : 0;
+}
+
+void log_alloc_stats(void) {
+	uint64_t requests = __atomic_load_n(&alloc_requests, __ATOMIC_RELAXED);
+	uint64_t allocs = __atomic_load_n(&alloc_allocs, __ATOMIC_RELAXED);
+	char buf[256];
+	sprintf(buf, "Allocations: %lu bytes live, %lu bytes at the peak, %lu "
+	             "allocations over %lu requests",
+	        (unsigned long) __atomic_load_n(&alloc_live_bytes,
+	                                        __ATOMIC_RELAXED),
+	        (unsigned long) __atomic_load_n(&alloc_peak_bytes,
+	                                        __ATOMIC_RELAXED),
+	        (unsigned long) allocs, (unsigned long) requests);
+	info(buf);
+
+	size_t num_sites = 0;
+	struct AllocSite* site;
+	for (site = __atomic_load_n(&alloc_sites, __ATOMIC_ACQUIRE); site != NULL;
+	     site = site->next) {
+		num_sites++;
+	}
+
+	/* The sites are only ever added at the front, so the first `num_sites`
+	 * are still the same
+	 */
+	struct AllocSite** sites = (malloc)(num_sites * sizeof(struct AllocSite*) +
+	                                    1);
+	size_t i = 0;
+	for (site = __atomic_load_n(&alloc_sites, __ATOMIC_ACQUIRE);
+	     i < num_sites; site = site->next) {
+		sites[i++] = site;
+	}
+	qsort(sites, num_sites, sizeof(struct AllocSite*), alloc_compare_sites);
+
+	for (i = 0; i < num_sites; i++) {
+		site = sites[i];
+		uint64_t site_allocs = __atomic_load_n(&site->allocs,
+		                                       __ATOMIC_RELAXED);
+		sprintf(buf, "Allocations at %.64s:%lu: %lu bytes live in %lu "
+		             "allocations, %lu bytes at the peak, %lu allocations "
+		             "(%.2f per request)", site->file,
+		        (unsigned long) site->line,
+		        (unsigned long) __atomic_load_n(&site->live_bytes,
+		                                        __ATOMIC_RELAXED),
+		        (unsigned long) __atomic_load_n(&site->live, __ATOMIC_RELAXED),
+		        (unsigned long) __atomic_load_n(&site->peak_bytes,
+		                                        __ATOMIC_RELAXED),
+		        (unsigned long) site_allocs,
+		        requests > 0 ? (double) site_allocs / (double) requests : 0.0);
+		info(buf);
+	}
+
+	(free)(sites);
+}
+
+#else
+
+void log_alloc_stats(void) {}
+
+#endif
@@ -0,0 +1,65 @@
+/* Allocation instrumentation. With `SERV_ALLOC_STATS` defined (see the
+ * README), every `malloc`, `calloc`, `realloc` and `free` in the server goes
+ * through counting wrappers instead, which keep the live bytes and
+ * allocations, the total allocations and the peak live bytes of each call
+ * site, so that leaks can be traced to the line that allocated the memory.
+ * The statistics are logged on `SIGUSR1`. Without `SERV_ALLOC_STATS`, this
+ * header doesn't change anything.
+ *
+ * This header has to be included after the system headers, since it
+ * replaces the allocation functions with macros.
+ */
+
+#ifndef C_HTTP_SERVER_ALLOC_H
+#define C_HTTP_SERVER_ALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef SERV_ALLOC_STATS
+
+/* An allocation call site and its statistics */
+struct AllocSite {
+	const char* file;
+	uint32_t line;
+	/* Whether the site is in the list of sites yet */
+	uint32_t registered;
+	/* The next site in the list of sites */
+	struct AllocSite* next;
+
+	uint64_t live_bytes;
+	uint64_t live;
+	uint64_t allocs;
+	uint64_t peak_bytes;
+};
+
+void* alloc_malloc(size_t size, struct AllocSite* site);
+void* alloc_calloc(size_t num, size_t size, struct AllocSite* site);
+void* alloc_realloc(void* ptr, size_t size, struct AllocSite* site);
+void alloc_free(void* ptr);
+
+/* Each call site gets its own (zero-initialized) statistics */
+#define SERV_ALLOC_SITE \
+	static struct AllocSite serv_alloc_site = {__FILE__, __LINE__, 0, NULL, \
+	                                           0, 0, 0, 0}
+
+#define malloc(size) \
+	({ SERV_ALLOC_SITE; alloc_malloc((size), &serv_alloc_site); })
+#define calloc(num, size) \
+	({ SERV_ALLOC_SITE; alloc_calloc((num), (size), &serv_alloc_site); })
+#define realloc(ptr, size) \
+	({ SERV_ALLOC_SITE; alloc_realloc((ptr), (size), &serv_alloc_site); })
+#define free(ptr) alloc_free(ptr)
+
+#endif
+
+/* Record that a request was received, for the allocations per request */
+void alloc_count_request(void);
+
+/* Log the statistics of every call site that allocated memory, the sites
+ * with the most live bytes first (if built with `SERV_ALLOC_STATS`)
+ */
+void log_alloc_stats(void);
+
+#endif
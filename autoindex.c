@@ -0,0 +1,959 @@
+/* Implementation of `autoindex.h`, see that file for documentation and
+ * types
+ */
+
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+
+#include "autoindex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#endif
+
+#include "handlers.h"
+#include "log.h"
+#include "misc.h"
+#include "trace.h"
+#include "tune.h"
+
+#include "alloc.h"
+
+/* The size of the batches of directory entries read at once, and of the
+ * chunks of streamed listings
+ */
+#define SERV_AUTOINDEX_BATCH_SIZE 65536
+
+/* The format of a listing */
+enum AutoindexFormat {
+	AutoindexHtml,
+	AutoindexJson,
+	NUM_AUTOINDEX_FORMATS
+};
+
+static const char* const autoindex_mime_types[NUM_AUTOINDEX_FORMATS] = {
+	"text/html; charset=utf-8",
+	"application/json"
+};
+
+/* An entry of a directory listing */
+struct AutoindexEntry {
+	char* name;
+	bool dir;
+	uint64_t size;
+	int64_t mtime;
+};
+
+/* A growable buffer a listing is rendered into */
+struct AutoindexBuf {
+	char* data;
+	size_t len;
+	size_t cap;
+};
+
+static void autoindex_append(struct AutoindexBuf* buf, const char* data,
+                             size_t len) {
+	if (buf->len + len > buf->cap) {
+		while (buf->len + len > buf->cap) {
+			buf->cap = buf->cap == 0 ? 4096 : buf->cap * 2;
+		}
+		buf->data = realloc(buf->data, buf->cap);
+	}
+
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+}
+
+static void autoindex_append_str(struct AutoindexBuf* buf, const char* str) {
+	autoindex_append(buf, str, strlen(str));
+}
+
+/* Append `len` bytes of `str`, escaped for HTML text and attributes */
+static void autoindex_append_html(struct AutoindexBuf* buf, const char* str,
+                                  size_t len) {
+	size_t i;
+	for (i = 0; i < len; i++) {
+		switch (str[i]) {
+			case '&':
+				autoindex_append_str(buf, "&amp;");
+				break;
+			case '<':
+				autoindex_append_str(buf, "&lt;");
+				break;
+			case '>':
+				autoindex_append_str(buf, "&gt;");
+				break;
+			case '"':
+				autoindex_append_str(buf, "&quot;");
+				break;
+			case '\'':
+				autoindex_append_str(buf, "&#39;");
+				break;
+			default:
+				autoindex_append(buf, &str[i], 1);
+				break;
+		}
+	}
+}
+
+/* Append `str`, percent-encoded for use as a relative URL */
+static void autoindex_append_url(struct AutoindexBuf* buf, const char* str) {
+	const char* hex = "0123456789ABCDEF";
+	for (; *str != '\0'; str++) {
+		unsigned char c = (unsigned char) *str;
+		if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+		    (c >= '0' && c <= '9') || c == '-' || c == '.' || c == '_' ||
+		    c == '~') {
+			autoindex_append(buf, str, 1);
+		} else {
+			char escaped[3] = {'%', hex[c >> 4], hex[c & 0xf]};
+			autoindex_append(buf, escaped, 3);
+		}
+	}
+}
+
+/* Append `len` bytes of `str` as the contents of a JSON string */
+static void autoindex_append_json(struct AutoindexBuf* buf, const char* str,
+                                  size_t len) {
+	size_t i;
+	for (i = 0; i < len; i++) {
+		unsigned char c = (unsigned char) str[i];
+		if (c == '"' || c == '\\') {
+			char escaped[2] = {'\\', (char) c};
+			autoindex_append(buf, escaped, 2);
+		} else if (c < 0x20) {
+			char escaped[8];
+			sprintf(escaped, "\\u%04x", (unsigned int) c);
+			autoindex_append(buf, escaped, 6);
+		} else {
+			autoindex_append(buf, &str[i], 1);
+		}
+	}
+}
+
+/* Format `mtime` (in seconds since the epoch) like "2000-01-01T00:00:00Z" */
+static void autoindex_format_time(int64_t mtime, char* out) {
+	time_t t = (time_t) mtime;
+	struct tm tm;
+	#ifdef _WIN32
+	tm = *gmtime(&t);
+	#else
+	gmtime_r(&t, &tm);
+	#endif
+	strftime(out, 32, "%Y-%m-%dT%H:%M:%SZ", &tm);
+}
+
+/* Render the start of a listing of the directory at the URL path `title`
+ * (`len` bytes), with a link to the parent directory if `parent` is true
+ */
+static void autoindex_render_head(struct AutoindexBuf* buf,
+                                  enum AutoindexFormat format,
+                                  const char* title, size_t len, bool parent) {
+	if (format == AutoindexJson) {
+		autoindex_append_str(buf, "{\"path\":\"");
+		autoindex_append_json(buf, title, len);
+		autoindex_append_str(buf, "\",\"entries\":[");
+		return;
+	}
+
+	autoindex_append_str(buf, "<!DOCTYPE html>\n<html>\n<head>\n"
+	                          "<meta charset=\"utf-8\">\n<title>Index of ");
+	autoindex_append_html(buf, title, len);
+	autoindex_append_str(buf, "</title>\n</head>\n<body>\n<h1>Index of ");
+	autoindex_append_html(buf, title, len);
+	autoindex_append_str(buf, "</h1>\n<table>\n<tr><th>Name</th><th>Size</th>"
+	                          "<th>Modified</th></tr>\n");
+	if (parent) {
+		autoindex_append_str(buf, "<tr><td><a href=\"../\">../</a></td>"
+		                          "<td></td><td></td></tr>\n");
+	}
+}
+
+/* Render `entry`, the `index`th entry of a listing */
+static void autoindex_render_entry(struct AutoindexBuf* buf,
+                                   enum AutoindexFormat format,
+                                   const struct AutoindexEntry* entry,
+                                   uint64_t index) {
+	char time[32];
+	char size[32];
+	autoindex_format_time(entry->mtime, time);
+	sprintf(size, "%lu", (unsigned long) entry->size);
+	size_t name_len = strlen(entry->name);
+
+	if (format == AutoindexJson) {
+		autoindex_append_str(buf, index == 0 ? "{\"name\":\"" : ",{\"name\":\"");
+		autoindex_append_json(buf, entry->name, name_len);
+		autoindex_append_str(buf, entry->dir ? "\",\"type\":\"directory\"" :
+		                                       "\",\"type\":\"file\"");
+		if (!entry->dir) {
+			autoindex_append_str(buf, ",\"size\":");
+			autoindex_append_str(buf, size);
+		}
+		autoindex_append_str(buf, ",\"modified\":\"");
+		autoindex_append_str(buf, time);
+		autoindex_append_str(buf, "\"}");
+		return;
+	}
+
+	autoindex_append_str(buf, "<tr><td><a href=\"");
+	autoindex_append_url(buf, entry->name);
+	autoindex_append_str(buf, entry->dir ? "/\">" : "\">");
+	autoindex_append_html(buf, entry->name, name_len);
+	autoindex_append_str(buf, entry->dir ? "/</a></td><td>-</td><td>" :
+	                                       "</a></td><td>");
+	if (!entry->dir) {
+		autoindex_append_str(buf, size);
+		autoindex_append_str(buf, "</td><td>");
+	}
+	autoindex_append_str(buf, time);
+	autoindex_append_str(buf, "</td></tr>\n");
+}
+
+static void autoindex_render_tail(struct AutoindexBuf* buf,
+                                  enum AutoindexFormat format) {
+	autoindex_append_str(buf, format == AutoindexJson ? "]}" :
+	                                                    "</table>\n</body>\n"
+	                                                    "</html>\n");
+}
+
+/* An open directory whose entries are being read */
+struct AutoindexDir {
+	#ifdef __linux__
+	int32_t fd;
+	/* The current batch of entries returned by `getdents64` */
+	char* batch;
+	size_t pos;
+	size_t len;
+	#else
+	DIR* dir;
+	char* path;
+	#endif
+};
+
+#ifdef __linux__
+/* The layout of the entries returned by `getdents64` */
+struct AutoindexDirent {
+	uint64_t ino;
+	int64_t off;
+	unsigned short reclen;
+	unsigned char type;
+	char name[1];
+};
+#endif
+
+/* Open the directory at `path`. Returns false if it isn't a directory. */
+static bool autoindex_open(struct AutoindexDir* dir, const char* path) {
+	#ifdef __linux__
+	dir->fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	dir->batch = NULL;
+	dir->pos = 0;
+	dir->len = 0;
+	return dir->fd >= 0;
+	#else
+	dir->dir = opendir(path);
+	dir->path = NULL;
+	if (dir->dir != NULL) {
+		dir->path = malloc(strlen(path) + 1);
+		strcpy(dir->path, path);
+	}
+	return dir->dir != NULL;
+	#endif
+}
+
+/* Read the next (non-hidden) entry of `dir` into `entry`, whose name is only
+ * valid until the next call. Returns false at the end of the directory.
+ */
+static bool autoindex_next(struct AutoindexDir* dir,
+                           struct AutoindexEntry* entry) {
+	struct stat st;
+
+	while (true) {
+		#ifdef __linux__
+		if (dir->pos >= dir->len) {
+			if (dir->batch == NULL) {
+				dir->batch = malloc(SERV_AUTOINDEX_BATCH_SIZE);
+			}
+
+			long len = syscall(SYS_getdents64, dir->fd, dir->batch,
+			                   SERV_AUTOINDEX_BATCH_SIZE);
+			if (len <= 0) {
+				return false;
+			}
+			dir->pos = 0;
+			dir->len = (size_t) len;
+		}
+
+		struct AutoindexDirent* dirent = (struct AutoindexDirent*)
+		                                 (dir->batch + dir->pos);
+		dir->pos += dirent->reclen;
+		entry->name = dirent->name;
+
+		if (entry->name[0] == '.' ||
+		    fstatat(dir->fd, entry->name, &st, 0) != 0) {
+			continue;
+		}
+		#else
+		struct dirent* dirent = readdir(dir->dir);
+		if (dirent == NULL) {
+			return false;
+		}
+		entry->name = dirent->d_name;
+		if (entry->name[0] == '.') {
+			continue;
+		}
+
+		char* path = malloc(strlen(dir->path) + strlen(entry->name) + 2);
+		sprintf(path, "%s/%s", dir->path, entry->name);
+		int32_t res = stat(path, &st);
+		free(path);
+		if (res != 0) {
+			continue;
+		}
+		#endif
+
+		/* Hidden entries and broken symbolic links aren't listed */
+		entry->dir = S_ISDIR(st.st_mode);
+		entry->size = (uint64_t) st.st_size;
+		entry->mtime = (int64_t) st.st_mtime;
+		return true;
+	}
+}
+
+static void autoindex_close(struct AutoindexDir* dir) {
+	#ifdef __linux__
+	close(dir->fd);
+	free(dir->batch);
+	#else
+	closedir(dir->dir);
+	free(dir->path);
+	#endif
+}
+
+/* A rendered listing, shared by the cache and the requests sending it */
+struct AutoindexBody {
+	uint32_t refs;
+	char* data;
+	size_t len;
+};
+
+static void autoindex_release(struct AutoindexBody* body) {
+	if (__atomic_sub_fetch(&body->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		free(body->data);
+		free(body);
+	}
+}
+
+#ifdef __linux__
+
+/* The number of buckets of the cache's hash tables */
+#define SERV_AUTOINDEX_BUCKETS 1024
+
+/* The inotify events that change a directory's listing */
+#define SERV_AUTOINDEX_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+                               IN_MOVED_TO | IN_MODIFY | IN_ATTRIB | \
+                               IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+/* The cached listings of a directory, by the request path they're sent
+ * for (which is in the listing) and the directory (which the path may no
+ * longer map to after a reload, see `reload.h`). Different paths to the same
+ * directory share its inotify watch.
+ */
+struct AutoindexCached {
+	char* url;
+	char* dir_path;
+	uint64_t hash;
+	/* The directory's inotify watch */
+	int32_t wd;
+	/* Changed whenever the listings are invalidated */
+	uint64_t generation;
+	/* The listing in each format, or NULL if it wasn't rendered since the
+	 * directory last changed
+	 */
+	struct AutoindexBody* bodies[NUM_AUTOINDEX_FORMATS];
+	uint64_t last_used;
+	/* The next entries in the buckets by path and by watch */
+	struct AutoindexCached* next;
+	struct AutoindexCached* next_wd;
+};
+
+/* Held while accessing the cache */
+static pthread_mutex_t autoindex_lock = PTHREAD_MUTEX_INITIALIZER;
+/* The inotify instance, -1 before it's created, or -2 if it can't be */
+static int32_t autoindex_inotify = -1;
+static struct AutoindexCached* autoindex_buckets[SERV_AUTOINDEX_BUCKETS];
+static struct AutoindexCached* autoindex_wd_buckets[SERV_AUTOINDEX_BUCKETS];
+static size_t autoindex_num_cached = 0;
+static uint64_t autoindex_cached_bytes = 0;
+/* Source of the generations and of the `last_used` times */
+static uint64_t autoindex_clock = 0;
+
+/* FNV-1a hash of `url` and `dir_path` (including the terminator of `url`) */
+static uint64_t autoindex_hash(const char* url, const char* dir_path) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	do {
+		hash = (hash ^ (unsigned char) *url) * 0x100000001b3ULL;
+	} while (*url++ != '\0');
+	for (; *dir_path != '\0'; dir_path++) {
+		hash = (hash ^ (unsigned char) *dir_path) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static struct AutoindexCached* autoindex_find(const char* url,
+                                              const char* dir_path,
+                                              uint64_t hash) {
+	struct AutoindexCached* cached;
+	for (cached = autoindex_buckets[hash % SERV_AUTOINDEX_BUCKETS];
+	     cached != NULL; cached = cached->next) {
+		if (cached->hash == hash && strcmp(cached->url, url) == 0 &&
+		    strcmp(cached->dir_path, dir_path) == 0) {
+			return cached;
+		}
+	}
+	return NULL;
+}
+
+/* Find the first entry after `prev` (or the first entry if it's NULL) with
+ * the watch `wd`
+ */
+static struct AutoindexCached* autoindex_find_wd(int32_t wd,
+                                                 struct AutoindexCached* prev) {
+	struct AutoindexCached* cached = prev == NULL ?
+	        autoindex_wd_buckets[(uint32_t) wd % SERV_AUTOINDEX_BUCKETS] :
+	        prev->next_wd;
+	for (; cached != NULL; cached = cached->next_wd) {
+		if (cached->wd == wd) {
+			return cached;
+		}
+	}
+	return NULL;
+}
+
+/* Drop the cached listings of `cached`, keeping the directory watched */
+static void autoindex_invalidate(struct AutoindexCached* cached) {
+	int32_t format;
+	for (format = 0; format < NUM_AUTOINDEX_FORMATS; format++) {
+		if (cached->bodies[format] != NULL) {
+			autoindex_cached_bytes -= cached->bodies[format]->len;
+			autoindex_release(cached->bodies[format]);
+			cached->bodies[format] = NULL;
+		}
+	}
+	cached->generation = ++autoindex_clock;
+}
+
+/* Remove `cached` from the cache, and its watch if no other entry uses it,
+ * unless the kernel already removed it (`unwatch` is false)
+ */
+static void autoindex_remove(struct AutoindexCached* cached, bool unwatch) {
+	struct AutoindexCached** link = &autoindex_buckets[cached->hash %
+	                                                   SERV_AUTOINDEX_BUCKETS];
+	while (*link != cached) {
+		link = &(*link)->next;
+	}
+	*link = cached->next;
+
+	link = &autoindex_wd_buckets[(uint32_t) cached->wd %
+	                             SERV_AUTOINDEX_BUCKETS];
+	while (*link != cached) {
+		link = &(*link)->next_wd;
+	}
+	*link = cached->next_wd;
+
+	if (unwatch && autoindex_find_wd(cached->wd, NULL) == NULL) {
+		inotify_rm_watch(autoindex_inotify, cached->wd);
+	}
+
+	autoindex_invalidate(cached);
+	free(cached->url);
+	free(cached->dir_path);
+	free(cached);
+	autoindex_num_cached--;
+}
+
+/* Remove the least recently used entry of the cache other than `keep`, only
+ * considering entries with listings if `with_bodies` is true. Returns false
+ * if there is no such entry.
+ */
+static bool autoindex_evict(const struct AutoindexCached* keep,
+                            bool with_bodies) {
+	struct AutoindexCached* oldest = NULL;
+	size_t i;
+	for (i = 0; i < SERV_AUTOINDEX_BUCKETS; i++) {
+		struct AutoindexCached* cached;
+		for (cached = autoindex_buckets[i]; cached != NULL;
+		     cached = cached->next) {
+			if (cached != keep &&
+			    (!with_bodies || cached->bodies[AutoindexHtml] != NULL ||
+			     cached->bodies[AutoindexJson] != NULL) &&
+			    (oldest == NULL || cached->last_used < oldest->last_used)) {
+				oldest = cached;
+			}
+		}
+	}
+
+	if (oldest == NULL) {
+		return false;
+	}
+
+	autoindex_remove(oldest, true);
+	return true;
+}
+
+/* Invalidate the listings of the directories that changed, as reported by
+ * the pending inotify events
+ */
+static void autoindex_drain(void) {
+	char events[4096]
+	     __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+
+	while ((len = read(autoindex_inotify, events, sizeof(events))) > 0) {
+		ssize_t pos = 0;
+		while (pos < len) {
+			struct inotify_event* event = (struct inotify_event*)
+			                              (events + pos);
+			pos += (ssize_t) sizeof(struct inotify_event) + event->len;
+
+			/* Events were lost, so any directory may have changed */
+			if (event->mask & IN_Q_OVERFLOW) {
+				size_t i;
+				for (i = 0; i < SERV_AUTOINDEX_BUCKETS; i++) {
+					struct AutoindexCached* cached;
+					for (cached = autoindex_buckets[i]; cached != NULL;
+					     cached = cached->next) {
+						autoindex_invalidate(cached);
+					}
+				}
+				continue;
+			}
+
+			struct AutoindexCached* cached = autoindex_find_wd(event->wd,
+			                                                   NULL);
+			while (cached != NULL) {
+				struct AutoindexCached* next = autoindex_find_wd(event->wd,
+				                                                 cached);
+				if (event->mask & IN_IGNORED) {
+					autoindex_remove(cached, false);
+				} else {
+					autoindex_invalidate(cached);
+				}
+				cached = next;
+			}
+		}
+	}
+}
+
+/* Look up the cached listing for the request path `url` of the directory
+ * `dir_path` in `format`, watching the directory if it isn't yet. Returns the
+ * listing (which should be released after use), or NULL and the generation
+ * to pass to `autoindex_store` after rendering it, which is 0 if it can't be
+ * cached.
+ */
+static struct AutoindexBody* autoindex_lookup(const char* url,
+                                              const char* dir_path,
+                                              enum AutoindexFormat format,
+                                              uint64_t* generation) {
+	*generation = 0;
+	pthread_mutex_lock(&autoindex_lock);
+
+	if (autoindex_inotify == -1) {
+		autoindex_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (autoindex_inotify < 0) {
+			warn("Can't cache directory listings without inotify");
+			autoindex_inotify = -2;
+		}
+	}
+
+	if (autoindex_inotify < 0) {
+		pthread_mutex_unlock(&autoindex_lock);
+		return NULL;
+	}
+
+	autoindex_drain();
+
+	uint64_t hash = autoindex_hash(url, dir_path);
+	struct AutoindexCached* cached = autoindex_find(url, dir_path, hash);
+	if (cached == NULL) {
+		if (autoindex_num_cached >= SERV_AUTOINDEX_CACHE_ENTRIES) {
+			autoindex_evict(NULL, false);
+		}
+
+		/* The watch is added before the directory is read, so no change is
+		 * missed
+		 */
+		int32_t wd = inotify_add_watch(autoindex_inotify, dir_path,
+		                               SERV_AUTOINDEX_EVENTS | IN_ONLYDIR);
+		if (wd < 0) {
+			pthread_mutex_unlock(&autoindex_lock);
+			return NULL;
+		}
+
+		cached = calloc(1, sizeof(struct AutoindexCached));
+		cached->url = malloc(strlen(url) + 1);
+		strcpy(cached->url, url);
+		cached->dir_path = malloc(strlen(dir_path) + 1);
+		strcpy(cached->dir_path, dir_path);
+		cached->hash = hash;
+		cached->wd = wd;
+		cached->generation = ++autoindex_clock;
+		cached->next = autoindex_buckets[hash % SERV_AUTOINDEX_BUCKETS];
+		autoindex_buckets[hash % SERV_AUTOINDEX_BUCKETS] = cached;
+		cached->next_wd = autoindex_wd_buckets[(uint32_t) wd %
+		                                       SERV_AUTOINDEX_BUCKETS];
+		autoindex_wd_buckets[(uint32_t) wd % SERV_AUTOINDEX_BUCKETS] = cached;
+		autoindex_num_cached++;
+	}
+
+	cached->last_used = ++autoindex_clock;
+	struct AutoindexBody* body = cached->bodies[format];
+	if (body != NULL) {
+		__atomic_add_fetch(&body->refs, 1, __ATOMIC_RELAXED);
+	} else {
+		*generation = cached->generation;
+	}
+
+	pthread_mutex_unlock(&autoindex_lock);
+	return body;
+}
+
+/* Cache the listing `body` for the request path `url` of the directory
+ * `dir_path` in `format`, unless the directory changed since `generation`
+ * was returned by `autoindex_lookup`
+ */
+static void autoindex_store(const char* url, const char* dir_path,
+                            enum AutoindexFormat format, uint64_t generation,
+                            struct AutoindexBody* body) {
+	if (generation == 0 || body->len > SERV_AUTOINDEX_CACHE_SIZE) {
+		return;
+	}
+
+	pthread_mutex_lock(&autoindex_lock);
+	autoindex_drain();
+
+	uint64_t hash = autoindex_hash(url, dir_path);
+	struct AutoindexCached* cached = autoindex_find(url, dir_path, hash);
+	if (cached != NULL && cached->generation == generation &&
+	    cached->bodies[format] == NULL) {
+		while (autoindex_cached_bytes + body->len > SERV_AUTOINDEX_CACHE_SIZE &&
+		       autoindex_evict(cached, true)) {}
+
+		__atomic_add_fetch(&body->refs, 1, __ATOMIC_RELAXED);
+		cached->bodies[format] = body;
+		autoindex_cached_bytes += body->len;
+	}
+
+	pthread_mutex_unlock(&autoindex_lock);
+}
+
+void free_autoindex_cache(void) {
+	pthread_mutex_lock(&autoindex_lock);
+
+	size_t i;
+	for (i = 0; i < SERV_AUTOINDEX_BUCKETS; i++) {
+		while (autoindex_buckets[i] != NULL) {
+			autoindex_remove(autoindex_buckets[i], true);
+		}
+	}
+
+	if (autoindex_inotify >= 0) {
+		close(autoindex_inotify);
+	}
+	autoindex_inotify = -1;
+
+	pthread_mutex_unlock(&autoindex_lock);
+}
+
+#else
+
+static struct AutoindexBody* autoindex_lookup(const char* url,
+                                              const char* dir_path,
+                                              enum AutoindexFormat format,
+                                              uint64_t* generation) {
+	*generation = 0;
+	return NULL;
+}
+
+static void autoindex_store(const char* url, const char* dir_path,
+                            enum AutoindexFormat format, uint64_t generation,
+                            struct AutoindexBody* body) {}
+
+void free_autoindex_cache(void) {}
+
+#endif
+
+/* Send the response head of a listing in `format`, with a `Content-Length`
+ * of `len`, or with chunked encoding if `chunked` is true
+ */
+static bool autoindex_send_head(Socket sock, const struct Route* route,
+                                enum AutoindexFormat format, uint64_t len,
+                                bool chunked) {
+	char buf[256];
+	char* cursor = buf;
+	/* The format depends on the `Accept` header, so caches must key on it */
+	cursor += sprintf(cursor, "HTTP/1.1 200 OK\r\nContent-Type: %s\r\n"
+	                          "Vary: Accept\r\n", autoindex_mime_types[format]);
+	if (chunked) {
+		cursor += sprintf(cursor, "Transfer-Encoding: chunked\r\n");
+	} else {
+		cursor += sprintf(cursor, "Content-Length: %lu\r\n",
+		                  (unsigned long) len);
+	}
+	if (route->max_age >= 0) {
+		cursor += sprintf(cursor, "Cache-Control: max-age=%ld\r\n",
+		                  (long) route->max_age);
+	}
+	cursor += sprintf(cursor, "\r\n");
+
+	bool sent = send_all(sock, buf, cursor - buf);
+	trace_phase(TraceHeadersSent);
+	return sent;
+}
+
+/* Send the contents of `buf` as a chunk and empty it */
+static bool autoindex_send_chunk(Socket sock, struct AutoindexBuf* buf) {
+	if (buf->len == 0) {
+		return true;
+	}
+
+	char size[24];
+	sprintf(size, "%lx\r\n", (unsigned long) buf->len);
+	autoindex_append(buf, "\r\n", 2);
+	bool sent = send_all(sock, size, strlen(size)) &&
+	            send_all(sock, buf->data, buf->len);
+	buf->len = 0;
+	return sent;
+}
+
+/* Send the cached or rendered listing `body` (only its head if `send_body`
+ * is false)
+ */
+static uint16_t autoindex_send_body(Socket sock, const struct Route* route,
+                                    enum AutoindexFormat format,
+                                    const struct AutoindexBody* body,
+                                    bool send_body) {
+	/* The head goes out in the same segment as the start of the body */
+	cork_socket(sock, true);
+	bool sent = autoindex_send_head(sock, route, format, body->len, false) &&
+	            (!send_body || send_all(sock, body->data, body->len));
+	cork_socket(sock, false);
+
+	if (!sent) {
+		warn("Couldn't send data");
+		return 0;
+	}
+
+	trace_phase(TraceLastByte);
+	return 200;
+}
+
+/* Stream the rest of the listing of `dir` after the entries already rendered
+ * into `buf`, of which there are `num_entries` (only the head if `send_body`
+ * is false)
+ */
+static uint16_t autoindex_stream(Socket sock, const struct Route* route,
+                                 enum AutoindexFormat format,
+                                 struct AutoindexDir* dir,
+                                 struct AutoindexBuf* buf,
+                                 uint64_t num_entries, bool send_body) {
+	/* Only full segments are sent until the end of the listing (the socket
+	 * is closed, flushing it, if sending fails)
+	 */
+	cork_socket(sock, true);
+	if (!autoindex_send_head(sock, route, format, 0, true)) {
+		warn("Couldn't send data");
+		return 0;
+	} else if (!send_body) {
+		cork_socket(sock, false);
+		return 200;
+	}
+
+	struct AutoindexEntry entry;
+	while (autoindex_next(dir, &entry)) {
+		autoindex_render_entry(buf, format, &entry, num_entries);
+		num_entries++;
+
+		if (buf->len >= SERV_AUTOINDEX_BATCH_SIZE &&
+		    !autoindex_send_chunk(sock, buf)) {
+			warn("Couldn't send data");
+			return 0;
+		}
+	}
+
+	autoindex_render_tail(buf, format);
+	if (!autoindex_send_chunk(sock, buf) || !send_all(sock, "0\r\n\r\n", 5)) {
+		warn("Couldn't send data");
+		return 0;
+	}
+
+	cork_socket(sock, false);
+	trace_phase(TraceLastByte);
+	return 200;
+}
+
+static int autoindex_compare_entries(const void* a, const void* b) {
+	return strcmp(((const struct AutoindexEntry*) a)->name,
+	              ((const struct AutoindexEntry*) b)->name);
+}
+
+/* The length of the path of the request target, without the query */
+static size_t autoindex_target_path_len(const struct Request* req) {
+	const char* query = memchr(req->target.ptr, '?', req->target.len);
+	return query == NULL ? req->target.len : (size_t) (query -
+	                                                   req->target.ptr);
+}
+
+/* Redirect to the request target with a "/" appended to its path */
+static uint16_t autoindex_redirect(struct Request* req, Socket sock) {
+	size_t path_len = autoindex_target_path_len(req);
+
+	char* buf = malloc(96 + req->target.len);
+	char* cursor = buf;
+	cursor += sprintf(cursor, "HTTP/1.1 301 Moved Permanently\r\n"
+	                          "Content-Length: 0\r\nLocation: ");
+	memcpy(cursor, req->target.ptr, path_len);
+	cursor += path_len;
+	*cursor++ = '/';
+	memcpy(cursor, req->target.ptr + path_len, req->target.len - path_len);
+	cursor += req->target.len - path_len;
+	cursor += sprintf(cursor, "\r\n\r\n");
+
+	if (!send_all(sock, buf, cursor - buf)) {
+		warn("Couldn't send full response");
+	}
+
+	free(buf);
+	return 301;
+}
+
+/* Read the directory `dir` (at `dir_path`) and send its listing for the
+ * request path `url` in `format` (only the head if `send_body` is false),
+ * caching it if `generation` (from `autoindex_lookup`) allows that
+ */
+static uint16_t autoindex_render(Socket sock, const struct Route* route,
+                                 enum AutoindexFormat format,
+                                 struct AutoindexDir* dir, const char* dir_path,
+                                 const char* url, uint64_t generation,
+                                 bool send_body) {
+	/* Collect the entries, unless there are too many to sort in memory */
+	struct AutoindexEntry* entries = NULL;
+	size_t num_entries = 0;
+	size_t cap = 0;
+	struct AutoindexEntry entry;
+	bool more;
+	while ((more = autoindex_next(dir, &entry)) &&
+	       num_entries < SERV_AUTOINDEX_STREAM_ENTRIES) {
+		if (num_entries == cap) {
+			cap = cap == 0 ? 64 : cap * 2;
+			entries = realloc(entries, cap * sizeof(struct AutoindexEntry));
+		}
+
+		entries[num_entries] = entry;
+		entries[num_entries].name = malloc(strlen(entry.name) + 1);
+		strcpy(entries[num_entries].name, entry.name);
+		num_entries++;
+	}
+
+	struct AutoindexBuf buf = {NULL, 0, 0};
+	autoindex_render_head(&buf, format, url, strlen(url), strlen(url) > 1);
+
+	if (!more) {
+		qsort(entries, num_entries, sizeof(struct AutoindexEntry),
+		      autoindex_compare_entries);
+	}
+
+	size_t i;
+	for (i = 0; i < num_entries; i++) {
+		autoindex_render_entry(&buf, format, &entries[i], i);
+		free(entries[i].name);
+	}
+	free(entries);
+
+	if (more) {
+		/* The entry that stopped the collection wasn't rendered yet */
+		autoindex_render_entry(&buf, format, &entry, num_entries);
+		uint16_t status = autoindex_stream(sock, route, format, dir, &buf,
+		                                   num_entries + 1, send_body);
+		free(buf.data);
+		return status;
+	}
+
+	autoindex_render_tail(&buf, format);
+	struct AutoindexBody* body = malloc(sizeof(struct AutoindexBody));
+	body->refs = 1;
+	body->data = buf.data;
+	body->len = buf.len;
+	autoindex_store(url, dir_path, format, generation, body);
+	uint16_t status = autoindex_send_body(sock, route, format, body,
+	                                      send_body);
+	autoindex_release(body);
+	return status;
+}
+
+uint16_t handle_autoindex(struct Request* req, struct Path path, Socket sock,
+                          const struct Route* route) {
+	char* dir_path = make_file_path(path, route->root);
+	struct AutoindexDir dir;
+
+	/* The request path (without the query) is the title of the listing */
+	size_t url_len = autoindex_target_path_len(req);
+	char* url = malloc(url_len + 1);
+	memcpy(url, req->target.ptr, url_len);
+	url[url_len] = '\0';
+
+	/* Relative links only work below a path ending in "/" */
+	if (url_len == 0 || url[url_len - 1] != '/') {
+		bool found = autoindex_open(&dir, dir_path);
+		if (found) {
+			autoindex_close(&dir);
+		}
+		free(url);
+		free(dir_path);
+		return found ? autoindex_redirect(req, sock) : send_404(sock);
+	}
+
+	enum AutoindexFormat format = AutoindexHtml;
+	const struct Slice* accept = get_header(&req->headers, HeaderAccept);
+	if ((req->path.query != NULL &&
+	     strstr(req->path.query, "format=json") != NULL) ||
+	    (accept != NULL && slice_contains(*accept, "application/json"))) {
+		format = AutoindexJson;
+	}
+
+	/* A cached listing is sent without reading the directory */
+	uint16_t status;
+	uint64_t generation;
+	struct AutoindexBody* body = autoindex_lookup(url, dir_path, format,
+	                                              &generation);
+	if (body != NULL) {
+		trace_phase(TraceResolved);
+		status = autoindex_send_body(sock, route, format, body,
+		                             req->method != Head);
+		autoindex_release(body);
+	} else if (!autoindex_open(&dir, dir_path)) {
+		status = send_404(sock);
+	} else {
+		trace_phase(TraceResolved);
+		status = autoindex_render(sock, route, format, &dir, dir_path, url,
+		                          generation, req->method != Head);
+		autoindex_close(&dir);
+	}
+
+	free(url);
+	free(dir_path);
+	return status;
+}
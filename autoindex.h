@@ -0,0 +1,43 @@
+/* Directory listings for file-serving routes with the "index" option (or
+ * `-i` for the data directory), sent for directories without an
+ * "index.html". Listings are rendered as HTML, or as JSON for clients
+ * accepting "application/json" or requesting "?format=json".
+ *
+ * On Linux, directory entries are read with `getdents64` in large batches,
+ * and rendered listings are cached per directory until inotify reports a
+ * change in it, so only changed directories are read again. Directories with
+ * more than `SERV_AUTOINDEX_STREAM_ENTRIES` entries are streamed with chunked
+ * encoding in directory order, one batch of entries at a time, instead of
+ * being sorted and rendered in memory, and aren't cached.
+ */
+
+#ifndef C_HTTP_SERVER_AUTOINDEX_H
+#define C_HTTP_SERVER_AUTOINDEX_H
+
+#include <stdint.h>
+
+#include "http.h"
+#include "router.h"
+#include "socket.h"
+
+/* Directories with more entries than this are streamed */
+#define SERV_AUTOINDEX_STREAM_ENTRIES 10000
+
+/* The maximum total size of the cached listings (64 MiB) */
+#define SERV_AUTOINDEX_CACHE_SIZE ((uint64_t) 64 * 1024 * 1024)
+
+/* The maximum number of cached listings (each needs an inotify watch) */
+#define SERV_AUTOINDEX_CACHE_ENTRIES 4096
+
+/* Send the listing of the directory at `path` relative to the route's root
+ * (only its head for HEAD requests), redirecting to the path with a trailing
+ * "/" first if it has none. Returns the HTTP status code, 404 if there is no
+ * such directory.
+ */
+uint16_t handle_autoindex(struct Request* req, struct Path path, Socket sock,
+                          const struct Route* route);
+
+/* Free the cached listings and stop watching their directories */
+void free_autoindex_cache(void);
+
+#endif
@@ -0,0 +1,55 @@
+/* Implementation of `bundle.h`, see that file for documentation and types */
+
+#include "bundle.h"
+
+#include <string.h>
+
+#ifndef SERV_BUNDLE
+/* Without a generated bundle, the bundle is empty */
+const struct Bundle serv_bundle = {NULL, 0, NULL, 0, NULL, 0};
+#endif
+
+uint32_t bundle_hash(const char* str, size_t len, uint32_t seed) {
+	/* FNV-1a, with the seed mixed into the offset basis and a final
+	 * avalanche, so that different seeds give unrelated hashes
+	 */
+	uint32_t hash = 2166136261u ^ (seed * 0x9e3779b9u);
+
+	size_t i;
+	for (i = 0; i < len; i++) {
+		hash ^= (uint8_t) str[i];
+		hash *= 16777619u;
+	}
+
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+
+	return hash;
+}
+
+const struct BundleFile* find_bundle_file(const struct Bundle* bundle,
+                                          const char* path, size_t len) {
+	if (bundle->num_files == 0) {
+		return NULL;
+	}
+
+	uint32_t bucket = bundle_hash(path, len, SERV_BUNDLE_BUCKET_SEED) &
+	                  (uint32_t) (bundle->num_buckets - 1);
+	uint32_t slot = bundle_hash(path, len, bundle->seeds[bucket]) &
+	                (uint32_t) (bundle->num_slots - 1);
+
+	if (bundle->slots[slot] == 0) {
+		return NULL;
+	}
+
+	/* Paths that aren't in the bundle hash to arbitrary slots */
+	const struct BundleFile* file = &bundle->files[bundle->slots[slot] - 1];
+	if (file->path_len != len || memcmp(file->path, path, len) != 0) {
+		return NULL;
+	}
+
+	return file;
+}
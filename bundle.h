@@ -0,0 +1,72 @@
+/* An asset bundle: a directory compiled into the server binary at build time
+ * (by `bundle_gen.c`, see the `SERV_BUNDLE_DIR` CMake option), which is
+ * served from read-only memory (`-b`) without any file system access. Each
+ * file comes with its pre-rendered response head, and files are looked up by
+ * their path with a perfect hash.
+ *
+ * This file doesn't depend on the rest of the server, since it's also used by
+ * the generator.
+ */
+
+#ifndef C_HTTP_SERVER_BUNDLE_H
+#define C_HTTP_SERVER_BUNDLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The seed of the hash selecting a path's bucket in the index */
+#define SERV_BUNDLE_BUCKET_SEED 0x5eed
+
+/* A file in an asset bundle */
+struct BundleFile {
+	/* The request path, e.g. "/about.html". A directory containing an
+	 * "index.html" also has an entry for its own path ("/" for the root).
+	 */
+	const char* path;
+	size_t path_len;
+	/* The response head ("200 OK" with `Content-Length`, `Content-Type` and
+	 * `ETag`), immediately followed by the file's contents, so that both can
+	 * be sent at once
+	 */
+	const uint8_t* response;
+	size_t head_len;
+	/* The size of the file's contents */
+	size_t size;
+	const char* mime_type;
+	/* The entity tag, including the quotes */
+	const char* etag;
+};
+
+/* An asset bundle. The index is a perfect hash of the paths: a path's bucket
+ * is chosen by `bundle_hash` with `SERV_BUNDLE_BUCKET_SEED`, and its slot by
+ * `bundle_hash` with the bucket's seed, which is chosen so that no two paths
+ * share a slot.
+ */
+struct Bundle {
+	const struct BundleFile* files;
+	size_t num_files;
+	/* The seed of each bucket (a power of two of them) */
+	const uint32_t* seeds;
+	size_t num_buckets;
+	/* 1 + the index of the file in each slot (a power of two of them), or 0
+	 * for empty slots
+	 */
+	const uint32_t* slots;
+	size_t num_slots;
+};
+
+/* The bundle compiled into the server, which is empty unless it was built
+ * with `SERV_BUNDLE` defined and the generated bundle source
+ */
+extern const struct Bundle serv_bundle;
+
+/* Hash the `len` bytes of `str` with the seed `seed` */
+uint32_t bundle_hash(const char* str, size_t len, uint32_t seed);
+
+/* Find the file with the path `path` (of `len` bytes) in the bundle. Returns
+ * NULL if there is no such file.
+ */
+const struct BundleFile* find_bundle_file(const struct Bundle* bundle,
+                                          const char* path, size_t len);
+
+#endif
@@ -0,0 +1,387 @@
+/* The asset bundle generator, which compiles a directory into a C source
+ * file defining `serv_bundle` (see `bundle.h`). It is run by the CMake build
+ * with the `SERV_BUNDLE_DIR` option, or by hand with
+ * "gcc -o bundle_gen bundle_gen.c bundle.c mime.c && ./bundle_gen DIR OUT.c"
+ * and then "gcc -DSERV_BUNDLE -o server main.c OUT.c".
+ */
+
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "bundle.h"
+#include "mime.h"
+
+/* How many seeds are tried for a bucket before giving up */
+#define BUNDLE_MAX_SEED_TRIES (1 << 24)
+
+/* A file (or a directory's index) to put into the bundle */
+struct GenFile {
+	/* The request path */
+	char* path;
+	/* The index of the file whose contents are served, for directories */
+	size_t target;
+	uint8_t* data;
+	size_t size;
+	const char* mime_type;
+	char etag[24];
+};
+
+static struct GenFile* gen_files = NULL;
+static size_t gen_num_files = 0;
+
+static struct GenFile* gen_add_file(const char* path) {
+	gen_files = realloc(gen_files, (gen_num_files + 1) *
+	                               sizeof(struct GenFile));
+	struct GenFile* file = &gen_files[gen_num_files];
+	memset(file, 0, sizeof(*file));
+	file->path = malloc(strlen(path) + 1);
+	strcpy(file->path, path);
+	file->target = gen_num_files;
+	gen_num_files++;
+	return file;
+}
+
+/* Read the file at `fs_path` into the bundle as `path`. Returns false on
+ * error.
+ */
+static bool gen_read_file(const char* fs_path, const char* path) {
+	FILE* in = fopen(fs_path, "rb");
+	if (in == NULL) {
+		perror(fs_path);
+		return false;
+	}
+
+	struct GenFile* file = gen_add_file(path);
+	size_t cap = 4096;
+	file->data = malloc(cap);
+	size_t len;
+	while ((len = fread(file->data + file->size, 1, cap - file->size, in)) >
+	       0) {
+		file->size += len;
+		if (file->size == cap) {
+			cap *= 2;
+			file->data = realloc(file->data, cap);
+		}
+	}
+	fclose(in);
+
+	const char* name = strrchr(path, '/');
+	file->mime_type = guess_mime_type(strrchr(name, '.'));
+
+	/* The ETag is the 64-bit FNV-1a hash of the contents */
+	uint64_t hash = 14695981039346656037ULL;
+	size_t i;
+	for (i = 0; i < file->size; i++) {
+		hash ^= file->data[i];
+		hash *= 1099511628211ULL;
+	}
+	sprintf(file->etag, "\"%08lx%08lx\"", (unsigned long) (hash >> 32),
+	        (unsigned long) (hash & 0xffffffff));
+
+	return true;
+}
+
+/* Add all files in the directory `fs_dir` (ending in "/") to the bundle,
+ * with paths starting with `dir` (ending in "/"). Returns false on error.
+ */
+static bool gen_read_dir(const char* fs_dir, const char* dir) {
+	DIR* d = opendir(fs_dir);
+	if (d == NULL) {
+		perror(fs_dir);
+		return false;
+	}
+
+	/* Read the names first, sorted, so that the output is reproducible */
+	char** names = NULL;
+	size_t num_names = 0;
+	struct dirent* entry;
+	while ((entry = readdir(d)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 ||
+		    strcmp(entry->d_name, "..") == 0) {
+			continue;
+		}
+
+		names = realloc(names, (num_names + 1) * sizeof(char*));
+		names[num_names] = malloc(strlen(entry->d_name) + 1);
+		strcpy(names[num_names], entry->d_name);
+		num_names++;
+	}
+	closedir(d);
+
+	size_t i;
+	size_t j;
+	for (i = 1; i < num_names; i++) {
+		for (j = i; j > 0 && strcmp(names[j - 1], names[j]) > 0; j--) {
+			char* name = names[j];
+			names[j] = names[j - 1];
+			names[j - 1] = name;
+		}
+	}
+
+	bool ok = true;
+	for (i = 0; i < num_names && ok; i++) {
+		char* fs_path = malloc(strlen(fs_dir) + strlen(names[i]) + 2);
+		char* path = malloc(strlen(dir) + strlen(names[i]) + 2);
+		sprintf(fs_path, "%s%s", fs_dir, names[i]);
+		sprintf(path, "%s%s", dir, names[i]);
+
+		struct stat info;
+		if (stat(fs_path, &info) != 0) {
+			perror(fs_path);
+			ok = false;
+		} else if (S_ISDIR(info.st_mode)) {
+			strcat(fs_path, "/");
+			strcat(path, "/");
+			ok = gen_read_dir(fs_path, path);
+		} else if (S_ISREG(info.st_mode)) {
+			ok = gen_read_file(fs_path, path);
+
+			/* The directory itself serves its index */
+			if (ok && strcmp(names[i], "index.html") == 0) {
+				size_t target = gen_num_files - 1;
+				char* dir_path = malloc(strlen(dir) + 1);
+				strcpy(dir_path, dir);
+				if (strlen(dir_path) > 1) {
+					dir_path[strlen(dir_path) - 1] = '\0';
+				}
+
+				struct GenFile* alias = gen_add_file(dir_path);
+				alias->target = target;
+				free(dir_path);
+			}
+		}
+
+		free(fs_path);
+		free(path);
+	}
+
+	for (i = 0; i < num_names; i++) {
+		free(names[i]);
+	}
+	free(names);
+
+	return ok;
+}
+
+/* The smallest power of two that is at least `n` */
+static size_t gen_pow2(size_t n) {
+	size_t pow2 = 1;
+	while (pow2 < n) {
+		pow2 *= 2;
+	}
+	return pow2;
+}
+
+/* Build the perfect hash index ("hash and displace"): the paths are split
+ * into buckets, and for each bucket (largest first) a seed is searched that
+ * puts all of its paths into free slots. Returns false if no seed is found.
+ */
+static bool gen_index(uint32_t* seeds, size_t num_buckets, uint32_t* slots,
+                      size_t num_slots) {
+	size_t* bucket_of = malloc((gen_num_files + 1) * sizeof(size_t));
+	size_t* sizes = calloc(num_buckets, sizeof(size_t));
+	size_t* order = malloc(num_buckets * sizeof(size_t));
+	uint32_t* taken = malloc((gen_num_files + 1) * sizeof(uint32_t));
+
+	size_t i;
+	for (i = 0; i < gen_num_files; i++) {
+		bucket_of[i] = bundle_hash(gen_files[i].path,
+		                           strlen(gen_files[i].path),
+		                           SERV_BUNDLE_BUCKET_SEED) &
+		               (num_buckets - 1);
+		sizes[bucket_of[i]]++;
+	}
+
+	for (i = 0; i < num_buckets; i++) {
+		order[i] = i;
+	}
+	size_t j;
+	for (i = 1; i < num_buckets; i++) {
+		for (j = i; j > 0 && sizes[order[j - 1]] < sizes[order[j]]; j--) {
+			size_t bucket = order[j];
+			order[j] = order[j - 1];
+			order[j - 1] = bucket;
+		}
+	}
+
+	bool ok = true;
+	for (i = 0; i < num_buckets && ok && sizes[order[i]] > 0; i++) {
+		size_t bucket = order[i];
+		uint32_t seed;
+
+		for (seed = 1; seed < BUNDLE_MAX_SEED_TRIES; seed++) {
+			size_t num_taken = 0;
+			bool fits = true;
+
+			for (j = 0; j < gen_num_files && fits; j++) {
+				if (bucket_of[j] != bucket) {
+					continue;
+				}
+
+				uint32_t slot = bundle_hash(gen_files[j].path,
+				                            strlen(gen_files[j].path), seed) &
+				                (uint32_t) (num_slots - 1);
+				if (slots[slot] != 0) {
+					fits = false;
+				} else {
+					slots[slot] = (uint32_t) j + 1;
+					taken[num_taken] = slot;
+					num_taken++;
+				}
+			}
+
+			if (fits) {
+				break;
+			}
+
+			/* Undo and try the next seed */
+			while (num_taken > 0) {
+				num_taken--;
+				slots[taken[num_taken]] = 0;
+			}
+		}
+
+		seeds[bucket] = seed;
+		ok = seed < BUNDLE_MAX_SEED_TRIES;
+	}
+
+	free(bucket_of);
+	free(sizes);
+	free(order);
+	free(taken);
+
+	return ok;
+}
+
+/* Render the response head of `file` into `head` */
+static void gen_render_head(const struct GenFile* file, char* head) {
+	sprintf(head, "HTTP/1.1 200 OK\r\nContent-Length: %lu\r\n"
+	        "Content-Type: %s\r\nETag: %s\r\n\r\n",
+	        (unsigned long) file->size, file->mime_type, file->etag);
+}
+
+/* Write `str` as a C string literal */
+static void gen_write_string(FILE* out, const char* str) {
+	fputc('"', out);
+	for (; *str != '\0'; str++) {
+		if (*str == '"' || *str == '\\' || *str < 0x20 || *str >= 0x7f) {
+			fprintf(out, "\\%03o", (unsigned int) (uint8_t) *str);
+		} else {
+			fputc(*str, out);
+		}
+	}
+	fputc('"', out);
+}
+
+int main(int argc, char** argv) {
+	if (argc != 3) {
+		fputs("usage: bundle_gen DIR OUT.c\n", stderr);
+		return 1;
+	}
+
+	char* dir = malloc(strlen(argv[1]) + 2);
+	strcpy(dir, argv[1]);
+	if (dir[strlen(dir) - 1] != '/') {
+		strcat(dir, "/");
+	}
+
+	if (!gen_read_dir(dir, "/")) {
+		return 1;
+	}
+
+	size_t num_buckets = gen_pow2(gen_num_files / 2 + 1);
+	size_t num_slots = gen_pow2(gen_num_files + 1);
+	uint32_t* seeds = calloc(num_buckets, sizeof(uint32_t));
+	uint32_t* slots = calloc(num_slots, sizeof(uint32_t));
+	if (!gen_index(seeds, num_buckets, slots, num_slots)) {
+		fputs("Could not build the bundle index\n", stderr);
+		return 1;
+	}
+
+	FILE* out = fopen(argv[2], "w");
+	if (out == NULL) {
+		perror(argv[2]);
+		return 1;
+	}
+
+	fprintf(out, "/* The asset bundle generated by bundle_gen from ");
+	gen_write_string(out, argv[1]);
+	fprintf(out, ", do not edit */\n\n#include \"bundle.h\"\n\n");
+
+	/* The response head and contents of each file */
+	size_t i;
+	size_t j;
+	for (i = 0; i < gen_num_files; i++) {
+		struct GenFile* file = &gen_files[i];
+		if (file->target != i) {
+			continue;
+		}
+
+		char head[256];
+		gen_render_head(file, head);
+
+		fprintf(out, "static const uint8_t bundle_file_%lu[] = {",
+		        (unsigned long) i);
+		size_t head_len = strlen(head);
+		for (j = 0; j < head_len + file->size; j++) {
+			uint8_t byte = j < head_len ? (uint8_t) head[j] :
+			               file->data[j - head_len];
+			fprintf(out, "%s%u,", j % 16 == 0 ? "\n\t" : " ",
+			        (unsigned int) byte);
+		}
+		fprintf(out, "\n};\n\n");
+	}
+
+	fprintf(out, "static const struct BundleFile bundle_files[] = {\n");
+	for (i = 0; i < gen_num_files; i++) {
+		struct GenFile* file = &gen_files[gen_files[i].target];
+		char head[256];
+		gen_render_head(file, head);
+
+		fprintf(out, "\t{");
+		gen_write_string(out, gen_files[i].path);
+		fprintf(out, ", %lu, bundle_file_%lu, %lu, %lu, ",
+		        (unsigned long) strlen(gen_files[i].path),
+		        (unsigned long) gen_files[i].target,
+		        (unsigned long) strlen(head), (unsigned long) file->size);
+		gen_write_string(out, file->mime_type);
+		fprintf(out, ", ");
+		gen_write_string(out, file->etag);
+		fprintf(out, "},\n");
+	}
+	if (gen_num_files == 0) {
+		fprintf(out, "\t{\"\", 0, 0, 0, 0, \"\", \"\"}\n");
+	}
+	fprintf(out, "};\n\n");
+
+	fprintf(out, "static const uint32_t bundle_seeds[] = {");
+	for (i = 0; i < num_buckets; i++) {
+		fprintf(out, "%s%lu,", i % 8 == 0 ? "\n\t" : " ",
+		        (unsigned long) seeds[i]);
+	}
+	fprintf(out, "\n};\n\nstatic const uint32_t bundle_slots[] = {");
+	for (i = 0; i < num_slots; i++) {
+		fprintf(out, "%s%lu,", i % 8 == 0 ? "\n\t" : " ",
+		        (unsigned long) slots[i]);
+	}
+	fprintf(out, "\n};\n\n");
+
+	fprintf(out, "const struct Bundle serv_bundle = {bundle_files, %lu, "
+	        "bundle_seeds, %lu, bundle_slots, %lu};\n",
+	        (unsigned long) gen_num_files, (unsigned long) num_buckets,
+	        (unsigned long) num_slots);
+
+	if (fclose(out) != 0) {
+		perror(argv[2]);
+		return 1;
+	}
+
+	printf("Bundled %lu paths from %s\n", (unsigned long) gen_num_files,
+	       argv[1]);
+	return 0;
+}
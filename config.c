@@ -0,0 +1,109 @@
+/* Implementation of `config.h`, see that file for documentation and types */
+
+#include "config.h"
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+#include "alloc.h"
+
+char* make_dir_path(const char* dir_str) {
+	char* dir = malloc(SERV_PATH_MAX_LEN);
+	memset(dir, 0, SERV_PATH_MAX_LEN);
+
+	if (getcwd(dir, (int) SERV_PATH_MAX_LEN) == NULL) {
+		error("Could not get current working directory");
+		free(dir);
+		return NULL;
+	}
+
+	if (dir[strlen(dir) - 1] != '/') {
+		dir[strlen(dir)] = '/';
+	}
+
+	if (dir_str != NULL) {
+		if (dir_str[0] == '/' || dir_str[0] == '~') {
+			error("Paths (-d, -u, -r) must be relative");
+			free(dir);
+			return NULL;
+		}
+
+		if (strlen(dir) + strlen(dir_str) + 2 > SERV_PATH_MAX_LEN) {
+			error("Path (-d, -u, -r) is too long");
+			free(dir);
+			return NULL;
+		}
+
+		strcat(dir, dir_str);
+
+		if (dir[strlen(dir) - 1] != '/') {
+			dir[strlen(dir)] = '/';
+		}
+	}
+
+	char* new_dir = realloc(dir, strlen(dir) + 1);
+	if (new_dir != NULL) {
+		dir = new_dir;
+	}
+
+	return dir;
+}
+
+bool parse_listener(const char* str, struct Listener* listener) {
+	memset(listener, 0, sizeof(*listener));
+
+	/* Split off the options. Unix socket paths can't contain ",". */
+	size_t addr_len = strcspn(str, ",");
+	listener->name = malloc(addr_len + 1);
+	memcpy(listener->name, str, addr_len);
+	listener->name[addr_len] = '\0';
+
+	if (!parse_socket_addr(listener->name, true, &listener->addr,
+	                       &listener->addr_len)) {
+		free_listener(listener);
+		return false;
+	}
+
+	const char* option = str + addr_len;
+	while (*option == ',') {
+		option++;
+		size_t len = strcspn(option, ",");
+
+		if (len > 8 && strncmp(option, "backlog=", 8) == 0 &&
+		    option[8] != '-') {
+			listener->backlog = (int32_t) strtol(option + 8, NULL, 10);
+		} else if (len > 5 && strncmp(option, "cert=", 5) == 0 &&
+		           listener->cert_file == NULL) {
+			listener->cert_file = malloc(len - 5 + 1);
+			memcpy(listener->cert_file, option + 5, len - 5);
+			listener->cert_file[len - 5] = '\0';
+		} else if (len > 4 && strncmp(option, "key=", 4) == 0 &&
+		           listener->key_file == NULL) {
+			listener->key_file = malloc(len - 4 + 1);
+			memcpy(listener->key_file, option + 4, len - 4);
+			listener->key_file[len - 4] = '\0';
+		} else {
+			free_listener(listener);
+			return false;
+		}
+
+		option += len;
+	}
+
+	if ((listener->cert_file == NULL) != (listener->key_file == NULL)) {
+		free_listener(listener);
+		return false;
+	}
+
+	return true;
+}
+
+void free_listener(struct Listener* listener) {
+	free(listener->name);
+	free(listener->cert_file);
+	free(listener->key_file);
+	memset(listener, 0, sizeof(*listener));
+}
@@ -0,0 +1,130 @@
+/* Server configuration, shared by the request handlers */
+
+#ifndef C_HTTP_SERVER_CONFIG_H
+#define C_HTTP_SERVER_CONFIG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "log.h"
+#include "socket.h"
+
+/* The default maximum size of a request body (16 MiB) */
+#define SERV_DEFAULT_MAX_UPLOAD_SIZE ((uint64_t) 16 * 1024 * 1024)
+
+/* The maximum length of a data, upload or route directory path */
+#define SERV_PATH_MAX_LEN 2048
+
+/* The TLS state of a listener, see `tls.h` */
+struct TlsContext;
+
+/* A socket the server accepts connections on (`-l`) */
+struct Listener {
+	/* The address as specified by the user, for logging */
+	char* name;
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	/* The maximum number of pending connections, or 0 for the default */
+	int32_t backlog;
+	/* The certificate (chain) and private key files for TLS, or NULL for
+	 * plaintext listeners
+	 */
+	char* cert_file;
+	char* key_file;
+	/* The TLS context set up from them on startup */
+	struct TlsContext* tls;
+	Socket sock;
+};
+
+/* Per-client rate limits, see `ratelimit.h` */
+struct RateLimit;
+
+/* Admission control, see `admission.h` */
+struct Admission;
+
+/* Page cache warming, see `warm.h` */
+struct Warmup;
+
+/* Worker threads, see `worker.h` */
+struct Workers;
+
+/* Socket tuning, see `tune.h` */
+struct SocketTuning;
+
+/* A route and the routing trie, see `router.h` */
+struct Route;
+struct RouterNode;
+
+/* The server configuration, set up on startup from the command-line arguments.
+ * All directory paths are absolute and end in "/".
+ */
+struct Config {
+	/* The directory that files are served from (`-d`) */
+	char* data_dir;
+	/* The directory that `POST` requests store files in (`-u`), or NULL if
+	 * `POST` requests are not allowed
+	 */
+	char* upload_dir;
+	/* The maximum size of a request body in bytes (`-m`) */
+	uint64_t max_upload_size;
+	/* The routes: the root route serving `data_dir` first, then the reverse
+	 * proxy routes (`-x`), then the FastCGI routes (`-f`), then the other
+	 * file-serving routes (`-r`), then the asset bundle routes (`-b`)
+	 */
+	struct Route* routes;
+	size_t num_routes;
+	/* The routing trie compiled from `routes` */
+	struct RouterNode* router;
+	/* The sockets the server accepts connections on */
+	struct Listener* listeners;
+	size_t num_listeners;
+	/* The per-client rate limits (`-L`), or NULL if clients aren't rate
+	 * limited
+	 */
+	struct RateLimit* rate_limit;
+	/* Whether `rate_limit` is freed with the configuration, which it isn't
+	 * once a reloaded configuration (see `reload.h`) took it over
+	 */
+	bool owns_rate_limit;
+	/* The admission control (`-A`), or NULL if connections are always
+	 * admitted
+	 */
+	struct Admission* admission;
+	/* The page cache warming (`-C`), or NULL if the page cache isn't warmed
+	 * on startup
+	 */
+	struct Warmup* warmup;
+	/* The worker threads serving connections (`-w`), or NULL if connections
+	 * are served by the accept loop
+	 */
+	struct Workers* workers;
+	/* The socket tuning (`-S`), or NULL to leave the sockets untuned */
+	struct SocketTuning* tuning;
+	/* The least severe level of the logged messages, applied with
+	 * `set_log_level` once the configuration is in use
+	 */
+	enum Level log_level;
+};
+
+/* Make the absolute path (ending in "/") of the directory at the relative
+ * path `dir_str` (or of the current working directory if `dir_str` is NULL).
+ * Returns NULL and logs an error if the path can't be made. The returned
+ * string should be `free`d after use.
+ */
+char* make_dir_path(const char* dir_str);
+
+/* Parse a listener from a string "ADDR[,backlog=N][,cert=FILE,key=FILE]",
+ * where ADDR is an address accepted by `parse_socket_addr` (with an empty host
+ * meaning all local addresses), e.g. ":8080,backlog=1024" or
+ * "unix:/run/server.sock". With "cert" and "key" (which must be given
+ * together), connections use TLS. Returns false if the string is invalid. The
+ * listener's socket and TLS context are not created. The listener should be
+ * freed with `free_listener` after use.
+ */
+bool parse_listener(const char* str, struct Listener* listener);
+
+/* Free the memory allocated by `parse_listener` */
+void free_listener(struct Listener* listener);
+
+#endif
@@ -0,0 +1,825 @@
+/* Implementation of `fastcgi.h`, see that file for documentation and types */
+
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+
+#include "fastcgi.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "handlers.h"
+#include "log.h"
+#include "misc.h"
+#include "proxy.h"
+#include "scan.h"
+
+#include "alloc.h"
+
+/* The record types, roles and flags used from the FastCGI protocol */
+#define FCGI_VERSION_1 1
+#define FCGI_BEGIN_REQUEST 1
+#define FCGI_END_REQUEST 3
+#define FCGI_PARAMS 4
+#define FCGI_STDIN 5
+#define FCGI_STDOUT 6
+#define FCGI_STDERR 7
+#define FCGI_RESPONDER 1
+#define FCGI_KEEP_CONN 1
+
+/* The size of a record header */
+#define FCGI_HEADER_LEN 8
+
+/* The maximum length of a record's content */
+#define FCGI_MAX_CONTENT 65535
+
+/* The ID of the only request on a connection */
+#define FCGI_REQUEST_ID 1
+
+/* The index file run for directories */
+#define FASTCGI_INDEX "index.php"
+
+bool parse_fastcgi_route(const char* str, const char* data_dir,
+                         struct Route* route) {
+	memset(route, 0, sizeof(*route));
+	route->max_age = -1;
+
+	const char* addr = strchr(str, '=');
+	if (addr == NULL || str[0] != '/') {
+		return false;
+	}
+
+	route->prefix_str = malloc(addr - str + 1);
+	memcpy(route->prefix_str, str, addr - str);
+	route->prefix_str[addr - str] = '\0';
+	route->prefix = parse_route_prefix(route->prefix_str);
+	route->methods = METHODS_ALL;
+	route->handler = handle_fastcgi;
+
+	struct FastcgiRoute* fastcgi = calloc(1, sizeof(struct FastcgiRoute));
+	fastcgi->max_conns = SERV_FASTCGI_DEFAULT_CONNS;
+	#ifndef _WIN32
+	pthread_mutex_init(&fastcgi->lock, NULL);
+	pthread_cond_init(&fastcgi->available, NULL);
+	#endif
+	route->data = fastcgi;
+
+	/* The address is followed by the comma-separated options */
+	const char* cursor = addr + 1;
+	size_t len = strcspn(cursor, ",");
+	fastcgi->name = malloc(len + 1);
+	memcpy(fastcgi->name, cursor, len);
+	fastcgi->name[len] = '\0';
+
+	if (len == 0 || !parse_socket_addr(fastcgi->name, false, &fastcgi->addr,
+	                                   &fastcgi->addr_len)) {
+		free_fastcgi_route(route);
+		return false;
+	}
+
+	cursor += len;
+	while (*cursor == ',') {
+		cursor++;
+		len = strcspn(cursor, ",");
+
+		char* option = malloc(len + 1);
+		memcpy(option, cursor, len);
+		option[len] = '\0';
+		cursor += len;
+
+		char* end = NULL;
+		bool valid = true;
+		if (strncmp(option, "root=", 5) == 0 && route->root == NULL) {
+			route->root = make_dir_path(option + 5);
+			valid = route->root != NULL;
+		} else if (strncmp(option, "conns=", 6) == 0) {
+			unsigned long conns = strtoul(option + 6, &end, 10);
+			valid = option[6] != '\0' && *end == '\0' && conns > 0 &&
+			        conns <= SERV_FASTCGI_MAX_CONNS;
+			fastcgi->max_conns = (uint32_t) conns;
+		} else {
+			valid = false;
+		}
+
+		free(option);
+		if (!valid) {
+			free_fastcgi_route(route);
+			return false;
+		}
+	}
+
+	if (route->root == NULL) {
+		route->root = malloc(strlen(data_dir) + 1);
+		strcpy(route->root, data_dir);
+	}
+
+	fastcgi->idle = malloc(fastcgi->max_conns * sizeof(Socket));
+	fastcgi->idle_since = malloc(fastcgi->max_conns * sizeof(time_t));
+
+	return true;
+}
+
+void free_fastcgi_route(struct Route* route) {
+	struct FastcgiRoute* fastcgi = route->data;
+
+	uint32_t i;
+	for (i = 0; i < fastcgi->num_idle; i++) {
+		close_socket(fastcgi->idle[i]);
+	}
+
+	#ifndef _WIN32
+	pthread_mutex_destroy(&fastcgi->lock);
+	pthread_cond_destroy(&fastcgi->available);
+	#endif
+
+	free(fastcgi->idle);
+	free(fastcgi->idle_since);
+	free(fastcgi->name);
+	free(fastcgi);
+	free_route(route);
+}
+
+/* Get a connection to the backend, waiting (up to `SERV_FASTCGI_QUEUE_SECS`)
+ * while it's handling `max_conns` requests already. The most recently used
+ * idle connection is reused if it's still open, otherwise a new one is made.
+ * Returns 0 on success, or the status code to send to the client otherwise.
+ */
+static uint16_t fastcgi_acquire(struct FastcgiRoute* fastcgi, Socket* sock,
+                                bool* pooled) {
+	#ifndef _WIN32
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += SERV_FASTCGI_QUEUE_SECS;
+
+	pthread_mutex_lock(&fastcgi->lock);
+	while (fastcgi->busy == fastcgi->max_conns) {
+		if (pthread_cond_timedwait(&fastcgi->available, &fastcgi->lock,
+		                           &deadline) == ETIMEDOUT &&
+		    fastcgi->busy == fastcgi->max_conns) {
+			pthread_mutex_unlock(&fastcgi->lock);
+			warn("Timed out waiting for a FastCGI backend connection");
+			return 503;
+		}
+	}
+	#endif
+
+	fastcgi->busy++;
+
+	/* Connections which have been idle for too long are closed, the others
+	 * are checked (outside the lock) below
+	 */
+	time_t now = time(NULL);
+	bool found = false;
+	while (!found && fastcgi->num_idle > 0) {
+		fastcgi->num_idle--;
+		*sock = fastcgi->idle[fastcgi->num_idle];
+		found = now - fastcgi->idle_since[fastcgi->num_idle] <
+		        SERV_FASTCGI_IDLE_SECS;
+		if (!found) {
+			close_socket(*sock);
+		}
+	}
+
+	#ifndef _WIN32
+	pthread_mutex_unlock(&fastcgi->lock);
+
+	/* An idle connection must not be readable: if it is, the backend either
+	 * closed it or sent unexpected data
+	 */
+	char probe;
+	if (found && recv(*sock, &probe, 1, MSG_PEEK | MSG_DONTWAIT) >= 0) {
+		close_socket(*sock);
+		found = false;
+	}
+	#endif
+
+	if (found) {
+		*pooled = true;
+		return 0;
+	}
+
+	*pooled = false;
+
+	if (!connect_socket(&fastcgi->addr, fastcgi->addr_len, sock)) {
+		char* buf = malloc(50 + strlen(fastcgi->name));
+		sprintf(buf, "Could not connect to FastCGI backend '%s'", fastcgi->name);
+		error(buf);
+		free(buf);
+
+		#ifndef _WIN32
+		pthread_mutex_lock(&fastcgi->lock);
+		#endif
+		fastcgi->busy--;
+		#ifndef _WIN32
+		pthread_cond_signal(&fastcgi->available);
+		pthread_mutex_unlock(&fastcgi->lock);
+		#endif
+		return 502;
+	}
+
+	#ifdef _WIN32
+	DWORD timeout = SERV_FASTCGI_TIMEOUT_SECS * 1000;
+	#else
+	struct timeval timeout = {SERV_FASTCGI_TIMEOUT_SECS, 0};
+	#endif
+	setsockopt(*sock, SOL_SOCKET, SO_RCVTIMEO, (char*) &timeout,
+	           sizeof(timeout));
+	setsockopt(*sock, SOL_SOCKET, SO_SNDTIMEO, (char*) &timeout,
+	           sizeof(timeout));
+
+	return 0;
+}
+
+/* Give back a connection taken with `fastcgi_acquire`, keeping it open for
+ * the next request if `reusable`, or closing it otherwise
+ */
+static void fastcgi_release(struct FastcgiRoute* fastcgi, Socket sock,
+                            bool reusable) {
+	if (!reusable) {
+		close_socket(sock);
+	}
+
+	#ifndef _WIN32
+	pthread_mutex_lock(&fastcgi->lock);
+	#endif
+
+	if (reusable) {
+		fastcgi->idle[fastcgi->num_idle] = sock;
+		fastcgi->idle_since[fastcgi->num_idle] = time(NULL);
+		fastcgi->num_idle++;
+	}
+
+	fastcgi->busy--;
+
+	#ifndef _WIN32
+	pthread_cond_signal(&fastcgi->available);
+	pthread_mutex_unlock(&fastcgi->lock);
+	#endif
+}
+
+/* Append `len` bytes of `data` to `buf`, growing it if needed */
+static void fastcgi_append(struct Buffer* buf, const void* data, size_t len) {
+	if (buf->len + len > buf->cap) {
+		buf->cap = max(buf->cap * 2, buf->len + len);
+		buf->buf = realloc(buf->buf, buf->cap);
+	}
+
+	memcpy(buf->buf + buf->len, data, len);
+	buf->len += len;
+}
+
+/* Append a record header for `content_len` bytes of content to `buf` */
+static void fastcgi_append_header(struct Buffer* buf, uint8_t type,
+                                  size_t content_len) {
+	uint8_t header[FCGI_HEADER_LEN] = {
+		FCGI_VERSION_1, type, 0, FCGI_REQUEST_ID,
+		(uint8_t) (content_len >> 8), (uint8_t) content_len, 0, 0
+	};
+	fastcgi_append(buf, header, sizeof(header));
+}
+
+/* Append the records of a stream of `type` containing `len` bytes of `data`
+ * (but not the empty record ending the stream) to `buf`
+ */
+static void fastcgi_append_records(struct Buffer* buf, uint8_t type,
+                                   const void* data, size_t len) {
+	const uint8_t* cursor = data;
+	while (len > 0) {
+		size_t record_len = min(len, FCGI_MAX_CONTENT);
+		fastcgi_append_header(buf, type, record_len);
+		fastcgi_append(buf, cursor, record_len);
+		cursor += record_len;
+		len -= record_len;
+	}
+}
+
+/* Append the length of a parameter name or value to `buf`, in one byte if
+ * it's short or in four otherwise
+ */
+static void fastcgi_append_length(struct Buffer* buf, size_t len) {
+	if (len < 128) {
+		uint8_t byte = (uint8_t) len;
+		fastcgi_append(buf, &byte, 1);
+	} else {
+		uint8_t bytes[4] = {
+			(uint8_t) ((len >> 24) | 0x80), (uint8_t) (len >> 16),
+			(uint8_t) (len >> 8), (uint8_t) len
+		};
+		fastcgi_append(buf, bytes, 4);
+	}
+}
+
+/* Append a name-value pair of the `FCGI_PARAMS` stream to `buf` */
+static void fastcgi_append_param(struct Buffer* buf, const char* name,
+                                 size_t name_len, const char* value,
+                                 size_t value_len) {
+	fastcgi_append_length(buf, name_len);
+	fastcgi_append_length(buf, value_len);
+	fastcgi_append(buf, name, name_len);
+	fastcgi_append(buf, value, value_len);
+}
+
+/* Append a name-value pair with a null-terminated value to `buf` */
+static void fastcgi_append_param_str(struct Buffer* buf, const char* name,
+                                     const char* value) {
+	fastcgi_append_param(buf, name, strlen(name), value, strlen(value));
+}
+
+/* Append the CGI/1.1 meta-variables (RFC 3875) of the request to `buf` */
+static void fastcgi_append_params(struct Buffer* buf, struct Request* req,
+                                  const char* script_name,
+                                  const char* script_filename,
+                                  const char* root, uint64_t body_len) {
+	fastcgi_append_param_str(buf, "GATEWAY_INTERFACE", "CGI/1.1");
+	fastcgi_append_param_str(buf, "SERVER_SOFTWARE", "c_http_server");
+	fastcgi_append_param_str(buf, "SERVER_PROTOCOL", "HTTP/1.1");
+	fastcgi_append_param_str(buf, "REQUEST_METHOD",
+	                         method_to_str(req->method));
+	fastcgi_append_param(buf, "REQUEST_URI", 11, req->target.ptr,
+	                     req->target.len);
+	fastcgi_append_param_str(buf, "SCRIPT_NAME", script_name);
+	fastcgi_append_param_str(buf, "SCRIPT_FILENAME", script_filename);
+	fastcgi_append_param_str(buf, "DOCUMENT_ROOT", root);
+	fastcgi_append_param_str(buf, "QUERY_STRING",
+	                         req->path.query != NULL ? req->path.query : "");
+
+	const struct Slice* host = get_header(&req->headers, HeaderHost);
+	if (host != NULL) {
+		/* The host name without the port (after the "]" of an IPv6 address) */
+		size_t name_len = 0;
+		if (host->len > 0 && host->ptr[0] == '[') {
+			name_len = scan_any(host->ptr, host->len, "]");
+		}
+		name_len += scan_any(host->ptr + name_len, host->len - name_len, ":");
+
+		fastcgi_append_param(buf, "SERVER_NAME", 11, host->ptr, name_len);
+	}
+
+	if (body_len > 0 || req->method == Post || req->method == Put ||
+	    req->method == Patch) {
+		char content_length[24];
+		sprintf(content_length, "%lu", (unsigned long) body_len);
+		fastcgi_append_param_str(buf, "CONTENT_LENGTH", content_length);
+	}
+
+	/* The request headers as "HTTP_NAME", where NAME is the header name in
+	 * upper case with "-" replaced by "_". "Proxy" isn't passed on, since
+	 * scripts would take it for the `HTTP_PROXY` environment variable.
+	 */
+	char* name = malloc(SERV_MAX_HEADER_SIZE + 6);
+	memcpy(name, "HTTP_", 5);
+
+	size_t i;
+	for (i = 0; i < req->headers.num; i++) {
+		const struct Header* header = &req->headers.list[i];
+		if (header->id == HeaderContentLength ||
+		    slice_eq_nocase(header->name, "proxy")) {
+			continue;
+		} else if (slice_eq_nocase(header->name, "content-type")) {
+			fastcgi_append_param(buf, "CONTENT_TYPE", 12, header->value.ptr,
+			                     header->value.len);
+			continue;
+		}
+
+		size_t j;
+		for (j = 0; j < header->name.len && j <= SERV_MAX_HEADER_SIZE; j++) {
+			char c = header->name.ptr[j];
+			if (c == '-') {
+				c = '_';
+			} else if (c >= 'a' && c <= 'z') {
+				c = (char) (c - 'a' + 'A');
+			}
+
+			name[5 + j] = c;
+		}
+
+		fastcgi_append_param(buf, name, 5 + j, header->value.ptr,
+		                     header->value.len);
+	}
+
+	free(name);
+}
+
+/* Receive exactly `len` bytes from `sock` into `buf` */
+static bool fastcgi_recv_all(Socket sock, void* buf, size_t len) {
+	char* cursor = buf;
+	while (len > 0) {
+		int32_t res = recv(sock, cursor, (int) len, 0);
+		if (res <= 0) {
+			return false;
+		}
+
+		cursor += res;
+		len -= res;
+	}
+
+	return true;
+}
+
+/* Send the request to the backend: the begin record, the parameters in
+ * `params` and the body (of which the part in `client` was already received
+ * and the rest is read from it). `read_client` is set if any part of the body
+ * was read from the client.
+ */
+static bool fastcgi_send_request(Socket backend, const struct Buffer* params,
+                                 struct Reader* client, uint64_t body_len,
+                                 const struct Request* req, Socket sock,
+                                 char* scratch, bool* read_client) {
+	uint8_t begin[8] = {0, FCGI_RESPONDER, FCGI_KEEP_CONN, 0, 0, 0, 0, 0};
+
+	/* Everything received so far is sent at once */
+	struct Buffer out = new_buffer(params->len + client->pending_len + 64);
+	fastcgi_append_header(&out, FCGI_BEGIN_REQUEST, sizeof(begin));
+	fastcgi_append(&out, begin, sizeof(begin));
+	fastcgi_append_records(&out, FCGI_PARAMS, params->buf, params->len);
+	fastcgi_append_header(&out, FCGI_PARAMS, 0);
+	fastcgi_append_records(&out, FCGI_STDIN, client->pending,
+	                       client->pending_len);
+	if (client->pending_len == body_len) {
+		fastcgi_append_header(&out, FCGI_STDIN, 0);
+	}
+
+	bool sent = send_all(backend, (const char*) out.buf, out.len);
+	free_buffer(out);
+	uint64_t remaining = body_len - client->pending_len;
+
+	if (!sent || remaining == 0) {
+		return sent;
+	}
+
+	/* The rest of the body must be read from the client */
+	*read_client = true;
+
+	const struct Slice* expect = get_header(&req->headers, HeaderExpect);
+	if (expect != NULL && slice_eq_nocase(*expect, "100-continue") &&
+	    req->body_len == 0) {
+		char* buf = "HTTP/1.1 100 Continue\r\n\r\n";
+		send_all(sock, buf, strlen(buf));
+	}
+
+	while (remaining > 0) {
+		int32_t res = recv(sock, scratch + FCGI_HEADER_LEN,
+		                   (int) min(remaining, FCGI_MAX_CONTENT), 0);
+		if (res <= 0) {
+			return false;
+		}
+
+		uint8_t header[FCGI_HEADER_LEN] = {
+			FCGI_VERSION_1, FCGI_STDIN, 0, FCGI_REQUEST_ID,
+			(uint8_t) (res >> 8), (uint8_t) res, 0, 0
+		};
+		memcpy(scratch, header, sizeof(header));
+		if (!send_all(backend, scratch, FCGI_HEADER_LEN + res)) {
+			return false;
+		}
+
+		remaining -= res;
+	}
+
+	uint8_t end[FCGI_HEADER_LEN] = {
+		FCGI_VERSION_1, FCGI_STDIN, 0, FCGI_REQUEST_ID, 0, 0, 0, 0
+	};
+	return send_all(backend, (const char*) end, sizeof(end));
+}
+
+/* Send the response head for the CGI response headers in `head` (of which
+ * `head_len` bytes are the headers) to the client. Returns the response's
+ * status code, or 0 if the headers are invalid.
+ */
+static uint16_t fastcgi_send_head(Socket sock, const char* head,
+                                  size_t head_len, bool* ok) {
+	struct Headers headers;
+	if (parse_headers(head, head_len, &headers) == 0) {
+		return 0;
+	}
+
+	/* The status is sent in a "Status" header, or implied by "Location" */
+	uint16_t status = 200;
+	const char* status_text = "200 OK";
+	size_t status_len = 6;
+
+	size_t i;
+	for (i = 0; i < headers.num; i++) {
+		const struct Header* header = &headers.list[i];
+		if (slice_eq_nocase(header->name, "status")) {
+			char code[4] = {0};
+			memcpy(code, header->value.ptr, min(header->value.len, 3));
+			status = (uint16_t) strtoul(code, NULL, 10);
+			status_text = header->value.ptr;
+			status_len = header->value.len;
+			break;
+		} else if (slice_eq_nocase(header->name, "location")) {
+			status = 302;
+			status_text = "302 Found";
+			status_len = 9;
+		}
+	}
+
+	if (status < 100 || status > 999) {
+		return 0;
+	}
+
+	/* The headers may grow when rewritten (e.g. from "Name:value\n") */
+	struct Buffer response_head = new_buffer(head_len + 64);
+	fastcgi_append(&response_head, "HTTP/1.1 ", 9);
+	fastcgi_append(&response_head, status_text, status_len);
+	fastcgi_append(&response_head, "\r\n", 2);
+
+	for (i = 0; i < headers.num; i++) {
+		const struct Header* header = &headers.list[i];
+		if (slice_eq_nocase(header->name, "status") ||
+		    header->id == HeaderConnection ||
+		    header->id == HeaderKeepAlive ||
+		    header->id == HeaderTransferEncoding) {
+			continue;
+		}
+
+		fastcgi_append(&response_head, header->name.ptr, header->name.len);
+		fastcgi_append(&response_head, ": ", 2);
+		fastcgi_append(&response_head, header->value.ptr, header->value.len);
+		fastcgi_append(&response_head, "\r\n", 2);
+	}
+
+	fastcgi_append(&response_head, "Connection: close\r\n\r\n", 21);
+
+	*ok = send_all(sock, (const char*) response_head.buf, response_head.len);
+	free_buffer(response_head);
+	return status;
+}
+
+/* Log the script's error output */
+static void fastcgi_log_stderr(const char* text, size_t len) {
+	while (len > 0 && (text[len - 1] == '\n' || text[len - 1] == '\r')) {
+		len--;
+	}
+
+	if (len == 0) {
+		return;
+	}
+
+	char* buf = malloc(len + 20);
+	memcpy(buf, "FastCGI script: ", 16);
+	memcpy(buf + 16, text, len);
+	buf[16 + len] = '\0';
+	warn(buf);
+	free(buf);
+}
+
+/* Receive the response from the backend and stream it to the client (without
+ * the body if `send_body` is false). Returns the response's status code, 0 if
+ * the client couldn't be sent the full response, or a negated status code to
+ * send to the client if the backend didn't respond (validly). `reusable` is
+ * set if the connection to the backend can be used for another request, and
+ * `received` if any part of a response was received.
+ */
+static int32_t fastcgi_receive_response(Socket backend, Socket sock,
+                                        bool send_body, char* scratch,
+                                        int pipe_fds[2], bool* reusable,
+                                        bool* received) {
+	*reusable = false;
+	*received = false;
+
+	/* Wait for the first byte, to tell a connection closed before the
+	 * response apart from an invalid response
+	 */
+	char first;
+	if (recv(backend, &first, 1, MSG_PEEK) <= 0) {
+		return -502;
+	}
+	*received = true;
+
+	struct Buffer head = new_buffer(0);
+	int32_t status = 0;
+	bool head_sent = false;
+	bool ok = true;
+
+	while (true) {
+		uint8_t header[FCGI_HEADER_LEN];
+		if (!fastcgi_recv_all(backend, header, sizeof(header)) ||
+		    header[0] != FCGI_VERSION_1) {
+			break;
+		}
+
+		uint8_t type = header[1];
+		size_t content_len = ((size_t) header[4] << 8) | header[5];
+		size_t padding_len = header[6];
+
+		if (type == FCGI_STDOUT && head_sent && send_body && ok) {
+			/* Stream the body directly to the client */
+			struct Reader body;
+			body.sock = backend;
+			body.pending = NULL;
+			body.pending_len = 0;
+
+			if (!proxy_copy(&body, sock, content_len, pipe_fds)) {
+				ok = false;
+				break;
+			}
+
+			content_len = 0;
+		}
+
+		if (!fastcgi_recv_all(backend, scratch, content_len + padding_len)) {
+			break;
+		}
+
+		if (type == FCGI_END_REQUEST) {
+			*reusable = true;
+			break;
+		} else if (type == FCGI_STDERR) {
+			fastcgi_log_stderr(scratch, content_len);
+		} else if (type == FCGI_STDOUT && !head_sent) {
+			/* Buffer the output until the end of the headers */
+			fastcgi_append(&head, scratch, content_len);
+
+			size_t head_len = 0;
+			size_t i;
+			for (i = 3; i < head.len && head_len == 0; i++) {
+				if (memcmp(head.buf + i - 3, "\r\n\r\n", 4) == 0) {
+					head_len = i + 1;
+				}
+			}
+
+			if (head_len == 0 && head.len > SERV_MAX_HEADER_SIZE) {
+				status = -502;
+				break;
+			} else if (head_len == 0) {
+				continue;
+			}
+
+			status = fastcgi_send_head(sock, (const char*) head.buf, head_len,
+			                           &ok);
+			if (status == 0) {
+				status = -502;
+				break;
+			}
+
+			head_sent = true;
+			if (ok && send_body) {
+				ok = send_all(sock, (const char*) head.buf + head_len,
+				              head.len - head_len);
+			}
+		}
+	}
+
+	free_buffer(head);
+
+	if (!head_sent && status == 0) {
+		status = -502;
+	} else if (head_sent && (!ok || !*reusable)) {
+		/* The response was cut short */
+		status = 0;
+	}
+
+	return status;
+}
+
+uint16_t handle_fastcgi(struct Request* req, struct Path path, Socket sock,
+                        const struct Route* route, const struct Config* config) {
+	(void) config;
+	struct FastcgiRoute* fastcgi = route->data;
+
+	/* Don't run scripts outside of the route's root */
+	size_t i;
+	for (i = 0; i < path.num_components; i++) {
+		if (strcmp(path.components[i], ".") == 0 ||
+		    strcmp(path.components[i], "..") == 0) {
+			return send_400(sock);
+		}
+	}
+
+	/* Only request bodies with a known length are forwarded */
+	uint64_t body_len = 0;
+	const struct Slice* content_length = get_header(&req->headers,
+	                                                HeaderContentLength);
+	if (get_header(&req->headers, HeaderTransferEncoding) != NULL) {
+		return send_411(sock);
+	} else if (content_length != NULL &&
+	           !slice_to_u64(*content_length, &body_len)) {
+		return send_400(sock);
+	}
+
+	/* Find the script, or the directory's index script */
+	char* script_filename = make_file_path(path, route->root);
+	struct stat script_stat;
+	if (stat(script_filename, &script_stat) == 0 &&
+	    S_ISDIR(script_stat.st_mode)) {
+		if (script_filename[strlen(script_filename) - 1] != '/') {
+			strcat(script_filename, "/");
+		}
+		strcat(script_filename, FASTCGI_INDEX);
+		if (stat(script_filename, &script_stat) != 0) {
+			script_stat.st_mode = 0;
+		}
+	} else if (stat(script_filename, &script_stat) != 0) {
+		script_stat.st_mode = 0;
+	}
+
+	if (!S_ISREG(script_stat.st_mode)) {
+		free(script_filename);
+		return send_404(sock);
+	}
+
+	/* The script's URL path is the route prefix followed by `path` */
+	size_t root_len = strlen(route->root);
+	size_t prefix_len = strlen(route->prefix_str);
+	while (prefix_len > 0 && route->prefix_str[prefix_len - 1] == '/') {
+		prefix_len--;
+	}
+
+	size_t script_len = strlen(script_filename) - root_len;
+	char* script_name = malloc(prefix_len + script_len + 2);
+	memcpy(script_name, route->prefix_str, prefix_len);
+	script_name[prefix_len] = '/';
+	strcpy(script_name + prefix_len + 1, script_filename + root_len);
+
+	struct Buffer params = new_buffer(req->head_len + 512);
+	fastcgi_append_params(&params, req, script_name, script_filename,
+	                      route->root, body_len);
+	free(script_name);
+	free(script_filename);
+
+	struct Reader client;
+	client.sock = sock;
+	client.pending = req->body;
+	client.pending_len = (size_t) min(body_len, (uint64_t) req->body_len);
+
+	int pipe_fds[2] = {-1, -1};
+	#ifdef __linux__
+	if (pipe2(pipe_fds, O_CLOEXEC)) {
+		error("Could not create a pipe for FastCGI");
+		free_buffer(params);
+		return send_500(sock);
+	}
+	#endif
+
+	/* Room for a record with padding, or a STDIN record with its header */
+	char* scratch = malloc(FCGI_HEADER_LEN + FCGI_MAX_CONTENT + 256);
+
+	/* A pooled connection may have been closed by the backend in the
+	 * meantime, so requests are retried on a new connection as long as no
+	 * part of the body had to be read from the client and the backend
+	 * either couldn't be sent the request or closed the connection without
+	 * responding. A backend that responded may have run the script, so its
+	 * requests are never retried.
+	 */
+	int32_t result = -502;
+	bool read_client = false;
+	bool pooled = true;
+
+	while (pooled && !read_client) {
+		Socket backend;
+		uint16_t acquired = fastcgi_acquire(fastcgi, &backend, &pooled);
+		if (acquired != 0) {
+			result = -(int32_t) acquired;
+			break;
+		}
+
+		bool reusable = false;
+		bool received = false;
+		if (fastcgi_send_request(backend, &params, &client, body_len, req, sock,
+		                         scratch, &read_client)) {
+			result = fastcgi_receive_response(backend, sock,
+			                                  req->method != Head, scratch,
+			                                  pipe_fds, &reusable, &received);
+		}
+
+		fastcgi_release(fastcgi, backend, reusable);
+
+		if (result >= 0) {
+			break;
+		} else if (received || !pooled) {
+			error("Invalid response from FastCGI backend");
+			break;
+		}
+	}
+
+	free(scratch);
+	free_buffer(params);
+	#ifdef __linux__
+	close(pipe_fds[0]);
+	close(pipe_fds[1]);
+	#endif
+
+	if (result == -503) {
+		return send_503(sock);
+	} else if (result < 0) {
+		return send_502(sock);
+	} else if (result == 0) {
+		warn("Couldn't forward the full response");
+	}
+
+	return (uint16_t) result;
+}
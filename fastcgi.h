@@ -0,0 +1,94 @@
+/* A FastCGI[1] handler, running the scripts under a path prefix (e.g. PHP
+ * scripts) on a FastCGI backend like PHP-FPM (over TCP or a Unix domain
+ * socket). Connections to the backend are kept open (`FCGI_KEEP_CONN`) and
+ * shared by all workers in a pool per route, which also limits the number of
+ * requests the backend handles at once. Request and response bodies are
+ * streamed (the response with `splice` on Linux) without buffering them.
+ *
+ * Each connection carries one request at a time, since common backends
+ * don't multiplex requests on a connection (`FCGI_MPXS_CONNS`).
+ *
+ * [1] Brown, M., "FastCGI Specification", Open Market, Inc., April 1996,
+ * <https://fastcgi-archives.github.io/FastCGI_Specification.html>.
+ */
+
+#ifndef C_HTTP_SERVER_FASTCGI_H
+#define C_HTTP_SERVER_FASTCGI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include "config.h"
+#include "http.h"
+#include "router.h"
+#include "socket.h"
+
+/* The default maximum number of requests a backend handles at once */
+#define SERV_FASTCGI_DEFAULT_CONNS 16
+
+/* The maximum number of requests a backend handles at once */
+#define SERV_FASTCGI_MAX_CONNS 1024
+
+/* How long a request waits for a connection to the backend, in seconds */
+#define SERV_FASTCGI_QUEUE_SECS 10
+
+/* How long an idle backend connection is kept open, in seconds */
+#define SERV_FASTCGI_IDLE_SECS 60
+
+/* How long to wait for the backend to send or receive data, in seconds */
+#define SERV_FASTCGI_TIMEOUT_SECS 60
+
+/* The data of a FastCGI route (`Route.data`), whose `root` is the directory
+ * with the scripts
+ */
+struct FastcgiRoute {
+	/* The backend's address as specified by the user, for logging */
+	char* name;
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	/* The maximum number of requests sent to the backend at once */
+	uint32_t max_conns;
+
+	/* The pool of connections, guarded by `lock` (where there are threads) */
+	#ifndef _WIN32
+	pthread_mutex_t lock;
+	pthread_cond_t available;
+	#endif
+	/* The number of requests being handled by the backend */
+	uint32_t busy;
+	/* The idle connections and since when they are idle, oldest first */
+	Socket* idle;
+	time_t* idle_since;
+	uint32_t num_idle;
+};
+
+/* Parse a FastCGI route from a string "PREFIX=ADDR[,root=PATH][,conns=N]",
+ * where ADDR is the backend's address (accepted by `parse_socket_addr`), PATH
+ * is the directory with the scripts (by default `data_dir`) and N is the
+ * maximum number of requests sent to the backend at once (default
+ * `SERV_FASTCGI_DEFAULT_CONNS`), e.g. "/app=unix:/run/php-fpm.sock,root=php".
+ * Returns false if the string is invalid. The route should be freed with
+ * `free_fastcgi_route` after use.
+ */
+bool parse_fastcgi_route(const char* str, const char* data_dir,
+                         struct Route* route);
+
+/* Close the route's idle backend connections and free the memory allocated by
+ * `parse_fastcgi_route`
+ */
+void free_fastcgi_route(struct Route* route);
+
+/* The route handler for FastCGI routes. Runs the script at `path` relative to
+ * the route's root (or its "index.php" if `path` is a directory) on the
+ * backend, and streams the response back to the client. Returns the HTTP
+ * status code sent to the client.
+ */
+uint16_t handle_fastcgi(struct Request* req, struct Path path, Socket sock,
+                        const struct Route* route, const struct Config* config);
+
+#endif
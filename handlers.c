@@ -11,21 +11,29 @@
 #include <sys/sendfile.h>
 #endif
 
+#include "autoindex.h"
 #include "log.h"
 #include "http.h"
+#include "mime.h"
+#include "misc.h"
+#include "trace.h"
+#include "tune.h"
+#include "upload.h"
+#include "warm.h"
 
-uint16_t handle_get(struct Path path, Socket sock, char* data_dir) {
-	/* Make file path */
+#include "alloc.h"
+
+char* make_file_path(struct Path path, const char* root) {
 	size_t path_len = 1;
 	size_t i;
 	for (i = 0; i < path.num_components; i++) {
 		path_len += strlen(path.components[i]);
 	}
 
-	size_t data_dir_len = strlen(data_dir);
-	char* file_path = malloc(data_dir_len + path_len + path.num_components + 11);
-	strcpy(file_path, data_dir);
-	char* file_path_cursor = file_path + data_dir_len;
+	size_t root_len = strlen(root);
+	char* file_path = malloc(root_len + path_len + path.num_components + 14);
+	strcpy(file_path, root);
+	char* file_path_cursor = file_path + root_len;
 	for (i = 0; i < path.num_components; i++) {
 		size_t component_len = strlen(path.components[i]);
 		memcpy(file_path_cursor, path.components[i], component_len);
@@ -33,7 +41,37 @@ uint16_t handle_get(struct Path path, Socket sock, char* data_dir) {
 		(*file_path_cursor) = '/';
 		file_path_cursor++;
 	}
-	file_path_cursor[-1] = '\0';
+
+	/* Remove the last component's "/", but keep the root's */
+	if (path.num_components > 0) {
+		file_path_cursor[-1] = '\0';
+	}
+
+	return file_path;
+}
+
+uint16_t handle_files(struct Request* req, struct Path path, Socket sock,
+                      const struct Route* route, const struct Config* config) {
+	switch (req->method) {
+		case Get:
+		case Head:
+			return handle_get(req, path, sock, route);
+		case Put:
+			return handle_upload(req, path, sock, route->root,
+			                     config->max_upload_size);
+		case Post:
+			return handle_upload(req, path, sock, route->upload_root,
+			                     config->max_upload_size);
+		default:
+			return send_501(sock);
+	}
+}
+
+uint16_t open_file_response(struct Request* req, struct Path path,
+                            const struct Route* route,
+                            struct FileResponse* response) {
+	/* Make file path */
+	char* file_path = make_file_path(path, route->root);
 
 	/* If the path is a directory, try `[path]/index.html` */
 	DIR* dir = opendir(file_path);
@@ -46,40 +84,125 @@ uint16_t handle_get(struct Path path, Socket sock, char* data_dir) {
 		}
 	}
 
-	/* Read file */
-	FILE* file = fopen(file_path, "rb");
-	if (file == NULL) {
+	/* Guess MIME type from file extension */
+	char* path_ext = strrchr(file_path, '.');
+	response->mime_type = guess_mime_type(path_ext);
+
+	/* Prefer a pre-compressed version of the file if the client accepts it */
+	response->file = NULL;
+	response->gzipped = false;
+	const struct Slice* accept_encoding = get_header(&req->headers,
+	                                                 HeaderAcceptEncoding);
+	if (route->gzip && accept_encoding != NULL &&
+	    slice_contains(*accept_encoding, "gzip")) {
+		size_t file_path_len = strlen(file_path);
+		strcat(file_path, ".gz");
+		response->file = fopen(file_path, "rb");
+		response->gzipped = response->file != NULL;
+		file_path[file_path_len] = '\0';
+	}
+
+	/* Open file */
+	if (response->file == NULL) {
+		response->file = fopen(file_path, "rb");
+	}
+	free(file_path);
+	if (response->file == NULL) {
 		warn("The file could not be opened");
-		return send_404(sock);
+		return 404;
 	}
 
-	if (fseek(file, 0, SEEK_END)) {
+	if (fseek(response->file, 0, SEEK_END)) {
 		error("Can't get file size");
-		return send_500(sock);
+		fclose(response->file);
+		return 500;
 	}
-	size_t file_size = ftell(file);
+	long file_size = ftell(response->file);
 	if (file_size == -1) {
 		error("Can't get file size");
-		return send_500(sock);
+		fclose(response->file);
+		return 500;
 	}
-	rewind(file);
+	rewind(response->file);
+	response->size = (uint64_t) file_size;
+	advise_sequential(response->file, response->size);
 
-	/* Guess MIME type from file extension */
-	char* path_ext = strrchr(file_path, '.');
-	char* mime_type = guess_mime_type(path_ext);
+	return 200;
+}
+
+bool send_file(Socket sock, FILE* file, uint64_t offset, uint64_t len) {
+	#ifdef __linux__
+	off_t file_offset = (off_t) offset;
+	while (len > 0) {
+		ssize_t sent = sendfile(sock, fileno(file), &file_offset,
+		                        (size_t) min(len, (uint64_t) 0x7ffff000));
+		if (sent <= 0) {
+			return false;
+		}
+		len -= (uint64_t) sent;
+	}
+
+	return true;
+	#else
+	char buf[SERV_DEFAULT_BUFFER_CAP * 8];
+	if (fseek(file, (long) offset, SEEK_SET)) {
+		return false;
+	}
+
+	while (len > 0) {
+		size_t amount = fread(buf, 1, (size_t) min(len, sizeof(buf)), file);
+		if (amount == 0 || !send_all(sock, buf, amount)) {
+			return false;
+		}
+		len -= amount;
+	}
+
+	return true;
+	#endif
+}
+
+uint16_t handle_get(struct Request* req, struct Path path, Socket sock,
+                    const struct Route* route) {
+	struct FileResponse response;
+	uint16_t status = open_file_response(req, path, route, &response);
+	if (status == 404 && route->autoindex) {
+		return handle_autoindex(req, path, sock, route);
+	} else if (status == 404) {
+		return send_404(sock);
+	} else if (status != 200) {
+		return send_500(sock);
+	}
+	trace_phase(TraceResolved);
 
 	/* Send status and headers */
-	char* buf = malloc(74 + strlen(mime_type));
-	sprintf(buf, "HTTP/1.1 200 OK\r\nContent-Length: "
+	char* buf = malloc(160 + strlen(response.mime_type));
+	char* buf_cursor = buf;
+	buf_cursor += sprintf(buf_cursor, "HTTP/1.1 200 OK\r\nContent-Length: "
 	#ifdef WIN32
 	"%llu"
 	#else
 	"%lu"
 	#endif
-	"\r\nContent-Type: %s\r\n\r\n", (uint64_t) file_size, mime_type);
-	size_t buf_len = strlen(buf);
+	"\r\nContent-Type: %s\r\n", response.size, response.mime_type);
+	if (response.gzipped) {
+		buf_cursor += sprintf(buf_cursor, "Content-Encoding: gzip\r\n");
+	}
+	if (route->gzip) {
+		buf_cursor += sprintf(buf_cursor, "Vary: Accept-Encoding\r\n");
+	}
+	if (route->max_age >= 0) {
+		buf_cursor += sprintf(buf_cursor, "Cache-Control: max-age=%ld\r\n",
+		                      (long) route->max_age);
+	}
+	buf_cursor += sprintf(buf_cursor, "\r\n");
+	size_t buf_len = buf_cursor - buf;
 
-	int32_t res = send(sock, buf, (int) buf_len, 0);
+	/* The head may go out in the same segment as the start of the file,
+	 * which isn't sent in response to HEAD requests
+	 */
+	bool send_body = req->method != Head && response.size > 0;
+	int32_t res = send(sock, buf, (int) buf_len,
+	                   send_body ? send_more_flag() : 0);
 	if (res == -1) {
 		error("Error sending response data");
 	} else if (res != buf_len) {
@@ -87,33 +210,166 @@ uint16_t handle_get(struct Path path, Socket sock, char* data_dir) {
 	}
 
 	free(buf);
+	trace_phase(TraceHeadersSent);
 
-	/* Read and send file */
-	uint8_t* content = malloc(file_size);
-	size_t content_size = fread(content, 1, file_size, file);
-	if (content_size != file_size) {
-		warn("Couldn't read entire file");
+	/* Send file */
+	bool sent = !send_body || send_file(sock, response.file, 0, response.size);
+	if (!sent) {
+		warn("Couldn't send data");
+	} else {
+		trace_phase(TraceLastByte);
 	}
 
-	fclose(file);
-	free(file_path);
+	fclose(response.file);
+
+	return sent ? 200 : 0;
+}
 
-	uint8_t* content_cursor = content;
-	while (content_size > 0) {
-		size_t amount = send(sock, (char*) content_cursor, (int) content_size,
-		                     0);
-		if (amount == -1) {
-			warn("Couldn't send data");
+const struct BundleFile* find_bundle_response(const struct Route* route,
+                                              struct Path path) {
+	/* Join the path components, ignoring a trailing "/" */
+	char key[SERV_PATH_MAX_LEN];
+	size_t len = 0;
+	size_t i;
+	for (i = 0; i < path.num_components; i++) {
+		size_t component_len = strlen(path.components[i]);
+		if (component_len == 0 && i > 0 && i == path.num_components - 1) {
 			break;
-		} else {
-			content_size -= amount;
-			content_cursor += amount;
 		}
+		if (len + 1 + component_len > sizeof(key)) {
+			return NULL;
+		}
+
+		key[len] = '/';
+		memcpy(key + len + 1, path.components[i], component_len);
+		len += 1 + component_len;
+	}
+
+	if (len == 0) {
+		key[0] = '/';
+		len = 1;
+	}
+
+	return find_bundle_file(route->data, key, len);
+}
+
+uint16_t handle_bundle(struct Request* req, struct Path path, Socket sock,
+                       const struct Route* route, const struct Config* config) {
+	(void) config;
+	const struct BundleFile* file = find_bundle_response(route, path);
+	if (file == NULL) {
+		return send_404(sock);
+	}
+	trace_phase(TraceResolved);
+
+	const struct Slice* if_none_match = get_header(&req->headers,
+	                                               HeaderIfNoneMatch);
+	if (if_none_match != NULL && (slice_contains(*if_none_match, file->etag) ||
+	                              slice_eq_nocase(*if_none_match, "*"))) {
+		char buf[96];
+		sprintf(buf, "HTTP/1.1 304 Not Modified\r\nETag: %s\r\n\r\n",
+		        file->etag);
+		if (!send_all(sock, buf, strlen(buf))) {
+			warn("Couldn't send full response");
+		}
+		return 304;
+	}
+
+	/* The head and contents are contiguous, so this is a single send (of
+	 * just the head for HEAD requests)
+	 */
+	size_t len = file->head_len + (req->method == Head ? 0 : file->size);
+	if (!send_all(sock, (const char*) file->response, len)) {
+		warn("Couldn't send data");
+		return 0;
+	}
+	trace_phase(TraceHeadersSent);
+	trace_phase(TraceLastByte);
+
+	return 200;
+}
+
+uint16_t handle_upload(struct Request* req, struct Path path, Socket sock,
+                       const char* root, uint64_t max_size) {
+	/* Don't allow uploads to directories or outside of `root` */
+	size_t i;
+	for (i = 0; i < path.num_components; i++) {
+		if (strcmp(path.components[i], "") == 0 ||
+		    strcmp(path.components[i], ".") == 0 ||
+		    strcmp(path.components[i], "..") == 0) {
+			return send_400(sock);
+		}
+	}
+
+	if (path.num_components == 0) {
+		return send_400(sock);
+	}
+
+	char* file_path = make_file_path(path, root);
+	uint16_t status = receive_upload(req, sock, file_path, max_size);
+	free(file_path);
+
+	switch (status) {
+		case 201:
+			return send_201(sock);
+		case 204:
+			return send_204(sock);
+		case 400:
+			return send_400(sock);
+		case 404:
+			return send_404(sock);
+		case 411:
+			return send_411(sock);
+		case 413:
+			return send_413(sock);
+		case 501:
+			return send_501(sock);
+		case 500:
+		default:
+			return send_500(sock);
 	}
+}
 
-	free(content);
+uint16_t send_201(Socket sock) {
+	char* buf = "HTTP/1.1 201 Created\r\n\r\n";
+	size_t buf_len = strlen(buf);
+
+	int32_t res = send(sock, buf, (int) buf_len, 0);
+	if (res == -1) {
+		error("Error sending response data");
+	} else if (res != buf_len) {
+		warn("Couldn't send full response");
+	}
 
-	return content_size == 0 ? 200 : 0;
+	return 201;
+}
+
+uint16_t send_204(Socket sock) {
+	char* buf = "HTTP/1.1 204 No Content\r\n\r\n";
+	size_t buf_len = strlen(buf);
+
+	int32_t res = send(sock, buf, (int) buf_len, 0);
+	if (res == -1) {
+		error("Error sending response data");
+	} else if (res != buf_len) {
+		warn("Couldn't send full response");
+	}
+
+	return 204;
+}
+
+uint16_t send_400(Socket sock) {
+	char* buf = "HTTP/1.1 400 Bad Request\r\n\r\n";
+	size_t buf_len = strlen(buf);
+
+	int32_t res = send(sock, buf, (int) buf_len, 0);
+	if (res == -1) {
+		error("Error sending response data");
+	} else if (res != buf_len) {
+		warn("Couldn't send full response");
+	}
+
+	return 400;
 }
 
 uint16_t send_404(Socket sock) {
@@ -130,6 +386,88 @@ uint16_t send_404(Socket sock) {
 	return 404;
 }
 
+uint16_t send_405(Socket sock, uint32_t methods) {
+	char buf[128] = "HTTP/1.1 405 Method Not Allowed\r\nAllow: ";
+	size_t buf_len = strlen(buf);
+
+	enum Method method;
+	for (method = Get; method < Other; method++) {
+		if (methods & METHOD_BIT(method)) {
+			buf_len += sprintf(buf + buf_len, "%s%s",
+			                   buf[buf_len - 1] == ' ' ? "" : ", ",
+			                   method_to_str(method));
+		}
+	}
+
+	strcpy(buf + buf_len, "\r\n\r\n");
+	buf_len += 4;
+
+	int32_t res = send(sock, buf, (int) buf_len, 0);
+	if (res == -1) {
+		error("Error sending response data");
+	} else if (res != buf_len) {
+		warn("Couldn't send full response");
+	}
+
+	return 405;
+}
+
+uint16_t send_411(Socket sock) {
+	char* buf = "HTTP/1.1 411 Length Required\r\n\r\n";
+	size_t buf_len = strlen(buf);
+
+	int32_t res = send(sock, buf, (int) buf_len, 0);
+	if (res == -1) {
+		error("Error sending response data");
+	} else if (res != buf_len) {
+		warn("Couldn't send full response");
+	}
+
+	return 411;
+}
+
+uint16_t send_413(Socket sock) {
+	char* buf = "HTTP/1.1 413 Content Too Large\r\n\r\n";
+	size_t buf_len = strlen(buf);
+
+	int32_t res = send(sock, buf, (int) buf_len, 0);
+	if (res == -1) {
+		error("Error sending response data");
+	} else if (res != buf_len) {
+		warn("Couldn't send full response");
+	}
+
+	return 413;
+}
+
+uint16_t send_429(Socket sock) {
+	char* buf = "HTTP/1.1 429 Too Many Requests\r\nRetry-After: 1\r\n\r\n";
+	size_t buf_len = strlen(buf);
+
+	int32_t res = send(sock, buf, (int) buf_len, 0);
+	if (res == -1) {
+		error("Error sending response data");
+	} else if (res != buf_len) {
+		warn("Couldn't send full response");
+	}
+
+	return 429;
+}
+
+uint16_t send_431(Socket sock) {
+	char* buf = "HTTP/1.1 431 Request Header Fields Too Large\r\n\r\n";
+	size_t buf_len = strlen(buf);
+
+	int32_t res = send(sock, buf, (int) buf_len, 0);
+	if (res == -1) {
+		error("Error sending response data");
+	} else if (res != buf_len) {
+		warn("Couldn't send full response");
+	}
+
+	return 431;
+}
+
 uint16_t send_500(Socket sock) {
 	char* buf = "HTTP/1.1 500 Internal Server Error\r\n\r\n";
 	size_t buf_len = strlen(buf);
@@ -157,3 +495,31 @@ uint16_t send_501(Socket sock) {
 
 	return 501;
 }
+
+uint16_t send_502(Socket sock) {
+	char* buf = "HTTP/1.1 502 Bad Gateway\r\n\r\n";
+	size_t buf_len = strlen(buf);
+
+	int32_t res = send(sock, buf, (int) buf_len, 0);
+	if (res == -1) {
+		error("Error sending response data");
+	} else if (res != buf_len) {
+		warn("Couldn't send full response");
+	}
+
+	return 502;
+}
+
+uint16_t send_503(Socket sock) {
+	char* buf = "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\n\r\n";
+	size_t buf_len = strlen(buf);
+
+	int32_t res = send(sock, buf, (int) buf_len, 0);
+	if (res == -1) {
+		error("Error sending response data");
+	} else if (res != buf_len) {
+		warn("Couldn't send full response");
+	}
+
+	return 503;
+}
@@ -5,22 +5,120 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 
+#include "bundle.h"
+#include "config.h"
 #include "http.h"
+#include "router.h"
 #include "socket.h"
 
-/* Handle a GET request, sending the requested file back as an HTTP response.
- * Returns the HTTP status code.
+/* Make the file system path of the file at `path` relative to the directory
+ * `root` (which must end in "/"). The returned string has room for appending
+ * "/index.html.gz" and should be `free`d after use.
  */
-uint16_t handle_get(struct Path path, Socket sock, char* data_dir);
+char* make_file_path(struct Path path, const char* root);
+
+/* A file to be sent as the response to a `GET` request */
+struct FileResponse {
+	FILE* file;
+	uint64_t size;
+	const char* mime_type;
+	/* Whether the file is the pre-compressed "FILE.gz" */
+	bool gzipped;
+};
+
+/* Open the file at `path` relative to the route's root (or its "index.html"
+ * if it's a directory) for a `GET` request, following the route's
+ * compression policy. Returns 200 if the file was opened, in which case
+ * `response->file` should be closed after use, or the error status code
+ * otherwise.
+ */
+uint16_t open_file_response(struct Request* req, struct Path path,
+                            const struct Route* route,
+                            struct FileResponse* response);
+
+/* Send `len` bytes of `file` starting at `offset` to the socket, without
+ * copying them through user space where possible (with `sendfile`). Returns
+ * false if an error occurs before all bytes were sent.
+ */
+bool send_file(Socket sock, FILE* file, uint64_t offset, uint64_t len);
+
+/* The route handler for file-serving routes, dispatching `GET` and `HEAD`
+ * requests to `handle_get`, `PUT` requests to `handle_upload` with the route's root, and
+ * `POST` requests to `handle_upload` with the route's upload root.
+ */
+uint16_t handle_files(struct Request* req, struct Path path, Socket sock,
+                      const struct Route* route, const struct Config* config);
+
+/* Handle a GET or HEAD request, sending the file at `path` relative to the
+ * route's root back as an HTTP response (without the body for HEAD),
+ * following the route's cache and compression policy, or the directory's
+ * listing if the route lists directories. Returns the HTTP status code.
+ */
+uint16_t handle_get(struct Request* req, struct Path path, Socket sock,
+                    const struct Route* route);
+
+/* Find the file at `path` relative to an asset bundle route (whose `data` is
+ * the `Bundle`), or the index of the directory at `path`. Returns NULL if
+ * there is no such file.
+ */
+const struct BundleFile* find_bundle_response(const struct Route* route,
+                                              struct Path path);
+
+/* The route handler for asset bundle routes (`-b`), sending the file at
+ * `path` from memory with its pre-rendered response head (only the head for
+ * HEAD requests), or a "304 Not Modified" response if the client already has
+ * it (`If-None-Match`)
+ */
+uint16_t handle_bundle(struct Request* req, struct Path path, Socket sock,
+                       const struct Route* route, const struct Config* config);
+
+/* Handle a PUT or POST request, storing the request body in the file at
+ * `path` relative to `root`. Returns the HTTP status code.
+ */
+uint16_t handle_upload(struct Request* req, struct Path path, Socket sock,
+                       const char* root, uint64_t max_size);
+
+/* Send a "201 Created" response. Returns 201. */
+uint16_t send_201(Socket sock);
+
+/* Send a "204 No Content" response. Returns 204. */
+uint16_t send_204(Socket sock);
+
+/* Send a "400 Bad Request" response. Returns 400. */
+uint16_t send_400(Socket sock);
 
 /* Send a "404 Not Found" response. Returns 404. */
 uint16_t send_404(Socket sock);
 
+/* Send a "405 Method Not Allowed" response, listing the allowed `methods`
+ * (see `METHOD_BIT`). Returns 405.
+ */
+uint16_t send_405(Socket sock, uint32_t methods);
+
+/* Send a "411 Length Required" response. Returns 411. */
+uint16_t send_411(Socket sock);
+
+/* Send a "413 Content Too Large" response. Returns 413. */
+uint16_t send_413(Socket sock);
+
+/* Send a "429 Too Many Requests" response. Returns 429. */
+uint16_t send_429(Socket sock);
+
+/* Send a "431 Request Header Fields Too Large" response. Returns 431. */
+uint16_t send_431(Socket sock);
+
 /* Send a "500 Internal Server Error" response. Returns 500. */
 uint16_t send_500(Socket sock);
 
 /* Send a "501 Not Implemented" response. Returns 501. */
 uint16_t send_501(Socket sock);
 
+/* Send a "502 Bad Gateway" response. Returns 502. */
+uint16_t send_502(Socket sock);
+
+/* Send a "503 Service Unavailable" response. Returns 503. */
+uint16_t send_503(Socket sock);
+
 #endif
@@ -0,0 +1,574 @@
+/* Implementation of `hpack.h`, see that file for documentation and types */
+
+#include "hpack.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+
+/* The static table (RFC 7541, appendix A), starting at index 1 */
+static const char* const hpack_static_table[][2] = {
+	{":authority", ""},
+	{":method", "GET"},
+	{":method", "POST"},
+	{":path", "/"},
+	{":path", "/index.html"},
+	{":scheme", "http"},
+	{":scheme", "https"},
+	{":status", "200"},
+	{":status", "204"},
+	{":status", "206"},
+	{":status", "304"},
+	{":status", "400"},
+	{":status", "404"},
+	{":status", "500"},
+	{"accept-charset", ""},
+	{"accept-encoding", "gzip, deflate"},
+	{"accept-language", ""},
+	{"accept-ranges", ""},
+	{"accept", ""},
+	{"access-control-allow-origin", ""},
+	{"age", ""},
+	{"allow", ""},
+	{"authorization", ""},
+	{"cache-control", ""},
+	{"content-disposition", ""},
+	{"content-encoding", ""},
+	{"content-language", ""},
+	{"content-length", ""},
+	{"content-location", ""},
+	{"content-range", ""},
+	{"content-type", ""},
+	{"cookie", ""},
+	{"date", ""},
+	{"etag", ""},
+	{"expect", ""},
+	{"expires", ""},
+	{"from", ""},
+	{"host", ""},
+	{"if-match", ""},
+	{"if-modified-since", ""},
+	{"if-none-match", ""},
+	{"if-range", ""},
+	{"if-unmodified-since", ""},
+	{"last-modified", ""},
+	{"link", ""},
+	{"location", ""},
+	{"max-forwards", ""},
+	{"proxy-authenticate", ""},
+	{"proxy-authorization", ""},
+	{"range", ""},
+	{"referer", ""},
+	{"refresh", ""},
+	{"retry-after", ""},
+	{"server", ""},
+	{"set-cookie", ""},
+	{"strict-transport-security", ""},
+	{"transfer-encoding", ""},
+	{"user-agent", ""},
+	{"vary", ""},
+	{"via", ""},
+	{"www-authenticate", ""}
+};
+
+#define HPACK_STATIC_LEN (sizeof(hpack_static_table) / \
+                          sizeof(hpack_static_table[0]))
+
+/* The Huffman code (RFC 7541, appendix B) is canonical, so it is stored as
+ * the symbols sorted by their code, and for each code length the first code,
+ * the index of its symbol and the number of codes of that length
+ */
+static const uint16_t hpack_huffman_symbols[257] = {
+	48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37,
+	45, 46, 47, 51, 52, 53, 54, 55, 56, 57, 61, 65,
+	95, 98, 100, 102, 103, 104, 108, 109, 110, 112, 114, 117,
+	58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+	77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89,
+	106, 107, 113, 118, 119, 120, 121, 122, 38, 42, 44, 59,
+	88, 90, 33, 34, 40, 41, 63, 39, 43, 124, 35, 62,
+	0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+	195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161,
+	167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230, 129,
+	132, 133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170,
+	173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+	233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150,
+	151, 152, 155, 157, 158, 165, 166, 168, 174, 175, 180, 182,
+	183, 188, 191, 197, 231, 239, 9, 142, 144, 145, 148, 159,
+	171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+	200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243,
+	255, 203, 204, 211, 212, 214, 221, 222, 223, 241, 244, 245,
+	246, 247, 248, 250, 251, 252, 253, 254, 2, 3, 4, 5,
+	6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+	21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220,
+	249, 10, 13, 22, 256
+};
+
+static const uint32_t hpack_huffman_first_code[31] = {
+	0, 0, 0, 0, 0, 0,
+	20, 92, 248, 0, 1016, 2042,
+	4090, 8184, 16380, 32764, 0, 0,
+	0, 524272, 1048550, 2097116, 4194258, 8388568,
+	16777194, 33554412, 67108832, 134217694, 268435426, 0,
+	1073741820
+};
+
+static const uint16_t hpack_huffman_first_index[31] = {
+	0, 0, 0, 0, 0, 0, 10, 36, 68, 0,
+	74, 79, 82, 84, 90, 92, 0, 0, 0, 95,
+	98, 106, 119, 145, 174, 186, 190, 205, 224, 0,
+	253
+};
+
+static const uint16_t hpack_huffman_count[31] = {
+	0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3,
+	2, 6, 2, 3, 0, 0, 0, 3, 8, 13, 26, 29,
+	12, 4, 15, 19, 29, 0, 4
+};
+
+/* The symbol marking the end of a Huffman-coded string */
+#define HPACK_HUFFMAN_EOS 256
+
+void hpack_decoder_init(struct HpackDecoder* decoder) {
+	decoder->entries = NULL;
+	decoder->num_entries = 0;
+	decoder->size = 0;
+	decoder->max_size = SERV_HPACK_TABLE_SIZE;
+}
+
+void free_hpack_decoder(struct HpackDecoder* decoder) {
+	size_t i;
+	for (i = 0; i < decoder->num_entries; i++) {
+		free(decoder->entries[i]);
+	}
+
+	free(decoder->entries);
+	hpack_decoder_init(decoder);
+}
+
+/* Evict the oldest entries until the table size is at most `size` */
+static void hpack_evict(struct HpackDecoder* decoder, size_t size) {
+	size_t evicted = 0;
+	while (decoder->size > size && evicted < decoder->num_entries) {
+		struct HpackEntry* entry = decoder->entries[evicted];
+		decoder->size -= entry->name_len + entry->value_len + 32;
+		free(entry);
+		evicted++;
+	}
+
+	memmove(decoder->entries, decoder->entries + evicted,
+	        (decoder->num_entries - evicted) * sizeof(struct HpackEntry*));
+	decoder->num_entries -= evicted;
+}
+
+/* Add an entry to the dynamic table, evicting old entries to make room */
+static void hpack_insert(struct HpackDecoder* decoder, struct Slice name,
+                         struct Slice value) {
+	size_t size = name.len + value.len + 32;
+	hpack_evict(decoder, size > decoder->max_size ? 0 :
+	                     decoder->max_size - size);
+
+	/* Entries larger than the table just empty it */
+	if (size > decoder->max_size) {
+		return;
+	}
+
+	struct HpackEntry* entry = malloc(sizeof(struct HpackEntry) + name.len +
+	                                  value.len);
+	entry->name_len = name.len;
+	entry->value_len = value.len;
+	memcpy((char*) (entry + 1), name.ptr, name.len);
+	memcpy((char*) (entry + 1) + name.len, value.ptr, value.len);
+
+	decoder->entries = realloc(decoder->entries, (decoder->num_entries + 1) *
+	                                             sizeof(struct HpackEntry*));
+	decoder->entries[decoder->num_entries] = entry;
+	decoder->num_entries++;
+	decoder->size += size;
+}
+
+/* Look up the entry at `index` in the static or dynamic table. Returns false
+ * if there is no such entry.
+ */
+static bool hpack_lookup(const struct HpackDecoder* decoder, uint64_t index,
+                         struct Slice* name, struct Slice* value) {
+	if (index == 0) {
+		return false;
+	}
+
+	if (index <= HPACK_STATIC_LEN) {
+		name->ptr = hpack_static_table[index - 1][0];
+		name->len = strlen(name->ptr);
+		value->ptr = hpack_static_table[index - 1][1];
+		value->len = strlen(value->ptr);
+		return true;
+	}
+
+	/* The newest dynamic table entry has the lowest index */
+	index -= HPACK_STATIC_LEN + 1;
+	if (index >= decoder->num_entries) {
+		return false;
+	}
+
+	const struct HpackEntry* entry =
+		decoder->entries[decoder->num_entries - 1 - (size_t) index];
+	name->ptr = (const char*) (entry + 1);
+	name->len = entry->name_len;
+	value->ptr = (const char*) (entry + 1) + entry->name_len;
+	value->len = entry->value_len;
+	return true;
+}
+
+/* Decode an integer with an `prefix_bits`-bit prefix, advancing `cursor`.
+ * Returns false if the integer is truncated or too large.
+ */
+static bool hpack_decode_int(const uint8_t** cursor, const uint8_t* end,
+                             uint8_t prefix_bits, uint64_t* value) {
+	if (*cursor >= end) {
+		return false;
+	}
+
+	uint8_t mask = (uint8_t) ((1 << prefix_bits) - 1);
+	*value = **cursor & mask;
+	(*cursor)++;
+
+	if (*value < mask) {
+		return true;
+	}
+
+	uint32_t shift = 0;
+	while (*cursor < end && shift <= 28) {
+		uint8_t byte = **cursor;
+		(*cursor)++;
+		*value += (uint64_t) (byte & 0x7f) << shift;
+		shift += 7;
+
+		if (!(byte & 0x80)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* Decode a Huffman-coded string into `out`, returning the decoded length, or
+ * -1 if the string is invalid or doesn't fit into `cap` bytes
+ */
+static int64_t hpack_decode_huffman(const uint8_t* data, size_t len,
+                                    char* out, size_t cap) {
+	size_t out_len = 0;
+	uint32_t code = 0;
+	uint32_t code_len = 0;
+
+	size_t i;
+	for (i = 0; i < len * 8; i++) {
+		code = (code << 1) | ((data[i / 8] >> (7 - i % 8)) & 1);
+		code_len++;
+
+		if (code_len > 30) {
+			return -1;
+		}
+
+		uint32_t offset = code - hpack_huffman_first_code[code_len];
+		if (hpack_huffman_count[code_len] == 0 ||
+		    code < hpack_huffman_first_code[code_len] ||
+		    offset >= hpack_huffman_count[code_len]) {
+			continue;
+		}
+
+		uint16_t symbol = hpack_huffman_symbols[
+			hpack_huffman_first_index[code_len] + offset];
+		if (symbol == HPACK_HUFFMAN_EOS || out_len == cap) {
+			return -1;
+		}
+
+		out[out_len] = (char) symbol;
+		out_len++;
+		code = 0;
+		code_len = 0;
+	}
+
+	/* The padding has to be a prefix of EOS (all ones) shorter than a byte */
+	if (code_len >= 8 || code != (uint32_t) (1 << code_len) - 1) {
+		return -1;
+	}
+
+	return (int64_t) out_len;
+}
+
+/* Decode a string literal into the arena, advancing `cursor` and
+ * `arena_len`. Returns false if the string is invalid. A string too large for
+ * the arena is skipped instead, clearing `fits`, and so is any string while
+ * `fits` is already clear.
+ */
+static bool hpack_decode_string(const uint8_t** cursor, const uint8_t* end,
+                                char* arena, size_t arena_cap,
+                                size_t* arena_len, struct Slice* str,
+                                bool* fits) {
+	if (*cursor >= end) {
+		return false;
+	}
+
+	bool huffman = (**cursor & 0x80) != 0;
+	uint64_t len;
+	if (!hpack_decode_int(cursor, end, 7, &len) ||
+	    len > (uint64_t) (end - *cursor)) {
+		return false;
+	}
+
+	char* out = arena + *arena_len;
+	size_t cap = arena_cap - *arena_len;
+	int64_t out_len = -1;
+
+	if (!*fits) {
+		/* Skipped */
+	} else if (huffman) {
+		out_len = hpack_decode_huffman(*cursor, (size_t) len, out,
+		                               cap > 0 ? cap - 1 : 0);
+		if (out_len < 0 && len * 8 / 5 < cap) {
+			return false;
+		}
+	} else if (len < cap) {
+		memcpy(out, *cursor, (size_t) len);
+		out_len = (int64_t) len;
+	}
+
+	*cursor += len;
+	if (out_len < 0) {
+		*fits = false;
+		str->ptr = "";
+		str->len = 0;
+		return true;
+	}
+
+	out[out_len] = '\0';
+	str->ptr = out;
+	str->len = (size_t) out_len;
+	*arena_len += (size_t) out_len + 1;
+	return true;
+}
+
+/* Copy `str` into the arena, so that it stays valid when the dynamic table
+ * changes
+ */
+static bool hpack_copy_string(struct Slice* str, char* arena,
+                              size_t arena_cap, size_t* arena_len) {
+	if (str->len + 1 > arena_cap - *arena_len) {
+		return false;
+	}
+
+	memcpy(arena + *arena_len, str->ptr, str->len);
+	arena[*arena_len + str->len] = '\0';
+	str->ptr = arena + *arena_len;
+	*arena_len += str->len + 1;
+	return true;
+}
+
+/* Decode the fields of a header block like `hpack_decode`, but only return
+ * false for compression errors. Once the headers don't fit, `too_large` is
+ * set and the rest of the block is still decoded (reusing the arena for each
+ * field), because its table updates have to be applied either way.
+ */
+static bool hpack_decode_fields(struct HpackDecoder* decoder,
+                                const uint8_t* block, size_t len,
+                                char* arena, size_t arena_cap,
+                                struct Headers* headers, bool* too_large) {
+	const uint8_t* cursor = block;
+	const uint8_t* end = block + len;
+	size_t arena_len = 0;
+
+	while (cursor < end) {
+		const uint8_t* field = cursor;
+		uint8_t byte = *cursor;
+		uint64_t index;
+		struct Slice name;
+		struct Slice value;
+		struct Slice unused;
+		bool indexing = false;
+		bool fits = true;
+
+		/* The headers are dropped once they are too large, so each field
+		 * can use the whole arena
+		 */
+		if (*too_large) {
+			arena_len = 0;
+		}
+
+		if (byte & 0x80) {
+			/* Indexed header field */
+			if (!hpack_decode_int(&cursor, end, 7, &index) ||
+			    !hpack_lookup(decoder, index, &name, &value)) {
+				return false;
+			}
+
+			fits = index <= HPACK_STATIC_LEN ||
+			       (hpack_copy_string(&name, arena, arena_cap, &arena_len) &&
+			        hpack_copy_string(&value, arena, arena_cap, &arena_len));
+		} else if ((byte & 0xe0) == 0x20) {
+			/* Dynamic table size update */
+			if (!hpack_decode_int(&cursor, end, 5, &index) ||
+			    index > SERV_HPACK_TABLE_SIZE) {
+				return false;
+			}
+
+			decoder->max_size = (size_t) index;
+			hpack_evict(decoder, decoder->max_size);
+			continue;
+		} else {
+			/* Literal header field, with incremental indexing (01), without
+			 * indexing (0000) or never indexed (0001)
+			 */
+			indexing = (byte & 0xc0) == 0x40;
+			if (!hpack_decode_int(&cursor, end, indexing ? 6 : 4, &index)) {
+				return false;
+			}
+
+			if (index == 0) {
+				if (!hpack_decode_string(&cursor, end, arena, arena_cap,
+				                         &arena_len, &name, &fits)) {
+					return false;
+				}
+			} else {
+				if (!hpack_lookup(decoder, index, &name, &unused)) {
+					return false;
+				}
+				fits = index <= HPACK_STATIC_LEN ||
+				       hpack_copy_string(&name, arena, arena_cap, &arena_len);
+			}
+
+			if (!hpack_decode_string(&cursor, end, arena, arena_cap,
+			                         &arena_len, &value, &fits)) {
+				return false;
+			}
+		}
+
+		if (!fits && arena_len > 0 && !*too_large) {
+			/* Drop the headers decoded so far and decode the field again
+			 * into the empty arena (the field has no side effects before
+			 * being inserted)
+			 */
+			*too_large = true;
+			cursor = field;
+			continue;
+		}
+
+		if (indexing) {
+			/* A field that doesn't fit into the whole arena is larger than
+			 * the table, so it would just empty it
+			 */
+			if (fits) {
+				hpack_insert(decoder, name, value);
+			} else {
+				hpack_evict(decoder, 0);
+			}
+		}
+
+		if (!fits || headers->num == SERV_MAX_HEADERS) {
+			*too_large = true;
+		}
+		if (*too_large) {
+			continue;
+		}
+
+		/* Pseudo-header fields aren't known headers */
+		struct Header* header = &headers->list[headers->num];
+		header->name = name;
+		header->value = value;
+		header->id = name.len > 0 && name.ptr[0] == ':' ? HeaderOther :
+		             header_from_str(name.ptr, name.len);
+		headers->num++;
+
+		if (header->id != HeaderOther && headers->known[header->id] == 0) {
+			headers->known[header->id] = (uint8_t) headers->num;
+		}
+	}
+
+	return true;
+}
+
+bool hpack_decode(struct HpackDecoder* decoder, const uint8_t* block,
+                  size_t len, char* arena, size_t arena_cap,
+                  struct Headers* headers, bool* too_large) {
+	memset(headers, 0, sizeof(*headers));
+	*too_large = false;
+
+	if (!hpack_decode_fields(decoder, block, len, arena, arena_cap, headers,
+	                         too_large)) {
+		*too_large = false;
+		return false;
+	}
+
+	return !*too_large;
+}
+
+/* Encode the integer `value` with an `prefix_bits`-bit prefix, keeping the
+ * other bits of the first byte (`first`), and return the number of bytes
+ * written
+ */
+static size_t hpack_encode_int(uint64_t value, uint8_t prefix_bits,
+                               uint8_t first, uint8_t* out) {
+	uint8_t mask = (uint8_t) ((1 << prefix_bits) - 1);
+	if (value < mask) {
+		out[0] = (uint8_t) (first | value);
+		return 1;
+	}
+
+	out[0] = (uint8_t) (first | mask);
+	value -= mask;
+	size_t len = 1;
+	while (value >= 0x80) {
+		out[len] = (uint8_t) ((value & 0x7f) | 0x80);
+		value >>= 7;
+		len++;
+	}
+	out[len] = (uint8_t) value;
+	return len + 1;
+}
+
+size_t hpack_encode_status(uint16_t status, uint8_t* out) {
+	/* Use the indexed ":status" entries of the static table if possible */
+	size_t i;
+	for (i = 7; i < 14; i++) {
+		if (strtol(hpack_static_table[i][1], NULL, 10) == status) {
+			out[0] = (uint8_t) (0x80 | (i + 1));
+			return 1;
+		}
+	}
+
+	char value[8];
+	sprintf(value, "%u", (unsigned int) status);
+	return hpack_encode_field(":status", value, strlen(value), out);
+}
+
+size_t hpack_encode_field(const char* name, const char* value,
+                          size_t value_len, uint8_t* out) {
+	size_t len = 0;
+
+	/* Literal header field without indexing, with an indexed name if the
+	 * name is in the static table
+	 */
+	size_t i;
+	for (i = 0; i < HPACK_STATIC_LEN; i++) {
+		if (strcmp(hpack_static_table[i][0], name) == 0) {
+			break;
+		}
+	}
+
+	if (i < HPACK_STATIC_LEN) {
+		len += hpack_encode_int(i + 1, 4, 0x00, out);
+	} else {
+		size_t name_len = strlen(name);
+		out[0] = 0x00;
+		len++;
+		len += hpack_encode_int(name_len, 7, 0x00, out + len);
+		memcpy(out + len, name, name_len);
+		len += name_len;
+	}
+
+	len += hpack_encode_int(value_len, 7, 0x00, out + len);
+	memcpy(out + len, value, value_len);
+	len += value_len;
+
+	return len;
+}
@@ -0,0 +1,77 @@
+/* HPACK (RFC 7541) header compression for HTTP/2. The decoder supports the
+ * static and dynamic tables and Huffman-coded strings. The encoder only uses
+ * the static table (and never Huffman coding), which every decoder accepts
+ * without having to keep any state for it.
+ */
+
+#ifndef C_HTTP_SERVER_HPACK_H
+#define C_HTTP_SERVER_HPACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "http.h"
+
+/* The maximum size of the decoder's dynamic table, as advertised to peers
+ * (the default of `SETTINGS_HEADER_TABLE_SIZE`)
+ */
+#define SERV_HPACK_TABLE_SIZE 4096
+
+/* The maximum number of bytes an encoded header field takes up, excluding
+ * the length of its value
+ */
+#define SERV_HPACK_FIELD_OVERHEAD 16
+
+/* An entry in the dynamic table, with the name and value stored after it */
+struct HpackEntry {
+	size_t name_len;
+	size_t value_len;
+};
+
+/* The state of an HPACK decoder, which is kept for the whole connection */
+struct HpackDecoder {
+	/* The dynamic table, oldest entry first */
+	struct HpackEntry** entries;
+	size_t num_entries;
+	/* The size of the table, as defined by the RFC */
+	size_t size;
+	size_t max_size;
+};
+
+/* Initialize a decoder with an empty dynamic table. The decoder should be
+ * freed with `free_hpack_decoder` after use.
+ */
+void hpack_decoder_init(struct HpackDecoder* decoder);
+
+/* Free the dynamic table of a decoder */
+void free_hpack_decoder(struct HpackDecoder* decoder);
+
+/* Decode the header block `block` of `len` bytes into `headers`. Names and
+ * values (null-terminated) are stored in `arena`, a buffer of `arena_cap`
+ * bytes, or point into the static table. Pseudo-header fields (":path" etc.)
+ * are included with the id `HeaderOther`. Returns false if the block is
+ * invalid (a compression error, which is fatal for the connection) or if the
+ * headers don't fit into `headers` or `arena`, in which case `too_large` is
+ * set. The whole block is decoded even then, so that the dynamic table stays
+ * in sync, which needs `arena_cap` to be larger than
+ * `SERV_HPACK_TABLE_SIZE`.
+ */
+bool hpack_decode(struct HpackDecoder* decoder, const uint8_t* block,
+                  size_t len, char* arena, size_t arena_cap,
+                  struct Headers* headers, bool* too_large);
+
+/* Encode a ":status" pseudo-header field into `out`, returning the number of
+ * bytes written (at most `SERV_HPACK_FIELD_OVERHEAD`)
+ */
+size_t hpack_encode_status(uint16_t status, uint8_t* out);
+
+/* Encode a header field with the lowercase `name` (which should be in the
+ * static table to save space) into `out`, returning the number of bytes
+ * written (at most `SERV_HPACK_FIELD_OVERHEAD` plus the lengths of the name
+ * and value)
+ */
+size_t hpack_encode_field(const char* name, const char* value,
+                          size_t value_len, uint8_t* out);
+
+#endif
@@ -2,6 +2,7 @@
 
 #include "http.h"
 
+#include <ctype.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
@@ -9,6 +10,11 @@
 #include "socket.h"
 #include "log.h"
 #include "handlers.h"
+#include "record.h"
+#include "router.h"
+#include "scan.h"
+
+#include "alloc.h"
 
 enum Method method_from_str(char* str) {
 	if (strcmp(str, "GET") == 0) {
@@ -28,6 +34,113 @@ enum Method method_from_str(char* str) {
 	}
 }
 
+/* Lowercase names of the well-known headers, indexed by `enum HeaderName` */
+static const char* const header_names[NUM_KNOWN_HEADERS] = {
+	"accept",
+	"accept-encoding",
+	"authorization",
+	"connection",
+	"content-length",
+	"content-type",
+	"cookie",
+	"expect",
+	"host",
+	"http2-settings",
+	"if-modified-since",
+	"if-none-match",
+	"if-range",
+	"keep-alive",
+	"range",
+	"transfer-encoding",
+	"upgrade",
+	"user-agent"
+};
+
+/* The size of `header_table` */
+#define HEADER_TABLE_SIZE 32
+
+/* A perfect hash of the well-known header names (see `header_from_str`) */
+#define HEADER_HASH(len, first, last) \
+	(((len) + 7 * (size_t) (first) + 30 * (size_t) (last)) % HEADER_TABLE_SIZE)
+
+/* The well-known headers, indexed by `HEADER_HASH` of their names */
+static const enum HeaderName header_table[HEADER_TABLE_SIZE] = {
+	HeaderHttp2Settings,
+	HeaderExpect,
+	HeaderOther,
+	HeaderConnection,
+	HeaderOther,
+	HeaderAccept,
+	HeaderIfModifiedSince,
+	HeaderOther,
+	HeaderAcceptEncoding,
+	HeaderOther,
+	HeaderOther,
+	HeaderOther,
+	HeaderOther,
+	HeaderKeepAlive,
+	HeaderOther,
+	HeaderTransferEncoding,
+	HeaderUpgrade,
+	HeaderCookie,
+	HeaderOther,
+	HeaderContentLength,
+	HeaderHost,
+	HeaderUserAgent,
+	HeaderOther,
+	HeaderContentType,
+	HeaderAuthorization,
+	HeaderRange,
+	HeaderOther,
+	HeaderOther,
+	HeaderIfNoneMatch,
+	HeaderIfRange,
+	HeaderOther,
+	HeaderOther
+};
+
+enum HeaderName header_from_str(const char* name, size_t len) {
+	if (len == 0) {
+		return HeaderOther;
+	}
+
+	enum HeaderName header = header_table[HEADER_HASH(len,
+	                                                  tolower((uint8_t) name[0]),
+	                                                  tolower((uint8_t) name[len - 1]))];
+	if (header == HeaderOther || strlen(header_names[header]) != len) {
+		return HeaderOther;
+	}
+
+	size_t i;
+	for (i = 0; i < len; i++) {
+		if (tolower((uint8_t) name[i]) != header_names[header][i]) {
+			return HeaderOther;
+		}
+	}
+
+	return header;
+}
+
+const char* method_to_str(enum Method method) {
+	switch (method) {
+		case Get:
+			return "GET";
+		case Head:
+			return "HEAD";
+		case Post:
+			return "POST";
+		case Put:
+			return "PUT";
+		case Delete:
+			return "DELETE";
+		case Patch:
+			return "PATCH";
+		case Other:
+		default:
+			return NULL;
+	}
+}
+
 struct Path parse_path(const char* path_str) {
 	struct Path path = {0};
 
@@ -45,24 +158,26 @@ struct Path parse_path(const char* path_str) {
 		return path;
 	}
 
+	/* Find the end of the path (the "?" or the null terminator) */
+	size_t str_len = strlen(path_str);
+	size_t path_len = scan_any(path_str, str_len, "?");
+
 	/* Count the number of segments (≤ number of "/" before "?") */
 	size_t i = 0;
-	while (path_str[i] != '\0' && path_str[i] != '?') {
-		if (path_str[i] == '/') {
-			path.num_components++;
-		}
-
+	while ((i += scan_any(path_str + i, path_len - i, "/")) < path_len) {
+		path.num_components++;
 		i++;
 	}
 
 	path.components = malloc(path.num_components * sizeof(char*));
 
 	/* Copy the segments into `path.segments` */
+	const char* path_end = path_str + path_len;
 	for (i = 0; i < path.num_components; i++) {
 		/* Ignore leading "/" */
 		path_str++;
 
-		size_t len = strcspn(path_str, "/?");
+		size_t len = scan_any(path_str, path_end - path_str, "/");
 
 		/* Ignore this segment if it's empty (e.g. when the path ends in "/") */
 		if (len == 0) {
@@ -72,7 +187,7 @@ struct Path parse_path(const char* path_str) {
 		}
 
 		path.components[i] = malloc(len + 1);
-		strncpy(path.components[i], path_str, len);
+		memcpy(path.components[i], path_str, len);
 		path.components[i][len] = 0;
 
 		path_str += len;
@@ -93,9 +208,9 @@ struct Path parse_path(const char* path_str) {
 	path_str++;
 
 	/* Copy the query string */
-	size_t query_len = strlen(path_str);
+	size_t query_len = str_len - path_len - 1;
 	path.query = malloc(query_len + 1);
-	strcpy(path.query, path_str);
+	memcpy(path.query, path_str, query_len + 1);
 
 	return path;
 }
@@ -117,11 +232,137 @@ void free_path(struct Path path) {
 	}
 }
 
-bool parse_request(const char* text_req, struct Request* req) {
+bool slice_eq_nocase(struct Slice slice, const char* str) {
+	size_t i;
+	for (i = 0; i < slice.len; i++) {
+		if (str[i] == '\0' ||
+		    tolower((uint8_t) slice.ptr[i]) != tolower((uint8_t) str[i])) {
+			return false;
+		}
+	}
+
+	return str[slice.len] == '\0';
+}
+
+bool slice_contains(struct Slice slice, const char* str) {
+	size_t len = strlen(str);
+	size_t i;
+	for (i = 0; i + len <= slice.len; i++) {
+		struct Slice candidate;
+		candidate.ptr = slice.ptr + i;
+		candidate.len = len;
+		if (slice_eq_nocase(candidate, str)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool slice_to_u64(struct Slice slice, uint64_t* value) {
+	if (slice.len == 0) {
+		return false;
+	}
+
+	*value = 0;
+
+	size_t i;
+	for (i = 0; i < slice.len; i++) {
+		if (slice.ptr[i] < '0' || slice.ptr[i] > '9' ||
+		    *value > (UINT64_MAX - (slice.ptr[i] - '0')) / 10) {
+			return false;
+		}
+
+		*value = *value * 10 + (slice.ptr[i] - '0');
+	}
+
+	return true;
+}
+
+size_t parse_headers(const char* text, size_t len, struct Headers* headers) {
+	const char* text_start = text;
+
+	headers->num = 0;
+	headers->too_many = false;
+	memset(headers->known, 0, sizeof(headers->known));
+
+	while (true) {
+		size_t line_len = scan_any(text, len, "\n");
+		if (line_len == len) {
+			return 0;
+		}
+
+		const char* line = text;
+		text += line_len + 1;
+		len -= line_len + 1;
+
+		if (line_len > 0 && line[line_len - 1] == '\r') {
+			line_len--;
+		}
+
+		if (line_len == 0) {
+			break;
+		}
+
+		if (headers->num == SERV_MAX_HEADERS) {
+			headers->too_many = true;
+			return 0;
+		}
+
+		size_t name_len = scan_any(line, line_len, ":");
+		if (name_len == line_len || !scan_is_token(line, name_len)) {
+			return 0;
+		}
+
+		/* Trim optional whitespace around the value */
+		const char* value = line + name_len + 1;
+		size_t value_len = line_len - name_len - 1;
+		while (value_len > 0 && (value[0] == ' ' || value[0] == '\t')) {
+			value++;
+			value_len--;
+		}
+		while (value_len > 0 && (value[value_len - 1] == ' ' ||
+		                         value[value_len - 1] == '\t')) {
+			value_len--;
+		}
+
+		struct Header* header = &headers->list[headers->num];
+		header->id = header_from_str(line, name_len);
+		header->name.ptr = line;
+		header->name.len = name_len;
+		header->value.ptr = value;
+		header->value.len = value_len;
+
+		headers->num++;
+		if (header->id != HeaderOther && headers->known[header->id] == 0) {
+			headers->known[header->id] = (uint8_t) headers->num;
+		}
+	}
+
+	return text - text_start;
+}
+
+const struct Slice* get_header(const struct Headers* headers,
+                               enum HeaderName name) {
+	if (name == HeaderOther || headers->known[name] == 0) {
+		return NULL;
+	}
+
+	return &headers->list[headers->known[name] - 1].value;
+}
+
+bool parse_request(const char* text_req, size_t len, struct Request* req) {
+	const char* text_start = text_req;
+	size_t text_len = len;
+
 	/* Parse HTTP request method */
-	size_t method_len = strcspn(text_req, " ");
+	size_t method_len = scan_any(text_req, text_len, " ");
+	if (method_len == text_len || !scan_is_token(text_req, method_len)) {
+		return false;
+	}
+
 	char* method_str = malloc(method_len + 1);
-	strncpy(method_str, text_req, method_len);
+	memcpy(method_str, text_req, method_len);
 	method_str[method_len] = 0;
 
 	if ((req->method = method_from_str(method_str)) == Other) {
@@ -133,34 +374,66 @@ bool parse_request(const char* text_req, struct Request* req) {
 
 	/* Parse the HTTP path */
 	text_req += method_len + 1;
-	size_t path_len = strcspn(text_req, " ");
+	text_len -= method_len + 1;
+	size_t path_len = scan_any(text_req, text_len, " \r\n");
+	req->target.ptr = text_req;
+	req->target.len = path_len;
 	char* path_str = malloc(path_len + 1);
-	strncpy(path_str, text_req, path_len);
+	memcpy(path_str, text_req, path_len);
 	path_str[path_len] = 0;
 	req->path = parse_path(path_str);
 
 	free(path_str);
 
-	return true;
+	/* Skip the rest of the request line */
+	size_t line_len = scan_any(text_req, text_len, "\n");
+	if (line_len == text_len) {
+		return false;
+	}
+
+	text_req += line_len + 1;
+	text_len -= line_len + 1;
+
+	/* Parse the headers, up to the first empty line */
+	size_t headers_len = parse_headers(text_req, text_len, &req->headers);
+	if (headers_len == 0) {
+		return false;
+	}
+
+	text_req += headers_len;
+	text_len -= headers_len;
+
+	req->head_len = text_req - text_start;
+	req->body = text_req;
+	req->body_len = text_len;
+
+	return req->head_len <= SERV_MAX_HEADER_SIZE;
 }
 
-bool handle_request(struct Request* req, Socket sock, char* data_dir) {
+bool handle_request(struct Request* req, Socket sock,
+                    const struct Config* config) {
 	uint16_t status;
+	uint64_t arrival = record_arrival();
 
-	switch (req->method) {
-		case Get:
-			status = handle_get(req->path, sock, data_dir);
-			break;
-		case Head:
-		case Post:
-		case Put:
-		case Delete:
-		case Patch:
-		default:
-			status = send_501(sock);
-			break;
+	/* Find the route with the longest matching prefix, and pass the rest of
+	 * the path on to its handler
+	 */
+	size_t depth;
+	const struct Route* route = find_route(config->router, req->path, &depth);
+
+	if (route == NULL) {
+		status = send_404(sock);
+	} else if (!(route->methods & METHOD_BIT(req->method))) {
+		status = send_405(sock, route->methods);
+	} else {
+		struct Path path = req->path;
+		path.components += depth;
+		path.num_components -= depth;
+		status = route->handler(req, path, sock, route, config);
 	}
 
+	record_request(req, arrival, status);
+
 	/* If the status indicates success or a client error */
 	if (status >= 200 && status < 500) {
 		return true;
@@ -168,154 +441,3 @@ bool handle_request(struct Request* req, Socket sock, char* data_dir) {
 		return false;
 	}
 }
-
-char* guess_mime_type(const char* file_ext) {
-	/* Below code generated based on data from
-	 * https://developer.mozilla.org/en-US/docs/Web/HTTP/Basics_of_HTTP/MIME_types/Common_types
-	 */
-	if (file_ext == NULL) {
-		return "application/octet-stream";
-	} else if (strcmp(file_ext, ".aac") == 0) {
-		return "audio/aac";
-	} else if (strcmp(file_ext, ".abw") == 0) {
-		return "application/x-abiword";
-	} else if (strcmp(file_ext, ".arc") == 0) {
-		return "application/x-freearc";
-	} else if (strcmp(file_ext, ".avif") == 0) {
-		return "image/avif";
-	} else if (strcmp(file_ext, ".avi") == 0) {
-		return "video/x-msvideo";
-	} else if (strcmp(file_ext, ".azw") == 0) {
-		return "application/vnd.amazon.ebook";
-	} else if (strcmp(file_ext, ".bmp") == 0) {
-		return "image/bmp";
-	} else if (strcmp(file_ext, ".bz") == 0) {
-		return "application/x-bzip";
-	} else if (strcmp(file_ext, ".bz2") == 0) {
-		return "application/x-bzip2";
-	} else if (strcmp(file_ext, ".cda") == 0) {
-		return "application/x-cdf";
-	} else if (strcmp(file_ext, ".csh") == 0) {
-		return "application/x-csh";
-	} else if (strcmp(file_ext, ".css") == 0) {
-		return "text/css";
-	} else if (strcmp(file_ext, ".csv") == 0) {
-		return "text/csv";
-	} else if (strcmp(file_ext, ".doc") == 0) {
-		return "application/msword";
-	} else if (strcmp(file_ext, ".docx") == 0) {
-		return "application/vnd.openxmlformats-officedocument.wordprocessingml.document";
-	} else if (strcmp(file_ext, ".eot") == 0) {
-		return "application/vnd.ms-fontobject";
-	} else if (strcmp(file_ext, ".epub") == 0) {
-		return "application/epub+zip";
-	} else if (strcmp(file_ext, ".gz") == 0) {
-		return "application/gzip";
-	} else if (strcmp(file_ext, ".gif") == 0) {
-		return "image/gif";
-	} else if (strcmp(file_ext, ".htm") == 0 || strcmp(file_ext, ".html") == 0) {
-		return "text/html";
-	} else if (strcmp(file_ext, ".ico") == 0) {
-		return "image/vnd.microsoft.icon";
-	} else if (strcmp(file_ext, ".ics") == 0) {
-		return "text/calendar";
-	} else if (strcmp(file_ext, ".jar") == 0) {
-		return "application/java-archive";
-	} else if (strcmp(file_ext, ".jpeg") == 0 || strcmp(file_ext, ".jpg") == 0) {
-		return "image/jpeg";
-	} else if (strcmp(file_ext, ".js") == 0 || strcmp(file_ext, ".mjs") == 0) {
-		return "text/javascript";
-	} else if (strcmp(file_ext, ".json") == 0) {
-		return "application/json";
-	} else if (strcmp(file_ext, ".jsonld") == 0) {
-		return "application/ld+json";
-	} else if (strcmp(file_ext, ".mid") == 0 || strcmp(file_ext, ".midi") == 0) {
-		return "audio/midi";
-	} else if (strcmp(file_ext, ".mp3") == 0) {
-		return "audio/mpeg";
-	} else if (strcmp(file_ext, ".mp4") == 0) {
-		return "video/mp4";
-	} else if (strcmp(file_ext, ".mpeg") == 0) {
-		return "video/mpeg";
-	} else if (strcmp(file_ext, ".mpkg") == 0) {
-		return "application/vnd.apple.installer+xml";
-	} else if (strcmp(file_ext, ".odp") == 0) {
-		return "application/vnd.oasis.opendocument.presentation";
-	} else if (strcmp(file_ext, ".ods") == 0) {
-		return "application/vnd.oasis.opendocument.spreadsheet";
-	} else if (strcmp(file_ext, ".odt") == 0) {
-		return "application/vnd.oasis.opendocument.text";
-	} else if (strcmp(file_ext, ".oga") == 0) {
-		return "audio/ogg";
-	} else if (strcmp(file_ext, ".ogv") == 0) {
-		return "video/ogg";
-	} else if (strcmp(file_ext, ".ogx") == 0) {
-		return "application/ogg";
-	} else if (strcmp(file_ext, ".opus") == 0) {
-		return "audio/opus";
-	} else if (strcmp(file_ext, ".otf") == 0) {
-		return "font/otf";
-	} else if (strcmp(file_ext, ".png") == 0) {
-		return "image/png";
-	} else if (strcmp(file_ext, ".pdf") == 0) {
-		return "application/pdf";
-	} else if (strcmp(file_ext, ".php") == 0) {
-		return "application/x-httpd-php";
-	} else if (strcmp(file_ext, ".ppt") == 0) {
-		return "application/vnd.ms-powerpoint";
-	} else if (strcmp(file_ext, ".pptx") == 0) {
-		return "application/vnd.openxmlformats-officedocument.presentationml.presentation";
-	} else if (strcmp(file_ext, ".rar") == 0) {
-		return "application/vnd.rar";
-	} else if (strcmp(file_ext, ".rtf") == 0) {
-		return "application/rtf";
-	} else if (strcmp(file_ext, ".sh") == 0) {
-		return "application/x-sh";
-	} else if (strcmp(file_ext, ".svg") == 0) {
-		return "image/svg+xml";
-	} else if (strcmp(file_ext, ".tar") == 0) {
-		return "application/x-tar";
-	} else if (strcmp(file_ext, ".tif") == 0 || strcmp(file_ext, ".tiff") == 0) {
-		return "image/tiff";
-	} else if (strcmp(file_ext, ".ts") == 0) {
-		return "video/mp2t";
-	} else if (strcmp(file_ext, ".ttf") == 0) {
-		return "font/ttf";
-	} else if (strcmp(file_ext, ".txt") == 0) {
-		return "text/plain";
-	} else if (strcmp(file_ext, ".vsd") == 0) {
-		return "application/vnd.visio";
-	} else if (strcmp(file_ext, ".wav") == 0) {
-		return "audio/wav";
-	} else if (strcmp(file_ext, ".weba") == 0) {
-		return "audio/webm";
-	} else if (strcmp(file_ext, ".webm") == 0) {
-		return "video/webm";
-	} else if (strcmp(file_ext, ".webp") == 0) {
-		return "image/webp";
-	} else if (strcmp(file_ext, ".woff") == 0) {
-		return "font/woff";
-	} else if (strcmp(file_ext, ".woff2") == 0) {
-		return "font/woff2";
-	} else if (strcmp(file_ext, ".xhtml") == 0) {
-		return "application/xhtml+xml";
-	} else if (strcmp(file_ext, ".xls") == 0) {
-		return "application/vnd.ms-excel";
-	} else if (strcmp(file_ext, ".xlsx") == 0) {
-		return "application/vnd.openxmlformats-officedocument.spreadsheetml.sheet";
-	} else if (strcmp(file_ext, ".xml") == 0) {
-		return "application/xml";
-	} else if (strcmp(file_ext, ".xul") == 0) {
-		return "application/vnd.mozilla.xul+xml";
-	} else if (strcmp(file_ext, ".zip") == 0) {
-		return "application/zip";
-	} else if (strcmp(file_ext, ".3gp") == 0) {
-		return "video/3gpp";
-	} else if (strcmp(file_ext, ".3g2") == 0) {
-		return "video/3gpp2";
-	} else if (strcmp(file_ext, ".7z") == 0) {
-		return "application/x-7z-compressed";
-	} else {
-		return "application/octet-stream";
-	}
-}
@@ -11,6 +11,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "config.h"
 #include "socket.h"
 
 /* A supported HTTP request method */
@@ -29,6 +30,9 @@ enum Method {
  */
 enum Method method_from_str(char* str);
 
+/* Get the name of an HTTP method. Returns NULL for `Other`. */
+const char* method_to_str(enum Method method);
+
 /* The path of an HTTP request */
 struct Path {
 	/* Individual path components, originally separated by "/" */
@@ -50,25 +54,134 @@ struct Path parse_path(const char* path_str);
  */
 void free_path(struct Path path);
 
+/* The maximum number of headers in a request */
+#define SERV_MAX_HEADERS 64
+
+/* The maximum size of the request line and headers, in bytes */
+#define SERV_MAX_HEADER_SIZE 8192
+
+/* A well-known HTTP header, which can be looked up using `get_header` without
+ * any string comparisons
+ */
+enum HeaderName {
+	HeaderAccept,
+	HeaderAcceptEncoding,
+	HeaderAuthorization,
+	HeaderConnection,
+	HeaderContentLength,
+	HeaderContentType,
+	HeaderCookie,
+	HeaderExpect,
+	HeaderHost,
+	HeaderHttp2Settings,
+	HeaderIfModifiedSince,
+	HeaderIfNoneMatch,
+	HeaderIfRange,
+	HeaderKeepAlive,
+	HeaderRange,
+	HeaderTransferEncoding,
+	HeaderUpgrade,
+	HeaderUserAgent,
+	/* Any other header */
+	HeaderOther
+};
+
+/* The number of well-known headers in `enum HeaderName` */
+#define NUM_KNOWN_HEADERS HeaderOther
+
+/* Find the well-known header with the given (case-insensitive) name, which
+ * does not have to be null-terminated. Returns `HeaderOther` if the name is
+ * not a well-known header.
+ */
+enum HeaderName header_from_str(const char* name, size_t len);
+
+/* A non-null-terminated string pointing into another buffer */
+struct Slice {
+	const char* ptr;
+	size_t len;
+};
+
+/* Check whether the slice is equal to the null-terminated string `str`,
+ * ignoring (ASCII) case
+ */
+bool slice_eq_nocase(struct Slice slice, const char* str);
+
+/* Check whether the slice contains the null-terminated string `str`,
+ * ignoring (ASCII) case
+ */
+bool slice_contains(struct Slice slice, const char* str);
+
+/* Parse the slice as a non-negative decimal integer. Returns false if the
+ * slice is empty, contains anything other than digits, or overflows.
+ */
+bool slice_to_u64(struct Slice slice, uint64_t* value);
+
+/* An HTTP request header. `name` and `value` point into the request text. */
+struct Header {
+	enum HeaderName id;
+	struct Slice name;
+	struct Slice value;
+};
+
+/* The headers of an HTTP request or response */
+struct Headers {
+	/* The headers, in the order in which they were received */
+	struct Header list[SERV_MAX_HEADERS];
+	size_t num;
+	/* For each well-known header, 1 + the index of its first occurrence in
+	 * `list`, or 0 if there is no such header
+	 */
+	uint8_t known[NUM_KNOWN_HEADERS];
+	/* Whether parsing stopped because there were more than
+	 * `SERV_MAX_HEADERS` headers
+	 */
+	bool too_many;
+};
+
+/* Parse header lines from the first `len` bytes of `text` into `headers`, up
+ * to and including the empty line that ends them. Returns the number of bytes
+ * parsed, or 0 if the headers are invalid, incomplete, or if there are more
+ * than `SERV_MAX_HEADERS` of them (setting `headers->too_many`). The parsed
+ * headers point into `text`.
+ */
+size_t parse_headers(const char* text, size_t len, struct Headers* headers);
+
+/* Get the value of the first header called `name` in `headers`, or NULL if
+ * there is no such header
+ */
+const struct Slice* get_header(const struct Headers* headers,
+                               enum HeaderName name);
+
 /* An HTTP request */
 struct Request {
 	enum Method method;
 	struct Path path;
+	/* The unparsed request target, as sent by the client */
+	struct Slice target;
+	struct Headers headers;
+	/* The length of the request line and headers, including the empty line
+	 * at the end. The request body (if any) starts at this offset.
+	 */
+	size_t head_len;
+	/* The part of the request body that was received together with the
+	 * request head (the rest still has to be read from the socket)
+	 */
+	const char* body;
+	size_t body_len;
 };
 
-/* Parse an HTTP request from the provided buffer into the request struct
- * pointed to by `req`. Returns true if parsing was successful, false
+/* Parse an HTTP request from the provided buffer of `len` bytes into the
+ * request struct pointed to by `req`. Returns true if parsing was successful, false
  * otherwise. If this function fails, `req` may have been partially modified.
+ * The parsed headers point into `text_req`, so it must outlive `req`.
  */
-bool parse_request(const char* text_req, struct Request* req);
+bool parse_request(const char* text_req, size_t len, struct Request* req);
 
 /* Handle an HTTP request using the provided request information in `req`.
  * Returns true if the request was handled without server error (HTTP status
  * code 2XX/3XX/4XX, and no fatal errors in the handlers).
  */
-bool handle_request(struct Request* req, Socket sock, char* data_dir);
-
-/* Guess the mime type by the provided file extension (with '.') */
-char* guess_mime_type(const char* file_ext);
+bool handle_request(struct Request* req, Socket sock,
+                    const struct Config* config);
 
 #endif
@@ -0,0 +1,1024 @@
+/* Implementation of `http2.h`, see that file for documentation and types */
+
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+
+#include "http2.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define poll WSAPoll
+#else
+#include <poll.h>
+#endif
+
+#include "misc.h"
+#include "handlers.h"
+#include "hpack.h"
+#include "log.h"
+#include "ratelimit.h"
+#include "router.h"
+#include "trace.h"
+
+#include "alloc.h"
+
+/* Frame types */
+#define H2_DATA 0x0
+#define H2_HEADERS 0x1
+#define H2_PRIORITY 0x2
+#define H2_RST_STREAM 0x3
+#define H2_SETTINGS 0x4
+#define H2_PUSH_PROMISE 0x5
+#define H2_PING 0x6
+#define H2_GOAWAY 0x7
+#define H2_WINDOW_UPDATE 0x8
+#define H2_CONTINUATION 0x9
+
+/* Frame flags */
+#define H2_FLAG_END_STREAM 0x1
+#define H2_FLAG_ACK 0x1
+#define H2_FLAG_END_HEADERS 0x4
+#define H2_FLAG_PADDED 0x8
+#define H2_FLAG_PRIORITY 0x20
+
+/* Settings */
+#define H2_SETTINGS_HEADER_TABLE_SIZE 0x1
+#define H2_SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define H2_SETTINGS_INITIAL_WINDOW_SIZE 0x4
+#define H2_SETTINGS_MAX_FRAME_SIZE 0x5
+
+/* Error codes */
+#define H2_NO_ERROR 0x0
+#define H2_PROTOCOL_ERROR 0x1
+#define H2_FLOW_CONTROL_ERROR 0x3
+#define H2_FRAME_SIZE_ERROR 0x6
+#define H2_REFUSED_STREAM 0x7
+#define H2_COMPRESSION_ERROR 0x9
+
+/* The largest flow control window */
+#define H2_MAX_WINDOW 0x7fffffff
+
+/* A stream with a response body that is still being sent */
+struct Http2Stream {
+	uint32_t id;
+	/* The stream's flow control window for sending */
+	int64_t window;
+	/* The body is either sent from a file or from memory */
+	FILE* file;
+	const uint8_t* data;
+	uint64_t offset;
+	uint64_t remaining;
+};
+
+/* The state of an HTTP/2 connection */
+struct Http2Connection {
+	Socket sock;
+	uint64_t client;
+	const struct Config* config;
+
+	/* Received bytes, of which `in_start` to `in_len` are not processed yet */
+	uint8_t in[SERV_H2_FRAME_HEADER_LEN + SERV_H2_MAX_FRAME_SIZE];
+	size_t in_start;
+	size_t in_len;
+
+	struct HpackDecoder decoder;
+	/* Storage for decoded header names and values */
+	char arena[2 * SERV_MAX_HEADER_SIZE];
+	/* A header block that continues in CONTINUATION frames */
+	uint8_t header_block[SERV_MAX_HEADER_SIZE];
+	size_t header_block_len;
+	uint32_t header_stream;
+	bool header_end_stream;
+	bool header_too_large;
+	/* Whether the header block contains trailers, which are ignored */
+	bool header_trailers;
+
+	/* The peer's settings */
+	uint32_t max_frame_size;
+	int64_t initial_window;
+	/* The connection's flow control window for sending */
+	int64_t window;
+
+	/* The highest stream id opened by the client */
+	uint32_t last_stream_id;
+	struct Http2Stream streams[SERV_H2_MAX_STREAMS];
+	size_t num_streams;
+	/* The stream which sends first in the next round */
+	size_t next_stream;
+
+	/* Whether the connection is closed after the current frame */
+	bool closing;
+};
+
+bool is_http2_preface(const char* data, size_t len) {
+	/* Only "PRI * HTTP/2.0\r\n\r\n" is read as a request head */
+	return len >= 18 && memcmp(data, SERV_H2_PREFACE, 18) == 0;
+}
+
+bool is_http2_upgrade(const struct Request* req) {
+	const struct Slice* upgrade = get_header(&req->headers, HeaderUpgrade);
+	const struct Slice* length = get_header(&req->headers,
+	                                        HeaderContentLength);
+
+	/* Requests with bodies aren't upgraded, since the body would have to be
+	 * read before switching protocols
+	 */
+	return req->method == Get && upgrade != NULL &&
+	       slice_contains(*upgrade, "h2c") &&
+	       get_header(&req->headers, HeaderHttp2Settings) != NULL &&
+	       get_header(&req->headers, HeaderTransferEncoding) == NULL &&
+	       (length == NULL || slice_eq_nocase(*length, "0"));
+}
+
+static void h2_put_u32(uint8_t* out, uint32_t value) {
+	out[0] = (uint8_t) (value >> 24);
+	out[1] = (uint8_t) (value >> 16);
+	out[2] = (uint8_t) (value >> 8);
+	out[3] = (uint8_t) value;
+}
+
+static uint32_t h2_get_u32(const uint8_t* in) {
+	return ((uint32_t) in[0] << 24) | ((uint32_t) in[1] << 16) |
+	       ((uint32_t) in[2] << 8) | (uint32_t) in[3];
+}
+
+/* Write a frame header into `out` */
+static void h2_frame_header(uint8_t* out, uint32_t len, uint8_t type,
+                            uint8_t flags, uint32_t stream) {
+	out[0] = (uint8_t) (len >> 16);
+	out[1] = (uint8_t) (len >> 8);
+	out[2] = (uint8_t) len;
+	out[3] = type;
+	out[4] = flags;
+	h2_put_u32(out + 5, stream & H2_MAX_WINDOW);
+}
+
+/* Send a frame with the payload `payload` of `len` bytes. Returns false if
+ * sending failed, in which case the connection is closed.
+ */
+static bool h2_send_frame(struct Http2Connection* conn, uint8_t type,
+                          uint8_t flags, uint32_t stream,
+                          const uint8_t* payload, size_t len) {
+	uint8_t frame[SERV_H2_FRAME_HEADER_LEN + 512];
+	h2_frame_header(frame, (uint32_t) len, type, flags, stream);
+
+	/* Small frames are sent at once, larger ones after their header */
+	bool sent;
+	if (len <= sizeof(frame) - SERV_H2_FRAME_HEADER_LEN) {
+		memcpy(frame + SERV_H2_FRAME_HEADER_LEN, payload, len);
+		sent = send_all(conn->sock, (const char*) frame,
+		                SERV_H2_FRAME_HEADER_LEN + len);
+	} else {
+		sent = send_all(conn->sock, (const char*) frame,
+		                SERV_H2_FRAME_HEADER_LEN) &&
+		       send_all(conn->sock, (const char*) payload, len);
+	}
+
+	if (!sent) {
+		conn->closing = true;
+		return false;
+	}
+
+	return true;
+}
+
+static bool h2_send_rst_stream(struct Http2Connection* conn, uint32_t stream,
+                               uint32_t error_code) {
+	uint8_t payload[4];
+	h2_put_u32(payload, error_code);
+	return h2_send_frame(conn, H2_RST_STREAM, 0, stream, payload, 4);
+}
+
+static bool h2_send_window_update(struct Http2Connection* conn,
+                                  uint32_t stream, uint32_t increment) {
+	uint8_t payload[4];
+	h2_put_u32(payload, increment);
+	return h2_send_frame(conn, H2_WINDOW_UPDATE, 0, stream, payload, 4);
+}
+
+/* Send a GOAWAY frame and close the connection after it */
+static void h2_send_goaway(struct Http2Connection* conn, uint32_t error_code) {
+	if (error_code != H2_NO_ERROR) {
+		char buf[64];
+		sprintf(buf, "Closing HTTP/2 connection with error %lu",
+		        (unsigned long) error_code);
+		warn(buf);
+	}
+
+	uint8_t payload[8];
+	h2_put_u32(payload, conn->last_stream_id);
+	h2_put_u32(payload + 4, error_code);
+	h2_send_frame(conn, H2_GOAWAY, 0, 0, payload, 8);
+	conn->closing = true;
+}
+
+/* Close the stream at index `i`, closing its file */
+static void h2_remove_stream(struct Http2Connection* conn, size_t i) {
+	if (conn->streams[i].file != NULL) {
+		fclose(conn->streams[i].file);
+	}
+
+	conn->num_streams--;
+	conn->streams[i] = conn->streams[conn->num_streams];
+	if (conn->next_stream >= conn->num_streams) {
+		conn->next_stream = 0;
+	}
+}
+
+static struct Http2Stream* h2_find_stream(struct Http2Connection* conn,
+                                          uint32_t id) {
+	size_t i;
+	for (i = 0; i < conn->num_streams; i++) {
+		if (conn->streams[i].id == id) {
+			return &conn->streams[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* Apply the settings in `payload` (of `len` bytes, a multiple of 6) sent by
+ * the peer. Returns false if a setting is invalid.
+ */
+static bool h2_apply_settings(struct Http2Connection* conn,
+                              const uint8_t* payload, size_t len) {
+	size_t i;
+	for (i = 0; i + 6 <= len; i += 6) {
+		uint16_t id = (uint16_t) ((payload[i] << 8) | payload[i + 1]);
+		uint32_t value = h2_get_u32(payload + i + 2);
+
+		if (id == H2_SETTINGS_INITIAL_WINDOW_SIZE) {
+			if (value > H2_MAX_WINDOW) {
+				h2_send_goaway(conn, H2_FLOW_CONTROL_ERROR);
+				return false;
+			}
+
+			/* The change applies to the windows of all open streams */
+			int64_t delta = (int64_t) value - conn->initial_window;
+			size_t j;
+			for (j = 0; j < conn->num_streams; j++) {
+				conn->streams[j].window += delta;
+			}
+			conn->initial_window = value;
+		} else if (id == H2_SETTINGS_MAX_FRAME_SIZE) {
+			if (value < 16384 || value > 16777215) {
+				h2_send_goaway(conn, H2_PROTOCOL_ERROR);
+				return false;
+			}
+			conn->max_frame_size = value;
+		}
+
+		/* The header table size only matters for an encoder with a dynamic
+		 * table, and other settings don't apply to servers
+		 */
+	}
+
+	return true;
+}
+
+/* Send the response headers `block` of `len` bytes on `stream` */
+static bool h2_send_headers(struct Http2Connection* conn, uint32_t stream,
+                            const uint8_t* block, size_t len,
+                            bool end_stream) {
+	uint8_t flags = (uint8_t) (H2_FLAG_END_HEADERS |
+	                           (end_stream ? H2_FLAG_END_STREAM : 0));
+	bool sent = h2_send_frame(conn, H2_HEADERS, flags, stream, block, len);
+	if (sent) {
+		trace_phase(TraceHeadersSent);
+	}
+	if (sent && end_stream) {
+		trace_phase(TraceLastByte);
+	}
+
+	return sent;
+}
+
+/* Respond on `stream` with an empty response with the status `status` and
+ * the header `name` set to `value` (if `name` isn't NULL)
+ */
+static uint16_t h2_send_status(struct Http2Connection* conn, uint32_t stream,
+                               uint16_t status, const char* name,
+                               const char* value) {
+	uint8_t block[256];
+	size_t len = hpack_encode_status(status, block);
+	len += hpack_encode_field("content-length", "0", 1, block + len);
+	if (name != NULL) {
+		len += hpack_encode_field(name, value, strlen(value), block + len);
+	}
+
+	h2_send_headers(conn, stream, block, len, true);
+	return status;
+}
+
+/* Start sending `size` bytes of `data` (or of `file` if `data` is NULL) on
+ * `stream`
+ */
+static void h2_add_stream(struct Http2Connection* conn, uint32_t stream,
+                          FILE* file, const uint8_t* data, uint64_t size) {
+	struct Http2Stream* s = &conn->streams[conn->num_streams];
+	s->id = stream;
+	s->window = conn->initial_window;
+	s->file = file;
+	s->data = data;
+	s->offset = 0;
+	s->remaining = size;
+	conn->num_streams++;
+}
+
+/* Respond to the request `req` for the file at `path` of an asset bundle
+ * route from memory. Returns the HTTP status code.
+ */
+static uint16_t h2_respond_bundle(struct Http2Connection* conn,
+                                  uint32_t stream, struct Request* req,
+                                  struct Path path, const struct Route* route) {
+	const struct BundleFile* file = find_bundle_response(route, path);
+	if (file == NULL) {
+		return h2_send_status(conn, stream, 404, NULL, NULL);
+	}
+	trace_phase(TraceResolved);
+
+	const struct Slice* if_none_match = get_header(&req->headers,
+	                                               HeaderIfNoneMatch);
+	if (if_none_match != NULL && (slice_contains(*if_none_match, file->etag) ||
+	                              slice_eq_nocase(*if_none_match, "*"))) {
+		uint8_t block[128];
+		size_t len = hpack_encode_status(304, block);
+		len += hpack_encode_field("etag", file->etag, strlen(file->etag),
+		                          block + len);
+		h2_send_headers(conn, stream, block, len, true);
+		return 304;
+	}
+
+	uint8_t* block = malloc(256 + strlen(file->mime_type));
+	char num[32];
+	size_t len = hpack_encode_status(200, block);
+	sprintf(num, "%lu", (unsigned long) file->size);
+	len += hpack_encode_field("content-length", num, strlen(num), block + len);
+	len += hpack_encode_field("content-type", file->mime_type,
+	                          strlen(file->mime_type), block + len);
+	len += hpack_encode_field("etag", file->etag, strlen(file->etag),
+	                          block + len);
+
+	bool end_stream = req->method == Head || file->size == 0;
+	bool sent = h2_send_headers(conn, stream, block, len, end_stream);
+	free(block);
+
+	if (sent && !end_stream) {
+		h2_add_stream(conn, stream, NULL, file->response + file->head_len,
+		              file->size);
+	}
+
+	return 200;
+}
+
+/* Respond to the request `req` on `stream`. Files are opened here and sent
+ * later in DATA frames. Returns the HTTP status code.
+ */
+static uint16_t h2_respond(struct Http2Connection* conn, uint32_t stream,
+                           struct Request* req) {
+	const struct Config* config = conn->config;
+
+	size_t depth;
+	const struct Route* route = find_route(config->router, req->path, &depth);
+	if (route == NULL) {
+		return h2_send_status(conn, stream, 404, NULL, NULL);
+	}
+
+	if (!(route->methods & METHOD_BIT(req->method))) {
+		char allow[64] = "";
+		enum Method method;
+		for (method = Get; method < Other; method++) {
+			if (route->methods & METHOD_BIT(method)) {
+				sprintf(allow + strlen(allow), "%s%s",
+				        allow[0] == '\0' ? "" : ", ", method_to_str(method));
+			}
+		}
+		return h2_send_status(conn, stream, 405, "allow", allow);
+	}
+
+	struct Path path = req->path;
+	path.components += depth;
+	path.num_components -= depth;
+
+	if (route->handler == handle_bundle) {
+		return h2_respond_bundle(conn, stream, req, path, route);
+	}
+
+	/* Uploads and proxying read from and write to the socket directly, so
+	 * they only work with HTTP/1.1
+	 */
+	if (route->handler != handle_files ||
+	    (req->method != Get && req->method != Head)) {
+		return h2_send_status(conn, stream, 501, NULL, NULL);
+	}
+
+	struct FileResponse response;
+	uint16_t status = open_file_response(req, path, route, &response);
+	if (status != 200) {
+		return h2_send_status(conn, stream, status, NULL, NULL);
+	}
+	trace_phase(TraceResolved);
+
+	uint8_t* block = malloc(256 + strlen(response.mime_type));
+	char num[32];
+	size_t len = hpack_encode_status(200, block);
+
+	sprintf(num, "%lu", (unsigned long) response.size);
+	len += hpack_encode_field("content-length", num, strlen(num),
+	                          block + len);
+	len += hpack_encode_field("content-type", response.mime_type,
+	                          strlen(response.mime_type), block + len);
+	if (response.gzipped) {
+		len += hpack_encode_field("content-encoding", "gzip", 4, block + len);
+	}
+	if (route->gzip) {
+		len += hpack_encode_field("vary", "accept-encoding", 15, block + len);
+	}
+	if (route->max_age >= 0) {
+		sprintf(num, "max-age=%ld", (long) route->max_age);
+		len += hpack_encode_field("cache-control", num, strlen(num),
+		                          block + len);
+	}
+
+	/* HEAD requests get the headers of the file without its contents */
+	bool end_stream = req->method == Head || response.size == 0;
+	bool sent = h2_send_headers(conn, stream, block, len, end_stream);
+	free(block);
+
+	if (!sent || end_stream) {
+		fclose(response.file);
+		return 200;
+	}
+
+	h2_add_stream(conn, stream, response.file, NULL, response.size);
+	return 200;
+}
+
+/* Handle the complete header block of a request on `stream`, whose
+ * HEADERS frame may have ended the stream (`end_stream`)
+ */
+static void h2_handle_request(struct Http2Connection* conn, uint32_t stream,
+                              bool end_stream) {
+	struct Headers headers;
+	bool too_large = false;
+	memset(&headers, 0, sizeof(headers));
+
+	/* The table updates in the dropped part of a truncated block are
+	 * missing, so the dynamic table can't be kept in sync
+	 */
+	if (conn->header_too_large) {
+		conn->header_block_len = 0;
+		conn->header_stream = 0;
+		conn->header_too_large = false;
+		h2_send_goaway(conn, H2_COMPRESSION_ERROR);
+		return;
+	}
+
+	bool decoded = hpack_decode(&conn->decoder, conn->header_block,
+	                            conn->header_block_len, conn->arena,
+	                            sizeof(conn->arena), &headers, &too_large);
+	conn->header_block_len = 0;
+	conn->header_stream = 0;
+
+	if (!decoded && !too_large) {
+		h2_send_goaway(conn, H2_COMPRESSION_ERROR);
+		return;
+	}
+
+	if (!decoded) {
+		h2_send_status(conn, stream, 431, NULL, NULL);
+	} else if (conn->num_streams >= SERV_H2_MAX_STREAMS) {
+		h2_send_rst_stream(conn, stream, H2_REFUSED_STREAM);
+		return;
+	} else {
+		struct Request req;
+		memset(&req, 0, sizeof(req));
+		char* method = NULL;
+		char* path = NULL;
+
+		size_t i;
+		for (i = 0; i < headers.num; i++) {
+			struct Header* header = &headers.list[i];
+			if (slice_eq_nocase(header->name, ":method")) {
+				method = (char*) header->value.ptr;
+			} else if (slice_eq_nocase(header->name, ":path")) {
+				path = (char*) header->value.ptr;
+				req.target = header->value;
+			}
+		}
+
+		if (method == NULL || path == NULL || path[0] != '/') {
+			h2_send_rst_stream(conn, stream, H2_PROTOCOL_ERROR);
+			return;
+		}
+
+		req.method = method_from_str(method);
+		req.path = parse_path(path);
+		req.headers = headers;
+
+		char buf[64 + SERV_PATH_MAX_LEN];
+		sprintf(buf, "HTTP/2 %s request for \"%.*s\" on stream %lu",
+		        method, (int) min(req.target.len, SERV_PATH_MAX_LEN),
+		        req.target.ptr, (unsigned long) stream);
+		debug(buf);
+
+		const struct RateLimit* limit = conn->config->rate_limit;
+		if (limit != NULL && !rate_limit_request(limit, conn->client)) {
+			debug("Rejecting a request over the rate limit");
+			h2_send_status(conn, stream, 429, "retry-after", "1");
+		} else {
+			trace_phase(TraceParsed);
+			alloc_count_request();
+			h2_respond(conn, stream, &req);
+		}
+		free_path(req.path);
+	}
+
+	/* The request body isn't needed, so the client can stop sending it */
+	if (!end_stream && !conn->closing) {
+		h2_send_rst_stream(conn, stream, H2_NO_ERROR);
+	}
+}
+
+/* Add a header block fragment of `len` bytes to the current header block */
+static void h2_add_header_block(struct Http2Connection* conn,
+                                const uint8_t* fragment, size_t len) {
+	if (conn->header_block_len + len > sizeof(conn->header_block)) {
+		/* The rest of the block is dropped, which is a connection error
+		 * once the block is complete (see `h2_handle_request`)
+		 */
+		conn->header_too_large = true;
+		len = sizeof(conn->header_block) - conn->header_block_len;
+	}
+
+	memcpy(conn->header_block + conn->header_block_len, fragment, len);
+	conn->header_block_len += len;
+}
+
+/* Handle the header block of `stream` after its last fragment */
+static void h2_end_header_block(struct Http2Connection* conn,
+                                uint32_t stream) {
+	if (!conn->header_trailers) {
+		h2_handle_request(conn, stream, conn->header_end_stream);
+		return;
+	}
+
+	/* Trailers are only decoded to keep the dynamic table in sync */
+	struct Headers headers;
+	bool too_large;
+	if (conn->header_too_large) {
+		h2_send_goaway(conn, H2_COMPRESSION_ERROR);
+	} else if (!hpack_decode(&conn->decoder, conn->header_block,
+	                         conn->header_block_len, conn->arena,
+	                         sizeof(conn->arena), &headers, &too_large) &&
+	           !too_large) {
+		h2_send_goaway(conn, H2_COMPRESSION_ERROR);
+	}
+	conn->header_block_len = 0;
+	conn->header_stream = 0;
+	conn->header_too_large = false;
+}
+
+/* Process the frame at the start of the unprocessed input */
+static void h2_process_frame(struct Http2Connection* conn) {
+	const uint8_t* header = conn->in + conn->in_start;
+	const uint8_t* payload = header + SERV_H2_FRAME_HEADER_LEN;
+	uint32_t len = ((uint32_t) header[0] << 16) | ((uint32_t) header[1] << 8) |
+	               (uint32_t) header[2];
+	uint8_t type = header[3];
+	uint8_t flags = header[4];
+	uint32_t stream = h2_get_u32(header + 5) & H2_MAX_WINDOW;
+
+	/* A header block must not be interrupted by other frames */
+	if (conn->header_stream != 0 &&
+	    (type != H2_CONTINUATION || stream != conn->header_stream)) {
+		h2_send_goaway(conn, H2_PROTOCOL_ERROR);
+		return;
+	}
+
+	switch (type) {
+		case H2_DATA:
+			if (stream == 0) {
+				h2_send_goaway(conn, H2_PROTOCOL_ERROR);
+				return;
+			}
+
+			/* Request bodies are discarded, so the whole window is given
+			 * back right away
+			 */
+			if (len > 0) {
+				h2_send_window_update(conn, 0, len);
+			}
+			break;
+		case H2_HEADERS: {
+			if (stream == 0 || stream % 2 == 0) {
+				h2_send_goaway(conn, H2_PROTOCOL_ERROR);
+				return;
+			}
+
+			/* Trailers of a request that was already answered */
+			bool trailers = stream <= conn->last_stream_id;
+
+			size_t start = 0;
+			size_t end = len;
+			if (flags & H2_FLAG_PADDED) {
+				if (len < 1 || payload[0] >= len) {
+					h2_send_goaway(conn, H2_PROTOCOL_ERROR);
+					return;
+				}
+				start = 1;
+				end = len - payload[0];
+			}
+			if (flags & H2_FLAG_PRIORITY) {
+				start += 5;
+			}
+			if (start > end) {
+				h2_send_goaway(conn, H2_PROTOCOL_ERROR);
+				return;
+			}
+
+			if (!trailers) {
+				conn->last_stream_id = stream;
+			}
+			h2_add_header_block(conn, payload + start, end - start);
+			conn->header_end_stream = (flags & H2_FLAG_END_STREAM) != 0;
+			conn->header_trailers = trailers;
+
+			if (flags & H2_FLAG_END_HEADERS) {
+				h2_end_header_block(conn, stream);
+			} else {
+				conn->header_stream = stream;
+			}
+			break;
+		}
+		case H2_CONTINUATION:
+			if (conn->header_stream == 0) {
+				h2_send_goaway(conn, H2_PROTOCOL_ERROR);
+				return;
+			}
+
+			h2_add_header_block(conn, payload, len);
+			if (flags & H2_FLAG_END_HEADERS) {
+				h2_end_header_block(conn, stream);
+			}
+			break;
+		case H2_RST_STREAM: {
+			if (stream == 0 || len != 4) {
+				h2_send_goaway(conn, H2_PROTOCOL_ERROR);
+				return;
+			}
+
+			size_t i;
+			for (i = 0; i < conn->num_streams; i++) {
+				if (conn->streams[i].id == stream) {
+					h2_remove_stream(conn, i);
+					break;
+				}
+			}
+			break;
+		}
+		case H2_SETTINGS:
+			if (stream != 0 || len % 6 != 0 ||
+			    ((flags & H2_FLAG_ACK) && len != 0)) {
+				h2_send_goaway(conn, H2_FRAME_SIZE_ERROR);
+				return;
+			}
+
+			if (!(flags & H2_FLAG_ACK) &&
+			    h2_apply_settings(conn, payload, len)) {
+				h2_send_frame(conn, H2_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+			}
+			break;
+		case H2_PUSH_PROMISE:
+			/* Clients can't push */
+			h2_send_goaway(conn, H2_PROTOCOL_ERROR);
+			return;
+		case H2_PING:
+			if (stream != 0 || len != 8) {
+				h2_send_goaway(conn, H2_FRAME_SIZE_ERROR);
+				return;
+			}
+
+			if (!(flags & H2_FLAG_ACK)) {
+				h2_send_frame(conn, H2_PING, H2_FLAG_ACK, 0, payload, 8);
+			}
+			break;
+		case H2_GOAWAY:
+			conn->closing = true;
+			break;
+		case H2_WINDOW_UPDATE: {
+			if (len != 4) {
+				h2_send_goaway(conn, H2_FRAME_SIZE_ERROR);
+				return;
+			}
+
+			uint32_t increment = h2_get_u32(payload) & H2_MAX_WINDOW;
+			if (increment == 0) {
+				h2_send_goaway(conn, H2_PROTOCOL_ERROR);
+				return;
+			}
+
+			if (stream == 0) {
+				conn->window += increment;
+				if (conn->window > H2_MAX_WINDOW) {
+					h2_send_goaway(conn, H2_FLOW_CONTROL_ERROR);
+				}
+			} else {
+				struct Http2Stream* s = h2_find_stream(conn, stream);
+				if (s != NULL) {
+					s->window += increment;
+					if (s->window > H2_MAX_WINDOW) {
+						h2_send_rst_stream(conn, stream,
+						                   H2_FLOW_CONTROL_ERROR);
+						h2_remove_stream(conn, (size_t) (s - conn->streams));
+					}
+				}
+			}
+			break;
+		}
+		default:
+			/* PRIORITY frames and unknown frame types are ignored */
+			break;
+	}
+}
+
+/* Process all complete frames that were received */
+static void h2_process_frames(struct Http2Connection* conn) {
+	while (!conn->closing &&
+	       conn->in_len - conn->in_start >= SERV_H2_FRAME_HEADER_LEN) {
+		const uint8_t* header = conn->in + conn->in_start;
+		uint32_t len = ((uint32_t) header[0] << 16) |
+		               ((uint32_t) header[1] << 8) | (uint32_t) header[2];
+
+		if (len > SERV_H2_MAX_FRAME_SIZE) {
+			h2_send_goaway(conn, H2_FRAME_SIZE_ERROR);
+			return;
+		}
+
+		if (conn->in_len - conn->in_start < SERV_H2_FRAME_HEADER_LEN + len) {
+			break;
+		}
+
+		h2_process_frame(conn);
+		conn->in_start += SERV_H2_FRAME_HEADER_LEN + len;
+	}
+
+	/* Move the incomplete frame to the start of the buffer */
+	memmove(conn->in, conn->in + conn->in_start,
+	        conn->in_len - conn->in_start);
+	conn->in_len -= conn->in_start;
+	conn->in_start = 0;
+}
+
+/* Receive more data from the peer, waiting for it (up to the idle timeout)
+ * only if `wait` is true. Returns false if the connection was closed or timed
+ * out.
+ */
+static bool h2_receive(struct Http2Connection* conn, bool wait) {
+	struct pollfd pfd;
+	pfd.fd = conn->sock;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	int32_t timeout = 0;
+	if (wait && conn->config->workers == NULL && conn->num_streams == 0) {
+		timeout = SERV_H2_SERIAL_IDLE_MS;
+	} else if (wait) {
+		timeout = SERV_H2_IDLE_SECS * 1000;
+	}
+
+	int32_t ready = poll(&pfd, 1, timeout);
+	if (ready == 0) {
+		return !wait;
+	} else if (ready < 0) {
+		return false;
+	}
+
+	int32_t res = recv(conn->sock, (char*) conn->in + conn->in_len,
+	                   (int) (sizeof(conn->in) - conn->in_len), 0);
+	if (res <= 0) {
+		return false;
+	}
+
+	conn->in_len += res;
+	return true;
+}
+
+/* Whether any stream has data to send and the windows to send it */
+static bool h2_can_send(const struct Http2Connection* conn) {
+	if (conn->window <= 0) {
+		return false;
+	}
+
+	size_t i;
+	for (i = 0; i < conn->num_streams; i++) {
+		if (conn->streams[i].window > 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* Send one DATA frame for each stream that can send, starting with a
+ * different stream each round, so that all streams make progress
+ */
+static void h2_send_data(struct Http2Connection* conn) {
+	size_t count = conn->num_streams;
+	size_t i = conn->next_stream;
+	conn->next_stream = count > 0 ? (conn->next_stream + 1) % count : 0;
+
+	while (count > 0 && conn->window > 0 && !conn->closing) {
+		count--;
+		if (i >= conn->num_streams) {
+			i = 0;
+		}
+
+		struct Http2Stream* s = &conn->streams[i];
+		uint64_t len = min(s->remaining, conn->max_frame_size);
+		if (s->window <= 0) {
+			i++;
+			continue;
+		}
+		len = min(len, (uint64_t) s->window);
+		len = min(len, (uint64_t) conn->window);
+
+		bool end = len == s->remaining;
+		uint8_t header[SERV_H2_FRAME_HEADER_LEN];
+		h2_frame_header(header, (uint32_t) len, H2_DATA,
+		                end ? H2_FLAG_END_STREAM : 0, s->id);
+
+		/* The frame header and its data go out in the same segment */
+		int32_t flags = 0;
+		#ifdef MSG_MORE
+		flags = MSG_MORE;
+		#endif
+		#ifdef MSG_NOSIGNAL
+		flags |= MSG_NOSIGNAL;
+		#endif
+		bool sent = send(conn->sock, (const char*) header, sizeof(header),
+		                 flags) == sizeof(header);
+		if (sent && s->data != NULL) {
+			sent = send_all(conn->sock, (const char*) s->data + s->offset,
+			                (size_t) len);
+		} else if (sent) {
+			sent = send_file(conn->sock, s->file, s->offset, len);
+		}
+		if (!sent) {
+			warn("Couldn't send data");
+			conn->closing = true;
+			return;
+		}
+
+		s->offset += len;
+		s->remaining -= len;
+		s->window -= (int64_t) len;
+		conn->window -= (int64_t) len;
+
+		if (end) {
+			trace_phase(TraceLastByte);
+
+			/* The last stream is moved here, so it's next */
+			h2_remove_stream(conn, i);
+		} else {
+			i++;
+		}
+	}
+}
+
+/* Decode the base64url-encoded `HTTP2-Settings` header into `out`, returning
+ * the number of bytes decoded
+ */
+static size_t h2_decode_settings_header(struct Slice value, uint8_t* out,
+                                        size_t cap) {
+	uint32_t bits = 0;
+	size_t num_bits = 0;
+	size_t len = 0;
+
+	size_t i;
+	for (i = 0; i < value.len && len < cap; i++) {
+		char c = value.ptr[i];
+		uint32_t digit;
+		if (c >= 'A' && c <= 'Z') {
+			digit = c - 'A';
+		} else if (c >= 'a' && c <= 'z') {
+			digit = c - 'a' + 26;
+		} else if (c >= '0' && c <= '9') {
+			digit = c - '0' + 52;
+		} else if (c == '-' || c == '+') {
+			digit = 62;
+		} else if (c == '_' || c == '/') {
+			digit = 63;
+		} else {
+			break;
+		}
+
+		bits = (bits << 6) | digit;
+		num_bits += 6;
+		if (num_bits >= 8) {
+			num_bits -= 8;
+			out[len] = (uint8_t) (bits >> num_bits);
+			len++;
+		}
+	}
+
+	return len;
+}
+
+void serve_http2(Socket sock, uint64_t client, const char* received,
+                 size_t received_len, struct Request* upgrade,
+                 const struct Config* config) {
+	struct Http2Connection* conn = calloc(1, sizeof(struct Http2Connection));
+	conn->sock = sock;
+	conn->client = client;
+	conn->config = config;
+	conn->max_frame_size = 16384;
+	conn->initial_window = SERV_H2_INITIAL_WINDOW;
+	conn->window = SERV_H2_INITIAL_WINDOW;
+	hpack_decoder_init(&conn->decoder);
+
+	if (upgrade != NULL) {
+		debug("Upgrading connection to HTTP/2");
+
+		uint8_t settings[256];
+		size_t settings_len = h2_decode_settings_header(
+			*get_header(&upgrade->headers, HeaderHttp2Settings), settings,
+			sizeof(settings));
+		h2_apply_settings(conn, settings, settings_len - settings_len % 6);
+
+		const char* response = "HTTP/1.1 101 Switching Protocols\r\n"
+		                       "Connection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+		if (conn->closing || !send_all(sock, response, strlen(response))) {
+			free_hpack_decoder(&conn->decoder);
+			free(conn);
+			return;
+		}
+	} else {
+		debug("Serving HTTP/2 connection");
+	}
+
+	/* The server's connection preface */
+	uint8_t settings[6];
+	settings[0] = 0;
+	settings[1] = H2_SETTINGS_MAX_CONCURRENT_STREAMS;
+	h2_put_u32(settings + 2, SERV_H2_MAX_STREAMS);
+	h2_send_frame(conn, H2_SETTINGS, 0, 0, settings, sizeof(settings));
+
+	/* Wait for the rest of the client's connection preface */
+	if (received != NULL) {
+		conn->in_len = min(received_len, sizeof(conn->in));
+		memcpy(conn->in, received, conn->in_len);
+	}
+	while (!conn->closing && conn->in_len < SERV_H2_PREFACE_LEN) {
+		if (!h2_receive(conn, true)) {
+			conn->closing = true;
+		}
+	}
+
+	if (!conn->closing && memcmp(conn->in, SERV_H2_PREFACE,
+	                             SERV_H2_PREFACE_LEN) != 0) {
+		h2_send_goaway(conn, H2_PROTOCOL_ERROR);
+	}
+	conn->in_start = SERV_H2_PREFACE_LEN;
+
+	/* The upgraded request is stream 1, which the client already closed */
+	if (upgrade != NULL && !conn->closing) {
+		conn->last_stream_id = 1;
+		h2_respond(conn, 1, upgrade);
+	}
+
+	/* Process frames, sending data while there is some and the windows
+	 * allow it, and only wait for the peer otherwise
+	 */
+	while (!conn->closing) {
+		h2_process_frames(conn);
+		if (conn->closing) {
+			break;
+		}
+
+		bool can_send = h2_can_send(conn);
+		if (can_send) {
+			h2_send_data(conn);
+		}
+
+		if (!conn->closing && !h2_receive(conn, !can_send)) {
+			if (conn->num_streams == 0 && conn->in_len == 0) {
+				/* Idle or closed by the peer */
+				h2_send_goaway(conn, H2_NO_ERROR);
+			}
+			break;
+		}
+	}
+
+	while (conn->num_streams > 0) {
+		h2_remove_stream(conn, 0);
+	}
+	free_hpack_decoder(&conn->decoder);
+	free(conn);
+}
@@ -0,0 +1,68 @@
+/* HTTP/2 over cleartext TCP (h2c, RFC 9113), either with prior knowledge
+ * (the client starts with the connection preface) or upgraded from an
+ * HTTP/1.1 request with `Upgrade: h2c`. Requests on any number of concurrent
+ * streams are routed like HTTP/1.1 requests, and files are sent in DATA
+ * frames (with `sendfile`) interleaved round-robin between the streams, as
+ * far as the peer's flow control windows allow. Only `GET` requests for
+ * file-serving routes are supported, other requests get a 501 response.
+ */
+
+#ifndef C_HTTP_SERVER_HTTP2_H
+#define C_HTTP_SERVER_HTTP2_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "http.h"
+#include "socket.h"
+
+/* The client connection preface */
+#define SERV_H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define SERV_H2_PREFACE_LEN 24
+
+/* The length of a frame header */
+#define SERV_H2_FRAME_HEADER_LEN 9
+
+/* The maximum size of a received frame's payload (the default, which isn't
+ * changed)
+ */
+#define SERV_H2_MAX_FRAME_SIZE 16384
+
+/* The maximum number of concurrent streams per connection */
+#define SERV_H2_MAX_STREAMS 100
+
+/* The initial flow control window size of connections and streams */
+#define SERV_H2_INITIAL_WINDOW 65535
+
+/* How long an idle connection is kept open, in seconds */
+#define SERV_H2_IDLE_SECS 10
+
+/* How long a connection without open streams is kept open when it's served
+ * by the accept loop (without `-w`), which can't accept other connections in
+ * the meantime, in milliseconds
+ */
+#define SERV_H2_SERIAL_IDLE_MS 200
+
+/* Check whether the received data starts with the (first part of the) HTTP/2
+ * connection preface, which is read as an HTTP/1.1 request head
+ */
+bool is_http2_preface(const char* data, size_t len);
+
+/* Check whether the request asks for an upgrade to HTTP/2 (`Upgrade: h2c`
+ * with an `HTTP2-Settings` header) that can be accepted
+ */
+bool is_http2_upgrade(const struct Request* req);
+
+/* Serve an HTTP/2 connection until it is closed. `received` are the bytes
+ * already received on the connection: either the start of the connection
+ * preface, or with an upgrade the bytes following the head of the request
+ * `upgrade` (which is answered on stream 1), otherwise NULL. `client` is the
+ * client's rate limiting key. The connection is not closed.
+ */
+void serve_http2(Socket sock, uint64_t client, const char* received,
+                 size_t received_len, struct Request* upgrade,
+                 const struct Config* config);
+
+#endif
@@ -1,11 +1,24 @@
 /* Implementation of `log.h`, see that file for documentation and types */
 
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <signal.h>
+#endif
+
 #include "log.h"
 #include "misc.h"
 
@@ -25,16 +38,64 @@ const char* level_to_str(enum Level level) {
 	}
 }
 
+bool parse_log_level(const char* str, enum Level* level) {
+	static const char* names[] = {"error", "warn", "info", "debug", "trace"};
+	int32_t i;
+	for (i = Error; i <= Trace; i++) {
+		if (strcmp(str, names[i]) == 0) {
+			*level = (enum Level) i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* The least severe level printed, changed on a reload (see `reload.h`) */
+static uint32_t log_level = Trace;
+
+void set_log_level(enum Level level) {
+	__atomic_store_n(&log_level, (uint32_t) level, __ATOMIC_RELAXED);
+}
+
+enum Level get_log_level(void) {
+	return (enum Level) __atomic_load_n(&log_level, __ATOMIC_RELAXED);
+}
+
 bool rfc3339_timestamp(char* buf, size_t len) {
 	time_t t = time(NULL);
+	#ifdef _WIN32
 	struct tm* utc_time = gmtime(&t);
+	#else
+	/* Messages are logged from several threads */
+	struct tm utc_time_buf;
+	struct tm* utc_time = gmtime_r(&t, &utc_time_buf);
+	#endif
 	size_t res = strftime(buf, len, "%Y-%m-%dT%H:%M:%SZ", utc_time);
 	return res != 0;
 }
 
+uint64_t monotonic_us(void) {
+	#ifdef _WIN32
+	LARGE_INTEGER counter;
+	LARGE_INTEGER frequency;
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&frequency);
+	return (uint64_t) (counter.QuadPart / (frequency.QuadPart / 1000000));
+	#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+	#endif
+}
+
 bool log_msg(enum Level level, const char* message) {
 	char timestamp[21] = {0};
 	int32_t res;
+	if ((uint32_t) level > __atomic_load_n(&log_level, __ATOMIC_RELAXED)) {
+		return true;
+	}
+
 	if (!rfc3339_timestamp(timestamp, sizeof(timestamp))) {
 		return false;
 	}
@@ -76,3 +137,40 @@ void trace(const char* message) {
 		exit(SERV_ERR_LOG);
 	}
 }
+
+#ifndef _WIN32
+
+/* Whether the statistics were requested (`SIGUSR1`) */
+static volatile sig_atomic_t stats_flag = 0;
+
+static void stats_signal_handler(int signal) {
+	(void) signal;
+	stats_flag = 1;
+}
+
+void stats_signal_init(void) {
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = stats_signal_handler;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGUSR1, &action, NULL)) {
+		warn("Could not install the statistics signal handler");
+	}
+}
+
+bool stats_requested(void) {
+	bool requested = stats_flag != 0;
+	stats_flag = 0;
+	return requested;
+}
+
+#else
+
+void stats_signal_init(void) {}
+
+bool stats_requested(void) {
+	return false;
+}
+
+#endif
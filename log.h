@@ -5,6 +5,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 enum Level {
 	Error,
@@ -25,8 +26,27 @@ const char* level_to_str(enum Level level);
  */
 bool rfc3339_timestamp(char* buf, size_t len);
 
+/* Get the time in microseconds since some unspecified point, for measuring
+ * durations. Unlike the wall-clock time, this never jumps.
+ */
+uint64_t monotonic_us(void);
+
+/* Parse a log level from its name ("error", "warn", "info", "debug" or
+ * "trace"). Returns false if the name is invalid.
+ */
+bool parse_log_level(const char* str, enum Level* level);
+
+/* Only print messages of `level` and more severe levels from now on. All
+ * messages are printed by default.
+ */
+void set_log_level(enum Level level);
+
+/* The least severe level of the printed messages, see `set_log_level` */
+enum Level get_log_level(void);
+
 /* Print a null-terminated log_msg message (without newline character) to the
- * standard output, returning whether the operation was completed successfully
+ * standard output (unless its level isn't printed, see `set_log_level`),
+ * returning whether the operation was completed successfully
  */
 bool log_msg(enum Level level, const char* message);
 
@@ -45,4 +65,15 @@ void debug(const char* message);
 /* Print a trace-level null-terminated `log_msg` message to stdout */
 void trace(const char* message);
 
+/* Install the `SIGUSR1` handler requesting the statistics to be logged. The
+ * handler is installed for the whole process, but every thread the server
+ * starts (the workers, TLS relays and warm-up threads) blocks all signals
+ * while it runs, so the signal is handled by the main thread and interrupts
+ * its `poll`.
+ */
+void stats_signal_init(void);
+
+/* Check whether the statistics were requested, resetting the request */
+bool stats_requested(void);
+
 #endif
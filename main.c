@@ -3,8 +3,37 @@
  * with CMake.
  */
 
+/* Needed for `splice` and other Linux-specific functions, which have to be
+ * declared by the first included system header
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "alloc.c"
 #include "log.c"
+#include "trace.c"
+#include "record.c"
+#include "config.c"
+#include "reload.c"
+#include "scan.c"
 #include "socket.c"
+#include "tune.c"
+#include "ratelimit.c"
+#include "admission.c"
 #include "http.c"
+#include "mime.c"
+#include "upload.c"
+#include "router.c"
+#include "proxy.c"
+#include "fastcgi.c"
+#include "bundle.c"
 #include "handlers.c"
+#include "autoindex.c"
+#include "warm.c"
+#include "hpack.c"
+#include "http2.c"
+#include "tls.c"
+#include "upgrade.c"
+#include "worker.c"
 #include "server.c"
@@ -0,0 +1,156 @@
+/* Implementation of `mime.h`, see that file for documentation and types */
+
+#include "mime.h"
+
+#include <string.h>
+
+char* guess_mime_type(const char* file_ext) {
+	/* Below code generated based on data from
+	 * https://developer.mozilla.org/en-US/docs/Web/HTTP/Basics_of_HTTP/MIME_types/Common_types
+	 */
+	if (file_ext == NULL) {
+		return "application/octet-stream";
+	} else if (strcmp(file_ext, ".aac") == 0) {
+		return "audio/aac";
+	} else if (strcmp(file_ext, ".abw") == 0) {
+		return "application/x-abiword";
+	} else if (strcmp(file_ext, ".arc") == 0) {
+		return "application/x-freearc";
+	} else if (strcmp(file_ext, ".avif") == 0) {
+		return "image/avif";
+	} else if (strcmp(file_ext, ".avi") == 0) {
+		return "video/x-msvideo";
+	} else if (strcmp(file_ext, ".azw") == 0) {
+		return "application/vnd.amazon.ebook";
+	} else if (strcmp(file_ext, ".bmp") == 0) {
+		return "image/bmp";
+	} else if (strcmp(file_ext, ".bz") == 0) {
+		return "application/x-bzip";
+	} else if (strcmp(file_ext, ".bz2") == 0) {
+		return "application/x-bzip2";
+	} else if (strcmp(file_ext, ".cda") == 0) {
+		return "application/x-cdf";
+	} else if (strcmp(file_ext, ".csh") == 0) {
+		return "application/x-csh";
+	} else if (strcmp(file_ext, ".css") == 0) {
+		return "text/css";
+	} else if (strcmp(file_ext, ".csv") == 0) {
+		return "text/csv";
+	} else if (strcmp(file_ext, ".doc") == 0) {
+		return "application/msword";
+	} else if (strcmp(file_ext, ".docx") == 0) {
+		return "application/vnd.openxmlformats-officedocument.wordprocessingml.document";
+	} else if (strcmp(file_ext, ".eot") == 0) {
+		return "application/vnd.ms-fontobject";
+	} else if (strcmp(file_ext, ".epub") == 0) {
+		return "application/epub+zip";
+	} else if (strcmp(file_ext, ".gz") == 0) {
+		return "application/gzip";
+	} else if (strcmp(file_ext, ".gif") == 0) {
+		return "image/gif";
+	} else if (strcmp(file_ext, ".htm") == 0 || strcmp(file_ext, ".html") == 0) {
+		return "text/html";
+	} else if (strcmp(file_ext, ".ico") == 0) {
+		return "image/vnd.microsoft.icon";
+	} else if (strcmp(file_ext, ".ics") == 0) {
+		return "text/calendar";
+	} else if (strcmp(file_ext, ".jar") == 0) {
+		return "application/java-archive";
+	} else if (strcmp(file_ext, ".jpeg") == 0 || strcmp(file_ext, ".jpg") == 0) {
+		return "image/jpeg";
+	} else if (strcmp(file_ext, ".js") == 0 || strcmp(file_ext, ".mjs") == 0) {
+		return "text/javascript";
+	} else if (strcmp(file_ext, ".json") == 0) {
+		return "application/json";
+	} else if (strcmp(file_ext, ".jsonld") == 0) {
+		return "application/ld+json";
+	} else if (strcmp(file_ext, ".mid") == 0 || strcmp(file_ext, ".midi") == 0) {
+		return "audio/midi";
+	} else if (strcmp(file_ext, ".mp3") == 0) {
+		return "audio/mpeg";
+	} else if (strcmp(file_ext, ".mp4") == 0) {
+		return "video/mp4";
+	} else if (strcmp(file_ext, ".mpeg") == 0) {
+		return "video/mpeg";
+	} else if (strcmp(file_ext, ".mpkg") == 0) {
+		return "application/vnd.apple.installer+xml";
+	} else if (strcmp(file_ext, ".odp") == 0) {
+		return "application/vnd.oasis.opendocument.presentation";
+	} else if (strcmp(file_ext, ".ods") == 0) {
+		return "application/vnd.oasis.opendocument.spreadsheet";
+	} else if (strcmp(file_ext, ".odt") == 0) {
+		return "application/vnd.oasis.opendocument.text";
+	} else if (strcmp(file_ext, ".oga") == 0) {
+		return "audio/ogg";
+	} else if (strcmp(file_ext, ".ogv") == 0) {
+		return "video/ogg";
+	} else if (strcmp(file_ext, ".ogx") == 0) {
+		return "application/ogg";
+	} else if (strcmp(file_ext, ".opus") == 0) {
+		return "audio/opus";
+	} else if (strcmp(file_ext, ".otf") == 0) {
+		return "font/otf";
+	} else if (strcmp(file_ext, ".png") == 0) {
+		return "image/png";
+	} else if (strcmp(file_ext, ".pdf") == 0) {
+		return "application/pdf";
+	} else if (strcmp(file_ext, ".php") == 0) {
+		return "application/x-httpd-php";
+	} else if (strcmp(file_ext, ".ppt") == 0) {
+		return "application/vnd.ms-powerpoint";
+	} else if (strcmp(file_ext, ".pptx") == 0) {
+		return "application/vnd.openxmlformats-officedocument.presentationml.presentation";
+	} else if (strcmp(file_ext, ".rar") == 0) {
+		return "application/vnd.rar";
+	} else if (strcmp(file_ext, ".rtf") == 0) {
+		return "application/rtf";
+	} else if (strcmp(file_ext, ".sh") == 0) {
+		return "application/x-sh";
+	} else if (strcmp(file_ext, ".svg") == 0) {
+		return "image/svg+xml";
+	} else if (strcmp(file_ext, ".tar") == 0) {
+		return "application/x-tar";
+	} else if (strcmp(file_ext, ".tif") == 0 || strcmp(file_ext, ".tiff") == 0) {
+		return "image/tiff";
+	} else if (strcmp(file_ext, ".ts") == 0) {
+		return "video/mp2t";
+	} else if (strcmp(file_ext, ".ttf") == 0) {
+		return "font/ttf";
+	} else if (strcmp(file_ext, ".txt") == 0) {
+		return "text/plain";
+	} else if (strcmp(file_ext, ".vsd") == 0) {
+		return "application/vnd.visio";
+	} else if (strcmp(file_ext, ".wav") == 0) {
+		return "audio/wav";
+	} else if (strcmp(file_ext, ".weba") == 0) {
+		return "audio/webm";
+	} else if (strcmp(file_ext, ".webm") == 0) {
+		return "video/webm";
+	} else if (strcmp(file_ext, ".webp") == 0) {
+		return "image/webp";
+	} else if (strcmp(file_ext, ".woff") == 0) {
+		return "font/woff";
+	} else if (strcmp(file_ext, ".woff2") == 0) {
+		return "font/woff2";
+	} else if (strcmp(file_ext, ".xhtml") == 0) {
+		return "application/xhtml+xml";
+	} else if (strcmp(file_ext, ".xls") == 0) {
+		return "application/vnd.ms-excel";
+	} else if (strcmp(file_ext, ".xlsx") == 0) {
+		return "application/vnd.openxmlformats-officedocument.spreadsheetml.sheet";
+	} else if (strcmp(file_ext, ".xml") == 0) {
+		return "application/xml";
+	} else if (strcmp(file_ext, ".xul") == 0) {
+		return "application/vnd.mozilla.xul+xml";
+	} else if (strcmp(file_ext, ".zip") == 0) {
+		return "application/zip";
+	} else if (strcmp(file_ext, ".3gp") == 0) {
+		return "video/3gpp";
+	} else if (strcmp(file_ext, ".3g2") == 0) {
+		return "video/3gpp2";
+	} else if (strcmp(file_ext, ".7z") == 0) {
+		return "application/x-7z-compressed";
+	} else {
+		return "application/octet-stream";
+	}
+}
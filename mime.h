@@ -0,0 +1,12 @@
+/* Guessing the MIME type of a file from its extension. This is used both by
+ * the server and by the asset bundle generator (`bundle_gen.c`), so it
+ * doesn't depend on anything else.
+ */
+
+#ifndef C_HTTP_SERVER_MIME_H
+#define C_HTTP_SERVER_MIME_H
+
+/* Guess the mime type by the provided file extension (with '.') */
+char* guess_mime_type(const char* file_ext);
+
+#endif
@@ -15,7 +15,53 @@
 #define CLI_HELP "Simple HTTP server usage:\n\
 '-h' to show this message\n\
 '-d PATH' to serve files from the (relative) PATH (default '.')\n\
-'-p PORT' to specify the port to listen on (default 8000)\n\n\
+'-p PORT' to specify the port to listen on at localhost (default 8000)\n\
+'-l ADDR[,backlog=N][,cert=FILE,key=FILE]' to listen on ADDR ('HOST:PORT',\n\
+  '[IPV6]:PORT', ':PORT' for all interfaces or 'unix:PATH') with up to N\n\
+  pending connections, optionally with TLS, repeatable\n\
+'-u PATH' to store POST request bodies in the (relative) PATH\n\
+'-W' to allow PUT requests to store files in the data directory\n\
+'-i' to list directories without an index.html in the data directory\n\
+'-m BYTES' to set the maximum request body size (default 16 MiB)\n\
+'-x PREFIX=ADDR[,ADDR...]' to forward requests under PREFIX to upstream\n\
+  servers at ADDR ('HOST:PORT', '[IPV6]:PORT' or 'unix:PATH'), repeatable\n\
+'-f PREFIX=ADDR[,root=PATH][,conns=N]' to run the scripts under PREFIX from\n\
+  the (relative) PATH (default the data directory) on the FastCGI backend at\n\
+  ADDR with up to N (default 16) requests at once, repeatable\n\
+'-r PREFIX=PATH[,cache=SECONDS][,gzip][,index][,put]' to serve files under\n\
+  PREFIX from the (relative) PATH, optionally with a Cache-Control max-age,\n\
+  pre-compressed 'FILE.gz' files, directory listings or PUT requests,\n\
+  repeatable\n\
+'-b PREFIX' to serve the asset bundle compiled into the server under\n\
+  PREFIX, repeatable\n\
+'-L [conns=RATE][,requests=RATE][,burst=SECONDS][,close]' to limit each\n\
+  client IP (or IPv6 /64) to RATE connections or requests per second, with\n\
+  bursts of up to SECONDS worth of RATE (default 1), either responding with\n\
+  '429 Too Many Requests' or closing the connection\n\
+'-A [inflight=N][,queue=N][,delay=MS][,lag=MS][,retry=SECONDS][,pause]' to\n\
+  shed load past N requests in flight, N connections in the accept queue,\n\
+  MS milliseconds of estimated queueing delay or of average time to serve a\n\
+  connection, either with '503 Service Unavailable' (and Retry-After) or by\n\
+  pausing accepting\n\
+'-C [paths=FILE][,threads=N][,lock=MIB]' to read the served files (or the\n\
+  paths listed in FILE) into the page cache on startup with N threads\n\
+  (default 4), locking up to MIB mebibytes of them in memory\n\
+'-w N[,pin][,rxcpu]' to serve connections with N worker threads, optionally\n\
+  each pinned to a CPU, and receiving the connections that arrived on its\n\
+  CPU (or NUMA node)\n\
+'-T FILE[,sample=N]' to write the phases of 1 in N connections (default 1)\n\
+  to FILE in the Chrome trace event format\n\
+'-S PROFILE[,defer=SECONDS][,fastopen=N][,batch=N][,cork|nocork]\n\
+  [,sndbuf=BYTES][,rcvbuf=BYTES]' to tune the sockets with the 'default',\n\
+  'latency' or 'throughput' profile, overriding some of its options\n\
+'-R FILE[,sample=N]' to record 1 in N requests (default 1) to the capture\n\
+  file FILE, for replaying them with 'replay' (credential headers are\n\
+  redacted, but URLs and bodies are recorded as is)\n\
+'-c FILE' to read the data and upload directories, the maximum body size,\n\
+  the rate limits and the log level from FILE (see the README)\n\n\
+Send SIGUSR2 to restart the server (e.g. after an upgrade) without downtime,\n\
+SIGHUP to reload the file given with '-c', and SIGUSR1 to log the statistics\n\
+of the worker threads and allocations.\n\n\
 Press [ENTER] to exit.\n"
 
 /* Miscellaneous unrecoverable errors */
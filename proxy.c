@@ -0,0 +1,835 @@
+/* Implementation of `proxy.h`, see that file for documentation and types */
+
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+
+#include "proxy.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+#include "handlers.h"
+#include "log.h"
+#include "misc.h"
+
+#include "alloc.h"
+
+/* An idle keep-alive connection to an upstream */
+struct ProxyIdleConnection {
+	const struct Upstream* upstream;
+	Socket sock;
+	time_t since;
+};
+
+/* The idle upstream connections of this worker, oldest first */
+static __thread struct ProxyIdleConnection proxy_pool[SERV_PROXY_POOL_SIZE];
+static __thread size_t proxy_pool_len = 0;
+
+bool parse_proxy_route(const char* str, struct Route* route) {
+	memset(route, 0, sizeof(*route));
+	route->max_age = -1;
+
+	const char* upstreams = strchr(str, '=');
+	if (upstreams == NULL || str[0] != '/') {
+		return false;
+	}
+
+	route->prefix_str = malloc(upstreams - str + 1);
+	memcpy(route->prefix_str, str, upstreams - str);
+	route->prefix_str[upstreams - str] = '\0';
+	route->prefix = parse_route_prefix(route->prefix_str);
+	route->methods = METHODS_ALL;
+	route->handler = handle_proxy;
+
+	struct ProxyRoute* proxy = calloc(1, sizeof(struct ProxyRoute));
+	route->data = proxy;
+
+	/* Parse the comma-separated upstream addresses */
+	const char* cursor = upstreams + 1;
+	while (*cursor != '\0') {
+		size_t len = strcspn(cursor, ",");
+		if (len == 0 || proxy->num_upstreams == SERV_PROXY_MAX_UPSTREAMS) {
+			free_proxy_route(route);
+			return false;
+		}
+
+		struct Upstream* upstream = &proxy->upstreams[proxy->num_upstreams];
+		proxy->num_upstreams++;
+
+		upstream->name = malloc(len + 1);
+		memcpy(upstream->name, cursor, len);
+		upstream->name[len] = '\0';
+
+		if (!parse_socket_addr(upstream->name, false, &upstream->addr,
+		                       &upstream->addr_len)) {
+			free_proxy_route(route);
+			return false;
+		}
+
+		cursor += len;
+		if (*cursor == ',') {
+			cursor++;
+		}
+	}
+
+	if (proxy->num_upstreams == 0) {
+		free_proxy_route(route);
+		return false;
+	}
+
+	return true;
+}
+
+void free_proxy_route(struct Route* route) {
+	struct ProxyRoute* proxy = route->data;
+
+	size_t i;
+	for (i = 0; i < proxy->num_upstreams; i++) {
+		free(proxy->upstreams[i].name);
+	}
+
+	free(proxy);
+	free_route(route);
+}
+
+void close_proxy_pool(void) {
+	size_t i;
+	for (i = 0; i < proxy_pool_len; i++) {
+		close_socket(proxy_pool[i].sock);
+	}
+
+	proxy_pool_len = 0;
+}
+
+/* Remove the connection at `index` from the pool, keeping the order */
+static void proxy_pool_remove(size_t index) {
+	memmove(&proxy_pool[index], &proxy_pool[index + 1],
+	        (proxy_pool_len - index - 1) * sizeof(proxy_pool[0]));
+	proxy_pool_len--;
+}
+
+/* Take the most recently used idle connection to `upstream` from the pool.
+ * Connections which have been idle for too long or were closed by the
+ * upstream are closed and skipped.
+ */
+static bool proxy_pool_take(const struct Upstream* upstream, Socket* sock) {
+	time_t now = time(NULL);
+	size_t i = proxy_pool_len;
+
+	while (i > 0) {
+		i--;
+		if (proxy_pool[i].upstream != upstream) {
+			continue;
+		}
+
+		Socket candidate = proxy_pool[i].sock;
+		bool alive = now - proxy_pool[i].since < SERV_PROXY_IDLE_SECS;
+		proxy_pool_remove(i);
+
+		#ifndef _WIN32
+		/* An idle connection must not be readable: if it is, the upstream
+		 * either closed it or sent unexpected data
+		 */
+		char probe;
+		if (alive && recv(candidate, &probe, 1, MSG_PEEK | MSG_DONTWAIT) >= 0) {
+			alive = false;
+		}
+		#endif
+
+		if (alive) {
+			*sock = candidate;
+			return true;
+		}
+
+		close_socket(candidate);
+	}
+
+	return false;
+}
+
+/* Return a connection to `upstream` to the pool, evicting the oldest idle
+ * connection if the pool is full
+ */
+static void proxy_pool_put(const struct Upstream* upstream, Socket sock) {
+	if (proxy_pool_len == SERV_PROXY_POOL_SIZE) {
+		close_socket(proxy_pool[0].sock);
+		proxy_pool_remove(0);
+	}
+
+	proxy_pool[proxy_pool_len].upstream = upstream;
+	proxy_pool[proxy_pool_len].sock = sock;
+	proxy_pool[proxy_pool_len].since = time(NULL);
+	proxy_pool_len++;
+}
+
+/* Pick the next healthy upstream of `route` (round-robin), or the one that
+ * will become healthy the soonest if all of them are down
+ */
+static struct Upstream* proxy_pick_upstream(struct ProxyRoute* route) {
+	time_t now = time(NULL);
+	size_t next = __atomic_load_n(&route->next_upstream, __ATOMIC_RELAXED);
+	struct Upstream* soonest = NULL;
+	time_t soonest_until = 0;
+	size_t i;
+
+	for (i = 0; i < route->num_upstreams; i++) {
+		size_t index = (next + i) % route->num_upstreams;
+		struct Upstream* upstream = &route->upstreams[index];
+		time_t down_until = __atomic_load_n(&upstream->down_until,
+		                                    __ATOMIC_RELAXED);
+
+		if (down_until <= now) {
+			__atomic_store_n(&route->next_upstream,
+			                 (index + 1) % route->num_upstreams,
+			                 __ATOMIC_RELAXED);
+			return upstream;
+		}
+
+		if (soonest == NULL || down_until < soonest_until) {
+			soonest = upstream;
+			soonest_until = down_until;
+		}
+	}
+
+	return soonest;
+}
+
+/* Mark `upstream` as down for `SERV_PROXY_RETRY_SECS`, logging it if it
+ * wasn't down already
+ */
+static void proxy_mark_down(struct Upstream* upstream) {
+	time_t now = time(NULL);
+	time_t down_until = __atomic_exchange_n(&upstream->down_until,
+	                                        now + SERV_PROXY_RETRY_SECS,
+	                                        __ATOMIC_RELAXED);
+	if (down_until <= now) {
+		char* buf = malloc(40 + strlen(upstream->name));
+		sprintf(buf, "Upstream '%s' is down, skipping it", upstream->name);
+		warn(buf);
+		free(buf);
+	}
+}
+
+/* Mark `upstream` as up, logging it if it was down */
+static void proxy_mark_up(struct Upstream* upstream) {
+	if (__atomic_load_n(&upstream->down_until, __ATOMIC_RELAXED) != 0 &&
+	    __atomic_exchange_n(&upstream->down_until, 0, __ATOMIC_RELAXED) != 0) {
+		char* buf = malloc(30 + strlen(upstream->name));
+		sprintf(buf, "Upstream '%s' is up again", upstream->name);
+		info(buf);
+		free(buf);
+	}
+}
+
+/* Get a connection to `upstream`, either from the pool or a new one. Marks
+ * the upstream as down if a new connection can't be established.
+ */
+static bool proxy_connect(struct Upstream* upstream, Socket* sock,
+                          bool* pooled) {
+	if (proxy_pool_take(upstream, sock)) {
+		*pooled = true;
+		return true;
+	}
+
+	*pooled = false;
+
+	if (!connect_socket(&upstream->addr, upstream->addr_len, sock)) {
+		proxy_mark_down(upstream);
+		return false;
+	}
+
+	proxy_mark_up(upstream);
+
+	#ifdef _WIN32
+	DWORD timeout = SERV_PROXY_TIMEOUT_SECS * 1000;
+	#else
+	struct timeval timeout = {SERV_PROXY_TIMEOUT_SECS, 0};
+	#endif
+	setsockopt(*sock, SOL_SOCKET, SO_RCVTIMEO, (char*) &timeout,
+	           sizeof(timeout));
+	setsockopt(*sock, SOL_SOCKET, SO_SNDTIMEO, (char*) &timeout,
+	           sizeof(timeout));
+
+	return true;
+}
+
+/* Whether a header is hop-by-hop (and must not be forwarded) */
+static bool proxy_is_hop_by_hop(const struct Header* header) {
+	switch (header->id) {
+		case HeaderConnection:
+		case HeaderKeepAlive:
+		case HeaderExpect:
+		case HeaderTransferEncoding:
+		case HeaderUpgrade:
+		case HeaderHttp2Settings:
+			return true;
+		default:
+			return slice_eq_nocase(header->name, "proxy-connection") ||
+			       slice_eq_nocase(header->name, "te");
+	}
+}
+
+/* Whether a header is forwarded by `proxy_write_headers` */
+static bool proxy_is_forwarded(const struct Header* header) {
+	return !proxy_is_hop_by_hop(header) ||
+	       header->id == HeaderTransferEncoding;
+}
+
+/* The length of the headers written by `proxy_write_headers`, which may be
+ * longer than they were received (e.g. "Name:value\n")
+ */
+static size_t proxy_headers_len(const struct Headers* headers) {
+	size_t len = 0;
+	size_t i;
+	for (i = 0; i < headers->num; i++) {
+		const struct Header* header = &headers->list[i];
+		if (proxy_is_forwarded(header)) {
+			len += header->name.len + header->value.len + 4;
+		}
+	}
+
+	return len;
+}
+
+/* Append the headers that aren't hop-by-hop to `cursor`, returning the new
+ * end of the written data (see `proxy_headers_len`)
+ */
+static char* proxy_write_headers(char* cursor, const struct Headers* headers) {
+	size_t i;
+	for (i = 0; i < headers->num; i++) {
+		const struct Header* header = &headers->list[i];
+		if (!proxy_is_forwarded(header)) {
+			continue;
+		}
+
+		memcpy(cursor, header->name.ptr, header->name.len);
+		cursor += header->name.len;
+		memcpy(cursor, ": ", 2);
+		cursor += 2;
+		memcpy(cursor, header->value.ptr, header->value.len);
+		cursor += header->value.len;
+		memcpy(cursor, "\r\n", 2);
+		cursor += 2;
+	}
+
+	return cursor;
+}
+
+bool proxy_copy(struct Reader* from, Socket to, uint64_t len,
+                int pipe_fds[2]) {
+	size_t from_pending = (size_t) min(len, (uint64_t) from->pending_len);
+	if (!send_all(to, from->pending, from_pending)) {
+		return false;
+	}
+
+	from->pending += from_pending;
+	from->pending_len -= from_pending;
+	if (len != UINT64_MAX) {
+		len -= from_pending;
+	}
+
+	#ifdef __linux__
+	while (len > 0) {
+		ssize_t in = splice(from->sock, NULL, pipe_fds[1], NULL,
+		                    (size_t) min(len, SERV_PROXY_BUFFER_SIZE),
+		                    SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (in == 0 && len == UINT64_MAX) {
+			return true;
+		} else if (in <= 0) {
+			return false;
+		}
+
+		if (len != UINT64_MAX) {
+			len -= in;
+		}
+
+		while (in > 0) {
+			ssize_t out = splice(pipe_fds[0], NULL, to, NULL, (size_t) in,
+			                     SPLICE_F_MOVE | SPLICE_F_MORE);
+			if (out <= 0) {
+				return false;
+			}
+
+			in -= out;
+		}
+	}
+	#else
+	char* buf = malloc(SERV_PROXY_BUFFER_SIZE);
+	while (len > 0) {
+		int32_t res = recv(from->sock, buf,
+		                   (int) min(len, SERV_PROXY_BUFFER_SIZE), 0);
+		if (res == 0 && len == UINT64_MAX) {
+			len = 0;
+			break;
+		} else if (res <= 0 || !send_all(to, buf, res)) {
+			break;
+		}
+
+		if (len != UINT64_MAX) {
+			len -= res;
+		}
+	}
+	free(buf);
+	#endif
+
+	return len == 0;
+}
+
+/* Forward a chunked body from `from` to `to`, including the chunk framing */
+static bool proxy_copy_chunked(struct Reader* from, Socket to,
+                               int pipe_fds[2]) {
+	char line[130];
+
+	while (true) {
+		if (!reader_read_line(from, line, sizeof(line) - 2)) {
+			return false;
+		}
+
+		#ifdef WIN32
+		uint64_t size = strtoull(line, NULL, 16);
+		#else
+		uint64_t size = strtoul(line, NULL, 16);
+		#endif
+
+		size_t line_len = strlen(line);
+		memcpy(line + line_len, "\r\n", 2);
+		if (!send_all(to, line, line_len + 2)) {
+			return false;
+		}
+
+		if (size == 0) {
+			break;
+		}
+
+		/* Copy the chunk data and the empty line after it */
+		if (!proxy_copy(from, to, size, pipe_fds) ||
+		    !reader_read_line(from, line, sizeof(line)) || line[0] != '\0' ||
+		    !send_all(to, "\r\n", 2)) {
+			return false;
+		}
+	}
+
+	/* Forward any trailer fields up to the final empty line */
+	size_t line_len;
+	do {
+		if (!reader_read_line(from, line, sizeof(line) - 2)) {
+			return false;
+		}
+
+		line_len = strlen(line);
+		memcpy(line + line_len, "\r\n", 2);
+		if (!send_all(to, line, line_len + 2)) {
+			return false;
+		}
+	} while (line_len > 0);
+
+	return true;
+}
+
+/* Whether `response` contains a complete response head */
+static bool proxy_has_head(const struct Buffer* response) {
+	size_t i;
+	for (i = 0; i + 4 <= response->len; i++) {
+		if (memcmp(response->buf + i, "\r\n\r\n", 4) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* Parse the response head at the start of `response` into `headers`,
+ * returning its status (or 0 if the head is invalid), and setting `line_end`
+ * to the end of its status line and `headers_len` to the length of its
+ * headers
+ */
+static uint16_t proxy_parse_head(const struct Buffer* response,
+                                 const char** line_end,
+                                 struct Headers* headers,
+                                 size_t* headers_len) {
+	const char* text = (const char*) response->buf;
+	*line_end = memchr(text, '\n', response->len);
+	*headers_len = 0;
+
+	if (*line_end == NULL || response->len < 12 ||
+	    memcmp(text, "HTTP/1.", 7) != 0) {
+		return 0;
+	}
+
+	uint16_t status = (uint16_t) strtoul(text + 9, NULL, 10);
+	*headers_len = parse_headers(*line_end + 1,
+	                             response->len - (*line_end + 1 - text),
+	                             headers);
+
+	/* Nothing asked the upstream to switch protocols */
+	if (status < 100 || status == 101 || status > 999 || *headers_len == 0) {
+		return 0;
+	}
+
+	return status;
+}
+
+uint16_t handle_proxy(struct Request* req, struct Path path, Socket sock,
+                      const struct Route* route, const struct Config* config) {
+	(void) path;
+	(void) config;
+	struct ProxyRoute* proxy = route->data;
+
+	/* Only request bodies with a known length are forwarded */
+	uint64_t body_len = 0;
+	const struct Slice* content_length = get_header(&req->headers,
+	                                                HeaderContentLength);
+	if (get_header(&req->headers, HeaderTransferEncoding) != NULL) {
+		return send_411(sock);
+	} else if (content_length != NULL &&
+	           !slice_to_u64(*content_length, &body_len)) {
+		return send_400(sock);
+	}
+
+	/* Make the request head sent to the upstream */
+	const char* method = method_to_str(req->method);
+	char* head = malloc(strlen(method) + 1 + req->target.len + 11 +
+	                    proxy_headers_len(&req->headers) + 26);
+	char* cursor = head;
+	cursor += sprintf(cursor, "%s ", method);
+	memcpy(cursor, req->target.ptr, req->target.len);
+	cursor += req->target.len;
+	memcpy(cursor, " HTTP/1.1\r\n", 11);
+	cursor += 11;
+	cursor = proxy_write_headers(cursor, &req->headers);
+	memcpy(cursor, "Connection: keep-alive\r\n\r\n", 26);
+	cursor += 26;
+	size_t head_len = cursor - head;
+
+	struct Reader client;
+	client.sock = sock;
+	client.pending = req->body;
+	client.pending_len = (size_t) min(body_len, (uint64_t) req->body_len);
+
+	int pipe_fds[2] = {-1, -1};
+	#ifdef __linux__
+	if (pipe2(pipe_fds, O_CLOEXEC)) {
+		error("Could not create a pipe for proxying");
+		free(head);
+		return send_500(sock);
+	}
+	#endif
+
+	/* Send the request to an upstream, trying the next one if an upstream
+	 * can't be reached. A pooled connection may have been closed by the
+	 * upstream in the meantime, so requests are retried on a new connection
+	 * as long as no part of the body had to be read from the client.
+	 */
+	struct Upstream* upstream = NULL;
+	Socket upstream_sock;
+	struct Buffer response = new_buffer(0);
+	bool retryable = true;
+	size_t attempts = 0;
+
+	while (true) {
+		if (!retryable || attempts > proxy->num_upstreams) {
+			break;
+		}
+
+		attempts++;
+		upstream = proxy_pick_upstream(proxy);
+
+		bool pooled;
+		if (!proxy_connect(upstream, &upstream_sock, &pooled)) {
+			upstream = NULL;
+			continue;
+		}
+
+		bool sent = send_all(upstream_sock, head, head_len) &&
+		            send_all(upstream_sock, client.pending, client.pending_len);
+
+		if (sent && client.pending_len < body_len) {
+			/* The rest of the body must be read from the client */
+			retryable = false;
+
+			const struct Slice* expect = get_header(&req->headers, HeaderExpect);
+			if (expect != NULL && slice_eq_nocase(*expect, "100-continue") &&
+			    req->body_len == 0) {
+				char* buf = "HTTP/1.1 100 Continue\r\n\r\n";
+				send_all(sock, buf, strlen(buf));
+			}
+
+			struct Reader rest = client;
+			rest.pending_len = 0;
+			sent = proxy_copy(&rest, upstream_sock,
+			                  body_len - client.pending_len, pipe_fds);
+		}
+
+		response.len = 0;
+		if (sent && receive_until(upstream_sock, &response, "\r\n\r\n",
+		                          SERV_MAX_HEADER_SIZE) && response.len > 0) {
+			break;
+		}
+
+		close_socket(upstream_sock);
+		upstream = NULL;
+
+		if (!pooled) {
+			warn("Could not forward request to upstream");
+		}
+	}
+
+	free(head);
+
+	if (upstream == NULL) {
+		error("No upstream could handle the request");
+		free_buffer(response);
+		#ifdef __linux__
+		close(pipe_fds[0]);
+		close(pipe_fds[1]);
+		#endif
+		return send_502(sock);
+	}
+
+	/* Parse the response status line and headers. Interim (1xx) responses
+	 * are skipped, since the client only gets the final response before the
+	 * connection is closed.
+	 */
+	const char* line_end;
+	struct Headers headers;
+	size_t headers_len;
+	uint16_t status = proxy_parse_head(&response, &line_end, &headers,
+	                                   &headers_len);
+
+	while (status >= 100 && status < 200) {
+		size_t interim_len = (size_t) (line_end + 1 + headers_len -
+		                               (const char*) response.buf);
+		memmove(response.buf, response.buf + interim_len,
+		        response.len - interim_len);
+		response.len -= interim_len;
+
+		if (!proxy_has_head(&response) &&
+		    (!receive_until(upstream_sock, &response, "\r\n\r\n",
+		                    SERV_MAX_HEADER_SIZE) || response.len == 0)) {
+			status = 0;
+			break;
+		}
+
+		status = proxy_parse_head(&response, &line_end, &headers,
+		                          &headers_len);
+	}
+
+	const char* text = (const char*) response.buf;
+	if (status == 0) {
+		error("Invalid response from upstream");
+		close_socket(upstream_sock);
+		free_buffer(response);
+		#ifdef __linux__
+		close(pipe_fds[0]);
+		close(pipe_fds[1]);
+		#endif
+		return send_502(sock);
+	}
+
+	/* Send the response head to the client, which is closed afterwards */
+	char* client_head = malloc((line_end + 1 - text) +
+	                           proxy_headers_len(&headers) + 21);
+	cursor = client_head;
+	memcpy(cursor, text, line_end + 1 - text);
+	cursor += line_end + 1 - text;
+	cursor = proxy_write_headers(cursor, &headers);
+	memcpy(cursor, "Connection: close\r\n\r\n", 21);
+	cursor += 21;
+
+	bool ok = send_all(sock, client_head, cursor - client_head);
+	free(client_head);
+
+	/* Stream the response body */
+	struct Reader body;
+	body.sock = upstream_sock;
+	body.pending = line_end + 1 + headers_len;
+	body.pending_len = response.len - (body.pending - text);
+
+	const struct Slice* connection = get_header(&headers, HeaderConnection);
+	bool reusable = connection == NULL || !slice_eq_nocase(*connection, "close");
+	uint64_t response_len;
+
+	if (!ok) {
+		reusable = false;
+	} else if (req->method == Head || status == 204 || status == 304) {
+		/* These responses never have a body */
+	} else if (get_header(&headers, HeaderTransferEncoding) != NULL) {
+		ok = proxy_copy_chunked(&body, sock, pipe_fds);
+	} else if ((content_length = get_header(&headers, HeaderContentLength)) !=
+	           NULL && slice_to_u64(*content_length, &response_len)) {
+		ok = proxy_copy(&body, sock, response_len, pipe_fds);
+	} else {
+		/* The body ends when the upstream closes the connection */
+		ok = proxy_copy(&body, sock, UINT64_MAX, pipe_fds);
+		reusable = false;
+	}
+
+	/* A connection with unread data would give its next request this
+	 * response's leftovers
+	 */
+	if (ok && reusable && body.pending_len == 0) {
+		proxy_pool_put(upstream, upstream_sock);
+	} else {
+		close_socket(upstream_sock);
+	}
+
+	free_buffer(response);
+	#ifdef __linux__
+	close(pipe_fds[0]);
+	close(pipe_fds[1]);
+	#endif
+
+	if (!ok) {
+		warn("Couldn't forward the full response");
+		return 0;
+	}
+
+	return status;
+}
+
+#ifndef _WIN32
+
+/* The state of the probe thread, see `start_proxy_probes` */
+static struct Route* proxy_probe_routes;
+static size_t proxy_probe_num_routes;
+static pthread_t proxy_probe_thread;
+static pthread_mutex_t proxy_probe_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t proxy_probe_wake = PTHREAD_COND_INITIALIZER;
+static bool proxy_probe_running = false;
+static bool proxy_probe_stopping = false;
+
+/* Check whether a connection to `upstream` can be established within
+ * `SERV_PROXY_PROBE_TIMEOUT_MS`, without blocking for longer
+ */
+static bool proxy_probe(const struct Upstream* upstream) {
+	int sock = socket(upstream->addr.ss_family, SOCK_STREAM | SERV_SOCK_CLOEXEC,
+	                  0);
+	if (sock < 0) {
+		return false;
+	}
+
+	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+	bool up = connect(sock, (const struct sockaddr*) &upstream->addr,
+	                  upstream->addr_len) == 0;
+	if (!up && errno == EINPROGRESS) {
+		struct pollfd pfd;
+		pfd.fd = sock;
+		pfd.events = POLLOUT;
+		pfd.revents = 0;
+
+		int err = 0;
+		socklen_t err_len = sizeof(err);
+		up = poll(&pfd, 1, SERV_PROXY_PROBE_TIMEOUT_MS) == 1 &&
+		     getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &err_len) == 0 &&
+		     err == 0;
+	}
+
+	close(sock);
+	return up;
+}
+
+static void* proxy_probe_loop(void* arg) {
+	(void) arg;
+
+	pthread_mutex_lock(&proxy_probe_lock);
+	while (!proxy_probe_stopping) {
+		pthread_mutex_unlock(&proxy_probe_lock);
+
+		size_t i;
+		for (i = 0; i < proxy_probe_num_routes; i++) {
+			if (proxy_probe_routes[i].handler != handle_proxy) {
+				continue;
+			}
+
+			struct ProxyRoute* proxy = proxy_probe_routes[i].data;
+			size_t j;
+			for (j = 0; j < proxy->num_upstreams; j++) {
+				if (proxy_probe(&proxy->upstreams[j])) {
+					proxy_mark_up(&proxy->upstreams[j]);
+				} else {
+					proxy_mark_down(&proxy->upstreams[j]);
+				}
+			}
+		}
+
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_sec += SERV_PROXY_PROBE_SECS;
+
+		pthread_mutex_lock(&proxy_probe_lock);
+		while (!proxy_probe_stopping &&
+		       pthread_cond_timedwait(&proxy_probe_wake, &proxy_probe_lock,
+		                              &until) == 0) {}
+	}
+	pthread_mutex_unlock(&proxy_probe_lock);
+
+	return NULL;
+}
+
+bool start_proxy_probes(struct Route* routes, size_t num_routes) {
+	size_t i;
+	for (i = 0; i < num_routes && routes[i].handler != handle_proxy; i++) {}
+	if (i == num_routes) {
+		return true;
+	}
+
+	proxy_probe_routes = routes;
+	proxy_probe_num_routes = num_routes;
+	proxy_probe_stopping = false;
+
+	/* Signals are handled by the main thread (see `stats_signal_init`) */
+	sigset_t all;
+	sigset_t old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	proxy_probe_running = pthread_create(&proxy_probe_thread, NULL,
+	                                     proxy_probe_loop, NULL) == 0;
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (!proxy_probe_running) {
+		error("Could not start the upstream probe thread");
+	}
+
+	return proxy_probe_running;
+}
+
+void stop_proxy_probes(void) {
+	if (!proxy_probe_running) {
+		return;
+	}
+
+	pthread_mutex_lock(&proxy_probe_lock);
+	proxy_probe_stopping = true;
+	pthread_cond_signal(&proxy_probe_wake);
+	pthread_mutex_unlock(&proxy_probe_lock);
+
+	pthread_join(proxy_probe_thread, NULL);
+	proxy_probe_running = false;
+}
+
+#else
+
+bool start_proxy_probes(struct Route* routes, size_t num_routes) {
+	(void) routes;
+	(void) num_routes;
+	return true;
+}
+
+void stop_proxy_probes(void) {}
+
+#endif
@@ -0,0 +1,114 @@
+/* A reverse proxy handler, forwarding requests under a path prefix to one of a
+ * set of upstream HTTP/1.1 servers (over TCP or Unix domain sockets).
+ * Connections to the upstreams are kept alive and reused from a per-worker
+ * pool, and responses are streamed back to the client (with `splice` on
+ * Linux) without buffering them.
+ */
+
+#ifndef C_HTTP_SERVER_PROXY_H
+#define C_HTTP_SERVER_PROXY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "config.h"
+#include "http.h"
+#include "router.h"
+#include "socket.h"
+
+/* The maximum number of upstreams per proxy route */
+#define SERV_PROXY_MAX_UPSTREAMS 8
+
+/* The size of the buffer used for copying data when `splice` is not
+ * available
+ */
+#define SERV_PROXY_BUFFER_SIZE 65536
+
+/* The maximum number of idle upstream connections kept open per worker */
+#define SERV_PROXY_POOL_SIZE 16
+
+/* How long an idle upstream connection is kept open, in seconds */
+#define SERV_PROXY_IDLE_SECS 30
+
+/* How long an upstream is skipped after it failed, in seconds */
+#define SERV_PROXY_RETRY_SECS 10
+
+/* How often every upstream is probed (see `start_proxy_probes`), in seconds */
+#define SERV_PROXY_PROBE_SECS 5
+
+/* How long a probe waits for the connection to be established, in
+ * milliseconds
+ */
+#define SERV_PROXY_PROBE_TIMEOUT_MS 1000
+
+/* How long to wait for an upstream to send or receive data, in seconds */
+#define SERV_PROXY_TIMEOUT_SECS 30
+
+/* An upstream server that requests can be forwarded to */
+struct Upstream {
+	/* The address as specified by the user, for logging */
+	char* name;
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	/* The time until which this upstream is considered unhealthy (because
+	 * connecting to it failed, during a request or a probe), or 0 if it's
+	 * healthy. Shared by all threads, so only accessed atomically.
+	 */
+	time_t down_until;
+};
+
+/* The data of a reverse proxy route (`Route.data`), forwarding all requests
+ * for paths starting with the route's prefix to its upstreams
+ */
+struct ProxyRoute {
+	struct Upstream upstreams[SERV_PROXY_MAX_UPSTREAMS];
+	size_t num_upstreams;
+	/* The upstream to try first for the next request (round-robin), only
+	 * accessed atomically
+	 */
+	size_t next_upstream;
+};
+
+/* Parse a proxy route from a string "PREFIX=UPSTREAM[,UPSTREAM...]" where
+ * each UPSTREAM is an address accepted by `parse_socket_addr`, e.g.
+ * "/api=127.0.0.1:9000,unix:/run/app.sock". Returns false if the string is
+ * invalid. The route should be freed with `free_proxy_route` after use.
+ */
+bool parse_proxy_route(const char* str, struct Route* route);
+
+/* Free the memory allocated by `parse_proxy_route` */
+void free_proxy_route(struct Route* route);
+
+/* The route handler for proxy routes. Forwards the request (with its full
+ * path) to one of the upstreams of `route`, and streams the response back to
+ * the client. If an upstream can't be reached, the next one is tried. Returns
+ * the HTTP status code sent to the client.
+ */
+uint16_t handle_proxy(struct Request* req, struct Path path, Socket sock,
+                      const struct Route* route, const struct Config* config);
+
+/* Copy `len` bytes (or everything until the connection is closed, if `len`
+ * is `UINT64_MAX`) from `from` to `to`, through the pipe `pipe_fds` with
+ * `splice` on Linux (elsewhere, `pipe_fds` is unused). Returns false if not
+ * all bytes could be copied.
+ */
+bool proxy_copy(struct Reader* from, Socket to, uint64_t len,
+                int pipe_fds[2]);
+
+/* Close all idle upstream connections in the calling worker's pool */
+void close_proxy_pool(void);
+
+/* Start a thread connecting to every upstream of the proxy routes among the
+ * `num_routes` `routes` every `SERV_PROXY_PROBE_SECS`, marking those that
+ * can't be reached as down (so requests fail over before trying them) and
+ * those that can as up again. Does nothing if there are no proxy routes, and
+ * returns false if the thread couldn't be started. The routes must be kept
+ * until `stop_proxy_probes` is called.
+ */
+bool start_proxy_probes(struct Route* routes, size_t num_routes);
+
+/* Stop the thread started by `start_proxy_probes`, if any */
+void stop_proxy_probes(void);
+
+#endif
@@ -0,0 +1,227 @@
+/* Implementation of `ratelimit.h`, see that file for documentation and
+ * types
+ */
+
+#include "ratelimit.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+/* A client in the rate limiting table. A key of 0 marks an empty slot. Each
+ * bucket is a single word, so it can be updated atomically: the high 32 bits
+ * are the time of the last update (in milliseconds since the server started),
+ * and the low 32 bits are the tokens in the bucket (in thousandths of a
+ * token).
+ */
+struct RateEntry {
+	uint64_t key;
+	uint64_t conns;
+	uint64_t reqs;
+};
+
+/* Thousandths of a token per token */
+#define RATE_MILLI 1000
+
+static struct RateEntry rate_table[SERV_RATE_TABLE_SIZE];
+
+bool parse_rate_limit(const char* str, struct RateLimit* limit) {
+	memset(limit, 0, sizeof(*limit));
+	uint32_t burst_secs = 1;
+
+	const char* option = str;
+	while (*option != '\0') {
+		size_t len = strcspn(option, ",");
+
+		if (len > 6 && strncmp(option, "conns=", 6) == 0) {
+			limit->conn_rate = (uint32_t) strtoul(option + 6, NULL, 10);
+		} else if (len > 9 && strncmp(option, "requests=", 9) == 0) {
+			limit->req_rate = (uint32_t) strtoul(option + 9, NULL, 10);
+		} else if (len > 6 && strncmp(option, "burst=", 6) == 0) {
+			burst_secs = (uint32_t) strtoul(option + 6, NULL, 10);
+		} else if (len == 5 && strncmp(option, "close", 5) == 0) {
+			limit->close = true;
+		} else {
+			return false;
+		}
+
+		option += len;
+		if (*option == ',') {
+			option++;
+		}
+	}
+
+	/* The bucket contents have to fit into 32 bits of thousandths */
+	if (burst_secs == 0 || (uint64_t) limit->conn_rate * burst_secs > 4000000 ||
+	    (uint64_t) limit->req_rate * burst_secs > 4000000) {
+		return false;
+	}
+
+	limit->conn_burst = limit->conn_rate * burst_secs;
+	limit->req_burst = limit->req_rate * burst_secs;
+
+	return limit->conn_rate > 0 || limit->req_rate > 0;
+}
+
+uint64_t rate_limit_key(const struct sockaddr_storage* addr) {
+	uint64_t key = 0;
+
+	if (addr->ss_family == AF_INET) {
+		const struct sockaddr_in* addr4 = (const struct sockaddr_in*) addr;
+		key = ((uint64_t) 0xffff << 32) | ntohl(addr4->sin_addr.s_addr);
+	} else if (addr->ss_family == AF_INET6) {
+		const uint8_t* bytes = (const uint8_t*)
+		                       &((const struct sockaddr_in6*) addr)->sin6_addr;
+		static const uint8_t v4_mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		                                      0xff, 0xff};
+
+		size_t i;
+		if (memcmp(bytes, v4_mapped, sizeof(v4_mapped)) == 0) {
+			/* IPv4 clients of dual-stack sockets use their IPv4 address */
+			key = (uint64_t) 0xffff;
+			for (i = 12; i < 16; i++) {
+				key = (key << 8) | bytes[i];
+			}
+		} else {
+			/* IPv6 clients use their /64 network, with the top bit set so
+			 * that no network (e.g. ::/64 of "::1") has the key 0 or an
+			 * IPv4 key. The networks with that bit set (multicast,
+			 * link-local etc., no global unicast ones) share their key
+			 * with those without it.
+			 */
+			for (i = 0; i < 8; i++) {
+				key = (key << 8) | bytes[i];
+			}
+			key |= (uint64_t) 1 << 63;
+		}
+	}
+
+	return key;
+}
+
+/* The current time in milliseconds since the first call */
+static uint32_t rate_now(void) {
+	static uint64_t start = 0;
+	uint64_t now = monotonic_us() / 1000;
+
+	uint64_t expected = 0;
+	if (__atomic_load_n(&start, __ATOMIC_RELAXED) == 0) {
+		/* Start at 1, so that the time 0 always means "never" */
+		__atomic_compare_exchange_n(&start, &expected, now - 1, false,
+		                            __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+	}
+
+	return (uint32_t) (now - __atomic_load_n(&start, __ATOMIC_RELAXED));
+}
+
+/* Find the table entry of the client with the key `key`, inserting it into
+ * an empty slot or in place of the least recently used client of the probe
+ * sequence if it's not in the table yet. If a client is evicted while another
+ * worker updates it, that update may be charged to the new client.
+ */
+static struct RateEntry* rate_find(uint64_t key) {
+	/* Fibonacci hashing spreads consecutive addresses across the table */
+	size_t start = (size_t) ((key * (uint64_t) 0x9e3779b97f4a7c15ULL) >> 32) &
+	               (SERV_RATE_TABLE_SIZE - 1);
+
+	struct RateEntry* oldest = NULL;
+	uint32_t oldest_age = 0;
+	uint32_t now = rate_now();
+
+	size_t i;
+	for (i = 0; i < SERV_RATE_MAX_PROBES; i++) {
+		struct RateEntry* entry = &rate_table[(start + i) &
+		                                      (SERV_RATE_TABLE_SIZE - 1)];
+		uint64_t entry_key = __atomic_load_n(&entry->key, __ATOMIC_ACQUIRE);
+
+		if (entry_key == key) {
+			return entry;
+		}
+
+		if (entry_key == 0) {
+			if (__atomic_compare_exchange_n(&entry->key, &entry_key, key,
+			                                false, __ATOMIC_ACQ_REL,
+			                                __ATOMIC_ACQUIRE) ||
+			    entry_key == key) {
+				return entry;
+			}
+		}
+
+		/* Remember the least recently used entry for eviction */
+		uint32_t conns_time = (uint32_t) (__atomic_load_n(&entry->conns,
+		                                  __ATOMIC_RELAXED) >> 32);
+		uint32_t reqs_time = (uint32_t) (__atomic_load_n(&entry->reqs,
+		                                 __ATOMIC_RELAXED) >> 32);
+		uint32_t age = now - (conns_time > reqs_time ? conns_time : reqs_time);
+		if (oldest == NULL || age > oldest_age) {
+			oldest = entry;
+			oldest_age = age;
+		}
+	}
+
+	/* Evict the least recently used client, resetting its buckets to full */
+	uint64_t oldest_key = __atomic_load_n(&oldest->key, __ATOMIC_ACQUIRE);
+	if (__atomic_compare_exchange_n(&oldest->key, &oldest_key, key, false,
+	                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		__atomic_store_n(&oldest->conns, 0, __ATOMIC_RELEASE);
+		__atomic_store_n(&oldest->reqs, 0, __ATOMIC_RELEASE);
+	}
+
+	return oldest;
+}
+
+/* Refill the token bucket `bucket` according to `rate` and `burst`, and take
+ * a token from it if there is one. Returns false if the bucket is empty.
+ */
+static bool rate_take(uint64_t* bucket, uint32_t rate, uint32_t burst) {
+	uint32_t now = rate_now();
+	uint64_t old = __atomic_load_n(bucket, __ATOMIC_ACQUIRE);
+	uint64_t new;
+	bool allowed;
+
+	do {
+		uint32_t last = (uint32_t) (old >> 32);
+		uint64_t tokens = old & 0xffffffff;
+
+		/* `rate` tokens per second are `rate` thousandths per millisecond.
+		 * A bucket that was never used (time 0) starts out full.
+		 */
+		if (last == 0) {
+			tokens = (uint64_t) burst * RATE_MILLI;
+		} else {
+			tokens += (uint64_t) (uint32_t) (now - last) * rate;
+		}
+		if (tokens > (uint64_t) burst * RATE_MILLI) {
+			tokens = (uint64_t) burst * RATE_MILLI;
+		}
+
+		allowed = tokens >= RATE_MILLI;
+		if (allowed) {
+			tokens -= RATE_MILLI;
+		}
+
+		new = ((uint64_t) now << 32) | tokens;
+	} while (!__atomic_compare_exchange_n(bucket, &old, new, true,
+	                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+	return allowed;
+}
+
+bool rate_limit_connection(const struct RateLimit* limit, uint64_t key) {
+	if (key == 0 || limit->conn_rate == 0) {
+		return true;
+	}
+
+	struct RateEntry* entry = rate_find(key);
+	return rate_take(&entry->conns, limit->conn_rate, limit->conn_burst);
+}
+
+bool rate_limit_request(const struct RateLimit* limit, uint64_t key) {
+	if (key == 0 || limit->req_rate == 0) {
+		return true;
+	}
+
+	struct RateEntry* entry = rate_find(key);
+	return rate_take(&entry->reqs, limit->req_rate, limit->req_burst);
+}
@@ -0,0 +1,60 @@
+/* Per-client rate limiting of connections and requests. Each client (an IPv4
+ * address, or the /64 network of an IPv6 address) gets a token bucket for
+ * connections and one for requests. The buckets live in a fixed-size
+ * open-addressing hash table shared by all workers, which is updated with
+ * atomic compare-and-swap operations only, and evicts the least recently
+ * used client of a probe sequence when that sequence is full.
+ */
+
+#ifndef C_HTTP_SERVER_RATELIMIT_H
+#define C_HTTP_SERVER_RATELIMIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "socket.h"
+
+/* The number of clients tracked at the same time (a power of 2) */
+#define SERV_RATE_TABLE_SIZE 4096
+
+/* The number of table slots searched for a client before evicting one */
+#define SERV_RATE_MAX_PROBES 8
+
+/* The limits for each client (`-L`). Rates are in tokens per second, and the
+ * burst sizes are the bucket capacities. A rate of 0 means no limit.
+ */
+struct RateLimit {
+	uint32_t conn_rate;
+	uint32_t conn_burst;
+	uint32_t req_rate;
+	uint32_t req_burst;
+	/* Whether over-limit clients are disconnected instead of getting a
+	 * "429 Too Many Requests" response
+	 */
+	bool close;
+};
+
+/* Parse rate limits from a string "OPTION[,OPTION...]", where the options
+ * are "conns=RATE" (connections per second), "requests=RATE" (requests per
+ * second), "burst=SECONDS" (the bucket capacities, in seconds worth of the
+ * rate, default 1) and "close" (disconnect over-limit clients). Returns false
+ * if the string is invalid.
+ */
+bool parse_rate_limit(const char* str, struct RateLimit* limit);
+
+/* Get the rate limiting key of a client with the address `addr`, or 0 if the
+ * client is not rate limited (e.g. on a Unix domain socket)
+ */
+uint64_t rate_limit_key(const struct sockaddr_storage* addr);
+
+/* Take a token from the connection bucket of the client with the key `key`.
+ * Returns false if the client is over its limit.
+ */
+bool rate_limit_connection(const struct RateLimit* limit, uint64_t key);
+
+/* Take a token from the request bucket of the client with the key `key`.
+ * Returns false if the client is over its limit.
+ */
+bool rate_limit_request(const struct RateLimit* limit, uint64_t key);
+
+#endif
@@ -0,0 +1,158 @@
+/* Implementation of `record.h`, see that file for documentation and types */
+
+#include "record.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include "log.h"
+#include "misc.h"
+#include "upgrade.h"
+
+#include "alloc.h"
+
+static FILE* record_file = NULL;
+/* Held while writing to the capture file. On Windows, connections are served
+ * by one thread.
+ */
+#ifndef _WIN32
+static pthread_mutex_t record_file_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+static uint64_t record_sample = 1;
+static uint64_t record_count = 0;
+static uint64_t record_start = 0;
+
+static void record_lock(void) {
+	#ifndef _WIN32
+	pthread_mutex_lock(&record_file_lock);
+	#endif
+}
+
+static void record_unlock(void) {
+	#ifndef _WIN32
+	pthread_mutex_unlock(&record_file_lock);
+	#endif
+}
+
+bool start_recording(const char* str) {
+	char* path;
+	if (!parse_output_file(str, &path, &record_sample)) {
+		error("Invalid recording options (-R) specified");
+		return false;
+	}
+
+	if (*path == '\0' || (record_file = fopen(path, "wb")) == NULL) {
+		error("Could not create the capture file (-R)");
+		free(path);
+		return false;
+	}
+
+	fputs(SERV_RECORD_MAGIC, record_file);
+	record_start = monotonic_us();
+	free(path);
+	return true;
+}
+
+void stop_recording(void) {
+	if (record_file == NULL) {
+		return;
+	}
+
+	record_lock();
+	fclose(record_file);
+	record_file = NULL;
+	record_unlock();
+}
+
+uint64_t record_arrival(void) {
+	return record_file != NULL ? monotonic_us() : 0;
+}
+
+/* Write `value` as an unsigned LEB128 varint to `buf`, returning the number
+ * of bytes written (at most 10)
+ */
+static size_t record_put_varint(uint8_t* buf, uint64_t value) {
+	size_t len = 0;
+	while (value >= 0x80) {
+		buf[len] = (uint8_t) (value | 0x80);
+		value >>= 7;
+		len++;
+	}
+
+	buf[len] = (uint8_t) value;
+	return len + 1;
+}
+
+/* Copy the request head of `req` (which starts at `raw`) for recording, with
+ * the values of the credential headers replaced by as many 'x's
+ */
+static char* record_redact_head(const struct Request* req, const char* raw) {
+	char* head = malloc(req->head_len);
+	memcpy(head, raw, req->head_len);
+
+	size_t i;
+	for (i = 0; i < req->headers.num; i++) {
+		const struct Header* header = &req->headers.list[i];
+		if (header->id != HeaderAuthorization && header->id != HeaderCookie &&
+		    !slice_eq_nocase(header->name, "proxy-authorization")) {
+			continue;
+		}
+
+		if (header->value.ptr >= raw &&
+		    header->value.ptr + header->value.len <= raw + req->head_len) {
+			memset(head + (header->value.ptr - raw), 'x', header->value.len);
+		}
+	}
+
+	return head;
+}
+
+void record_request(const struct Request* req, uint64_t arrival,
+                    uint16_t status) {
+	if (arrival == 0 || __atomic_fetch_add(&record_count, 1,
+	                                       __ATOMIC_RELAXED) % record_sample) {
+		return;
+	}
+
+	/* Only the start of the body (as far as it was received with the head)
+	 * is recorded, the rest is replayed as zeros
+	 */
+	uint64_t body_len = 0;
+	const struct Slice* content_length = get_header(&req->headers,
+	                                                HeaderContentLength);
+	if (content_length == NULL || !slice_to_u64(*content_length, &body_len)) {
+		body_len = req->body_len;
+	}
+
+	size_t recorded_body = (size_t) min(min(body_len, (uint64_t) req->body_len),
+	                                    (uint64_t) SERV_RECORD_MAX_BODY);
+	const char* raw = req->body - req->head_len;
+	size_t raw_len = req->head_len + recorded_body;
+
+	uint8_t header[40];
+	size_t header_len = 0;
+	header_len += record_put_varint(header + header_len,
+	                                arrival - record_start);
+	header_len += record_put_varint(header + header_len, status);
+	header_len += record_put_varint(header + header_len, raw_len);
+	header_len += record_put_varint(header + header_len,
+	                                body_len - recorded_body);
+
+	char* head = record_redact_head(req, raw);
+
+	record_lock();
+	if (record_file != NULL) {
+		fwrite(header, 1, header_len, record_file);
+		fwrite(head, 1, req->head_len, record_file);
+		fwrite(req->body, 1, recorded_body, record_file);
+		fflush(record_file);
+	}
+	record_unlock();
+
+	free(head);
+}
@@ -0,0 +1,55 @@
+/* Traffic recording (`-R`). A sample of the raw HTTP/1.1 requests is written
+ * to a capture file, together with their arrival times and the status codes
+ * they were answered with, so that the real request mix can be replayed
+ * against a server later (see `replay.c`). The values of the
+ * "Authorization", "Proxy-Authorization" and "Cookie" headers are replaced by
+ * as many 'x's, but the rest of the requests (e.g. tokens in URLs or request
+ * bodies) is recorded as is.
+ *
+ * The capture file starts with `SERV_RECORD_MAGIC`, followed by one record
+ * per request, in the order the requests were answered:
+ * - the arrival time in microseconds since the recording started
+ * - the status code of the response
+ * - the length of the recorded request bytes
+ * - the number of body bytes that weren't recorded (which are streamed by the
+ *   handlers, and are sent as zeros when the request is replayed)
+ * - the recorded request bytes (the request head and the start of the body)
+ * where all numbers are unsigned LEB128 varints.
+ */
+
+#ifndef C_HTTP_SERVER_RECORD_H
+#define C_HTTP_SERVER_RECORD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "http.h"
+
+/* The first bytes of a capture file */
+#define SERV_RECORD_MAGIC "SRVREC1\n"
+
+/* The maximum number of body bytes recorded per request */
+#define SERV_RECORD_MAX_BODY 65536
+
+/* Start recording requests as described by a string "FILE[,sample=N]",
+ * where FILE is the capture file and 1 in every N requests is recorded
+ * (default 1). Returns false (and logs an error) if the string is invalid or
+ * the file can't be created.
+ */
+bool start_recording(const char* str);
+
+/* Finish the capture file, if there is one */
+void stop_recording(void);
+
+/* The arrival time of a request received now, to be passed to
+ * `record_request`, or 0 if requests aren't being recorded
+ */
+uint64_t record_arrival(void);
+
+/* Record the request `req`, which arrived at `arrival` (see
+ * `record_arrival`) and was answered with `status`, if it's sampled
+ */
+void record_request(const struct Request* req, uint64_t arrival,
+                    uint16_t status);
+
+#endif
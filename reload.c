@@ -0,0 +1,278 @@
+/* Implementation of `reload.h`, see that file for documentation and types */
+
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+
+#include "reload.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <signal.h>
+#endif
+
+#include "log.h"
+#include "misc.h"
+#include "ratelimit.h"
+
+#include "alloc.h"
+
+/* A thread using configurations, see `enter_config` */
+struct ReloadReader {
+	/* The epoch the thread started using the current configuration in, or 0
+	 * if it isn't using one
+	 */
+	uint64_t epoch;
+	/* Keeps the readers on separate cache lines */
+	char padding[56];
+};
+
+/* A replaced configuration, freed once no reader is in an epoch before
+ * `epoch`
+ */
+struct ReloadRetired {
+	struct Config* config;
+	ConfigFree free_config;
+	uint64_t epoch;
+	struct ReloadRetired* next;
+};
+
+static struct ReloadReader reload_readers[SERV_RELOAD_MAX_READERS];
+static uint32_t reload_num_readers = 0;
+static __thread struct ReloadReader* reload_reader = NULL;
+
+/* The current epoch, advanced whenever a configuration is published */
+static uint64_t reload_epoch = 1;
+static struct Config* reload_current = NULL;
+/* The replaced configurations, only accessed by the main thread */
+static struct ReloadRetired* reload_retired = NULL;
+
+/* Remove the whitespace around `str` */
+static char* reload_trim(char* str) {
+	str += strspn(str, " \t");
+	size_t len = strlen(str);
+	while (len > 0 && strchr(" \t\r\n", str[len - 1]) != NULL) {
+		len--;
+	}
+
+	str[len] = '\0';
+	return str;
+}
+
+/* Check whether `value` is valid for the setting `key`, and return the field
+ * of `settings` for the setting, or NULL if either is invalid
+ */
+static char** reload_setting(struct Settings* settings, const char* key,
+                             const char* value) {
+	if (strcmp(key, "data_dir") == 0) {
+		return &settings->data_dir;
+	} else if (strcmp(key, "upload_dir") == 0) {
+		return &settings->upload_dir;
+	} else if (strcmp(key, "max_body_size") == 0) {
+		char* end;
+		unsigned long size = strtoul(value, &end, 10);
+		return size > 0 && *end == '\0' ? &settings->max_upload_size : NULL;
+	} else if (strcmp(key, "rate_limit") == 0) {
+		struct RateLimit limit;
+		return strcmp(value, "off") == 0 || parse_rate_limit(value, &limit) ?
+		       &settings->rate_limit : NULL;
+	} else if (strcmp(key, "log_level") == 0) {
+		enum Level level;
+		return parse_log_level(value, &level) ? &settings->log_level : NULL;
+	}
+
+	return NULL;
+}
+
+bool read_config_file(const char* path, struct Settings* settings) {
+	memset(settings, 0, sizeof(*settings));
+
+	FILE* file = fopen(path, "r");
+	if (file == NULL) {
+		char* buf = malloc(48 + strlen(path) + 1);
+		sprintf(buf, "Can't read the configuration file '%s'", path);
+		error(buf);
+		free(buf);
+		return false;
+	}
+
+	char line[4096];
+	uint32_t line_num = 0;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		line_num++;
+
+		char* key = reload_trim(line);
+		if (*key == '\0' || *key == '#') {
+			continue;
+		}
+
+		char* equals = strchr(key, '=');
+		char** setting = NULL;
+		if (equals != NULL) {
+			*equals = '\0';
+			key = reload_trim(key);
+			char* value = reload_trim(equals + 1);
+			if (*value != '\0' &&
+			    (setting = reload_setting(settings, key, value)) != NULL) {
+				free(*setting);
+				*setting = malloc(strlen(value) + 1);
+				strcpy(*setting, value);
+			}
+		}
+
+		if (setting == NULL) {
+			char* buf = malloc(64 + strlen(path) + 1);
+			sprintf(buf, "Invalid setting in line %lu of '%s'",
+			        (unsigned long) line_num, path);
+			error(buf);
+			free(buf);
+			fclose(file);
+			free_settings(settings);
+			return false;
+		}
+	}
+
+	fclose(file);
+	return true;
+}
+
+void free_settings(struct Settings* settings) {
+	free(settings->data_dir);
+	free(settings->upload_dir);
+	free(settings->max_upload_size);
+	free(settings->rate_limit);
+	free(settings->log_level);
+	memset(settings, 0, sizeof(*settings));
+}
+
+void merge_settings(const struct Settings* file, const struct Settings* args,
+                    struct Settings* merged) {
+	merged->data_dir = file->data_dir != NULL ? file->data_dir :
+	                   args->data_dir;
+	merged->upload_dir = file->upload_dir != NULL ? file->upload_dir :
+	                     args->upload_dir;
+	merged->max_upload_size = file->max_upload_size != NULL ?
+	                          file->max_upload_size : args->max_upload_size;
+	merged->rate_limit = file->rate_limit != NULL ? file->rate_limit :
+	                     args->rate_limit;
+	merged->log_level = file->log_level != NULL ? file->log_level :
+	                    args->log_level;
+}
+
+void publish_config(struct Config* config, ConfigFree free_old) {
+	/* Readers that see the new epoch also see the new configuration */
+	struct Config* old = __atomic_exchange_n(&reload_current, config,
+	                                         __ATOMIC_SEQ_CST);
+	uint64_t epoch = __atomic_add_fetch(&reload_epoch, 1, __ATOMIC_SEQ_CST);
+
+	if (old != NULL && free_old != NULL) {
+		struct ReloadRetired* retired = malloc(sizeof(struct ReloadRetired));
+		retired->config = old;
+		retired->free_config = free_old;
+		retired->epoch = epoch;
+		retired->next = reload_retired;
+		reload_retired = retired;
+	}
+}
+
+const struct Config* enter_config(void) {
+	if (reload_reader == NULL) {
+		uint32_t index = __atomic_fetch_add(&reload_num_readers, 1,
+		                                    __ATOMIC_RELAXED);
+		if (index >= SERV_RELOAD_MAX_READERS) {
+			error("Too many threads are using the configuration");
+			exit(SERV_ERR_MISC);
+		}
+		reload_reader = &reload_readers[index];
+	}
+
+	/* The epoch is announced before the configuration is read, so either
+	 * `reclaim_configs` sees the epoch, or this sees the configuration that
+	 * replaced the one it is freeing
+	 */
+	__atomic_store_n(&reload_reader->epoch,
+	                 __atomic_load_n(&reload_epoch, __ATOMIC_SEQ_CST),
+	                 __ATOMIC_SEQ_CST);
+	return __atomic_load_n(&reload_current, __ATOMIC_SEQ_CST);
+}
+
+void exit_config(void) {
+	__atomic_store_n(&reload_reader->epoch, 0, __ATOMIC_RELEASE);
+}
+
+bool reclaim_configs(void) {
+	if (reload_retired == NULL) {
+		return false;
+	}
+
+	/* The configurations replaced before the oldest epoch a reader is in
+	 * can't be in use
+	 */
+	uint64_t oldest = __atomic_load_n(&reload_epoch, __ATOMIC_SEQ_CST);
+	uint32_t num_readers = __atomic_load_n(&reload_num_readers,
+	                                       __ATOMIC_ACQUIRE);
+	uint32_t i;
+	for (i = 0; i < num_readers && i < SERV_RELOAD_MAX_READERS; i++) {
+		uint64_t epoch = __atomic_load_n(&reload_readers[i].epoch,
+		                                 __ATOMIC_SEQ_CST);
+		if (epoch != 0 && epoch < oldest) {
+			oldest = epoch;
+		}
+	}
+
+	struct ReloadRetired** link = &reload_retired;
+	while (*link != NULL) {
+		struct ReloadRetired* retired = *link;
+		if (retired->epoch <= oldest) {
+			*link = retired->next;
+			retired->free_config(retired->config);
+			free(retired);
+		} else {
+			link = &retired->next;
+		}
+	}
+
+	return reload_retired != NULL;
+}
+
+#ifndef _WIN32
+
+/* Whether a reload was requested (`SIGHUP`) */
+static volatile sig_atomic_t reload_flag = 0;
+
+static void reload_signal_handler(int signal) {
+	(void) signal;
+	reload_flag = 1;
+}
+
+void reload_signal_init(void) {
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = reload_signal_handler;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGHUP, &action, NULL)) {
+		warn("Could not install the reload signal handler");
+	}
+}
+
+bool reload_requested(void) {
+	bool requested = reload_flag != 0;
+	reload_flag = 0;
+	return requested;
+}
+
+#else
+
+void reload_signal_init(void) {}
+
+bool reload_requested(void) {
+	return false;
+}
+
+#endif
@@ -0,0 +1,104 @@
+/* Live configuration reloading (`-c`). The settings in a configuration file
+ * (see `read_config_file`) override the corresponding command-line options,
+ * and the file is read again whenever the server gets a `SIGHUP`, without
+ * restarting the server or closing any connections.
+ *
+ * A reloaded configuration is published as a new `Config`, which shares
+ * everything that can't be reloaded (the listeners, workers, proxy and
+ * FastCGI connection pools, ...) with the configuration it replaces. Each
+ * connection is served with the configuration that was current when it was
+ * accepted, which it gets without taking a lock (see `enter_config`), and a
+ * replaced configuration is freed once no connection can use it anymore:
+ * each thread serving connections announces the epoch it started using a
+ * configuration in, and a configuration replaced in epoch E is freed once no
+ * thread is still in an epoch before E.
+ */
+
+#ifndef C_HTTP_SERVER_RELOAD_H
+#define C_HTTP_SERVER_RELOAD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "worker.h"
+
+/* The maximum number of threads serving connections (the accept loop and
+ * the workers)
+ */
+#define SERV_RELOAD_MAX_READERS (SERV_MAX_WORKERS + 1)
+
+/* How often (in milliseconds) freeing the replaced configurations is retried
+ * while some are still in use
+ */
+#define SERV_RELOAD_RECLAIM_MS 100
+
+/* The settings that can be reloaded, as given on the command line or in a
+ * configuration file, each NULL if it isn't given
+ */
+struct Settings {
+	/* The data directory (`-d`, "data_dir") */
+	char* data_dir;
+	/* The directory `POST` requests store files in (`-u`, "upload_dir") */
+	char* upload_dir;
+	/* The maximum size of a request body (`-m`, "max_body_size") */
+	char* max_upload_size;
+	/* The per-client rate limits (`-L`, "rate_limit"), or "off" */
+	char* rate_limit;
+	/* The least severe level of the logged messages ("log_level", see
+	 * `parse_log_level`)
+	 */
+	char* log_level;
+};
+
+/* Read the settings from the configuration file at `path`, which has one
+ * "KEY = VALUE" line per setting (with the keys listed in `Settings`), and
+ * may contain empty lines and comments starting with "#". Returns false (and
+ * logs an error) if the file can't be read or has an invalid line or value.
+ * The settings should be freed with `free_settings`.
+ */
+bool read_config_file(const char* path, struct Settings* settings);
+
+/* Free the settings read by `read_config_file` */
+void free_settings(struct Settings* settings);
+
+/* Get the settings from `file`, falling back to those in `args` for the
+ * settings not in `file`. The merged settings point to the strings of
+ * `file` and `args`.
+ */
+void merge_settings(const struct Settings* file, const struct Settings* args,
+                    struct Settings* merged);
+
+/* A function freeing a replaced configuration */
+typedef void (*ConfigFree)(struct Config* config);
+
+/* Make `config` the configuration used for the connections accepted from now
+ * on. The replaced configuration is freed with `free_old` (unless it's NULL)
+ * by `reclaim_configs`, once it's no longer used. Only called by the main
+ * thread.
+ */
+void publish_config(struct Config* config, ConfigFree free_old);
+
+/* Get the current configuration, which may be used until `exit_config` is
+ * called by the same thread. Called by at most `SERV_RELOAD_MAX_READERS`
+ * threads.
+ */
+const struct Config* enter_config(void);
+
+/* Stop using the configuration returned by `enter_config` */
+void exit_config(void);
+
+/* Free the replaced configurations that are no longer used. Returns whether
+ * some are still in use. Only called by the main thread.
+ */
+bool reclaim_configs(void);
+
+/* Install the `SIGHUP` handler requesting a reload, which is handled by the
+ * main thread like the one of `stats_signal_init`
+ */
+void reload_signal_init(void);
+
+/* Check whether a reload was requested, resetting the request */
+bool reload_requested(void);
+
+#endif
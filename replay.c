@@ -0,0 +1,399 @@
+/* A replay tool for the captures recorded with the server's `-R` option (see
+ * `record.h` for the file format), re-issuing the recorded requests against
+ * a running server at their original pace, a multiple of it, or as fast as
+ * possible, over many connections at once. Reports the throughput and
+ * latency percentiles, and every response whose status differs from the
+ * recorded one.
+ *
+ * To compile and run, record some traffic with "-R capture.bin", then start
+ * the server to compare and run "./replay ::1 8000 capture.bin [SPEED]
+ * [CONNECTIONS]", where SPEED is 1 (the original pace, the default), a
+ * factor like 2 (twice as fast) or "max", and CONNECTIONS is the number of
+ * requests in flight at once (default 16). Latencies are measured from the
+ * time a request was due, so a server (or replay) that can't keep up shows
+ * up as latency rather than as a lower request rate. The exit code is 1 if
+ * any response status differed or any request failed.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <netdb.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+/* The first bytes of a capture file (`SERV_RECORD_MAGIC`) */
+#define REPLAY_MAGIC "SRVREC1\n"
+
+/* The default number of requests in flight */
+#define REPLAY_CONNECTIONS 16
+
+/* The maximum number of status mismatches listed */
+#define REPLAY_MAX_LISTED 10
+
+/* A recorded request and the outcome of replaying it */
+struct ReplayRequest {
+	/* The arrival time in microseconds since the recording started */
+	uint64_t arrival;
+	uint16_t recorded_status;
+	const uint8_t* data;
+	size_t len;
+	/* The number of zero body bytes sent after `data` */
+	uint64_t padding;
+
+	/* The status code received, or 0 if the request failed */
+	uint16_t status;
+	/* The time from when the request was due until the response was
+	 * complete, in seconds
+	 */
+	double latency;
+};
+
+static struct addrinfo* replay_addr;
+static struct ReplayRequest* replay_requests;
+static size_t replay_num_requests;
+static size_t replay_next = 0;
+static double replay_speed = 1;
+static double replay_start;
+
+static double replay_now(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+/* Read an unsigned LEB128 varint from `*cursor` (before `end`), advancing
+ * `*cursor`. Returns false if the data ends early.
+ */
+static bool replay_varint(const uint8_t** cursor, const uint8_t* end,
+                          uint64_t* value) {
+	uint32_t shift = 0;
+	*value = 0;
+
+	while (*cursor < end && shift < 64) {
+		uint8_t byte = **cursor;
+		(*cursor)++;
+		*value |= (uint64_t) (byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			return true;
+		}
+		shift += 7;
+	}
+
+	return false;
+}
+
+/* Parse the capture `data` into `replay_requests`. Returns false if it isn't
+ * a valid capture.
+ */
+static bool replay_parse(const uint8_t* data, size_t len) {
+	size_t magic_len = strlen(REPLAY_MAGIC);
+	if (len < magic_len || memcmp(data, REPLAY_MAGIC, magic_len) != 0) {
+		return false;
+	}
+
+	const uint8_t* cursor = data + magic_len;
+	const uint8_t* end = data + len;
+	size_t cap = 0;
+
+	while (cursor < end) {
+		uint64_t arrival, status, request_len, padding;
+		if (!replay_varint(&cursor, end, &arrival) ||
+		    !replay_varint(&cursor, end, &status) ||
+		    !replay_varint(&cursor, end, &request_len) ||
+		    !replay_varint(&cursor, end, &padding) ||
+		    request_len > (uint64_t) (end - cursor)) {
+			return false;
+		}
+
+		if (replay_num_requests == cap) {
+			cap = cap * 2 + 1024;
+			replay_requests = realloc(replay_requests,
+			                          cap * sizeof(struct ReplayRequest));
+		}
+
+		struct ReplayRequest* request = &replay_requests[replay_num_requests];
+		memset(request, 0, sizeof(*request));
+		request->arrival = arrival;
+		request->recorded_status = (uint16_t) status;
+		request->data = cursor;
+		request->len = (size_t) request_len;
+		request->padding = padding;
+		replay_num_requests++;
+
+		cursor += request_len;
+	}
+
+	return true;
+}
+
+/* Requests are recorded in the order they were answered */
+static int replay_compare_arrival(const void* a, const void* b) {
+	uint64_t x = ((const struct ReplayRequest*) a)->arrival;
+	uint64_t y = ((const struct ReplayRequest*) b)->arrival;
+	return x < y ? -1 : x > y;
+}
+
+static int replay_compare_latency(const void* a, const void* b) {
+	double x = *(const double*) a;
+	double y = *(const double*) b;
+	return x < y ? -1 : x > y;
+}
+
+/* Send `request` on a new connection and read the response until the server
+ * closes the connection. Returns the response's status code, or 0 if the
+ * request failed.
+ */
+static uint16_t replay_send(const struct ReplayRequest* request) {
+	int sock = socket(replay_addr->ai_family, SOCK_STREAM, 0);
+	if (sock < 0 || connect(sock, replay_addr->ai_addr,
+	                        replay_addr->ai_addrlen) != 0) {
+		if (sock >= 0) {
+			close(sock);
+		}
+		return 0;
+	}
+
+	int one = 1;
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	char buf[65536];
+	bool ok = send(sock, request->data, request->len, MSG_NOSIGNAL) ==
+	          (ssize_t) request->len;
+
+	/* The part of the body that wasn't recorded is sent as zeros */
+	uint64_t padding = request->padding;
+	if (padding > 0) {
+		memset(buf, 0, sizeof(buf));
+	}
+	while (ok && padding > 0) {
+		size_t len = padding < sizeof(buf) ? (size_t) padding : sizeof(buf);
+		ok = send(sock, buf, len, MSG_NOSIGNAL) == (ssize_t) len;
+		padding -= len;
+	}
+
+	/* The server may answer (and close the connection) before the whole body
+	 * was sent, so the response is read even if sending failed
+	 */
+	size_t received = 0;
+	ssize_t res;
+	while ((res = recv(sock, buf + received, sizeof(buf) - received, 0)) > 0) {
+		received = received + res < 16 ? received + res : 16;
+	}
+
+	close(sock);
+
+	if (received < 12 || memcmp(buf, "HTTP/1.", 7) != 0) {
+		return 0;
+	}
+
+	buf[12] = '\0';
+	return (uint16_t) strtoul(buf + 9, NULL, 10);
+}
+
+/* Replay requests (in the order they arrived) until there are none left */
+static void* replay_worker(void* arg) {
+	double* max_behind = arg;
+	uint64_t first_arrival = replay_requests[0].arrival;
+
+	while (true) {
+		size_t index = __atomic_fetch_add(&replay_next, 1, __ATOMIC_RELAXED);
+		if (index >= replay_num_requests) {
+			break;
+		}
+
+		struct ReplayRequest* request = &replay_requests[index];
+
+		/* Wait until the request is due, at the scaled original pace */
+		double due = replay_now();
+		if (replay_speed > 0) {
+			due = replay_start + (double) (request->arrival - first_arrival) /
+			                     1e6 / replay_speed;
+			double wait = due - replay_now();
+			if (wait > 0) {
+				struct timespec sleep;
+				sleep.tv_sec = (time_t) wait;
+				sleep.tv_nsec = (long) ((wait - (double) sleep.tv_sec) * 1e9);
+				nanosleep(&sleep, NULL);
+			} else if (-wait > *max_behind) {
+				*max_behind = -wait;
+			}
+		}
+
+		request->status = replay_send(request);
+		request->latency = replay_now() - due;
+	}
+
+	return NULL;
+}
+
+/* Print the request line of `request` (up to the first line break) */
+static void replay_print_request_line(const struct ReplayRequest* request) {
+	const uint8_t* line_end = memchr(request->data, '\r', request->len);
+	size_t line_len = line_end == NULL ? request->len :
+	                  (size_t) (line_end - request->data);
+	if (line_len > 100) {
+		line_len = 100;
+	}
+
+	fwrite(request->data, 1, line_len, stdout);
+}
+
+int main(int argc, char** argv) {
+	if (argc < 4 || argc > 6) {
+		fputs("usage: replay HOST PORT FILE [SPEED|max] [CONNECTIONS]\n",
+		      stderr);
+		return 1;
+	}
+
+	if (argc >= 5) {
+		replay_speed = strcmp(argv[4], "max") == 0 ? 0 : strtod(argv[4], NULL);
+	}
+	long connections = argc == 6 ? strtol(argv[5], NULL, 10) :
+	                   REPLAY_CONNECTIONS;
+	if ((argc >= 5 && strcmp(argv[4], "max") != 0 && replay_speed <= 0) ||
+	    connections <= 0 || connections > 4096) {
+		fputs("Invalid speed or number of connections\n", stderr);
+		return 1;
+	}
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(argv[1], argv[2], &hints, &replay_addr) != 0) {
+		fputs("Invalid address\n", stderr);
+		return 1;
+	}
+
+	/* Read the whole capture, the requests point into it */
+	FILE* file = fopen(argv[3], "rb");
+	if (file == NULL) {
+		perror("fopen");
+		freeaddrinfo(replay_addr);
+		return 1;
+	}
+
+	size_t cap = 1 << 20;
+	size_t len = 0;
+	uint8_t* data = malloc(cap);
+	size_t read;
+	while ((read = fread(data + len, 1, cap - len, file)) > 0) {
+		len += read;
+		if (len == cap) {
+			cap *= 2;
+			data = realloc(data, cap);
+		}
+	}
+	fclose(file);
+
+	if (!replay_parse(data, len) || replay_num_requests == 0) {
+		fputs("Invalid or empty capture file\n", stderr);
+		free(data);
+		free(replay_requests);
+		freeaddrinfo(replay_addr);
+		return 1;
+	}
+
+	qsort(replay_requests, replay_num_requests, sizeof(struct ReplayRequest),
+	      replay_compare_arrival);
+
+	double recorded_secs = (double) (replay_requests[replay_num_requests - 1]
+	                                 .arrival - replay_requests[0].arrival) / 1e6;
+	if (replay_speed > 0) {
+		printf("replaying %lu requests recorded over %.1f s with %ld "
+		       "connections at %gx speed\n",
+		       (unsigned long) replay_num_requests, recorded_secs,
+		       connections, replay_speed);
+	} else {
+		printf("replaying %lu requests recorded over %.1f s with %ld "
+		       "connections at maximum speed\n",
+		       (unsigned long) replay_num_requests, recorded_secs,
+		       connections);
+	}
+	fflush(stdout);
+
+	pthread_t* threads = malloc((size_t) connections * sizeof(pthread_t));
+	double* max_behind = calloc((size_t) connections, sizeof(double));
+	replay_start = replay_now();
+
+	long i;
+	for (i = 0; i < connections; i++) {
+		pthread_create(&threads[i], NULL, replay_worker, &max_behind[i]);
+	}
+	for (i = 0; i < connections; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	double secs = replay_now() - replay_start;
+
+	/* Collect the results */
+	double* latencies = malloc(replay_num_requests * sizeof(double));
+	size_t num_ok = 0;
+	size_t failed = 0;
+	size_t mismatched = 0;
+	size_t j;
+	for (j = 0; j < replay_num_requests; j++) {
+		const struct ReplayRequest* request = &replay_requests[j];
+		if (request->status == 0) {
+			failed++;
+			continue;
+		}
+
+		latencies[num_ok] = request->latency;
+		num_ok++;
+
+		if (request->recorded_status != 0 &&
+		    request->status != request->recorded_status) {
+			if (mismatched < REPLAY_MAX_LISTED) {
+				printf("status mismatch: ");
+				replay_print_request_line(request);
+				printf(" was %u, now %u\n",
+				       (unsigned int) request->recorded_status,
+				       (unsigned int) request->status);
+			}
+			mismatched++;
+		}
+	}
+
+	double behind = 0;
+	for (i = 0; i < connections; i++) {
+		behind = max_behind[i] > behind ? max_behind[i] : behind;
+	}
+
+	qsort(latencies, num_ok, sizeof(double), replay_compare_latency);
+
+	printf("%lu requests in %.2f s: %.0f requests/s, %lu failed, %lu status "
+	       "mismatches\n", (unsigned long) replay_num_requests, secs,
+	       (double) replay_num_requests / secs, (unsigned long) failed,
+	       (unsigned long) mismatched);
+	if (num_ok > 0) {
+		printf("latency: p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, p99.9 %.3f "
+		       "ms, max %.3f ms\n", latencies[num_ok / 2] * 1e3,
+		       latencies[num_ok * 9 / 10] * 1e3,
+		       latencies[num_ok * 99 / 100] * 1e3,
+		       latencies[num_ok * 999 / 1000] * 1e3,
+		       latencies[num_ok - 1] * 1e3);
+	}
+	if (replay_speed > 0) {
+		printf("at most %.3f ms behind the recorded pace\n", behind * 1e3);
+	}
+
+	free(latencies);
+	free(max_behind);
+	free(threads);
+	free(data);
+	free(replay_requests);
+	freeaddrinfo(replay_addr);
+
+	return failed > 0 || mismatched > 0 ? 1 : 0;
+}
@@ -0,0 +1,250 @@
+/* Implementation of `router.h`, see that file for documentation and types */
+
+#include "router.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "handlers.h"
+#include "log.h"
+
+#include "alloc.h"
+
+struct Path parse_route_prefix(const char* str) {
+	struct Path prefix = parse_path(str);
+
+	if (prefix.num_components == 1 && prefix.components[0][0] == '\0') {
+		free(prefix.components[0]);
+		prefix.num_components = 0;
+	}
+
+	return prefix;
+}
+
+bool parse_route(const char* str, struct Route* route) {
+	memset(route, 0, sizeof(*route));
+	route->max_age = -1;
+
+	const char* root = strchr(str, '=');
+	if (root == NULL || str[0] != '/') {
+		return false;
+	}
+
+	route->prefix_str = malloc(root - str + 1);
+	memcpy(route->prefix_str, str, root - str);
+	route->prefix_str[root - str] = '\0';
+	route->prefix = parse_route_prefix(route->prefix_str);
+	route->methods = METHOD_BIT(Get) | METHOD_BIT(Head);
+	route->handler = handle_files;
+
+	/* Parse the directory and the comma-separated options */
+	root++;
+	size_t root_len = strcspn(root, ",");
+	char* root_str = malloc(root_len + 1);
+	memcpy(root_str, root, root_len);
+	root_str[root_len] = '\0';
+	route->root = make_dir_path(root_str);
+	free(root_str);
+
+	if (route->root == NULL) {
+		free_route(route);
+		return false;
+	}
+
+	const char* option = root + root_len;
+	while (*option == ',') {
+		option++;
+		size_t len = strcspn(option, ",");
+
+		if (len == 4 && strncmp(option, "gzip", 4) == 0) {
+			route->gzip = true;
+		} else if (len == 5 && strncmp(option, "index", 5) == 0) {
+			route->autoindex = true;
+		} else if (len == 3 && strncmp(option, "put", 3) == 0) {
+			route->methods |= METHOD_BIT(Put);
+		} else if (len > 6 && strncmp(option, "cache=", 6) == 0) {
+			route->max_age = strtol(option + 6, NULL, 10);
+		} else {
+			free_route(route);
+			return false;
+		}
+
+		option += len;
+	}
+
+	return true;
+}
+
+void free_route(struct Route* route) {
+	free(route->prefix_str);
+	free_path(route->prefix);
+	free(route->root);
+	free(route->upload_root);
+	memset(route, 0, sizeof(*route));
+}
+
+/* Find the index of the child of `node` whose edge starts with `component`
+ * using binary search. If there is no such child, returns the index where it
+ * would have to be inserted and sets `found` to false.
+ */
+static size_t router_find_child(const struct RouterNode* node,
+                                const char* component, bool* found) {
+	size_t low = 0;
+	size_t high = node->num_children;
+
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		int32_t cmp = strcmp(node->children[mid]->edge[0], component);
+
+		if (cmp == 0) {
+			*found = true;
+			return mid;
+		} else if (cmp < 0) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	*found = false;
+	return low;
+}
+
+static struct RouterNode* router_new_node(char** edge, size_t edge_len) {
+	struct RouterNode* node = malloc(sizeof(struct RouterNode));
+	node->edge = edge;
+	node->edge_len = edge_len;
+	node->route = NULL;
+	node->children = NULL;
+	node->num_children = 0;
+	return node;
+}
+
+static void router_insert_child(struct RouterNode* node, size_t index,
+                                struct RouterNode* child) {
+	node->children = realloc(node->children, (node->num_children + 1) *
+	                                         sizeof(struct RouterNode*));
+	memmove(&node->children[index + 1], &node->children[index],
+	        (node->num_children - index) * sizeof(struct RouterNode*));
+	node->children[index] = child;
+	node->num_children++;
+}
+
+/* Insert `route` into the trie below `node`, for the path `components` */
+static bool router_insert(struct RouterNode* node, char** components,
+                          size_t num_components, const struct Route* route) {
+	while (num_components > 0) {
+		bool found;
+		size_t index = router_find_child(node, components[0], &found);
+
+		if (!found) {
+			struct RouterNode* child = router_new_node(components,
+			                                           num_components);
+			child->route = route;
+			router_insert_child(node, index, child);
+			return true;
+		}
+
+		/* Find the length of the common prefix of the edge and the path */
+		struct RouterNode* child = node->children[index];
+		size_t common = 1;
+		while (common < child->edge_len && common < num_components &&
+		       strcmp(child->edge[common], components[common]) == 0) {
+			common++;
+		}
+
+		/* Split the edge if the path diverges from it */
+		if (common < child->edge_len) {
+			struct RouterNode* split = router_new_node(child->edge, common);
+			child->edge += common;
+			child->edge_len -= common;
+			router_insert_child(split, 0, child);
+			node->children[index] = split;
+			child = split;
+		}
+
+		node = child;
+		components += common;
+		num_components -= common;
+	}
+
+	if (node->route != NULL) {
+		return false;
+	}
+
+	node->route = route;
+	return true;
+}
+
+struct RouterNode* build_router(const struct Route* routes, size_t num_routes) {
+	struct RouterNode* router = router_new_node(NULL, 0);
+
+	size_t i;
+	for (i = 0; i < num_routes; i++) {
+		if (!router_insert(router, routes[i].prefix.components,
+		                   routes[i].prefix.num_components, &routes[i])) {
+			char* buf = malloc(40 + strlen(routes[i].prefix_str));
+			sprintf(buf, "Duplicate route for the prefix '%s'",
+			        routes[i].prefix_str);
+			error(buf);
+			free(buf);
+			free_router(router);
+			return NULL;
+		}
+	}
+
+	return router;
+}
+
+void free_router(struct RouterNode* router) {
+	size_t i;
+	for (i = 0; i < router->num_children; i++) {
+		free_router(router->children[i]);
+	}
+
+	free(router->children);
+	free(router);
+}
+
+const struct Route* find_route(const struct RouterNode* router,
+                               struct Path path, size_t* depth) {
+	const struct Route* route = router->route;
+	size_t matched = 0;
+	size_t i = 0;
+
+	*depth = 0;
+
+	while (i < path.num_components) {
+		bool found;
+		size_t index = router_find_child(router, path.components[i], &found);
+		if (!found) {
+			break;
+		}
+
+		const struct RouterNode* child = router->children[index];
+		if (child->edge_len > path.num_components - i) {
+			break;
+		}
+
+		for (matched = 1; matched < child->edge_len; matched++) {
+			if (strcmp(child->edge[matched], path.components[i + matched]) != 0) {
+				break;
+			}
+		}
+
+		if (matched < child->edge_len) {
+			break;
+		}
+
+		i += child->edge_len;
+		router = child;
+
+		if (router->route != NULL) {
+			route = router->route;
+			*depth = i;
+		}
+	}
+
+	return route;
+}
@@ -0,0 +1,108 @@
+/* A routing table mapping request path prefixes to handlers. The table is
+ * compiled once at startup into a radix trie over path components, so a
+ * lookup only walks the components of the request path, without allocating.
+ */
+
+#ifndef C_HTTP_SERVER_ROUTER_H
+#define C_HTTP_SERVER_ROUTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "http.h"
+#include "socket.h"
+
+/* The bit for `method` in a route's method mask */
+#define METHOD_BIT(method) ((uint32_t) 1 << (uint32_t) (method))
+
+/* A method mask containing all supported methods */
+#define METHODS_ALL (METHOD_BIT(Get) | METHOD_BIT(Head) | METHOD_BIT(Post) | \
+                     METHOD_BIT(Put) | METHOD_BIT(Delete) | METHOD_BIT(Patch))
+
+struct Route;
+
+/* A route's request handler. `path` is the request path relative to the
+ * route's prefix. Returns the HTTP status code sent to the client.
+ */
+typedef uint16_t (*RouteHandler)(struct Request* req, struct Path path,
+                                 Socket sock, const struct Route* route,
+                                 const struct Config* config);
+
+/* A route, handling all requests for paths starting with `prefix` */
+struct Route {
+	/* The path prefix as given by the user, for logging */
+	char* prefix_str;
+	struct Path prefix;
+	/* The methods allowed on this route (see `METHOD_BIT`) */
+	uint32_t methods;
+	RouteHandler handler;
+	/* The directory files are served from and `PUT` requests store files in
+	 * (absolute, ending in "/"), or NULL
+	 */
+	char* root;
+	/* The directory `POST` requests store files in, or NULL */
+	char* upload_root;
+	/* The `max-age` of the `Cache-Control` header sent with responses, in
+	 * seconds, or -1 to not send that header
+	 */
+	int64_t max_age;
+	/* Whether pre-compressed files ("FILE.gz" next to "FILE") are sent to
+	 * clients accepting gzip
+	 */
+	bool gzip;
+	/* Whether directories without an "index.html" are listed (see
+	 * `autoindex.h`)
+	 */
+	bool autoindex;
+	/* Handler-specific data, e.g. the `ProxyRoute` of a proxy route */
+	void* data;
+};
+
+/* Parse `str` as a route prefix. Unlike with `parse_path`, the prefix "/" has
+ * no components.
+ */
+struct Path parse_route_prefix(const char* str);
+
+/* Parse a file-serving route from a string "PREFIX=PATH[,OPTION...]", where
+ * PATH is relative to the current directory and the options are
+ * "cache=SECONDS" (send `Cache-Control: max-age=SECONDS`), "gzip" (send
+ * pre-compressed files), "index" (list directories) and "put" (allow `PUT`
+ * requests). Returns false if the string is invalid. The route should be
+ * freed with `free_route`.
+ */
+bool parse_route(const char* str, struct Route* route);
+
+/* Free the memory owned by `route` (but not `route->data`) */
+void free_route(struct Route* route);
+
+/* A node of the routing trie */
+struct RouterNode {
+	/* The path components on the edge from the parent node to this node */
+	char** edge;
+	size_t edge_len;
+	/* The route for the path ending at this node, or NULL */
+	const struct Route* route;
+	/* The child nodes, sorted by the first component of their edge */
+	struct RouterNode** children;
+	size_t num_children;
+};
+
+/* Compile the routing trie for the given routes, which must outlive it.
+ * Returns NULL (and logs an error) if two routes have the same prefix. The
+ * trie should be freed with `free_router`.
+ */
+struct RouterNode* build_router(const struct Route* routes, size_t num_routes);
+
+/* Free a routing trie */
+void free_router(struct RouterNode* router);
+
+/* Find the route with the longest prefix of `path`. Returns NULL if there is
+ * no such route, otherwise `depth` is set to the number of path components
+ * matched by the route's prefix.
+ */
+const struct Route* find_route(const struct RouterNode* router,
+                               struct Path path, size_t* depth);
+
+#endif
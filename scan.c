@@ -0,0 +1,232 @@
+/* Implementation of `scan.h`, see that file for documentation and types */
+
+#include "scan.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_HAVE_X86
+#include <immintrin.h>
+#endif
+
+/* The currently selected implementations, set by `scan_init` */
+static size_t (*scan_any_impl)(const char* str, size_t len, const char* set) = NULL;
+static bool (*scan_is_token_impl)(const char* str, size_t len) = NULL;
+static const char* scan_impl = "scalar";
+
+/* Whether the given byte is a `tchar` */
+static bool scan_is_tchar(uint8_t c) {
+	if (c <= 0x20 || c >= 0x7F) {
+		return false;
+	}
+
+	switch (c) {
+		case '"':
+		case '(':
+		case ')':
+		case ',':
+		case '/':
+		case ':':
+		case ';':
+		case '<':
+		case '=':
+		case '>':
+		case '?':
+		case '@':
+		case '[':
+		case '\\':
+		case ']':
+		case '{':
+		case '}':
+			return false;
+		default:
+			return true;
+	}
+}
+
+size_t scan_any_scalar(const char* str, size_t len, const char* set) {
+	size_t set_len = strlen(set);
+	size_t i;
+	size_t k;
+	for (i = 0; i < len; i++) {
+		for (k = 0; k < set_len; k++) {
+			if (str[i] == set[k]) {
+				return i;
+			}
+		}
+	}
+
+	return len;
+}
+
+bool scan_is_token_scalar(const char* str, size_t len) {
+	size_t i;
+	for (i = 0; i < len; i++) {
+		if (!scan_is_tchar((uint8_t) str[i])) {
+			return false;
+		}
+	}
+
+	return len != 0;
+}
+
+#ifdef SCAN_HAVE_X86
+
+__attribute__((target("sse2")))
+static size_t scan_any_sse2(const char* str, size_t len, const char* set) {
+	size_t set_len = strlen(set);
+	__m128i needles[SCAN_MAX_SET];
+	size_t i;
+	size_t k;
+
+	for (k = 0; k < set_len; k++) {
+		needles[k] = _mm_set1_epi8(set[k]);
+	}
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		__m128i block = _mm_loadu_si128((const __m128i*) (str + i));
+		__m128i hits = _mm_cmpeq_epi8(block, needles[0]);
+		for (k = 1; k < set_len; k++) {
+			hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, needles[k]));
+		}
+
+		int mask = _mm_movemask_epi8(hits);
+		if (mask != 0) {
+			return i + __builtin_ctz((unsigned int) mask);
+		}
+	}
+
+	return i + scan_any_scalar(str + i, len - i, set);
+}
+
+/* Mark every byte of `block` that is not a `tchar`. Bytes outside of
+ * 0x21..0x7E are rejected with a signed range check (so bytes >= 0x80, which
+ * are negative, fail it too), the delimiters inside that range are rejected
+ * as two small ranges (":;<=>?@" and "[\]") plus 7 single characters.
+ */
+#define SCAN_NON_TCHAR(PREFIX, SUFFIX, block) \
+	PREFIX##_or_##SUFFIX( \
+	PREFIX##_or_##SUFFIX( \
+		PREFIX##_or_##SUFFIX( \
+			PREFIX##_cmpgt_epi8(PREFIX##_set1_epi8(0x21), block), \
+			PREFIX##_cmpgt_epi8(block, PREFIX##_set1_epi8(0x7E))), \
+		PREFIX##_or_##SUFFIX( \
+			PREFIX##_and_##SUFFIX( \
+				PREFIX##_cmpgt_epi8(block, PREFIX##_set1_epi8(0x39)), \
+				PREFIX##_cmpgt_epi8(PREFIX##_set1_epi8(0x41), block)), \
+			PREFIX##_and_##SUFFIX( \
+				PREFIX##_cmpgt_epi8(block, PREFIX##_set1_epi8(0x5A)), \
+				PREFIX##_cmpgt_epi8(PREFIX##_set1_epi8(0x5E), block)))), \
+	PREFIX##_or_##SUFFIX( \
+		PREFIX##_or_##SUFFIX( \
+			PREFIX##_or_##SUFFIX( \
+				PREFIX##_cmpeq_epi8(block, PREFIX##_set1_epi8('"')), \
+				PREFIX##_cmpeq_epi8(block, PREFIX##_set1_epi8('('))), \
+			PREFIX##_or_##SUFFIX( \
+				PREFIX##_cmpeq_epi8(block, PREFIX##_set1_epi8(')')), \
+				PREFIX##_cmpeq_epi8(block, PREFIX##_set1_epi8(',')))), \
+		PREFIX##_or_##SUFFIX( \
+			PREFIX##_or_##SUFFIX( \
+				PREFIX##_cmpeq_epi8(block, PREFIX##_set1_epi8('/')), \
+				PREFIX##_cmpeq_epi8(block, PREFIX##_set1_epi8('{'))), \
+			PREFIX##_cmpeq_epi8(block, PREFIX##_set1_epi8('}')))))
+
+__attribute__((target("sse2")))
+static bool scan_is_token_sse2(const char* str, size_t len) {
+	size_t i;
+	for (i = 0; i + 16 <= len; i += 16) {
+		__m128i block = _mm_loadu_si128((const __m128i*) (str + i));
+		if (_mm_movemask_epi8(SCAN_NON_TCHAR(_mm, si128, block)) != 0) {
+			return false;
+		}
+	}
+
+	return len != 0 && (i == len || scan_is_token_scalar(str + i, len - i));
+}
+
+__attribute__((target("avx2")))
+static size_t scan_any_avx2(const char* str, size_t len, const char* set) {
+	size_t set_len = strlen(set);
+	__m256i needles[SCAN_MAX_SET];
+	size_t i;
+	size_t k;
+
+	for (k = 0; k < set_len; k++) {
+		needles[k] = _mm256_set1_epi8(set[k]);
+	}
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		__m256i block = _mm256_loadu_si256((const __m256i*) (str + i));
+		__m256i hits = _mm256_cmpeq_epi8(block, needles[0]);
+		for (k = 1; k < set_len; k++) {
+			hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, needles[k]));
+		}
+
+		int mask = _mm256_movemask_epi8(hits);
+		if (mask != 0) {
+			return i + __builtin_ctz((unsigned int) mask);
+		}
+	}
+
+	return i + scan_any_sse2(str + i, len - i, set);
+}
+
+__attribute__((target("avx2")))
+static bool scan_is_token_avx2(const char* str, size_t len) {
+	size_t i;
+	for (i = 0; i + 32 <= len; i += 32) {
+		__m256i block = _mm256_loadu_si256((const __m256i*) (str + i));
+		if (_mm256_movemask_epi8(SCAN_NON_TCHAR(_mm256, si256, block)) != 0) {
+			return false;
+		}
+	}
+
+	return len != 0 && (i == len || scan_is_token_sse2(str + i, len - i));
+}
+
+#endif
+
+void scan_init(void) {
+	scan_any_impl = scan_any_scalar;
+	scan_is_token_impl = scan_is_token_scalar;
+	scan_impl = "scalar";
+
+	#ifdef SCAN_HAVE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		scan_any_impl = scan_any_avx2;
+		scan_is_token_impl = scan_is_token_avx2;
+		scan_impl = "avx2";
+	} else if (__builtin_cpu_supports("sse2")) {
+		scan_any_impl = scan_any_sse2;
+		scan_is_token_impl = scan_is_token_sse2;
+		scan_impl = "sse2";
+	}
+	#endif
+}
+
+const char* scan_impl_name(void) {
+	if (scan_any_impl == NULL) {
+		scan_init();
+	}
+
+	return scan_impl;
+}
+
+size_t scan_any(const char* str, size_t len, const char* set) {
+	if (scan_any_impl == NULL) {
+		scan_init();
+	}
+
+	return scan_any_impl(str, len, set);
+}
+
+bool scan_is_token(const char* str, size_t len) {
+	if (scan_is_token_impl == NULL) {
+		scan_init();
+	}
+
+	return scan_is_token_impl(str, len);
+}
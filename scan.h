@@ -0,0 +1,45 @@
+/* Byte scanning helpers for the HTTP parser, with SSE2 and AVX2
+ * implementations on x86 and a scalar fallback everywhere else. The fastest
+ * implementation supported by the CPU is selected at runtime.
+ */
+
+#ifndef C_HTTP_SERVER_SCAN_H
+#define C_HTTP_SERVER_SCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* The maximum number of characters in a `scan_any` set */
+#define SCAN_MAX_SET 4
+
+/* Select the scanner implementation based on the features of the CPU. Calling
+ * this is optional (the scanner initializes itself on first use), but it
+ * should be done once at startup, before any other threads are started.
+ */
+void scan_init(void);
+
+/* Return the name of the selected scanner implementation ("avx2", "sse2" or
+ * "scalar")
+ */
+const char* scan_impl_name(void);
+
+/* Find the first byte in the first `len` bytes of `str` that is one of the
+ * characters in the null-terminated `set` (which must contain at most
+ * `SCAN_MAX_SET` characters). Returns the index of that byte, or `len` if no
+ * such byte exists. `str` does not have to be null-terminated.
+ */
+size_t scan_any(const char* str, size_t len, const char* set);
+
+/* Check whether all of the first `len` bytes of `str` are valid HTTP token
+ * characters (`tchar`, see <https://www.rfc-editor.org/rfc/rfc9110#name-tokens>).
+ * Returns false if `len` is 0.
+ */
+bool scan_is_token(const char* str, size_t len);
+
+/* The scalar versions of `scan_any` and `scan_is_token`, used as the fallback
+ * and for comparison with the vectorized implementations.
+ */
+size_t scan_any_scalar(const char* str, size_t len, const char* set);
+bool scan_is_token_scalar(const char* str, size_t len);
+
+#endif
@@ -0,0 +1,188 @@
+/* A microbenchmark comparing the scanner implementation selected for this
+ * CPU (see `scan.h`) with the scalar one, on request heads split into lines
+ * and header names the way the HTTP parser does, and on single long lines
+ *
+ * To compile and run, build it with CMake (or
+ * "gcc -O2 -o scan_bench scan_bench.c scan.c") and run "./scan_bench", or
+ * "./scan_bench 4096" to use lines of up to 4096 bytes for the long line
+ * part (default `BENCH_LINE_LEN`). The exit code is 1 if the implementations
+ * disagree.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "scan.h"
+
+/* How long each part of the benchmark runs per implementation, in seconds */
+#define BENCH_SECS 1
+/* The default length of the long lines */
+#define BENCH_LINE_LEN 8192
+
+/* A typical browser request head */
+static const char bench_head[] =
+	"GET /assets/styles/main.css?v=20240611 HTTP/1.1\r\n"
+	"Host: www.example.com\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:127.0) Gecko/20100101 "
+	"Firefox/127.0\r\n"
+	"Accept: text/css,*/*;q=0.1\r\n"
+	"Accept-Language: en-US,en;q=0.5\r\n"
+	"Accept-Encoding: gzip, deflate, br, zstd\r\n"
+	"Referer: https://www.example.com/blog/2024/06/some-article-title\r\n"
+	"Connection: keep-alive\r\n"
+	"Cookie: session=4f9c2a1b8e7d6c5b4a39281706f5e4d3; theme=dark; "
+	"consent=1\r\n"
+	"Sec-Fetch-Dest: style\r\n"
+	"Sec-Fetch-Mode: no-cors\r\n"
+	"Sec-Fetch-Site: same-origin\r\n"
+	"If-Modified-Since: Tue, 11 Jun 2024 08:15:00 GMT\r\n"
+	"If-None-Match: \"5f3a-61a8b2c4d9e00\"\r\n"
+	"Cache-Control: max-age=0\r\n"
+	"\r\n";
+
+/* The scanner functions being measured */
+struct BenchImpl {
+	const char* name;
+	size_t (*any)(const char* str, size_t len, const char* set);
+	bool (*is_token)(const char* str, size_t len);
+};
+
+/* Defeats the optimizer, like the parser using the results would */
+static volatile size_t bench_sink;
+
+static double bench_now(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+/* Scan `head` (of length `len`) like `parse_headers`, finding the end of each
+ * line and the colon of each header and checking the header name. Returns a
+ * checksum of the results.
+ */
+static size_t bench_parse(const struct BenchImpl* impl, const char* head,
+                          size_t len) {
+	size_t sum = 0;
+	size_t i = 0;
+
+	while (i < len) {
+		size_t line_len = impl->any(head + i, len - i, "\n");
+		size_t name_len = impl->any(head + i, line_len, ":");
+		if (name_len < line_len && impl->is_token(head + i, name_len)) {
+			sum += name_len;
+		}
+
+		sum = sum * 31 + line_len;
+		i += line_len + 1;
+	}
+
+	return sum;
+}
+
+/* Scan the long lines of `lines` (`num_lines` lines of length `line_len`)
+ * for their end and check whether the part before it is a token. Returns a
+ * checksum of the results.
+ */
+static size_t bench_lines(const struct BenchImpl* impl, const char* lines,
+                          size_t line_len, size_t num_lines) {
+	size_t sum = 0;
+	size_t i;
+
+	for (i = 0; i < num_lines; i++) {
+		const char* line = lines + i * line_len;
+		size_t token_len = impl->any(line, line_len, "\r\n");
+		sum = sum * 31 + token_len;
+		sum = sum * 31 + (size_t) impl->is_token(line, token_len);
+	}
+
+	return sum;
+}
+
+/* Run `bench_parse` (`lines` == NULL) or `bench_lines` with `impl` for
+ * `BENCH_SECS`, print the throughput and return the checksum
+ */
+static size_t bench_run(const struct BenchImpl* impl, const char* part,
+                        const char* data, size_t len, const char* lines,
+                        size_t line_len, size_t num_lines) {
+	uint64_t rounds = 0;
+	size_t sum = 0;
+	double start = bench_now();
+	double elapsed;
+
+	do {
+		uint32_t i;
+		for (i = 0; i < 1000; i++) {
+			sum = lines == NULL ? bench_parse(impl, data, len) :
+			      bench_lines(impl, lines, line_len, num_lines);
+			bench_sink = sum;
+		}
+
+		rounds += 1000;
+		elapsed = bench_now() - start;
+	} while (elapsed < BENCH_SECS);
+
+	size_t bytes = lines == NULL ? len : line_len * num_lines;
+	printf("%-6s %-10s %9.0f MB/s %12.0f scans/s\n", impl->name, part,
+	       (double) rounds * (double) bytes / elapsed / 1e6,
+	       (double) rounds / elapsed);
+	return sum;
+}
+
+int main(int argc, char** argv) {
+	size_t line_len = argc == 2 ? strtoul(argv[1], NULL, 10) : BENCH_LINE_LEN;
+	if (argc > 2 || line_len < 2) {
+		fputs("usage: scan_bench [LINE_LEN]\n", stderr);
+		return 2;
+	}
+
+	scan_init();
+	struct BenchImpl impls[2];
+	impls[0].name = scan_impl_name();
+	impls[0].any = scan_any;
+	impls[0].is_token = scan_is_token;
+	impls[1].name = "scalar";
+	impls[1].any = scan_any_scalar;
+	impls[1].is_token = scan_is_token_scalar;
+
+	/* Lines of up to `line_len` bytes (padded to `line_len`), all token
+	 * characters up to the "\r\n" ending them, so every byte before it is
+	 * scanned
+	 */
+	size_t num_lines = 16;
+	char* lines = malloc(line_len * num_lines);
+	size_t i;
+	for (i = 0; i < num_lines; i++) {
+		char* line = lines + i * line_len;
+		size_t len = 2 + (line_len - 2) * (i + 1) / num_lines;
+		memset(line, 'a' + (char) i, line_len);
+		line[len - 2] = '\r';
+		line[len - 1] = '\n';
+	}
+
+	bool agree = true;
+	size_t head_sums[2];
+	size_t line_sums[2];
+	for (i = 0; i < 2; i++) {
+		head_sums[i] = bench_run(&impls[i], "head", bench_head,
+		                         sizeof(bench_head) - 1, NULL, 0, 0);
+		line_sums[i] = bench_run(&impls[i], "long lines", NULL, 0, lines,
+		                         line_len, num_lines);
+	}
+
+	if (head_sums[0] != head_sums[1] || line_sums[0] != line_sums[1]) {
+		fprintf(stderr, "the %s and scalar implementations disagree\n",
+		        impls[0].name);
+		agree = false;
+	}
+
+	free(lines);
+	return agree ? 0 : 1;
+}
@@ -6,6 +6,7 @@
  * paths and serving those files.
  */
 
+#include <errno.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <stdint.h>
@@ -14,10 +15,291 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef _WIN32
+#define poll WSAPoll
+#else
+#include <poll.h>
+#include <signal.h>
+#endif
+
 #include "misc.h"
+#include "admission.h"
+#include "autoindex.h"
+#include "warm.h"
 #include "log.h"
 #include "socket.h"
 #include "http.h"
+#include "handlers.h"
+#include "fastcgi.h"
+#include "http2.h"
+#include "proxy.h"
+#include "ratelimit.h"
+#include "record.h"
+#include "reload.h"
+#include "router.h"
+#include "scan.h"
+#include "tls.h"
+#include "trace.h"
+#include "tune.h"
+#include "upgrade.h"
+#include "worker.h"
+
+#include "alloc.h"
+
+/* Read a request from the `incoming` connection of the client with the rate
+ * limiting key `client`, handle it, and close the connection. If the client
+ * is over its connection rate limit (`allowed` is false) or its request rate
+ * limit, the request is rejected. HTTP/2 connections (with prior knowledge or
+ * upgraded from the request) are served until the client closes them.
+ */
+static void serve_connection(Socket incoming, uint64_t client, bool allowed,
+                             const struct Config* config) {
+	struct Buffer buffer = new_buffer(0);
+	if (!receive_until(incoming, &buffer, "\r\n\r\n", SERV_MAX_HEADER_SIZE)) {
+		error("Could not read any data from connection");
+		free_buffer(buffer);
+		close_socket(incoming);
+		return;
+	}
+
+	size_t http_req_len = buffer.len;
+	char* http_req = buffer_to_str(buffer);
+
+	if (is_http2_preface(http_req, http_req_len)) {
+		if (allowed) {
+			serve_http2(incoming, client, http_req, http_req_len, NULL, config);
+		}
+		free(http_req);
+		close_socket(incoming);
+		return;
+	}
+
+	struct Request req = {0};
+	if (!parse_request(http_req, http_req_len, &req)) {
+		error("Could not parse HTTP request");
+		if (http_req_len >= SERV_MAX_HEADER_SIZE || req.headers.too_many) {
+			send_431(incoming);
+		} else if (http_req_len > 0) {
+			send_400(incoming);
+		}
+		free(http_req);
+		free_path(req.path);
+		close_socket(incoming);
+		return;
+	}
+	trace_phase(TraceParsed);
+	alloc_count_request();
+
+	if (config->rate_limit != NULL &&
+	    (!allowed || !rate_limit_request(config->rate_limit, client))) {
+		debug("Rejecting a request over the rate limit");
+		if (!config->rate_limit->close) {
+			send_429(incoming);
+		}
+		free(http_req);
+		free_path(req.path);
+		close_socket(incoming);
+		return;
+	}
+
+	if (is_http2_upgrade(&req)) {
+		serve_http2(incoming, client, req.body, req.body_len, &req, config);
+	} else if (!handle_request(&req, incoming, config)) {
+		error("Could not handle HTTP request");
+	}
+
+	free(http_req);
+	free_path(req.path);
+	close_socket(incoming);
+}
+
+/* Serve the connection `incoming` accepted on `listener` (see
+ * `serve_connection`) with the current configuration, after the TLS handshake
+ * on TLS listeners, and record the end of the request for the admission
+ * control. Called by the accept loop or, with `-w`, by a worker.
+ */
+static void serve_accepted(Socket incoming, uint64_t client, bool allowed,
+                           const struct Listener* listener, struct Trace* trace,
+                           const struct Config* config) {
+	uint64_t start = monotonic_us();
+	trace_attach(trace, incoming);
+
+	/* The connection keeps using this configuration if it's reloaded in the
+	 * meantime
+	 */
+	const struct Config* current = enter_config();
+
+	/* TLS connections are served on the socket returned after the
+	 * handshake
+	 */
+	if (listener->tls == NULL) {
+		serve_connection(incoming, client, allowed, current);
+	} else if (tls_accept(listener, incoming, &incoming)) {
+		serve_connection(incoming, client, allowed, current);
+	} else {
+		close_socket(incoming);
+	}
+
+	exit_config();
+	trace_close();
+
+	if (config->admission != NULL) {
+		admission_end(config->admission, monotonic_us() - start);
+	}
+}
+
+/* Set up the reloadable part of `config` from `settings`: the data and upload
+ * directories, the maximum request body size, the rate limits, the log level
+ * (the current one if it isn't set) and the directories and methods of the
+ * root route (the first route, whose other fields must already be set up).
+ * Returns false (and logs an error) if a setting is invalid. The settings set
+ * up should be freed with `unload_settings`, also if this fails.
+ */
+static bool load_settings(struct Config* config,
+                          const struct Settings* settings, bool allow_put) {
+	struct Route* root_route = &config->routes[0];
+	config->data_dir = NULL;
+	config->upload_dir = NULL;
+	config->max_upload_size = SERV_DEFAULT_MAX_UPLOAD_SIZE;
+	config->rate_limit = NULL;
+	config->owns_rate_limit = true;
+	root_route->root = NULL;
+	root_route->upload_root = NULL;
+
+	if (settings->max_upload_size != NULL) {
+		#ifdef WIN32
+		uint64_t parsed = strtoull(settings->max_upload_size, NULL, 10);
+		#else
+		uint64_t parsed = strtoul(settings->max_upload_size, NULL, 10);
+		#endif
+		if (parsed == 0) {
+			warn("Invalid maximum body size (-m) specified");
+		} else {
+			config->max_upload_size = parsed;
+		}
+	}
+
+	if ((config->data_dir = make_dir_path(settings->data_dir)) == NULL) {
+		return false;
+	}
+
+	if (settings->upload_dir != NULL &&
+	    (config->upload_dir = make_dir_path(settings->upload_dir)) == NULL) {
+		return false;
+	}
+
+	if (settings->rate_limit != NULL &&
+	    strcmp(settings->rate_limit, "off") != 0) {
+		config->rate_limit = malloc(sizeof(struct RateLimit));
+		if (!parse_rate_limit(settings->rate_limit, config->rate_limit)) {
+			error("Invalid rate limits (-L) specified");
+			return false;
+		}
+	}
+
+	root_route->methods = METHOD_BIT(Get) | METHOD_BIT(Head);
+	root_route->root = malloc(strlen(config->data_dir) + 1);
+	strcpy(root_route->root, config->data_dir);
+	if (allow_put) {
+		root_route->methods |= METHOD_BIT(Put);
+	}
+	if (config->upload_dir != NULL) {
+		root_route->methods |= METHOD_BIT(Post);
+		root_route->upload_root = malloc(strlen(config->upload_dir) + 1);
+		strcpy(root_route->upload_root, config->upload_dir);
+	}
+
+	config->log_level = get_log_level();
+	if (settings->log_level != NULL &&
+	    !parse_log_level(settings->log_level, &config->log_level)) {
+		error("Invalid log level specified");
+		return false;
+	}
+
+	return true;
+}
+
+/* Free the part of `config` set up by `load_settings` */
+static void unload_settings(struct Config* config) {
+	free(config->data_dir);
+	free(config->upload_dir);
+	if (config->owns_rate_limit) {
+		free(config->rate_limit);
+	}
+	free(config->routes[0].root);
+	free(config->routes[0].upload_root);
+}
+
+/* Free a configuration made by `reload_config` */
+static void free_reloaded_config(struct Config* config) {
+	unload_settings(config);
+	if (config->router != NULL) {
+		free_router(config->router);
+	}
+	free(config->routes);
+	free(config);
+}
+
+/* Whether the rate limits `a` and `b` (either of which may be NULL) are the
+ * same
+ */
+static bool same_rate_limit(const struct RateLimit* a,
+                            const struct RateLimit* b) {
+	if (a == NULL || b == NULL) {
+		return a == b;
+	}
+
+	return a->conn_rate == b->conn_rate && a->conn_burst == b->conn_burst &&
+	       a->req_rate == b->req_rate && a->req_burst == b->req_burst &&
+	       a->close == b->close;
+}
+
+/* Make a new configuration from `base` with the settings from the
+ * configuration file at `path`, or from the command-line options `args` for
+ * the settings not in the file. The routes are shared with `base` except for
+ * the root route's directories, and the rate limiter is taken over from the
+ * current configuration `previous` if it's unchanged. Returns NULL (and logs
+ * an error) if the file or a setting is invalid.
+ */
+static struct Config* reload_config(const struct Config* base,
+                                    struct Config* previous, const char* path,
+                                    const struct Settings* args,
+                                    bool allow_put) {
+	struct Settings file;
+	if (!read_config_file(path, &file)) {
+		return NULL;
+	}
+
+	struct Settings settings;
+	merge_settings(&file, args, &settings);
+
+	struct Config* config = malloc(sizeof(struct Config));
+	*config = *base;
+	config->routes = malloc(base->num_routes * sizeof(struct Route));
+	memcpy(config->routes, base->routes,
+	       base->num_routes * sizeof(struct Route));
+	config->router = NULL;
+
+	bool loaded = load_settings(config, &settings, allow_put) &&
+	              (config->router = build_router(config->routes,
+	                                             config->num_routes)) != NULL;
+	free_settings(&file);
+
+	if (!loaded) {
+		free_reloaded_config(config);
+		return NULL;
+	}
+
+	if (config->rate_limit != NULL &&
+	    same_rate_limit(config->rate_limit, previous->rate_limit)) {
+		free(config->rate_limit);
+		config->rate_limit = previous->rate_limit;
+		config->owns_rate_limit = previous->owns_rate_limit;
+		previous->owns_rate_limit = false;
+	}
+
+	return config;
+}
 
 int32_t main(int32_t argc, char** argv) {
 	info("Starting HTTP server");
@@ -25,12 +307,34 @@ int32_t main(int32_t argc, char** argv) {
 	/* Get command-line arguments */
 	char* listen_port_str = NULL;
 	char* data_dir_str = NULL;
+	char* upload_dir_str = NULL;
+	char* max_upload_str = NULL;
+	bool allow_put = false;
+	bool autoindex = false;
+	char** proxy_route_strs = NULL;
+	size_t num_proxy_routes = 0;
+	char** fastcgi_route_strs = NULL;
+	size_t num_fastcgi_routes = 0;
+	char** route_strs = NULL;
+	size_t num_file_routes = 0;
+	char** bundle_route_strs = NULL;
+	size_t num_bundle_routes = 0;
+	char** listener_strs = NULL;
+	size_t num_listener_strs = 0;
+	char* rate_limit_str = NULL;
+	char* admission_str = NULL;
+	char* warmup_str = NULL;
+	char* workers_str = NULL;
+	char* trace_str = NULL;
+	char* tuning_str = NULL;
+	char* record_str = NULL;
+	char* config_file_str = NULL;
 	int32_t c;
 
 	opterr = 0;
 	optarg = 0;
 
-	while ((c = getopt(argc, argv, "hp:d:")) != -1) {
+	while ((c = getopt(argc, argv, "hp:l:d:u:m:Wix:f:r:b:L:A:C:w:T:S:R:c:")) != -1) {
 		switch (c) {
 			case 'h':
 				/* `-h` - Print help string and exit after a keypress */
@@ -41,18 +345,149 @@ int32_t main(int32_t argc, char** argv) {
 				/* `-p` - Set the listening port */
 				listen_port_str = optarg;
 				break;
+			case 'l':
+				/* `-l` - Add a listening address (repeatable) */
+				listener_strs = realloc(listener_strs, (num_listener_strs + 1) *
+				                                       sizeof(char*));
+				listener_strs[num_listener_strs] = optarg;
+				num_listener_strs++;
+				break;
 			case 'd':
 				/* `-d` - Set the HTTP data directory */
 				data_dir_str = optarg;
 				break;
+			case 'u':
+				/* `-u` - Set the upload directory for POST requests */
+				upload_dir_str = optarg;
+				break;
+			case 'm':
+				/* `-m` - Set the maximum request body size */
+				max_upload_str = optarg;
+				break;
+			case 'W':
+				/* `-W` - Allow PUT requests to the data directory */
+				allow_put = true;
+				break;
+			case 'i':
+				/* `-i` - List directories in the data directory */
+				autoindex = true;
+				break;
+			case 'x':
+				/* `-x` - Add a reverse proxy route (repeatable) */
+				proxy_route_strs = realloc(proxy_route_strs,
+				                           (num_proxy_routes + 1) *
+				                           sizeof(char*));
+				proxy_route_strs[num_proxy_routes] = optarg;
+				num_proxy_routes++;
+				break;
+			case 'f':
+				/* `-f` - Add a FastCGI route (repeatable) */
+				fastcgi_route_strs = realloc(fastcgi_route_strs,
+				                             (num_fastcgi_routes + 1) *
+				                             sizeof(char*));
+				fastcgi_route_strs[num_fastcgi_routes] = optarg;
+				num_fastcgi_routes++;
+				break;
+			case 'r':
+				/* `-r` - Add a file-serving route (repeatable) */
+				route_strs = realloc(route_strs, (num_file_routes + 1) *
+				                                 sizeof(char*));
+				route_strs[num_file_routes] = optarg;
+				num_file_routes++;
+				break;
+			case 'b':
+				/* `-b` - Serve the asset bundle under a prefix (repeatable) */
+				bundle_route_strs = realloc(bundle_route_strs,
+				                            (num_bundle_routes + 1) *
+				                            sizeof(char*));
+				bundle_route_strs[num_bundle_routes] = optarg;
+				num_bundle_routes++;
+				break;
+			case 'L':
+				/* `-L` - Set the per-client rate limits */
+				rate_limit_str = optarg;
+				break;
+			case 'A':
+				/* `-A` - Set the admission control thresholds */
+				admission_str = optarg;
+				break;
+			case 'C':
+				/* `-C` - Warm the page cache on startup */
+				warmup_str = optarg;
+				break;
+			case 'w':
+				/* `-w` - Serve connections with worker threads */
+				workers_str = optarg;
+				break;
+			case 'T':
+				/* `-T` - Write traces of sampled connections */
+				trace_str = optarg;
+				break;
+			case 'S':
+				/* `-S` - Set the socket tuning profile */
+				tuning_str = optarg;
+				break;
+			case 'R':
+				/* `-R` - Record requests to a capture file */
+				record_str = optarg;
+				break;
+			case 'c':
+				/* `-c` - Read the reloadable settings from a file */
+				config_file_str = optarg;
+				break;
 			case '?':
 				/* Unknown option or no value when required */
 				if (optopt == 'p') {
 					error("Option -p (port) requires a value");
 					return SERV_ERR_ARGS;
+				} else if (optopt == 'l') {
+					error("Option -l (listening address) requires a value");
+					return SERV_ERR_ARGS;
 				} else if (optopt == 'd') {
 					error("Option -d (directory) requires a value");
 					return SERV_ERR_ARGS;
+				} else if (optopt == 'u') {
+					error("Option -u (upload directory) requires a value");
+					return SERV_ERR_ARGS;
+				} else if (optopt == 'm') {
+					error("Option -m (maximum body size) requires a value");
+					return SERV_ERR_ARGS;
+				} else if (optopt == 'x') {
+					error("Option -x (reverse proxy route) requires a value");
+					return SERV_ERR_ARGS;
+				} else if (optopt == 'f') {
+					error("Option -f (FastCGI route) requires a value");
+					return SERV_ERR_ARGS;
+				} else if (optopt == 'L') {
+					error("Option -L (rate limits) requires a value");
+					return SERV_ERR_ARGS;
+				} else if (optopt == 'A') {
+					error("Option -A (admission control) requires a value");
+					return SERV_ERR_ARGS;
+				} else if (optopt == 'C') {
+					error("Option -C (page cache warming) requires a value");
+					return SERV_ERR_ARGS;
+				} else if (optopt == 'w') {
+					error("Option -w (worker threads) requires a value");
+					return SERV_ERR_ARGS;
+				} else if (optopt == 'T') {
+					error("Option -T (trace file) requires a value");
+					return SERV_ERR_ARGS;
+				} else if (optopt == 'S') {
+					error("Option -S (socket tuning) requires a value");
+					return SERV_ERR_ARGS;
+				} else if (optopt == 'R') {
+					error("Option -R (capture file) requires a value");
+					return SERV_ERR_ARGS;
+				} else if (optopt == 'c') {
+					error("Option -c (configuration file) requires a value");
+					return SERV_ERR_ARGS;
+				} else if (optopt == 'r') {
+					error("Option -r (route) requires a value");
+					return SERV_ERR_ARGS;
+				} else if (optopt == 'b') {
+					error("Option -b (asset bundle prefix) requires a value");
+					return SERV_ERR_ARGS;
 				} else {
 					char buf[32] = "Unknown command-line option '\0'";
 					buf[29] = (char) optopt;
@@ -66,9 +501,7 @@ int32_t main(int32_t argc, char** argv) {
 
 	/* Parse command-line arguments */
 	uint16_t listen_port = 8000;
-	size_t path_max_len = 2048;
-	char* data_dir = malloc(path_max_len);
-	memset(data_dir, 0, path_max_len);
+	struct Config config = {0};
 
 	if (listen_port_str != NULL) {
 		#ifdef WIN32
@@ -83,84 +516,589 @@ int32_t main(int32_t argc, char** argv) {
 		}
 	}
 
-	if (getcwd(data_dir, (int) path_max_len) == NULL) {
-		error("Could not get current working directory");
-		return SERV_ERR_MISC;
+	/* Set up the root route serving the data directory, and the reloadable
+	 * settings, which are overridden by the configuration file
+	 */
+	config.routes = calloc(1 + num_proxy_routes + num_fastcgi_routes +
+	                       num_file_routes + num_bundle_routes,
+	                       sizeof(struct Route));
+	struct Route* root_route = &config.routes[0];
+	root_route->prefix_str = malloc(2);
+	strcpy(root_route->prefix_str, "/");
+	root_route->prefix = parse_route_prefix(root_route->prefix_str);
+	root_route->handler = handle_files;
+	root_route->max_age = -1;
+	root_route->autoindex = autoindex;
+	config.num_routes = 1;
+
+	struct Settings args = {0};
+	args.data_dir = data_dir_str;
+	args.upload_dir = upload_dir_str;
+	args.max_upload_size = max_upload_str;
+	args.rate_limit = rate_limit_str;
+
+	struct Settings file = {0};
+	if (config_file_str != NULL && !read_config_file(config_file_str, &file)) {
+		return SERV_ERR_ARGS;
+	}
+
+	struct Settings settings;
+	merge_settings(&file, &args, &settings);
+	bool loaded = load_settings(&config, &settings, allow_put);
+	free_settings(&file);
+	if (!loaded) {
+		return SERV_ERR_ARGS;
 	}
+	set_log_level(config.log_level);
 
-	if (data_dir[strlen(data_dir)] != '/') {
-		data_dir[strlen(data_dir)] = '/';
+	if (admission_str != NULL) {
+		config.admission = malloc(sizeof(struct Admission));
+		if (!parse_admission(admission_str, config.admission)) {
+			error("Invalid admission control thresholds (-A) specified");
+			return SERV_ERR_ARGS;
+		}
 	}
 
-	if (data_dir_str != NULL) {
-		if (data_dir_str[0] == '/' || data_dir_str[0] == '~') {
-			error("Path (-d) must be relative");
+	if (warmup_str != NULL) {
+		config.warmup = malloc(sizeof(struct Warmup));
+		if (!parse_warmup(warmup_str, config.warmup)) {
+			error("Invalid page cache warming options (-C) specified");
 			return SERV_ERR_ARGS;
 		}
+	}
 
-		strcat(data_dir, data_dir_str);
+	if (workers_str != NULL) {
+		config.workers = malloc(sizeof(struct Workers));
+		if (!parse_workers(workers_str, config.workers)) {
+			error("Invalid worker threads (-w) specified");
+			return SERV_ERR_ARGS;
+		}
+	}
 
-		if (data_dir[strlen(data_dir)] != '/') {
-			data_dir[strlen(data_dir)] = '/';
+	if (tuning_str != NULL) {
+		config.tuning = malloc(sizeof(struct SocketTuning));
+		if (!parse_socket_tuning(tuning_str, config.tuning)) {
+			error("Invalid socket tuning (-S) specified");
+			return SERV_ERR_ARGS;
 		}
 	}
 
-	char* new_data_dir = realloc(data_dir, strlen(data_dir) + 1);
-	if (new_data_dir != NULL) {
-		data_dir = new_data_dir;
+	if (trace_str != NULL && !start_tracing(trace_str)) {
+		return SERV_ERR_ARGS;
 	}
 
-	char* buf = malloc(26);
-	sprintf(buf, "Listening on port '%d'", listen_port);
+	if (record_str != NULL && !start_recording(record_str)) {
+		return SERV_ERR_ARGS;
+	}
+
+	/* Set up the other routes */
+	size_t i;
+	for (i = 0; i < num_proxy_routes; i++) {
+		if (!parse_proxy_route(proxy_route_strs[i],
+		                       &config.routes[config.num_routes])) {
+			error("Invalid reverse proxy route (-x) specified");
+			return SERV_ERR_ARGS;
+		}
+		config.num_routes++;
+	}
+
+	for (i = 0; i < num_fastcgi_routes; i++) {
+		if (!parse_fastcgi_route(fastcgi_route_strs[i], config.data_dir,
+		                         &config.routes[config.num_routes])) {
+			error("Invalid FastCGI route (-f) specified");
+			return SERV_ERR_ARGS;
+		}
+		config.num_routes++;
+	}
+
+	for (i = 0; i < num_file_routes; i++) {
+		if (!parse_route(route_strs[i], &config.routes[config.num_routes])) {
+			error("Invalid route (-r) specified");
+			return SERV_ERR_ARGS;
+		}
+		config.num_routes++;
+	}
+
+	if (num_bundle_routes > 0 && serv_bundle.num_files == 0) {
+		error("This server was built without an asset bundle (SERV_BUNDLE_DIR)");
+		return SERV_ERR_ARGS;
+	}
+
+	for (i = 0; i < num_bundle_routes; i++) {
+		struct Route* route = &config.routes[config.num_routes];
+		if (bundle_route_strs[i][0] != '/') {
+			error("Invalid asset bundle prefix (-b) specified");
+			return SERV_ERR_ARGS;
+		}
+
+		route->prefix_str = malloc(strlen(bundle_route_strs[i]) + 1);
+		strcpy(route->prefix_str, bundle_route_strs[i]);
+		route->prefix = parse_route_prefix(route->prefix_str);
+		route->methods = METHOD_BIT(Get) | METHOD_BIT(Head);
+		route->handler = handle_bundle;
+		route->max_age = -1;
+		route->data = (void*) &serv_bundle;
+		config.num_routes++;
+	}
+
+	free(proxy_route_strs);
+	free(fastcgi_route_strs);
+	free(route_strs);
+	free(bundle_route_strs);
+
+	if ((config.router = build_router(config.routes,
+	                                  config.num_routes)) == NULL) {
+		return SERV_ERR_ARGS;
+	}
+
+	/* Set up the listeners, adding the localhost listener on the `-p` port if
+	 * that was given or if there are no other listeners
+	 */
+	config.listeners = calloc(num_listener_strs + 1, sizeof(struct Listener));
+	for (i = 0; i < num_listener_strs; i++) {
+		if (!parse_listener(listener_strs[i],
+		                    &config.listeners[config.num_listeners])) {
+			error("Invalid listening address (-l) specified");
+			return SERV_ERR_ARGS;
+		}
+		config.num_listeners++;
+	}
+
+	free(listener_strs);
+
+	if (listen_port_str != NULL || config.num_listeners == 0) {
+		char port_listener_str[16];
+		sprintf(port_listener_str, "[::1]:%u", (unsigned int) listen_port);
+		if (!parse_listener(port_listener_str,
+		                    &config.listeners[config.num_listeners])) {
+			error("Invalid listen port (-p) specified");
+			return SERV_ERR_ARGS;
+		}
+		config.num_listeners++;
+	}
+
+	char* buf;
+	for (i = 0; i < config.num_listeners; i++) {
+		if (config.listeners[i].cert_file != NULL &&
+		    !create_tls_context(&config.listeners[i])) {
+			return SERV_ERR_ARGS;
+		}
+
+		buf = malloc(64 + strlen(config.listeners[i].name) + 1);
+		if (config.listeners[i].backlog > 0) {
+			sprintf(buf, "Listening on '%s'%s (backlog %ld)",
+			        config.listeners[i].name,
+			        config.listeners[i].tls != NULL ? " with TLS" : "",
+			        (long) config.listeners[i].backlog);
+		} else {
+			sprintf(buf, "Listening on '%s'%s", config.listeners[i].name,
+			        config.listeners[i].tls != NULL ? " with TLS" : "");
+		}
+		info(buf);
+		free(buf);
+	}
+
+	buf = malloc(20 + strlen(config.data_dir) + 1);
+	sprintf(buf, "Serving data from '%s'", config.data_dir);
 	info(buf);
 	free(buf);
 
-	buf = malloc(20 + strlen(data_dir) + 1);
-	sprintf(buf, "Serving data from '%s'", data_dir);
-	info(buf);
+	if (config.upload_dir != NULL) {
+		buf = malloc(34 + strlen(config.upload_dir) + 1);
+		sprintf(buf, "Storing POST request bodies in '%s'", config.upload_dir);
+		info(buf);
+		free(buf);
+	}
+
+	if (allow_put) {
+		info("Allowing PUT requests to the data directory");
+	}
+
+	if (config_file_str != NULL) {
+		buf = malloc(48 + strlen(config_file_str) + 1);
+		sprintf(buf, "Reloading the settings in '%s' on SIGHUP",
+		        config_file_str);
+		info(buf);
+		free(buf);
+	}
+
+	if (autoindex) {
+		info("Listing directories in the data directory");
+	}
+
+	if (config.rate_limit != NULL) {
+		buf = malloc(96);
+		sprintf(buf, "Limiting clients to %lu connections and %lu requests "
+		             "per second", (unsigned long) config.rate_limit->conn_rate,
+		        (unsigned long) config.rate_limit->req_rate);
+		info(buf);
+		free(buf);
+	}
+
+	if (config.admission != NULL) {
+		info("Shedding load when overloaded");
+	}
+
+	if (config.workers != NULL) {
+		buf = malloc(96);
+		sprintf(buf, "Serving connections with %u worker threads%s",
+		        (unsigned int) config.workers->num_workers,
+		        config.workers->rx_cpu ? ", pinned to the receiving CPUs" :
+		        config.workers->pin ? ", pinned to CPUs" : "");
+		info(buf);
+		free(buf);
+	}
+
+	if (config.tuning != NULL) {
+		struct SocketTuning* tuning = config.tuning;
+		buf = malloc(200);
+		sprintf(buf, "Using the '%s' socket tuning profile (defer %lds, fast "
+		        "open queue %ld, accept batch %u, %s, send buffer %ld, receive "
+		        "buffer %ld)", tuning->profile, (long) tuning->defer_secs,
+		        (long) tuning->fastopen, (unsigned int) tuning->batch,
+		        tuning->cork ? "corked" : "uncorked",
+		        (long) tuning->send_buffer, (long) tuning->recv_buffer);
+		info(buf);
+		free(buf);
+	}
+
+	for (i = 1; i < config.num_routes; i++) {
+		struct Route* route = &config.routes[i];
+		if (route->handler == handle_proxy) {
+			struct ProxyRoute* proxy = route->data;
+			size_t j;
+			for (j = 0; j < proxy->num_upstreams; j++) {
+				buf = malloc(40 + strlen(route->prefix_str) +
+				             strlen(proxy->upstreams[j].name) + 1);
+				sprintf(buf, "Forwarding requests for '%s' to '%s'",
+				        route->prefix_str, proxy->upstreams[j].name);
+				info(buf);
+				free(buf);
+			}
+		} else if (route->handler == handle_fastcgi) {
+			struct FastcgiRoute* fastcgi = route->data;
+			buf = malloc(80 + strlen(route->prefix_str) +
+			             strlen(route->root) + strlen(fastcgi->name) + 1);
+			sprintf(buf, "Running scripts for '%s' from '%s' on '%s' (up to "
+			        "%lu at once)", route->prefix_str, route->root,
+			        fastcgi->name, (unsigned long) fastcgi->max_conns);
+			info(buf);
+			free(buf);
+		} else if (route->handler == handle_bundle) {
+			buf = malloc(60 + strlen(route->prefix_str) + 1);
+			sprintf(buf, "Serving requests for '%s' from the asset bundle "
+			        "(%lu files)", route->prefix_str,
+			        (unsigned long) serv_bundle.num_files);
+			info(buf);
+			free(buf);
+		} else {
+			buf = malloc(64 + strlen(route->prefix_str) +
+			             strlen(route->root) + 1);
+			sprintf(buf, "Serving requests for '%s' from '%s'%s",
+			        route->prefix_str, route->root,
+			        route->autoindex ? " with directory listings" : "");
+			info(buf);
+			free(buf);
+		}
+	}
+
+	scan_init();
+	buf = malloc(30 + strlen(scan_impl_name()) + 1);
+	sprintf(buf, "Using the '%s' request scanner", scan_impl_name());
+	debug(buf);
 	free(buf);
 
-	/* Start listening */
-	Socket sock = create_socket(listen_port);
+	/* Warm the page cache before accepting connections (on an upgrade, the
+	 * old process keeps serving in the meantime)
+	 */
+	if (config.warmup != NULL) {
+		warm_page_cache(config.warmup, &config);
+	}
+
+	/* Start listening, reusing the listeners inherited from the old process
+	 * on an upgrade
+	 */
+	for (i = 0; i < config.num_listeners; i++) {
+		struct Listener* listener = &config.listeners[i];
+		if (take_inherited_listener(listener)) {
+			buf = malloc(32 + strlen(listener->name) + 1);
+			sprintf(buf, "Reusing the listener on '%s'", listener->name);
+			debug(buf);
+			free(buf);
+		} else {
+			listener->sock = create_listener(&listener->addr,
+			                                 listener->addr_len,
+			                                 listener->backlog);
+		}
+
+		if (config.tuning != NULL) {
+			tune_listener(listener->sock, listener, config.tuning);
+		}
+	}
+
+	set_response_tuning(config.tuning);
+
+	#ifndef _WIN32
+	/* Clients closing their connection early (which is common with HTTP/2
+	 * streams being cancelled) shouldn't stop the server
+	 */
+	signal(SIGPIPE, SIG_IGN);
+	#endif
+
+	int32_t upgrade_fd = upgrade_init();
+
+	stats_signal_init();
+	if (config_file_str != NULL) {
+		reload_signal_init();
+	}
+
+	/* The configuration is replaced on a reload, the parts that can't be
+	 * reloaded stay shared with `config`
+	 */
+	struct Config* current = &config;
+	publish_config(current, NULL);
+
+	if (config.workers != NULL) {
+		if (!start_workers(config.workers, serve_accepted, &config)) {
+			return SERV_ERR_MISC;
+		}
+	}
+
+	if (!start_proxy_probes(config.routes, config.num_routes)) {
+		return SERV_ERR_MISC;
+	}
+
+	upgrade_ready();
+
+	/* Serve HTTP requests, waiting for connections on any listener, for
+	 * upgrade requests (the entry after the listeners in `poll_fds`) and,
+	 * during an upgrade, for the new process to become ready (the last entry)
+	 */
+	struct pollfd* poll_fds = calloc(config.num_listeners + 2,
+	                                 sizeof(struct pollfd));
+	for (i = 0; i < config.num_listeners; i++) {
+		poll_fds[i].fd = config.listeners[i].sock;
+		poll_fds[i].events = POLLIN;
+	}
+	poll_fds[config.num_listeners].fd = upgrade_fd;
+	poll_fds[config.num_listeners].events = POLLIN;
+	struct pollfd* upgrade_poll_fd = &poll_fds[config.num_listeners + 1];
+	upgrade_poll_fd->fd = -1;
+	upgrade_poll_fd->events = POLLIN;
 
-	/* Serve HTTP requests */
 	while (true) {
-		Socket incoming;
-		if (!accept_connection(sock, &incoming)) {
-			error("Could not accept incoming connection");
-			continue;
+		/* Replaced configurations are freed once no connection uses them */
+		int32_t timeout = reclaim_configs() ? SERV_RELOAD_RECLAIM_MS : -1;
+		int32_t upgrade_wait = upgrade_timeout();
+		if (upgrade_wait >= 0 && (timeout < 0 || upgrade_wait < timeout)) {
+			timeout = upgrade_wait;
+		}
+		int32_t decay_wait = config.admission != NULL ?
+		                     admission_timeout(config.admission) : -1;
+		if (decay_wait >= 0 && (timeout < 0 || decay_wait < timeout)) {
+			timeout = decay_wait;
 		}
 
-		struct Buffer buffer = new_buffer(0);
-		if (!receive(incoming, &buffer)) {
-			error("Could not read any data from connection");
-			free_buffer(buffer);
-			continue;
+		int32_t ready = poll(poll_fds, config.num_listeners + 2, timeout);
+
+		/* `SIGUSR1` and `SIGHUP` interrupt `poll` */
+		if (stats_requested()) {
+			if (config.workers != NULL) {
+				log_worker_stats(config.workers);
+			}
+			log_alloc_stats();
+		}
+
+		if (reload_requested()) {
+			struct Config* reloaded = reload_config(&config, current,
+			                                        config_file_str, &args,
+			                                        allow_put);
+			if (reloaded != NULL) {
+				publish_config(reloaded, current == &config ? NULL :
+				                         free_reloaded_config);
+				current = reloaded;
+				set_log_level(current->log_level);
+
+				buf = malloc(64 + strlen(current->data_dir) + 1);
+				sprintf(buf, "Reloaded the settings, serving data from '%s'",
+				        current->data_dir);
+				info(buf);
+				free(buf);
+			} else {
+				error("Could not reload the settings, keeping the old ones");
+			}
+		}
+
+		/* Connections are accepted until the new process started by an
+		 * upgrade is ready
+		 */
+		if (upgrade_poll_fd->fd >= 0 &&
+		    ((ready > 0 && upgrade_poll_fd->revents != 0) ||
+		     upgrade_timeout() == 0)) {
+			bool took_over;
+			if (finish_upgrade(&took_over)) {
+				upgrade_poll_fd->fd = -1;
+				if (took_over) {
+					stop_listening(&config);
+					break;
+				}
+			}
 		}
 
-		char* http_req = buffer_to_str(buffer);
+		/* Without new connections, the lag of the last ones decays */
+		if (ready == 0 && config.admission != NULL) {
+			admission_decay(config.admission);
+		}
 
-		struct Request req = {0};
-		if (!parse_request(http_req, &req)) {
-			error("Could not parse HTTP request");
-			free(http_req);
-			free_path(req.path);
-			close_socket(incoming);
+		if (ready <= 0) {
 			continue;
 		}
 
-		free(http_req);
+		if ((poll_fds[config.num_listeners].revents & POLLIN) &&
+		    upgrade_requested()) {
+			info("Upgrade requested, starting a new server process");
+			upgrade_poll_fd->fd = start_upgrade(argv, &config);
+		}
 
-		if (!handle_request(&req, incoming, data_dir)) {
-			error("Could not handle HTTP request");
+		bool paused = false;
+
+		uint32_t batch = config.tuning != NULL ? config.tuning->batch : 1;
+
+		for (i = 0; i < config.num_listeners; i++) {
+			if (!(poll_fds[i].revents & POLLIN)) {
+				continue;
+			}
+
+			/* Accept up to a batch of connections, until the (then
+			 * non-blocking) listener has no more pending ones
+			 */
+			uint32_t accepted;
+			for (accepted = 0; accepted < batch; accepted++) {
+				/* When overloaded, either leave the connection in the accept
+				 * queue for now, or shed it with a 503 response
+				 */
+				enum AdmissionResult admission = Admit;
+				if (config.admission != NULL) {
+					admission = admission_check(config.admission,
+					                            config.listeners[i].sock);
+				}
+				if (admission == Pause) {
+					paused = true;
+					break;
+				}
+
+				Socket incoming;
+				struct sockaddr_storage peer;
+				if (!accept_connection(config.listeners[i].sock, &incoming,
+				                       &peer)) {
+					#ifndef _WIN32
+					if (errno == EAGAIN || errno == EWOULDBLOCK) {
+						break;
+					}
+					#endif
+					error("Could not accept incoming connection");
+					break;
+				}
+
+				/* TLS clients can't read the plaintext 503, so they are just
+				 * disconnected
+				 */
+				if (admission == Shed && config.listeners[i].tls != NULL) {
+					close_socket(incoming);
+					continue;
+				} else if (admission == Shed) {
+					admission_shed(config.admission, incoming);
+					continue;
+				}
+
+				/* Clients over their connection rate limit are either
+				 * disconnected right away or get a 429 response
+				 */
+				uint64_t client = rate_limit_key(&peer);
+				bool allowed = current->rate_limit == NULL ||
+				               rate_limit_connection(current->rate_limit,
+				                                     client);
+				if (!allowed && current->rate_limit->close) {
+					debug("Closing a connection over the rate limit");
+					close_socket(incoming);
+					continue;
+				}
+
+				if (config.admission != NULL) {
+					admission_begin(config.admission);
+				}
+
+				struct Trace* trace = trace_accept(incoming);
+				if (config.workers != NULL) {
+					dispatch_connection(config.workers, incoming, client,
+					                    allowed, &config.listeners[i], trace);
+				} else {
+					serve_accepted(incoming, client, allowed,
+					               &config.listeners[i], trace, &config);
+				}
+			}
 		}
 
-		free_path(req.path);
-		close_socket(incoming);
+		/* Wait for the load to go down (but not for upgrade requests) before
+		 * accepting again
+		 */
+		if (paused) {
+			poll(&poll_fds[config.num_listeners], 1, SERV_ADMISSION_PAUSE_MS);
+			admission_decay(config.admission);
+		}
+	}
+
+	info("Stopped accepting connections, exiting");
+
+	if (config.workers != NULL) {
+		stop_workers(config.workers);
 	}
+	stop_proxy_probes();
+	if (current != &config) {
+		free_reloaded_config(current);
+	}
+	reclaim_configs();
+	stop_tracing();
+	stop_recording();
 
-	close_socket(sock);
-	free(data_dir);
+	free(poll_fds);
+	for (i = 0; i < config.num_listeners; i++) {
+		close_socket(config.listeners[i].sock);
+		free_tls_context(&config.listeners[i]);
+		free_listener(&config.listeners[i]);
+	}
+	free(config.listeners);
+	free(config.data_dir);
+	free(config.upload_dir);
+	free_router(config.router);
+	for (i = 0; i < config.num_routes; i++) {
+		if (config.routes[i].handler == handle_proxy) {
+			free_proxy_route(&config.routes[i]);
+		} else if (config.routes[i].handler == handle_fastcgi) {
+			free_fastcgi_route(&config.routes[i]);
+		} else {
+			free_route(&config.routes[i]);
+		}
+	}
+	free(config.routes);
+	if (config.owns_rate_limit) {
+		free(config.rate_limit);
+	}
+	if (config.admission != NULL) {
+		free_admission(config.admission);
+		free(config.admission);
+	}
+	if (config.warmup != NULL) {
+		free_warmup(config.warmup);
+		free(config.warmup);
+	}
+	if (config.workers != NULL) {
+		free_workers(config.workers);
+		free(config.workers);
+	}
+	free(config.tuning);
+	close_proxy_pool();
+	free_autoindex_cache();
 
 	return EXIT_SUCCESS;
 }
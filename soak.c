@@ -0,0 +1,144 @@
+/* A soak test for finding leaks in the server, sending many sequential
+ * requests for the same file and comparing the server's resident memory
+ * after a warm-up with its resident memory at the end
+ *
+ * To compile and run, start the server (ideally built with
+ * "-DSERV_ALLOC_STATS=ON", so the statistics of every allocation site are
+ * logged at the end) and run "./soak $(pidof c_http_server) ::1 8000 /file".
+ * The exit code is 1 if the memory grew by more than `SOAK_TOLERANCE_KIB`.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <netdb.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+/* The default number of requests */
+#define SOAK_REQUESTS 1000000
+/* The number of requests before the first memory sample, for the server's
+ * caches and pools to fill up
+ */
+#define SOAK_WARMUP 10000
+/* How much the server's memory may grow after the warm-up, in KiB */
+#define SOAK_TOLERANCE_KIB 1024
+
+static struct addrinfo* soak_addr;
+
+/* Returns the resident memory of the process `pid` in KiB, or 0 if it can't
+ * be read
+ */
+static uint64_t soak_rss_kib(long pid) {
+	char path[64];
+	sprintf(path, "/proc/%ld/statm", pid);
+
+	FILE* statm = fopen(path, "r");
+	if (statm == NULL) {
+		return 0;
+	}
+
+	unsigned long size = 0;
+	unsigned long resident = 0;
+	if (fscanf(statm, "%lu %lu", &size, &resident) != 2) {
+		resident = 0;
+	}
+	fclose(statm);
+
+	return (uint64_t) resident * (uint64_t) sysconf(_SC_PAGESIZE) / 1024;
+}
+
+/* Send `request` on a new connection and read the response until the server
+ * closes the connection. Returns false if the server isn't reachable.
+ */
+static bool soak_request(const char* request, size_t len) {
+	int sock = socket(soak_addr->ai_family, SOCK_STREAM, 0);
+	if (sock < 0 || connect(sock, soak_addr->ai_addr,
+	                        soak_addr->ai_addrlen) != 0) {
+		perror("connect");
+		if (sock >= 0) {
+			close(sock);
+		}
+		return false;
+	}
+
+	int one = 1;
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	char buf[65536];
+	bool ok = send(sock, request, len, 0) == (ssize_t) len;
+	while (ok && recv(sock, buf, sizeof(buf), 0) > 0) {}
+
+	close(sock);
+	return ok;
+}
+
+int main(int argc, char** argv) {
+	if (argc != 5 && argc != 6) {
+		fputs("usage: soak PID HOST PORT PATH [REQUESTS]\n", stderr);
+		return 1;
+	}
+
+	long pid = strtol(argv[1], NULL, 10);
+	uint64_t requests = argc == 6 ? strtoul(argv[5], NULL, 10) : SOAK_REQUESTS;
+	if (soak_rss_kib(pid) == 0 || requests <= SOAK_WARMUP) {
+		fputs("Invalid PID or number of requests\n", stderr);
+		return 1;
+	}
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(argv[2], argv[3], &hints, &soak_addr) != 0) {
+		fputs("Invalid address\n", stderr);
+		return 1;
+	}
+
+	char request[1024];
+	snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\n"
+	         "Connection: close\r\n\r\n", argv[4], argv[2]);
+	size_t len = strlen(request);
+
+	uint64_t warm_kib = 0;
+	uint64_t i;
+	for (i = 0; i < requests; i++) {
+		if (!soak_request(request, len)) {
+			freeaddrinfo(soak_addr);
+			return 1;
+		}
+
+		if (i + 1 == SOAK_WARMUP) {
+			warm_kib = soak_rss_kib(pid);
+		}
+		if ((i + 1) % (requests / 10) == 0) {
+			printf("%8lu requests: %lu KiB resident\n", (unsigned long) (i + 1),
+			       (unsigned long) soak_rss_kib(pid));
+			fflush(stdout);
+		}
+	}
+
+	uint64_t end_kib = soak_rss_kib(pid);
+	printf("resident after the warm-up: %lu KiB, at the end: %lu KiB\n",
+	       (unsigned long) warm_kib, (unsigned long) end_kib);
+
+	/* Have the server log its allocation statistics */
+	kill((pid_t) pid, SIGUSR1);
+
+	freeaddrinfo(soak_addr);
+	if (end_kib > warm_kib + SOAK_TOLERANCE_KIB) {
+		printf("the server's memory grew by %lu KiB\n",
+		       (unsigned long) (end_kib - warm_kib));
+		return 1;
+	}
+
+	return 0;
+}
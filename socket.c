@@ -1,14 +1,30 @@
 /* Implementation of `socket.h`, see that file for documentation and types */
 
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+
 #include "socket.h"
 
 #include <stdio.h>
 #include <unistd.h>
 #include <memory.h>
+#include <string.h>
 #include <stdlib.h>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
 #include "log.h"
 #include "misc.h"
+#include "trace.h"
+
+#include "alloc.h"
 
 void close_socket(Socket sock) {
 	#ifdef _WIN32
@@ -21,6 +37,20 @@ void close_socket(Socket sock) {
 }
 
 Socket create_socket(uint16_t listen_port) {
+	struct sockaddr_storage addr = {0};
+	struct sockaddr_in6* listen_addr = (struct sockaddr_in6*) &addr;
+	listen_addr->sin6_family = AF_INET6;
+	/* Set the address to ::1 (localhost) */
+	memset(&listen_addr->sin6_addr, 0, sizeof(listen_addr->sin6_addr));
+	((uint16_t*) (&listen_addr->sin6_addr))[7] = htons(1);
+	/* Set the port to the one passed to `create_socket` */
+	listen_addr->sin6_port = htons(listen_port);
+
+	return create_listener(&addr, sizeof(struct sockaddr_in6), 0);
+}
+
+Socket create_listener(const struct sockaddr_storage* addr,
+                       socklen_t addr_len, int32_t backlog) {
 	#ifdef _WIN32
 	/* Initialize Windows Sockets version 2.2. This is not required on Linux. */
 	struct WSAData wsa_data;
@@ -39,18 +69,9 @@ Socket create_socket(uint16_t listen_port) {
 	char* so_false = (char*) &so_false_int;
 	int so_size = sizeof(int);
 
-	struct sockaddr_in6 listen_addr = {0};
-	/* Set the address to ::1 (localhost) */
-	memset(&listen_addr.sin6_addr, 0, sizeof(listen_addr.sin6_addr));
-	((uint16_t*) (&listen_addr.sin6_addr))[7] = htons(1);
-	/* Set the port to the one passed to `create_socket` */
-	listen_addr.sin6_port = htons(listen_port);
-
-	int32_t addr_size = sizeof(listen_addr);
-	struct sockaddr* addr = (struct sockaddr*) &listen_addr;
-	addr->sa_family = AF_INET6;
-
-	Socket sock = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
+	bool tcp = addr->ss_family == AF_INET6 || addr->ss_family == AF_INET;
+	Socket sock = socket(addr->ss_family, SOCK_STREAM | SERV_SOCK_CLOEXEC,
+	                     tcp ? IPPROTO_TCP : 0);
 
 	#ifdef _WIN32
 	if (sock == INVALID_SOCKET) {
@@ -69,14 +90,34 @@ Socket create_socket(uint16_t listen_port) {
 	 * - On Unix-like OSs, it allows a process to bind to a recently-closed
 	 *   socket (which can occasionally speed up socket initialization)
 	 */
-	#ifdef _WIN32
-	int32_t res = setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, so_false, so_size);
-	#else
-	int32_t res = setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, so_true, so_size);
+	int32_t res = 0;
+	if (tcp) {
+		#ifdef _WIN32
+		res = setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, so_false, so_size);
+		#else
+		res = setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, so_true, so_size);
+		#endif
+		res = res || setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, so_true,
+		                        so_size);
+	}
+	if (!res && addr->ss_family == AF_INET6) {
+		res = setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, so_false, so_size);
+	}
+
+	#ifndef _WIN32
+	/* Remove a Unix domain socket file left over from an earlier run, but
+	 * never any other kind of file
+	 */
+	struct stat stat_buf;
+	if (addr->ss_family == AF_UNIX &&
+	    stat(((struct sockaddr_un*) addr)->sun_path, &stat_buf) == 0 &&
+	    S_ISSOCK(stat_buf.st_mode)) {
+		unlink(((struct sockaddr_un*) addr)->sun_path);
+	}
 	#endif
-	if (res || setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, so_false, so_size) ||
-	    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, so_true, so_size) ||
-	    bind(sock, addr, addr_size) || listen(sock, SOMAXCONN)) {
+
+	if (res || bind(sock, (const struct sockaddr*) addr, addr_len) ||
+	    listen(sock, backlog > 0 ? backlog : SOMAXCONN)) {
 		error("Could not open network socket");
 		close_socket(sock);
 		exit(SERV_ERR_SOCK);
@@ -85,10 +126,17 @@ Socket create_socket(uint16_t listen_port) {
 	return sock;
 }
 
-bool accept_connection(Socket sock, Socket* incoming) {
-	struct sockaddr_in6 addr;
+bool accept_connection(Socket sock, Socket* incoming,
+                       struct sockaddr_storage* peer) {
+	struct sockaddr_storage addr;
 	socklen_t addr_size = sizeof(addr);
+	memset(&addr, 0, sizeof(addr));
+	#ifdef __linux__
+	Socket res = accept4(sock, (struct sockaddr*) &addr, &addr_size,
+	                     SOCK_CLOEXEC);
+	#else
 	Socket res = accept(sock, (struct sockaddr*) &addr, &addr_size);
+	#endif
 	#ifdef _WIN32
 	if (res == INVALID_SOCKET || addr_size > sizeof(addr)) {
 		return false;
@@ -99,24 +147,36 @@ bool accept_connection(Socket sock, Socket* incoming) {
 	}
 	#endif
 	*incoming = res;
+	*peer = addr;
+
+	#if !defined(__linux__) && !defined(_WIN32)
+	/* Connections accepted on a non-blocking listener (see `tune.h`) inherit
+	 * `O_NONBLOCK` outside of Linux, but are used with blocking I/O
+	 */
+	int flags = fcntl(res, F_GETFL);
+	if (flags != -1 && (flags & O_NONBLOCK)) {
+		fcntl(res, F_SETFL, flags & ~O_NONBLOCK);
+	}
+	#endif
+
+	char host[64] = "unix";
+	char port[16] = "0";
+	if ((addr.ss_family != AF_INET6 && addr.ss_family != AF_INET) ||
+	    getnameinfo((struct sockaddr*) &addr, addr_size, host, sizeof(host),
+	                port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV)) {
+		strcpy(host, "unix");
+		strcpy(port, "0");
+	}
 
-	char trace_buf[103];
-	sprintf(trace_buf, "Accepted a new connection from "
-	                   "[%04x:%04x:%04x:%04x:%04x:%04x:%04x:%04x]:%d (socket "
-					   #ifdef WIN32
+	/* The message, the address and the socket's up to 20 digits */
+	char trace_buf[48 + sizeof(host) + sizeof(port) + 20];
+	sprintf(trace_buf, "Accepted a new connection from [%s]:%s (socket "
+	                   #ifdef WIN32
 	                   "%llu)"
-					   #else
-					   "%lu)"
-					   #endif
-					   , ntohs(((uint16_t*) (&addr.sin6_addr))[0]),
-	        ntohs(((uint16_t*) (&addr.sin6_addr))[1]),
-	        ntohs(((uint16_t*) (&addr.sin6_addr))[2]),
-	        ntohs(((uint16_t*) (&addr.sin6_addr))[3]),
-	        ntohs(((uint16_t*) (&addr.sin6_addr))[4]),
-	        ntohs(((uint16_t*) (&addr.sin6_addr))[5]),
-	        ntohs(((uint16_t*) (&addr.sin6_addr))[6]),
-	        ntohs(((uint16_t*) (&addr.sin6_addr))[7]), ntohs(addr.sin6_port),
-	        (uint64_t) res);
+	                   #else
+	                   "%lu)"
+	                   #endif
+	                   , host, port, (uint64_t) res);
 	debug(trace_buf);
 
 	return true;
@@ -172,3 +232,222 @@ bool receive(Socket sock, struct Buffer* buf) {
 	buf->len = res;
 	return true;
 }
+
+bool receive_until(Socket sock, struct Buffer* buf, const char* terminator,
+                   size_t max_len) {
+	size_t terminator_len = strlen(terminator);
+
+	while (buf->len < max_len) {
+		if (buf->len == buf->cap) {
+			size_t new_cap = min(buf->cap * 2, max_len);
+			uint8_t* new_buf = realloc(buf->buf, new_cap);
+			if (new_buf == NULL) {
+				return false;
+			}
+
+			buf->buf = new_buf;
+			buf->cap = new_cap;
+		}
+
+		int32_t res = recv(sock, (char*) buf->buf + buf->len,
+		                   (int) (min(buf->cap, max_len) - buf->len), 0);
+		if (res == -1) {
+			return false;
+		} else if (res == 0) {
+			return true;
+		}
+		trace_phase(TraceFirstByte);
+
+		char trace_buf[61];
+		sprintf(trace_buf, "Received %d bytes on socket "
+		#ifdef WIN32
+		"%llu"
+		#else
+		"%lu"
+		#endif
+		, res, (uint64_t) sock);
+		trace(trace_buf);
+
+		/* Only search the newly received bytes (and the end of the old ones,
+		 * in case the terminator was split between two calls to `recv`)
+		 */
+		size_t i = buf->len < terminator_len ? 0 : buf->len - terminator_len + 1;
+		buf->len += res;
+
+		for (; i + terminator_len <= buf->len; i++) {
+			if (memcmp(buf->buf + i, terminator, terminator_len) == 0) {
+				return true;
+			}
+		}
+	}
+
+	return true;
+}
+
+bool reader_read_line(struct Reader* reader, char* line, size_t cap) {
+	size_t len = 0;
+
+	while (true) {
+		size_t available;
+		if (reader->pending_len > 0) {
+			available = min(reader->pending_len, cap - len);
+			memcpy(line + len, reader->pending, available);
+		} else {
+			int32_t res = recv(reader->sock, line + len, (int) (cap - len),
+			                   MSG_PEEK);
+			if (res <= 0) {
+				return false;
+			}
+
+			available = res;
+		}
+
+		/* Only consume the bytes up to the end of the line */
+		char* end = memchr(line + len, '\n', available);
+		size_t consumed = end == NULL ? available :
+		                  (size_t) (end - (line + len)) + 1;
+
+		if (reader->pending_len > 0) {
+			reader->pending += consumed;
+			reader->pending_len -= consumed;
+		} else if (recv(reader->sock, line + len, (int) consumed, 0) !=
+		           (int32_t) consumed) {
+			return false;
+		}
+
+		len += consumed;
+
+		if (end != NULL) {
+			len--;
+			if (len > 0 && line[len - 1] == '\r') {
+				len--;
+			}
+
+			line[len] = '\0';
+			return true;
+		} else if (len == cap) {
+			return false;
+		}
+	}
+}
+
+bool parse_socket_addr(const char* str, bool passive,
+                       struct sockaddr_storage* addr, socklen_t* addr_len) {
+	memset(addr, 0, sizeof(*addr));
+
+	if (strncmp(str, "unix:", 5) == 0) {
+		#ifdef _WIN32
+		return false;
+		#else
+		struct sockaddr_un* unix_addr = (struct sockaddr_un*) addr;
+		if (strlen(str + 5) == 0 ||
+		    strlen(str + 5) >= sizeof(unix_addr->sun_path)) {
+			return false;
+		}
+
+		unix_addr->sun_family = AF_UNIX;
+		strcpy(unix_addr->sun_path, str + 5);
+		*addr_len = sizeof(struct sockaddr_un);
+		return true;
+		#endif
+	}
+
+	/* Split the string into the host and port */
+	const char* port = strrchr(str, ':');
+	if (port == NULL || port[1] == '\0') {
+		return false;
+	}
+
+	size_t host_len = port - str;
+	const char* host_start = str;
+	if (host_len >= 2 && str[0] == '[' && str[host_len - 1] == ']') {
+		host_start++;
+		host_len -= 2;
+	}
+
+	char* host = malloc(host_len + 1);
+	memcpy(host, host_start, host_len);
+	host[host_len] = '\0';
+
+	struct addrinfo hints = {0};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+	struct addrinfo* res = NULL;
+	int32_t status = getaddrinfo(host_len == 0 && passive ? NULL : host,
+	                             port + 1, &hints, &res);
+	free(host);
+
+	if (status != 0 || res == NULL) {
+		return false;
+	}
+
+	/* With an empty host, prefer the IPv6 wildcard address (which also
+	 * accepts IPv4 connections on dual-stack sockets)
+	 */
+	struct addrinfo* chosen = res;
+	struct addrinfo* cursor;
+	for (cursor = res; host_len == 0 && cursor != NULL; cursor = cursor->ai_next) {
+		if (cursor->ai_family == AF_INET6) {
+			chosen = cursor;
+			break;
+		}
+	}
+
+	memcpy(addr, chosen->ai_addr, chosen->ai_addrlen);
+	*addr_len = (socklen_t) chosen->ai_addrlen;
+	freeaddrinfo(res);
+
+	return true;
+}
+
+bool connect_socket(const struct sockaddr_storage* addr, socklen_t addr_len,
+                    Socket* sock) {
+	int32_t protocol = addr->ss_family == AF_INET6 ||
+	                   addr->ss_family == AF_INET ? IPPROTO_TCP : 0;
+	Socket res = socket(addr->ss_family, SOCK_STREAM | SERV_SOCK_CLOEXEC,
+	                    protocol);
+
+	#ifdef _WIN32
+	if (res == INVALID_SOCKET) {
+		return false;
+	}
+	#else
+	if (res < 0) {
+		return false;
+	}
+	#endif
+
+	if (connect(res, (const struct sockaddr*) addr, addr_len)) {
+		#ifdef _WIN32
+		closesocket(res);
+		#else
+		close(res);
+		#endif
+		return false;
+	}
+
+	if (protocol == IPPROTO_TCP) {
+		int so_true = 1;
+		setsockopt(res, IPPROTO_TCP, TCP_NODELAY, (char*) &so_true,
+		           sizeof(so_true));
+	}
+
+	*sock = res;
+	return true;
+}
+
+bool send_all(Socket sock, const char* data, size_t len) {
+	while (len > 0) {
+		int32_t res = send(sock, data, (int) len, 0);
+		if (res <= 0) {
+			return false;
+		}
+
+		data += res;
+		len -= res;
+	}
+
+	return true;
+}
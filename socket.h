@@ -18,6 +18,7 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/tcp.h>
+#include <netdb.h>
 #endif
 
 #ifdef _WIN32
@@ -26,24 +27,65 @@ typedef SOCKET Socket;
 typedef int32_t Socket;
 #endif
 
+/* The `socket` type flag for closing a socket on `exec`, if supported */
+#ifdef SOCK_CLOEXEC
+#define SERV_SOCK_CLOEXEC SOCK_CLOEXEC
+#else
+#define SERV_SOCK_CLOEXEC 0
+#endif
+
 /* The default Buffer capacity */
 #define SERV_DEFAULT_BUFFER_CAP 2048
 
 /* Close the provided socket. Any error will be ignored. */
 void close_socket(Socket sock);
 
-/* Create a new dual-stack (IPv4 and IPv6) TCP socket using the provided port.
- * The returned socket will be ready to accept new connections. If an error
- * occurs, this function will stop the server.
+/* Create a new dual-stack (IPv4 and IPv6) TCP socket listening on localhost
+ * (::1) using the provided port. The returned socket will be ready to accept
+ * new connections. If an error occurs, this function will stop the server.
  */
 Socket create_socket(uint16_t listen_port);
 
+/* Create a new socket listening on the given address (see
+ * `parse_socket_addr`), with a queue of up to `backlog` pending connections
+ * (or the system default if `backlog` is 0). IPv6 sockets are dual-stack, and
+ * a Unix domain socket left over at the same path is replaced. The socket is
+ * closed on `exec` (see `upgrade.h` for how listeners are inherited). The
+ * returned socket will be ready to accept new connections. If an error
+ * occurs, this function will stop the server.
+ */
+Socket create_listener(const struct sockaddr_storage* addr,
+                       socklen_t addr_len, int32_t backlog);
+
 /* Accept an incoming connection on a socket. Returns true if the connection
- * is accepted, false if an error occurs. The connection can be used via the
+ * is accepted, false if an error occurs (or, for a non-blocking socket, if no
+ * connection is pending, with `errno` set to `EAGAIN`/`EWOULDBLOCK`). The connection can be used via the
  * `incoming` `Socket`, which on success will contain the socket for the new
- * connection, ready to be used with `send`, `recv`, etc.
+ * connection, ready to be used with `send`, `recv`, etc., and `peer` will
+ * contain the address of the client.
+ */
+bool accept_connection(Socket sock, Socket* incoming,
+                       struct sockaddr_storage* peer);
+
+/* Parse a socket address from a string, which can be either "HOST:PORT" (with
+ * a host name or an IPv4 address), "[IPV6]:PORT", or "unix:PATH" for a Unix
+ * domain socket (not supported on Windows). If `passive` is true, the host
+ * may be empty (":PORT"), meaning all local addresses. Returns true if the
+ * address was parsed (and resolved) successfully.
+ */
+bool parse_socket_addr(const char* str, bool passive,
+                       struct sockaddr_storage* addr, socklen_t* addr_len);
+
+/* Open a new connection to the given address. Returns true if the connection
+ * was established, in which case `sock` contains the connected socket.
  */
-bool accept_connection(Socket sock, Socket* incoming);
+bool connect_socket(const struct sockaddr_storage* addr, socklen_t addr_len,
+                    Socket* sock);
+
+/* Send all of the `len` bytes in `data` to the socket. Returns false if an
+ * error occurs before all data was sent.
+ */
+bool send_all(Socket sock, const char* data, size_t len);
 
 /* A byte buffer with known length and capacity. The internal buffer `buf` is a
  * heap-allocated array, which should be `free`d after use
@@ -79,4 +121,32 @@ char* buffer_to_str(struct Buffer buf);
  */
 bool receive(Socket sock, struct Buffer* buf);
 
+/* Receive data into the provided buffer from the given socket, appending to
+ * any data already in it and growing it as required, until the buffer
+ * contains the null-terminated `terminator`, the connection is closed, or
+ * `max_len` bytes are in the buffer. Returns false if an error occurs, true
+ * otherwise. On success, `buf.len` may be 0 if the connection was closed
+ * without sending any data.
+ */
+bool receive_until(Socket sock, struct Buffer* buf, const char* terminator,
+                   size_t max_len);
+
+/* A reader for the data following a message head (e.g. an HTTP request body),
+ * which returns the `pending` bytes received together with the head first and
+ * then reads from the socket.
+ */
+struct Reader {
+	Socket sock;
+	const char* pending;
+	size_t pending_len;
+};
+
+/* Read a single line (up to and including "\n") from `reader` into `line`,
+ * without the line ending and null-terminated. Only the bytes of that line
+ * are consumed from the socket (using `MSG_PEEK`), so the data following the
+ * line can still be read directly from the socket. Returns false on error or
+ * if the line doesn't fit into `cap` bytes.
+ */
+bool reader_read_line(struct Reader* reader, char* line, size_t cap);
+
 #endif
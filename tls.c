@@ -0,0 +1,264 @@
+/* Implementation of `tls.h`, see that file for documentation and types */
+
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+
+#include "tls.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+#ifdef SERV_TLS
+
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include "alloc.h"
+
+struct TlsContext {
+	SSL_CTX* ctx;
+};
+
+/* A connection encrypted in user space by a relay thread */
+struct TlsRelay {
+	SSL* ssl;
+	/* The client's connection */
+	Socket sock;
+	/* The relay's end of the socket pair */
+	Socket plain;
+};
+
+/* Log the reason for the last OpenSSL error after `message` */
+static void tls_error(const char* message) {
+	char reason[256];
+	char buf[320];
+	ERR_error_string_n(ERR_get_error(), reason, sizeof(reason));
+	sprintf(buf, "%s: %s", message, reason);
+	error(buf);
+}
+
+/* Pick HTTP/2 if the client supports it, HTTP/1.1 otherwise */
+static int tls_select_alpn(SSL* ssl, const unsigned char** out,
+                           unsigned char* out_len, const unsigned char* in,
+                           unsigned int in_len, void* arg) {
+	static const unsigned char protocols[] = "\x02h2\x08http/1.1";
+	unsigned char* selected;
+	(void) ssl;
+	(void) arg;
+
+	if (SSL_select_next_proto(&selected, out_len, protocols,
+	                          sizeof(protocols) - 1, in, in_len) !=
+	    OPENSSL_NPN_NEGOTIATED) {
+		return SSL_TLSEXT_ERR_NOACK;
+	}
+
+	*out = selected;
+	return SSL_TLSEXT_ERR_OK;
+}
+
+bool create_tls_context(struct Listener* listener) {
+	SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+	if (ctx == NULL) {
+		tls_error("Could not create TLS context");
+		return false;
+	}
+
+	SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+
+	/* Let OpenSSL hand the record layer to the kernel after the handshake */
+	SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+
+	/* Clients can resume sessions with (stateless) session tickets, whose
+	 * key is generated on startup
+	 */
+	SSL_CTX_set_session_id_context(ctx, (const unsigned char*) "c_http_server",
+	                               13);
+	SSL_CTX_set_alpn_select_cb(ctx, tls_select_alpn, NULL);
+
+	if (SSL_CTX_use_certificate_chain_file(ctx, listener->cert_file) != 1) {
+		tls_error("Could not load TLS certificate");
+		SSL_CTX_free(ctx);
+		return false;
+	}
+	if (SSL_CTX_use_PrivateKey_file(ctx, listener->key_file,
+	                                SSL_FILETYPE_PEM) != 1 ||
+	    SSL_CTX_check_private_key(ctx) != 1) {
+		tls_error("Could not load TLS private key");
+		SSL_CTX_free(ctx);
+		return false;
+	}
+
+	listener->tls = malloc(sizeof(struct TlsContext));
+	listener->tls->ctx = ctx;
+	return true;
+}
+
+void free_tls_context(struct Listener* listener) {
+	if (listener->tls != NULL) {
+		SSL_CTX_free(listener->tls->ctx);
+		free(listener->tls);
+		listener->tls = NULL;
+	}
+}
+
+/* Relay a connection between the client (through OpenSSL) and the socket
+ * pair until either side closes it
+ */
+static void* tls_relay(void* arg) {
+	struct TlsRelay* relay = arg;
+	char buf[16384];
+
+	struct pollfd fds[2];
+	fds[0].fd = relay->sock;
+	fds[0].events = POLLIN;
+	fds[1].fd = relay->plain;
+	fds[1].events = POLLIN;
+
+	while (true) {
+		fds[0].revents = 0;
+		fds[1].revents = 0;
+
+		/* Data OpenSSL has already decrypted doesn't show up in `poll` */
+		if (SSL_pending(relay->ssl) == 0 && poll(fds, 2, -1) <= 0) {
+			break;
+		}
+
+		if (SSL_pending(relay->ssl) > 0 || fds[0].revents != 0) {
+			int32_t len = SSL_read(relay->ssl, buf, sizeof(buf));
+			if (len <= 0 || !send_all(relay->plain, buf, len)) {
+				break;
+			}
+		}
+
+		if (fds[1].revents != 0) {
+			int32_t len = recv(relay->plain, buf, sizeof(buf), 0);
+			if (len <= 0 || SSL_write(relay->ssl, buf, len) <= 0) {
+				break;
+			}
+		}
+	}
+
+	SSL_shutdown(relay->ssl);
+	SSL_free(relay->ssl);
+	close_socket(relay->sock);
+	close_socket(relay->plain);
+	free(relay);
+
+	return NULL;
+}
+
+/* Serve the connection through a relay thread. Returns false if it could not
+ * be started.
+ */
+static bool tls_start_relay(SSL* ssl, Socket incoming, Socket* plain) {
+	Socket pair[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SERV_SOCK_CLOEXEC, 0, pair) != 0) {
+		error("Could not create the TLS relay socket pair");
+		return false;
+	}
+
+	struct TlsRelay* relay = malloc(sizeof(struct TlsRelay));
+	relay->ssl = ssl;
+	relay->sock = incoming;
+	relay->plain = pair[1];
+
+	/* Signals are handled by the main thread (see `stats_signal_init`) */
+	sigset_t all;
+	sigset_t old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+
+	pthread_t thread;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	int32_t res = pthread_create(&thread, &attr, tls_relay, relay);
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (res != 0) {
+		error("Could not start the TLS relay thread");
+		close_socket(pair[0]);
+		close_socket(pair[1]);
+		free(relay);
+		return false;
+	}
+
+	*plain = pair[0];
+	return true;
+}
+
+bool tls_accept(const struct Listener* listener, Socket incoming,
+                Socket* plain) {
+	SSL* ssl = SSL_new(listener->tls->ctx);
+	if (ssl == NULL || SSL_set_fd(ssl, incoming) != 1) {
+		tls_error("Could not set up TLS connection");
+		SSL_free(ssl);
+		return false;
+	}
+
+	if (SSL_accept(ssl) != 1) {
+		debug("TLS handshake failed");
+		ERR_clear_error();
+		SSL_free(ssl);
+		return false;
+	}
+
+	/* With both directions offloaded (and nothing left over in OpenSSL's
+	 * buffers), the socket carries plaintext from here on
+	 */
+	bool ktls = BIO_get_ktls_send(SSL_get_wbio(ssl)) &&
+	            BIO_get_ktls_recv(SSL_get_rbio(ssl)) && !SSL_has_pending(ssl);
+
+	char buf[96];
+	sprintf(buf, "TLS handshake done (%s, %s%s)", SSL_get_version(ssl),
+	        ktls ? "kTLS" : "user space",
+	        SSL_session_reused(ssl) ? ", resumed" : "");
+	debug(buf);
+
+	if (ktls) {
+		/* The SSL doesn't own the socket, so this doesn't close it */
+		SSL_free(ssl);
+		*plain = incoming;
+		return true;
+	}
+
+	if (!tls_start_relay(ssl, incoming, plain)) {
+		SSL_free(ssl);
+		return false;
+	}
+
+	return true;
+}
+
+#else
+
+bool create_tls_context(struct Listener* listener) {
+	(void) listener;
+	error("This server was built without TLS support (SERV_TLS)");
+	return false;
+}
+
+void free_tls_context(struct Listener* listener) {
+	(void) listener;
+}
+
+bool tls_accept(const struct Listener* listener, Socket incoming,
+                Socket* plain) {
+	(void) listener;
+	(void) incoming;
+	(void) plain;
+	return false;
+}
+
+#endif
@@ -0,0 +1,40 @@
+/* TLS termination for listeners with a certificate (`-l ADDR,cert=,key=`).
+ * The handshake, including session resumption with session tickets, is done
+ * by OpenSSL, after which record encryption is handed to the kernel (kTLS),
+ * so that the connection can be used like a plaintext socket by all handlers
+ * and `sendfile` still sends files without copying them. Where the kernel
+ * can't take over (no "tls" module, or an unsupported cipher), a thread
+ * encrypts the connection in user space, relaying it through a socket pair.
+ *
+ * TLS support is only compiled in with `SERV_TLS` defined (the CMake option
+ * of the same name), since it needs OpenSSL and threads.
+ */
+
+#ifndef C_HTTP_SERVER_TLS_H
+#define C_HTTP_SERVER_TLS_H
+
+#include <stdbool.h>
+
+#include "config.h"
+#include "socket.h"
+
+/* Set up the TLS context of `listener` from its certificate and key files.
+ * Returns false (after logging the reason) if the files can't be loaded or
+ * the server was built without TLS support. The context should be freed with
+ * `free_tls_context` after use.
+ */
+bool create_tls_context(struct Listener* listener);
+
+/* Free the TLS context of a listener, if it has one */
+void free_tls_context(struct Listener* listener);
+
+/* Perform the TLS handshake on the `incoming` connection of a TLS listener.
+ * Returns false if it fails, in which case `incoming` should be closed.
+ * Otherwise, `plain` is set to the socket to serve the connection on, which
+ * is either `incoming` itself (with kTLS) or the relay's end of the socket
+ * pair. Either way, only `plain` should be closed after use.
+ */
+bool tls_accept(const struct Listener* listener, Socket incoming,
+                Socket* plain);
+
+#endif
@@ -0,0 +1,177 @@
+/* A benchmark for the server's TLS listeners, measuring full and resumed
+ * handshakes per second and the throughput of downloading a file, using a
+ * single local client connection at a time
+ *
+ * To compile and run, configure the CMake build with "-DSERV_TLS=ON", start
+ * the server with a TLS listener (e.g. "-l [::1]:8443,cert=c.pem,key=k.pem")
+ * and run "./tls_bench ::1 8443 /big-file".
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <netdb.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <openssl/ssl.h>
+
+/* How long each part of the benchmark runs, in seconds */
+#define BENCH_SECS 3
+
+static struct addrinfo* bench_addr;
+
+static double bench_now(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+/* Connect to the server and perform a TLS handshake, resuming `session` if
+ * it isn't NULL. Returns NULL on failure.
+ */
+static SSL* bench_connect(SSL_CTX* ctx, SSL_SESSION* session) {
+	int sock = socket(bench_addr->ai_family, SOCK_STREAM, 0);
+	if (sock < 0 || connect(sock, bench_addr->ai_addr,
+	                        bench_addr->ai_addrlen) != 0) {
+		perror("connect");
+		if (sock >= 0) {
+			close(sock);
+		}
+		return NULL;
+	}
+
+	int one = 1;
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	SSL* ssl = SSL_new(ctx);
+	SSL_set_fd(ssl, sock);
+	if (session != NULL) {
+		SSL_set_session(ssl, session);
+	}
+
+	if (SSL_connect(ssl) != 1) {
+		fputs("TLS handshake failed\n", stderr);
+		SSL_free(ssl);
+		close(sock);
+		return NULL;
+	}
+
+	return ssl;
+}
+
+/* Close the connection, shutting down TLS properly (sessions of connections
+ * that weren't aren't resumed)
+ */
+static void bench_close(SSL* ssl) {
+	int sock = SSL_get_fd(ssl);
+	SSL_shutdown(ssl);
+	SSL_free(ssl);
+	close(sock);
+}
+
+/* Count handshakes for `BENCH_SECS`, resuming sessions if `resume` is true */
+static void bench_handshakes(SSL_CTX* ctx, bool resume) {
+	SSL_SESSION* session = NULL;
+	uint64_t count = 0;
+	uint64_t resumed = 0;
+
+	double start = bench_now();
+	while (bench_now() - start < BENCH_SECS) {
+		SSL* ssl = bench_connect(ctx, session);
+		if (ssl == NULL) {
+			exit(1);
+		}
+
+		/* TLS 1.3 session tickets are only read after the handshake, so the
+		 * first connection sends a request and reads the whole response
+		 */
+		if (resume && session == NULL) {
+			char buf[4096];
+			SSL_write(ssl, "GET / HTTP/1.1\r\n\r\n", 18);
+			while (SSL_read(ssl, buf, sizeof(buf)) > 0) {}
+			session = SSL_get1_session(ssl);
+		}
+
+		resumed += SSL_session_reused(ssl);
+		count++;
+		bench_close(ssl);
+	}
+
+	double secs = bench_now() - start;
+	printf("%-9s handshakes: %8.1f/s (%lu of %lu resumed)\n",
+	       resume ? "resumed" : "full", (double) count / secs,
+	       (unsigned long) resumed, (unsigned long) count);
+
+	SSL_SESSION_free(session);
+}
+
+/* Download `path` repeatedly for `BENCH_SECS` and measure the throughput */
+static void bench_bulk(SSL_CTX* ctx, const char* host, const char* path) {
+	char request[1024];
+	char buf[65536];
+	uint64_t bytes = 0;
+	uint64_t requests = 0;
+
+	snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\n"
+	         "Connection: close\r\n\r\n", path, host);
+
+	double start = bench_now();
+	while (bench_now() - start < BENCH_SECS) {
+		SSL* ssl = bench_connect(ctx, NULL);
+		if (ssl == NULL) {
+			exit(1);
+		}
+
+		SSL_write(ssl, request, (int) strlen(request));
+
+		int len;
+		while ((len = SSL_read(ssl, buf, sizeof(buf))) > 0) {
+			bytes += (uint64_t) len;
+		}
+
+		requests++;
+		bench_close(ssl);
+	}
+
+	double secs = bench_now() - start;
+	printf("bulk throughput:  %8.1f MiB/s (%lu requests)\n",
+	       (double) bytes / secs / (1024 * 1024), (unsigned long) requests);
+}
+
+int main(int argc, char** argv) {
+	if (argc != 4) {
+		fputs("usage: tls_bench HOST PORT PATH\n", stderr);
+		return 1;
+	}
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(argv[1], argv[2], &hints, &bench_addr) != 0) {
+		fputs("Invalid address\n", stderr);
+		return 1;
+	}
+
+	/* The benchmark doesn't verify the (usually self-signed) certificate */
+	SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+	SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+	SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+
+	bench_handshakes(ctx, false);
+	bench_handshakes(ctx, true);
+	bench_bulk(ctx, argv[1], argv[3]);
+
+	SSL_CTX_free(ctx);
+	freeaddrinfo(bench_addr);
+	return 0;
+}
@@ -0,0 +1,227 @@
+/* Implementation of `trace.h`, see that file for documentation and types */
+
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#ifdef SERV_USDT
+#include <sys/sdt.h>
+#define SERV_PROBE(name, sock) DTRACE_PROBE1(c_http_server, name, (long) (sock))
+#else
+#define SERV_PROBE(name, sock)
+#endif
+
+#include "log.h"
+#include "upgrade.h"
+
+#include "alloc.h"
+
+/* The names of the spans ending at each phase in the trace file */
+static const char* const trace_span_names[NUM_TRACE_PHASES] = {
+	"accept",
+	"wait for request",
+	"receive and parse request",
+	"resolve file",
+	"send headers",
+	"send body",
+	"close"
+};
+
+/* The trace file, or NULL if connections aren't sampled */
+static FILE* trace_file = NULL;
+/* Held while writing to the trace file. On Windows, connections are served
+ * by one thread.
+ */
+#ifndef _WIN32
+static pthread_mutex_t trace_file_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+/* Whether no trace was written to the file yet */
+static bool trace_file_empty = true;
+/* 1 in `trace_sample` connections is traced */
+static uint64_t trace_sample = 1;
+static uint64_t trace_count = 0;
+/* The process ID in the trace file */
+static long trace_pid = 0;
+
+/* The connection being served by the current thread */
+static __thread struct Trace* trace_current = NULL;
+static __thread Socket trace_sock;
+/* The phases that the connection already reached, as bits */
+static __thread uint32_t trace_reached = 0;
+
+static void trace_lock(void) {
+	#ifndef _WIN32
+	pthread_mutex_lock(&trace_file_lock);
+	#endif
+}
+
+static void trace_unlock(void) {
+	#ifndef _WIN32
+	pthread_mutex_unlock(&trace_file_lock);
+	#endif
+}
+
+bool start_tracing(const char* str) {
+	char* path;
+	if (!parse_output_file(str, &path, &trace_sample)) {
+		error("Invalid tracing options (-T) specified");
+		return false;
+	}
+
+	if (*path == '\0' || (trace_file = fopen(path, "w")) == NULL) {
+		error("Could not create the trace file (-T)");
+		free(path);
+		return false;
+	}
+
+	#ifndef _WIN32
+	trace_pid = (long) getpid();
+	#endif
+
+	fputs("[\n", trace_file);
+	free(path);
+	return true;
+}
+
+void stop_tracing(void) {
+	if (trace_file == NULL) {
+		return;
+	}
+
+	trace_lock();
+	fputs("\n]\n", trace_file);
+	fclose(trace_file);
+	trace_file = NULL;
+	trace_unlock();
+}
+
+struct Trace* trace_accept(Socket sock) {
+	SERV_PROBE(accept, sock);
+
+	if (trace_file == NULL ||
+	    __atomic_fetch_add(&trace_count, 1, __ATOMIC_RELAXED) % trace_sample !=
+	    0) {
+		return NULL;
+	}
+
+	struct Trace* trace = calloc(1, sizeof(struct Trace));
+	trace->sock = sock;
+	trace->times[TraceAccept] = monotonic_us();
+	return trace;
+}
+
+void trace_attach(struct Trace* trace, Socket sock) {
+	trace_current = trace;
+	trace_sock = sock;
+	trace_reached = 1 << TraceAccept;
+}
+
+void trace_phase(enum TracePhase phase) {
+	if (trace_reached & (1 << phase)) {
+		return;
+	}
+	trace_reached |= 1 << phase;
+
+	switch (phase) {
+		case TraceAccept:
+			SERV_PROBE(accept, trace_sock);
+			break;
+		case TraceFirstByte:
+			SERV_PROBE(first_byte, trace_sock);
+			break;
+		case TraceParsed:
+			SERV_PROBE(parsed, trace_sock);
+			break;
+		case TraceResolved:
+			SERV_PROBE(resolved, trace_sock);
+			break;
+		case TraceHeadersSent:
+			SERV_PROBE(headers_sent, trace_sock);
+			break;
+		case TraceLastByte:
+			SERV_PROBE(last_byte, trace_sock);
+			break;
+		case TraceClose:
+		default:
+			SERV_PROBE(close, trace_sock);
+			break;
+	}
+
+	if (trace_current != NULL) {
+		trace_current->times[phase] = monotonic_us();
+	}
+}
+
+/* Write the spans of `trace` to the trace file */
+static void trace_write(const struct Trace* trace) {
+	long tid = 0;
+	#ifdef __linux__
+	tid = (long) syscall(SYS_gettid);
+	#endif
+
+	/* Format the events first, to hold the lock only while writing them */
+	char events[NUM_TRACE_PHASES * 160 + 256];
+	char* cursor = events;
+	uint64_t start = trace->times[TraceAccept];
+	cursor += sprintf(cursor, "{\"name\":\"connection\",\"cat\":\"connection\","
+	                          "\"ph\":\"X\",\"ts\":%lu,\"dur\":%lu,\"pid\":%ld,"
+	                          "\"tid\":%ld,\"args\":{\"socket\":%ld}}",
+	                  (unsigned long) start,
+	                  (unsigned long) (trace->times[TraceClose] - start),
+	                  trace_pid, tid, (long) trace->sock);
+
+	/* Each span starts at the previous phase that was reached */
+	uint64_t previous = start;
+	int32_t phase;
+	for (phase = TraceFirstByte; phase < NUM_TRACE_PHASES; phase++) {
+		if (trace->times[phase] == 0) {
+			continue;
+		}
+
+		cursor += sprintf(cursor, ",\n{\"name\":\"%s\",\"cat\":\"phase\","
+		                          "\"ph\":\"X\",\"ts\":%lu,\"dur\":%lu,"
+		                          "\"pid\":%ld,\"tid\":%ld}",
+		                  trace_span_names[phase], (unsigned long) previous,
+		                  (unsigned long) (trace->times[phase] - previous),
+		                  trace_pid, tid);
+		previous = trace->times[phase];
+	}
+
+	trace_lock();
+	if (trace_file != NULL) {
+		if (!trace_file_empty) {
+			fputs(",\n", trace_file);
+		}
+		fputs(events, trace_file);
+		fflush(trace_file);
+		trace_file_empty = false;
+	}
+	trace_unlock();
+}
+
+void trace_close(void) {
+	trace_phase(TraceClose);
+
+	if (trace_current != NULL) {
+		trace_write(trace_current);
+		free(trace_current);
+		trace_current = NULL;
+	}
+}
@@ -0,0 +1,77 @@
+/* Request-phase tracing. Each connection passes through the phases in
+ * `enum TracePhase`, and reaching one fires a static USDT probe (with the
+ * `SERV_USDT` build option, see the README), which is a single `nop` unless a
+ * tracer like `perf` or `bpftrace` is attached. With `-T`, the phases of a
+ * sample of the connections are also written to a file in the Chrome trace
+ * event format (for `chrome://tracing` or Perfetto), as one span per phase.
+ *
+ * The connection being traced is tracked per thread, so that the phases can
+ * be recorded anywhere while it is served. Each phase is only recorded the
+ * first time it is reached on a connection, i.e. for the first request of an
+ * HTTP/2 connection.
+ */
+
+#ifndef C_HTTP_SERVER_TRACE_H
+#define C_HTTP_SERVER_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "socket.h"
+
+/* The phases of a connection, in order */
+enum TracePhase {
+	/* The connection was accepted */
+	TraceAccept,
+	/* The first bytes of the request were received */
+	TraceFirstByte,
+	/* The request was parsed */
+	TraceParsed,
+	/* The file to send was found and opened */
+	TraceResolved,
+	/* The response head was sent */
+	TraceHeadersSent,
+	/* The last byte of the response was sent */
+	TraceLastByte,
+	/* The connection was closed */
+	TraceClose,
+	NUM_TRACE_PHASES
+};
+
+/* The recorded phases of a sampled connection */
+struct Trace {
+	Socket sock;
+	/* The time each phase was reached (see `monotonic_us`), or 0 */
+	uint64_t times[NUM_TRACE_PHASES];
+};
+
+/* Start writing the traces of sampled connections as described by a string
+ * "FILE[,sample=N]", where FILE is the trace file and 1 in every N
+ * connections is traced (default 1). Returns false (and logs an error) if
+ * the string is invalid or the file can't be created.
+ */
+bool start_tracing(const char* str);
+
+/* Finish the trace file, if there is one */
+void stop_tracing(void);
+
+/* Record that the connection `sock` was accepted. Returns the connection's
+ * trace if it was sampled, or NULL. The trace should be passed to
+ * `trace_attach` by the thread serving the connection.
+ */
+struct Trace* trace_accept(Socket sock);
+
+/* Make the connection `sock`, with the trace `trace` (or NULL if it isn't
+ * sampled), the one traced by the calling thread
+ */
+void trace_attach(struct Trace* trace, Socket sock);
+
+/* Record that the calling thread's connection reached `phase` */
+void trace_phase(enum TracePhase phase);
+
+/* Record that the calling thread's connection was closed, write its trace
+ * (if it was sampled) and free it
+ */
+void trace_close(void);
+
+#endif
@@ -0,0 +1,219 @@
+/* Implementation of `tune.h`, see that file for documentation and types */
+
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+
+#include "tune.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#endif
+
+#include "log.h"
+
+/* A named set of tuning options */
+struct TuningProfile {
+	const char* name;
+	int32_t defer_secs;
+	int32_t fastopen;
+	uint32_t batch;
+	bool cork;
+	int32_t send_buffer;
+	int32_t recv_buffer;
+};
+
+/* The profiles, the first one being the default. "latency" accepts
+ * connections right after the handshake, since with `TCP_DEFER_ACCEPT` a
+ * connection whose request is sent late (e.g. after a preconnect) or whose
+ * request segment is lost is only accepted after a retransmission.
+ * "throughput" defers accepting to save wake-ups, accepts more connections at
+ * once, and has a large send buffer (which the kernel doubles), which keeps
+ * `sendfile` from waking up for every few packets of a large file.
+ */
+static const struct TuningProfile tune_profiles[] = {
+	{"default", 0, 0, 1, false, 0, 0},
+	{"latency", 0, 256, 16, true, 0, 0},
+	{"throughput", 5, 1024, 64, true, 4 * 1024 * 1024, 0}
+};
+
+/* The response options, set once on startup */
+static bool tune_cork = false;
+
+/* Parse a non-negative option value of at most `max`. Returns false if the
+ * value is invalid.
+ */
+static bool tune_parse_value(const char* str, size_t len, long max,
+                             int32_t* value) {
+	char* end;
+	long parsed = strtol(str, &end, 10);
+	if (end == str || end != str + len || parsed < 0 || parsed > max) {
+		return false;
+	}
+
+	*value = (int32_t) parsed;
+	return true;
+}
+
+bool parse_socket_tuning(const char* str, struct SocketTuning* tuning) {
+	memset(tuning, 0, sizeof(*tuning));
+
+	size_t len = strcspn(str, ",");
+	const struct TuningProfile* profile = NULL;
+	size_t i;
+	for (i = 0; i < sizeof(tune_profiles) / sizeof(tune_profiles[0]); i++) {
+		if (strlen(tune_profiles[i].name) == len &&
+		    strncmp(str, tune_profiles[i].name, len) == 0) {
+			profile = &tune_profiles[i];
+		}
+	}
+
+	if (profile == NULL) {
+		return false;
+	}
+
+	tuning->profile = profile->name;
+	tuning->defer_secs = profile->defer_secs;
+	tuning->fastopen = profile->fastopen;
+	tuning->batch = profile->batch;
+	tuning->cork = profile->cork;
+	tuning->send_buffer = profile->send_buffer;
+	tuning->recv_buffer = profile->recv_buffer;
+
+	const char* option = str + len;
+	while (*option == ',') {
+		option++;
+		len = strcspn(option, ",");
+
+		int32_t batch = 0;
+		bool valid;
+		if (len > 6 && strncmp(option, "defer=", 6) == 0) {
+			valid = tune_parse_value(option + 6, len - 6, 3600,
+			                         &tuning->defer_secs);
+		} else if (len > 9 && strncmp(option, "fastopen=", 9) == 0) {
+			valid = tune_parse_value(option + 9, len - 9, 65535,
+			                         &tuning->fastopen);
+		} else if (len > 6 && strncmp(option, "batch=", 6) == 0) {
+			valid = tune_parse_value(option + 6, len - 6, SERV_TUNE_MAX_BATCH,
+			                         &batch) && batch > 0;
+			tuning->batch = (uint32_t) batch;
+		} else if (len == 4 && strncmp(option, "cork", 4) == 0) {
+			valid = true;
+			tuning->cork = true;
+		} else if (len == 6 && strncmp(option, "nocork", 6) == 0) {
+			valid = true;
+			tuning->cork = false;
+		} else if (len > 7 && strncmp(option, "sndbuf=", 7) == 0) {
+			valid = tune_parse_value(option + 7, len - 7, 0x3fffffff,
+			                         &tuning->send_buffer);
+		} else if (len > 7 && strncmp(option, "rcvbuf=", 7) == 0) {
+			valid = tune_parse_value(option + 7, len - 7, 0x3fffffff,
+			                         &tuning->recv_buffer);
+		} else {
+			valid = false;
+		}
+
+		if (!valid) {
+			return false;
+		}
+
+		option += len;
+	}
+
+	#ifdef _WIN32
+	/* Listeners stay blocking on Windows */
+	tuning->batch = 1;
+	#endif
+
+	return *option == '\0';
+}
+
+/* Set an `int` socket option, logging a warning named `name` on failure */
+static void tune_set_option(Socket sock, int level, int option, int value,
+                            const char* name) {
+	if (setsockopt(sock, level, option, (char*) &value, sizeof(value))) {
+		char buf[64];
+		sprintf(buf, "Could not set %s on a listener", name);
+		warn(buf);
+	}
+}
+
+void tune_listener(Socket sock, const struct Listener* listener,
+                   const struct SocketTuning* tuning) {
+	bool tcp = listener->addr.ss_family == AF_INET6 ||
+	           listener->addr.ss_family == AF_INET;
+
+	/* Accepted connections inherit the buffer sizes, which must be set
+	 * before the handshake for the receive window to be scaled to them
+	 */
+	if (tuning->send_buffer > 0) {
+		tune_set_option(sock, SOL_SOCKET, SO_SNDBUF, tuning->send_buffer,
+		                "SO_SNDBUF");
+	}
+	if (tuning->recv_buffer > 0) {
+		tune_set_option(sock, SOL_SOCKET, SO_RCVBUF, tuning->recv_buffer,
+		                "SO_RCVBUF");
+	}
+
+	#ifdef TCP_DEFER_ACCEPT
+	if (tcp) {
+		tune_set_option(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+		                tuning->defer_secs, "TCP_DEFER_ACCEPT");
+	}
+	#endif
+
+	#ifdef TCP_FASTOPEN
+	if (tcp && tuning->fastopen > 0) {
+		tune_set_option(sock, IPPROTO_TCP, TCP_FASTOPEN, tuning->fastopen,
+		                "TCP_FASTOPEN");
+	}
+	#endif
+
+	/* A batch ends when `accept` would block. On Linux, accepted sockets
+	 * don't inherit `O_NONBLOCK` (elsewhere `accept_connection` clears it).
+	 */
+	#ifndef _WIN32
+	int flags = fcntl(sock, F_GETFL);
+	if (flags != -1) {
+		flags = tuning->batch > 1 ? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+		fcntl(sock, F_SETFL, flags);
+	}
+	#endif
+
+	(void) tcp;
+}
+
+void set_response_tuning(const struct SocketTuning* tuning) {
+	tune_cork = tuning != NULL && tuning->cork;
+}
+
+int32_t send_more_flag(void) {
+	#ifdef MSG_MORE
+	return tune_cork ? MSG_MORE : 0;
+	#else
+	return 0;
+	#endif
+}
+
+void cork_socket(Socket sock, bool cork) {
+	if (!tune_cork) {
+		return;
+	}
+
+	int value = cork ? 1 : 0;
+	#if defined(TCP_CORK)
+	setsockopt(sock, IPPROTO_TCP, TCP_CORK, (char*) &value, sizeof(value));
+	#elif defined(TCP_NOPUSH)
+	setsockopt(sock, IPPROTO_TCP, TCP_NOPUSH, (char*) &value, sizeof(value));
+	#else
+	(void) sock;
+	(void) value;
+	#endif
+}
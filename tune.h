@@ -0,0 +1,84 @@
+/* Socket tuning profiles (`-S`). A profile bundles the kernel-assisted
+ * accept and send options of the listeners and connections:
+ * - `TCP_DEFER_ACCEPT`, so a connection only wakes the accept loop once its
+ *   request has arrived instead of right after the handshake
+ * - `TCP_FASTOPEN`, so returning clients can send their request in the SYN
+ * - accepting up to a batch of connections per wake-up from non-blocking
+ *   listeners, instead of going back to `poll` after every connection
+ * - holding back response heads (`MSG_MORE`, `TCP_CORK`) so that they leave
+ *   in the same packet as the start of the body
+ * - fixed send and receive buffer sizes instead of the kernel's autotuning
+ * Most options are only available on Linux and are ignored elsewhere.
+ */
+
+#ifndef C_HTTP_SERVER_TUNE_H
+#define C_HTTP_SERVER_TUNE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "socket.h"
+
+/* The maximum number of connections accepted per listener and wake-up */
+#define SERV_TUNE_MAX_BATCH 1024
+
+/* The socket tuning options (`-S`) */
+struct SocketTuning {
+	/* The name of the profile the options are based on, for logging */
+	const char* profile;
+	/* How long (in seconds) a connection without data waits in the kernel
+	 * before being accepted anyway (`TCP_DEFER_ACCEPT`), or 0 to accept
+	 * connections right after the handshake
+	 */
+	int32_t defer_secs;
+	/* The maximum number of pending Fast Open requests (`TCP_FASTOPEN`), or
+	 * 0 to not allow Fast Open
+	 */
+	int32_t fastopen;
+	/* The maximum number of connections accepted per listener and wake-up */
+	uint32_t batch;
+	/* Whether response heads are held back for the body (`MSG_MORE`,
+	 * `TCP_CORK`)
+	 */
+	bool cork;
+	/* The send and receive buffer sizes of connections in bytes
+	 * (`SO_SNDBUF`, `SO_RCVBUF`), or 0 for the system default
+	 */
+	int32_t send_buffer;
+	int32_t recv_buffer;
+};
+
+/* Parse the socket tuning options from a string "PROFILE[,OPTION...]", where
+ * PROFILE is "default" (the system defaults, one connection per wake-up),
+ * "latency" or "throughput" (see the README for their options), and the
+ * options override those of the profile: "defer=SECONDS", "fastopen=N",
+ * "batch=N", "cork", "nocork", "sndbuf=BYTES" and "rcvbuf=BYTES". Returns
+ * false if the string is invalid.
+ */
+bool parse_socket_tuning(const char* str, struct SocketTuning* tuning);
+
+/* Apply the tuning to a listening socket (inherited by the connections
+ * accepted on it), and make the socket non-blocking if connections are
+ * accepted in batches. Options which can't be set are logged and skipped.
+ */
+void tune_listener(Socket sock, const struct Listener* listener,
+                   const struct SocketTuning* tuning);
+
+/* Use `tuning` for the responses sent from now on, see `send_more_flag` and
+ * `cork_socket`. NULL restores the defaults.
+ */
+void set_response_tuning(const struct SocketTuning* tuning);
+
+/* The `send` flag for data that is immediately followed by more data (e.g. a
+ * response head followed by `sendfile`), which is `MSG_MORE` if response
+ * heads are held back, otherwise 0
+ */
+int32_t send_more_flag(void);
+
+/* Hold back partial packets on `sock` until uncorked (if response heads are
+ * held back), for responses sent with many small `send`s
+ */
+void cork_socket(Socket sock, bool cork);
+
+#endif
@@ -0,0 +1,493 @@
+/* Implementation of `upgrade.h`, see that file for documentation and types */
+
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+
+#include "upgrade.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#endif
+
+#include "log.h"
+#include "misc.h"
+
+#include "alloc.h"
+
+#ifndef _WIN32
+extern char** environ;
+#endif
+
+#ifdef _WIN32
+
+int32_t upgrade_init(void) {
+	return -1;
+}
+
+bool upgrade_requested(void) {
+	return false;
+}
+
+bool take_inherited_listener(struct Listener* listener) {
+	return false;
+}
+
+void upgrade_ready(void) {}
+
+int32_t start_upgrade(char** argv, const struct Config* config) {
+	error("Upgrades are not supported on Windows");
+	return -1;
+}
+
+int32_t upgrade_timeout(void) {
+	return -1;
+}
+
+bool finish_upgrade(bool* took_over) {
+	*took_over = false;
+	return true;
+}
+
+void stop_listening(struct Config* config) {
+	size_t i;
+	for (i = 0; i < config->num_listeners; i++) {
+		closesocket(config->listeners[i].sock);
+	}
+}
+
+#else
+
+/* The self-pipe written to by the signal handler, to wake up `poll` */
+static int upgrade_pipe[2] = {-1, -1};
+
+/* The inherited listening sockets, -1 once taken */
+static int32_t* inherited_fds = NULL;
+static size_t num_inherited_fds = 0;
+static bool inherited_fds_parsed = false;
+
+/* The new process started by `start_upgrade` (0 if there is none), the read
+ * end of the pipe it reports its readiness on and the time by which it must
+ * be ready
+ */
+static pid_t upgrade_pid = 0;
+static int upgrade_ready_fd = -1;
+static time_t upgrade_deadline = 0;
+
+static void upgrade_signal_handler(int signal) {
+	(void) signal;
+	int saved_errno = errno;
+	if (write(upgrade_pipe[1], "u", 1) < 0) {
+		/* The pipe is full, so an upgrade is already pending */
+	}
+	errno = saved_errno;
+}
+
+int32_t upgrade_init(void) {
+	if (pipe2(upgrade_pipe, O_CLOEXEC | O_NONBLOCK)) {
+		error("Could not create the upgrade signal pipe");
+		return -1;
+	}
+
+	/* Interrupted system calls are restarted, so that requests in flight
+	 * aren't affected by the signal
+	 */
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = upgrade_signal_handler;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGUSR2, &action, NULL)) {
+		error("Could not install the upgrade signal handler");
+		return -1;
+	}
+
+	return upgrade_pipe[0];
+}
+
+bool upgrade_requested(void) {
+	char buf[16];
+	bool requested = false;
+	while (read(upgrade_pipe[0], buf, sizeof(buf)) > 0) {
+		requested = true;
+	}
+
+	return requested;
+}
+
+/* Parse the inherited fds from the environment */
+static void upgrade_parse_fds(void) {
+	inherited_fds_parsed = true;
+
+	const char* cursor = getenv(SERV_UPGRADE_FDS_ENV);
+	while (cursor != NULL && *cursor != '\0') {
+		char* end;
+		long fd = strtol(cursor, &end, 10);
+		if (end == cursor || fd < 0) {
+			warn("Invalid inherited listener fds in " SERV_UPGRADE_FDS_ENV);
+			break;
+		}
+
+		inherited_fds = realloc(inherited_fds, (num_inherited_fds + 1) *
+		                                       sizeof(int32_t));
+		inherited_fds[num_inherited_fds] = (int32_t) fd;
+		num_inherited_fds++;
+
+		cursor = *end == ',' ? end + 1 : end;
+	}
+}
+
+/* Check whether two socket addresses are the same */
+static bool upgrade_same_addr(const struct sockaddr_storage* a,
+                              const struct sockaddr_storage* b) {
+	if (a->ss_family != b->ss_family) {
+		return false;
+	}
+
+	if (a->ss_family == AF_INET) {
+		const struct sockaddr_in* a4 = (const struct sockaddr_in*) a;
+		const struct sockaddr_in* b4 = (const struct sockaddr_in*) b;
+		return a4->sin_port == b4->sin_port &&
+		       a4->sin_addr.s_addr == b4->sin_addr.s_addr;
+	} else if (a->ss_family == AF_INET6) {
+		const struct sockaddr_in6* a6 = (const struct sockaddr_in6*) a;
+		const struct sockaddr_in6* b6 = (const struct sockaddr_in6*) b;
+		return a6->sin6_port == b6->sin6_port &&
+		       memcmp(&a6->sin6_addr, &b6->sin6_addr,
+		              sizeof(a6->sin6_addr)) == 0;
+	} else if (a->ss_family == AF_UNIX) {
+		return strcmp(((const struct sockaddr_un*) a)->sun_path,
+		              ((const struct sockaddr_un*) b)->sun_path) == 0;
+	}
+
+	return false;
+}
+
+bool take_inherited_listener(struct Listener* listener) {
+	if (!inherited_fds_parsed) {
+		upgrade_parse_fds();
+	}
+
+	size_t i;
+	for (i = 0; i < num_inherited_fds; i++) {
+		if (inherited_fds[i] < 0) {
+			continue;
+		}
+
+		struct sockaddr_storage addr;
+		socklen_t addr_len = sizeof(addr);
+		memset(&addr, 0, sizeof(addr));
+		if (getsockname(inherited_fds[i], (struct sockaddr*) &addr,
+		                &addr_len) ||
+		    !upgrade_same_addr(&addr, &listener->addr)) {
+			continue;
+		}
+
+		listener->sock = inherited_fds[i];
+		fcntl(listener->sock, F_SETFD, FD_CLOEXEC);
+		inherited_fds[i] = -1;
+		return true;
+	}
+
+	return false;
+}
+
+void upgrade_ready(void) {
+	if (!inherited_fds_parsed) {
+		upgrade_parse_fds();
+	}
+
+	size_t i;
+	for (i = 0; i < num_inherited_fds; i++) {
+		if (inherited_fds[i] >= 0) {
+			close(inherited_fds[i]);
+		}
+	}
+
+	free(inherited_fds);
+	inherited_fds = NULL;
+	num_inherited_fds = 0;
+
+	const char* ready_fd_str = getenv(SERV_UPGRADE_READY_ENV);
+	if (ready_fd_str != NULL) {
+		int32_t ready_fd = (int32_t) strtol(ready_fd_str, NULL, 10);
+		if (write(ready_fd, "r", 1) != 1) {
+			warn("Could not notify the old server process");
+		}
+		close(ready_fd);
+	}
+
+	unsetenv(SERV_UPGRADE_FDS_ENV);
+	unsetenv(SERV_UPGRADE_READY_ENV);
+}
+
+/* Find the binary `execvp` would execute for `name`, searching `PATH` if
+ * `name` contains no "/". Returns NULL if there is no such binary, otherwise
+ * the path, which should be `free`d after use.
+ */
+static char* upgrade_find_binary(const char* name) {
+	if (strchr(name, '/') != NULL) {
+		char* path = malloc(strlen(name) + 1);
+		strcpy(path, name);
+		return path;
+	}
+
+	const char* dirs = getenv("PATH");
+	if (dirs == NULL) {
+		dirs = "/usr/bin:/bin";
+	}
+
+	while (true) {
+		size_t dir_len = strcspn(dirs, ":");
+		char* path = malloc(dir_len + 1 + strlen(name) + 1);
+		memcpy(path, dirs, dir_len);
+		sprintf(path + dir_len, dir_len == 0 ? "%s" : "/%s", name);
+		if (access(path, X_OK) == 0) {
+			return path;
+		}
+
+		free(path);
+		if (dirs[dir_len] == '\0') {
+			return NULL;
+		}
+		dirs += dir_len + 1;
+	}
+}
+
+/* Make the environment of the new process: this one's, with the listener fds
+ * `fds` and the readiness pipe fd `ready_fd` in place of any inherited ones.
+ * Only the array and its last two strings are allocated.
+ */
+static char** upgrade_make_env(const char* fds, const char* ready_fd) {
+	size_t num_vars = 0;
+	while (environ[num_vars] != NULL) {
+		num_vars++;
+	}
+
+	char** env = malloc((num_vars + 3) * sizeof(char*));
+	size_t len = 0;
+	size_t i;
+	for (i = 0; i < num_vars; i++) {
+		if (strncmp(environ[i], SERV_UPGRADE_FDS_ENV "=",
+		            strlen(SERV_UPGRADE_FDS_ENV) + 1) != 0 &&
+		    strncmp(environ[i], SERV_UPGRADE_READY_ENV "=",
+		            strlen(SERV_UPGRADE_READY_ENV) + 1) != 0) {
+			env[len] = environ[i];
+			len++;
+		}
+	}
+
+	env[len] = malloc(strlen(SERV_UPGRADE_FDS_ENV) + 1 + strlen(fds) + 1);
+	sprintf(env[len], "%s=%s", SERV_UPGRADE_FDS_ENV, fds);
+	env[len + 1] = malloc(strlen(SERV_UPGRADE_READY_ENV) + 1 +
+	                      strlen(ready_fd) + 1);
+	sprintf(env[len + 1], "%s=%s", SERV_UPGRADE_READY_ENV, ready_fd);
+	env[len + 2] = NULL;
+
+	return env;
+}
+
+/* Free the environment made by `upgrade_make_env` */
+static void upgrade_free_env(char** env) {
+	size_t len = 0;
+	while (env[len + 2] != NULL) {
+		len++;
+	}
+
+	free(env[len]);
+	free(env[len + 1]);
+	free(env);
+}
+
+int32_t start_upgrade(char** argv, const struct Config* config) {
+	if (upgrade_pid != 0) {
+		error("An upgrade is already in progress");
+		return -1;
+	}
+
+	char* binary = upgrade_find_binary(argv[0]);
+	if (binary == NULL) {
+		error("Could not find the new server binary");
+		return -1;
+	}
+
+	int ready_pipe[2];
+	if (pipe2(ready_pipe, O_CLOEXEC)) {
+		error("Could not create the upgrade readiness pipe");
+		free(binary);
+		return -1;
+	}
+
+	/* Everything the new process gets is prepared before `fork`: other
+	 * threads may hold the allocator's or the environment's locks, so the
+	 * child only changes the fd flags and executes the binary
+	 */
+	char* fds = malloc(config->num_listeners * 12 + 1);
+	char* cursor = fds;
+	*cursor = '\0';
+
+	size_t i;
+	for (i = 0; i < config->num_listeners; i++) {
+		cursor += sprintf(cursor, i == 0 ? "%ld" : ",%ld",
+		                  (long) config->listeners[i].sock);
+	}
+
+	char ready_fd[12];
+	sprintf(ready_fd, "%ld", (long) ready_pipe[1]);
+	char** env = upgrade_make_env(fds, ready_fd);
+	free(fds);
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		/* Pass the listeners and the write end of the readiness pipe on to
+		 * the new process, closing everything else on `exec`
+		 */
+		for (i = 0; i < config->num_listeners; i++) {
+			fcntl(config->listeners[i].sock, F_SETFD, 0);
+		}
+		fcntl(ready_pipe[1], F_SETFD, 0);
+
+		execve(binary, argv, env);
+
+		static const char message[] = "Could not execute the new server "
+		                              "binary\n";
+		if (write(STDERR_FILENO, message, sizeof(message) - 1) < 0) {
+			/* Nothing else can be reported */
+		}
+		_exit(SERV_ERR_MISC);
+	}
+
+	free(binary);
+	upgrade_free_env(env);
+
+	if (pid < 0) {
+		error("Could not start a new server process");
+		close(ready_pipe[0]);
+		close(ready_pipe[1]);
+		return -1;
+	}
+
+	close(ready_pipe[1]);
+
+	upgrade_pid = pid;
+	upgrade_ready_fd = ready_pipe[0];
+	upgrade_deadline = time(NULL) + SERV_UPGRADE_TIMEOUT_SECS;
+	return upgrade_ready_fd;
+}
+
+int32_t upgrade_timeout(void) {
+	if (upgrade_pid == 0) {
+		return -1;
+	}
+
+	time_t now = time(NULL);
+	return now >= upgrade_deadline ? 0 :
+	       (int32_t) (upgrade_deadline - now) * 1000;
+}
+
+bool finish_upgrade(bool* took_over) {
+	struct pollfd poll_fd;
+	poll_fd.fd = upgrade_ready_fd;
+	poll_fd.events = POLLIN;
+	poll_fd.revents = 0;
+
+	/* The pipe is readable once the new process is ready, or at EOF if it
+	 * exited without becoming ready
+	 */
+	bool readable = poll(&poll_fd, 1, 0) > 0;
+	if (!readable && time(NULL) < upgrade_deadline) {
+		return false;
+	}
+
+	char ready = 0;
+	*took_over = readable && read(upgrade_ready_fd, &ready, 1) == 1;
+	close(upgrade_ready_fd);
+	upgrade_ready_fd = -1;
+
+	pid_t pid = upgrade_pid;
+	upgrade_pid = 0;
+
+	if (!*took_over) {
+		error("The new server process did not start");
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+		return true;
+	}
+
+	char buf[64];
+	sprintf(buf, "Handed the listeners over to process %ld", (long) pid);
+	info(buf);
+
+	return true;
+}
+
+void stop_listening(struct Config* config) {
+	/* The listeners are shared with the new process, so they are closed
+	 * without shutting them down
+	 */
+	size_t i;
+	for (i = 0; i < config->num_listeners; i++) {
+		close(config->listeners[i].sock);
+		config->listeners[i].sock = -1;
+	}
+
+	alarm(SERV_DRAIN_SECS);
+}
+
+#endif
+
+bool parse_output_file(const char* str, char** path, uint64_t* sample) {
+	size_t len = strcspn(str, ",");
+	*path = malloc(len + 1);
+	memcpy(*path, str, len);
+	(*path)[len] = '\0';
+	*sample = 1;
+
+	const char* option = str + len;
+	if (*option == ',') {
+		option++;
+	}
+
+	while (*option != '\0') {
+		len = strcspn(option, ",");
+
+		if (len > 7 && strncmp(option, "sample=", 7) == 0) {
+			*sample = (uint64_t) strtoul(option + 7, NULL, 10);
+		} else {
+			*sample = 0;
+		}
+
+		if (*sample == 0) {
+			free(*path);
+			*path = NULL;
+			return false;
+		}
+
+		option += len;
+		if (*option == ',') {
+			option++;
+		}
+	}
+
+	#ifndef _WIN32
+	if (getenv(SERV_UPGRADE_FDS_ENV) != NULL) {
+		*path = realloc(*path, strlen(*path) + 24);
+		sprintf(*path + strlen(*path), ".%ld", (long) getpid());
+	}
+	#endif
+
+	return true;
+}
@@ -0,0 +1,96 @@
+/* Zero-downtime restarts and binary upgrades. On `SIGUSR2`, the server
+ * re-executes its (possibly replaced) binary with the same arguments, passing
+ * its listening sockets on to the new process, which reuses them instead of
+ * binding new ones. Once the new process is ready, the old one stops
+ * accepting connections, drains the ones in flight and exits, so the
+ * listening sockets are never closed and no connection is refused.
+ */
+
+#ifndef C_HTTP_SERVER_UPGRADE_H
+#define C_HTTP_SERVER_UPGRADE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "socket.h"
+
+/* The environment variable listing the inherited listening socket fds */
+#define SERV_UPGRADE_FDS_ENV "SERV_LISTEN_FDS"
+
+/* The environment variable holding the fd the new process reports its
+ * readiness on
+ */
+#define SERV_UPGRADE_READY_ENV "SERV_READY_FD"
+
+/* How long the old process waits for the new one to become ready, in
+ * seconds
+ */
+#define SERV_UPGRADE_TIMEOUT_SECS 30
+
+/* How long the old process may take to drain the connections in flight
+ * before it is stopped, in seconds
+ */
+#define SERV_DRAIN_SECS 30
+
+/* Install the `SIGUSR2` handler. Returns a file descriptor that becomes
+ * readable when an upgrade is requested, to be polled together with the
+ * listeners, or -1 if upgrades are not supported.
+ */
+int32_t upgrade_init(void);
+
+/* Check whether an upgrade was requested, resetting the request */
+bool upgrade_requested(void);
+
+/* Take the inherited listening socket bound to the address of `listener`,
+ * setting `listener->sock`. Returns false if no such socket was inherited, in
+ * which case a new one has to be created.
+ */
+bool take_inherited_listener(struct Listener* listener);
+
+/* Close the inherited listening sockets that weren't taken (because their
+ * listener was removed), and tell the old process (if any) that this one is
+ * ready to accept connections
+ */
+void upgrade_ready(void);
+
+/* Start a new server process with the arguments `argv`, passing the
+ * listeners on to it. Returns a file descriptor that becomes readable when
+ * the new process is ready (or exited), to be polled together with the
+ * listeners (which this process keeps accepting on in the meantime) until
+ * `finish_upgrade` returns true, or -1 (and logs an error) if the new process
+ * couldn't be started or an upgrade is already in progress.
+ */
+int32_t start_upgrade(char** argv, const struct Config* config);
+
+/* Get the time left for the new process started by `start_upgrade` to become
+ * ready, in milliseconds (as a `poll` timeout), or -1 if no upgrade is in
+ * progress
+ */
+int32_t upgrade_timeout(void);
+
+/* Check whether the new process started by `start_upgrade` is ready, called
+ * once the descriptor returned by `start_upgrade` is readable or
+ * `upgrade_timeout` returned 0. Returns false if it's still starting.
+ * Otherwise the upgrade is over and `took_over` is set: to true if the new
+ * process took over, in which case this one should stop accepting
+ * connections, drain and exit, or to false (logging an error) if the new
+ * process failed to start or timed out and was stopped, in which case this
+ * one keeps serving.
+ */
+bool finish_upgrade(bool* took_over);
+
+/* Stop accepting connections on the listeners without affecting the new
+ * process, and limit the time until this process exits to `SERV_DRAIN_SECS`
+ */
+void stop_listening(struct Config* config);
+
+/* Parse the option "FILE[,sample=N]" of an output file (`-T`, `-R`), setting
+ * `path` to FILE (to be freed after use) and `sample` to N (default 1). A
+ * process started by an upgrade appends ".PID" to the path, so that it
+ * doesn't overwrite the old process's file. Returns false if the option is
+ * invalid.
+ */
+bool parse_output_file(const char* str, char** path, uint64_t* sample);
+
+#endif
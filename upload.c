@@ -0,0 +1,327 @@
+/* Implementation of `upload.h`, see that file for documentation and types */
+
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+
+#include "upload.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#endif
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "log.h"
+#include "misc.h"
+
+#include "alloc.h"
+
+/* A file that an upload is written to. On Linux, this is a file descriptor so
+ * that `splice` can be used, elsewhere it's a stdio `FILE*`.
+ */
+#ifdef __linux__
+typedef int UploadFile;
+#else
+typedef FILE* UploadFile;
+#endif
+
+/* The source of the body bytes of an upload */
+struct UploadSource {
+	struct Reader reader;
+	#ifdef __linux__
+	/* The pipe used to `splice` from the socket to the file */
+	int pipe[2];
+	#endif
+};
+
+/* The number of temporary upload files created so far, used to generate
+ * unique temporary file names
+ */
+static unsigned long upload_counter = 0;
+
+/* Create the file `path`, which must not exist yet. Returns false (with
+ * `errno` set to `EEXIST` if the file exists) if it couldn't be created.
+ */
+static bool upload_open(const char* path, UploadFile* file) {
+	#ifdef __linux__
+	*file = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	return *file >= 0;
+	#else
+	*file = fopen(path, "wbx");
+	return *file != NULL;
+	#endif
+}
+
+/* Create a new temporary file next to `path` for an upload to it. The name
+ * includes the process ID, so that the processes of an upgrade (or several
+ * servers sharing a directory) don't write to the same file, and names that
+ * are taken anyway are skipped. Returns the temporary file's path, or NULL if
+ * it couldn't be created.
+ */
+static char* upload_open_temp(const char* path, UploadFile* file) {
+	#ifdef _WIN32
+	long pid = (long) _getpid();
+	#else
+	long pid = (long) getpid();
+	#endif
+
+	char* tmp_path = malloc(strlen(path) + 64);
+	while (true) {
+		sprintf(tmp_path, "%s.upload-%ld-%lu", path, pid,
+		        __atomic_fetch_add(&upload_counter, 1, __ATOMIC_RELAXED));
+		if (upload_open(tmp_path, file)) {
+			return tmp_path;
+		} else if (errno != EEXIST) {
+			free(tmp_path);
+			return NULL;
+		}
+	}
+}
+
+static bool upload_close(UploadFile file) {
+	#ifdef __linux__
+	return close(file) == 0;
+	#else
+	return fclose(file) == 0;
+	#endif
+}
+
+static bool upload_write(UploadFile file, const char* data, size_t len) {
+	#ifdef __linux__
+	while (len > 0) {
+		ssize_t res = write(file, data, len);
+		if (res <= 0) {
+			return false;
+		}
+
+		data += res;
+		len -= res;
+	}
+
+	return true;
+	#else
+	return fwrite(data, 1, len, file) == len;
+	#endif
+}
+
+/* Copy exactly `len` body bytes from `src` to `file` */
+static bool upload_copy(struct UploadSource* src, UploadFile file,
+                        uint64_t len) {
+	size_t from_pending = (size_t) min(len,
+	                                   (uint64_t) src->reader.pending_len);
+	if (!upload_write(file, src->reader.pending, from_pending)) {
+		return false;
+	}
+
+	src->reader.pending += from_pending;
+	src->reader.pending_len -= from_pending;
+	len -= from_pending;
+
+	#ifdef __linux__
+	while (len > 0) {
+		ssize_t in = splice(src->reader.sock, NULL, src->pipe[1], NULL,
+		                    (size_t) min(len, SERV_UPLOAD_BUFFER_SIZE),
+		                    SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (in <= 0) {
+			return false;
+		}
+
+		len -= in;
+
+		while (in > 0) {
+			ssize_t out = splice(src->pipe[0], NULL, file, NULL, (size_t) in,
+			                     SPLICE_F_MOVE | SPLICE_F_MORE);
+			if (out <= 0) {
+				return false;
+			}
+
+			in -= out;
+		}
+	}
+	#else
+	char* buf = malloc(SERV_UPLOAD_BUFFER_SIZE);
+	while (len > 0) {
+		int32_t res = recv(src->reader.sock, buf,
+		                   (int) min(len, SERV_UPLOAD_BUFFER_SIZE), 0);
+		if (res <= 0 || !upload_write(file, buf, res)) {
+			break;
+		}
+
+		len -= res;
+	}
+	free(buf);
+	#endif
+
+	return len == 0;
+}
+
+/* Copy a chunked body from `src` to `file`. Returns 0 on success, or the
+ * HTTP status code of the error.
+ */
+static uint16_t upload_chunked(struct UploadSource* src, UploadFile file,
+                               uint64_t max_size) {
+	char line[128];
+	uint64_t total = 0;
+
+	while (true) {
+		if (!reader_read_line(&src->reader, line, sizeof(line))) {
+			return 400;
+		}
+
+		/* Parse the hexadecimal chunk size, ignoring any chunk extensions */
+		char* size_end;
+		#ifdef WIN32
+		uint64_t size = strtoull(line, &size_end, 16);
+		#else
+		uint64_t size = strtoul(line, &size_end, 16);
+		#endif
+		if (size_end == line || (*size_end != '\0' && *size_end != ';' &&
+		                         *size_end != ' ' && *size_end != '\t')) {
+			return 400;
+		}
+
+		if (size == 0) {
+			break;
+		}
+
+		if (size > max_size - total) {
+			return 413;
+		}
+
+		if (!upload_copy(src, file, size)) {
+			return 400;
+		}
+
+		total += size;
+
+		/* Every chunk is followed by an empty line */
+		if (!reader_read_line(&src->reader, line, sizeof(line)) ||
+		    line[0] != '\0') {
+			return 400;
+		}
+	}
+
+	/* Skip any trailer fields up to the final empty line */
+	do {
+		if (!reader_read_line(&src->reader, line, sizeof(line))) {
+			return 400;
+		}
+	} while (line[0] != '\0');
+
+	return 0;
+}
+
+uint16_t receive_upload(struct Request* req, Socket sock, const char* file_path,
+                        uint64_t max_size) {
+	const struct Slice* transfer_encoding = get_header(&req->headers, HeaderTransferEncoding);
+	const struct Slice* content_length_str = get_header(&req->headers, HeaderContentLength);
+	uint64_t content_length = 0;
+
+	if (transfer_encoding != NULL) {
+		if (!slice_eq_nocase(*transfer_encoding, "chunked")) {
+			warn("Unsupported request transfer encoding");
+			return 501;
+		}
+	} else if (content_length_str == NULL) {
+		return 411;
+	} else if (!slice_to_u64(*content_length_str, &content_length)) {
+		return 400;
+	} else if (content_length > max_size) {
+		warn("Request body is too large");
+		return 413;
+	}
+
+	/* Check whether the upload creates a new file or replaces one */
+	bool existed = false;
+	FILE* existing = fopen(file_path, "rb");
+	if (existing != NULL) {
+		existed = true;
+		fclose(existing);
+	}
+
+	UploadFile file;
+	char* tmp_path = upload_open_temp(file_path, &file);
+	if (tmp_path == NULL) {
+		warn("The upload file could not be created");
+		return 404;
+	}
+
+	struct UploadSource src;
+	src.reader.sock = sock;
+	src.reader.pending = req->body;
+	src.reader.pending_len = req->body_len;
+
+	#ifdef __linux__
+	if (pipe2(src.pipe, O_CLOEXEC)) {
+		error("Could not create a pipe for the upload");
+		upload_close(file);
+		remove(tmp_path);
+		free(tmp_path);
+		return 500;
+	}
+	#endif
+
+	/* Only ask for the body once the request is known to be acceptable */
+	const struct Slice* expect = get_header(&req->headers, HeaderExpect);
+	if (expect != NULL && slice_eq_nocase(*expect, "100-continue") &&
+	    req->body_len == 0) {
+		char* buf = "HTTP/1.1 100 Continue\r\n\r\n";
+		if (send(sock, buf, (int) strlen(buf), 0) == -1) {
+			error("Error sending response data");
+		}
+	}
+
+	uint16_t status = 0;
+	if (transfer_encoding != NULL) {
+		status = upload_chunked(&src, file, max_size);
+	} else if (!upload_copy(&src, file, content_length)) {
+		warn("Couldn't receive the entire request body");
+		status = 400;
+	}
+
+	#ifdef __linux__
+	close(src.pipe[0]);
+	close(src.pipe[1]);
+	#endif
+
+	if (!upload_close(file) && status == 0) {
+		error("Couldn't write the upload file");
+		status = 500;
+	}
+
+	if (status == 0) {
+		#ifdef _WIN32
+		/* `rename` doesn't replace existing files on Windows */
+		remove(file_path);
+		#endif
+		if (rename(tmp_path, file_path)) {
+			error("Couldn't move the upload file into place");
+			status = 500;
+		}
+	}
+
+	if (status != 0) {
+		remove(tmp_path);
+	}
+
+	free(tmp_path);
+
+	if (status != 0) {
+		return status;
+	}
+
+	return existed ? 204 : 201;
+}
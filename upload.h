@@ -0,0 +1,35 @@
+/* Streaming of HTTP request bodies (for `PUT` and `POST` requests) into files.
+ * On Linux, the body is moved from the socket to the file with `splice`,
+ * without copying it to user space, elsewhere it is copied through a small
+ * buffer. Bodies are never buffered in memory as a whole.
+ */
+
+#ifndef C_HTTP_SERVER_UPLOAD_H
+#define C_HTTP_SERVER_UPLOAD_H
+
+#include <stdint.h>
+
+#include "http.h"
+#include "socket.h"
+
+/* The size of the buffer used for chunk-size lines and for copying body data
+ * when `splice` is not available
+ */
+#define SERV_UPLOAD_BUFFER_SIZE 65536
+
+/* Receive the body of `req` (using either `Content-Length` or
+ * `Transfer-Encoding: chunked`) from `sock` and store it in the file at
+ * `file_path`. The body is written to a temporary file next to `file_path`,
+ * which is renamed to `file_path` once the whole body has been received, so
+ * the file is replaced atomically. Bodies larger than `max_size` are rejected.
+ * If the request contains `Expect: 100-continue`, the "100 Continue" interim
+ * response is sent before reading the body.
+ *
+ * Returns the HTTP status code of the response that should be sent (201 if
+ * the file was created, 204 if it was replaced, or an error status), but does
+ * not send that response itself.
+ */
+uint16_t receive_upload(struct Request* req, Socket sock, const char* file_path,
+                        uint64_t max_size);
+
+#endif
@@ -0,0 +1,407 @@
+/* Implementation of `warm.h`, see that file for documentation and types */
+
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+
+#include "warm.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "config.h"
+#include "handlers.h"
+#include "log.h"
+#include "router.h"
+
+#include "alloc.h"
+
+/* The maximum depth of directories that are warmed */
+#define SERV_WARM_MAX_DEPTH 32
+
+bool parse_warmup(const char* str, struct Warmup* warmup) {
+	memset(warmup, 0, sizeof(*warmup));
+	warmup->threads = 4;
+
+	const char* option = str;
+	while (*option != '\0') {
+		size_t len = strcspn(option, ",");
+
+		if (len > 6 && strncmp(option, "paths=", 6) == 0) {
+			free(warmup->paths_file);
+			warmup->paths_file = malloc(len - 6 + 1);
+			memcpy(warmup->paths_file, option + 6, len - 6);
+			warmup->paths_file[len - 6] = '\0';
+		} else if (len > 8 && strncmp(option, "threads=", 8) == 0) {
+			warmup->threads = (uint32_t) strtoul(option + 8, NULL, 10);
+			if (warmup->threads == 0 ||
+			    warmup->threads > SERV_WARM_MAX_THREADS) {
+				free(warmup->paths_file);
+				return false;
+			}
+		} else if (len > 5 && strncmp(option, "lock=", 5) == 0) {
+			warmup->lock_bytes = (uint64_t) strtoul(option + 5, NULL, 10) *
+			                     1024 * 1024;
+		} else {
+			free(warmup->paths_file);
+			return false;
+		}
+
+		option += len;
+		if (*option == ',') {
+			option++;
+		}
+	}
+
+	return true;
+}
+
+#ifndef _WIN32
+
+/* A file to warm */
+struct WarmFile {
+	char* path;
+	uint64_t size;
+	/* Whether the file is locked in memory */
+	bool lock;
+	/* The file's mapping, if it was locked */
+	struct WarmMapping mapping;
+};
+
+/* The files to warm, and the progress of the warm-up threads */
+struct WarmState {
+	struct WarmFile* files;
+	size_t num_files;
+	size_t cap;
+	uint64_t total_bytes;
+
+	/* The index of the next file to warm */
+	size_t next;
+	uint64_t warmed_bytes;
+	/* The last quarter of `total_bytes` that was logged */
+	uint32_t reported;
+	uint64_t start_us;
+};
+
+/* Add the file or directory (recursively) at `path` to the files to warm */
+static void warm_add_path(struct WarmState* state, const char* path,
+                          uint32_t depth) {
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		char* buf = malloc(40 + strlen(path) + 1);
+		sprintf(buf, "Can't warm '%s', it doesn't exist", path);
+		warn(buf);
+		free(buf);
+		return;
+	}
+
+	if (S_ISDIR(st.st_mode)) {
+		DIR* dir;
+		if (depth >= SERV_WARM_MAX_DEPTH || (dir = opendir(path)) == NULL) {
+			return;
+		}
+
+		size_t path_len = strlen(path);
+		struct dirent* entry;
+		while ((entry = readdir(dir)) != NULL) {
+			if (strcmp(entry->d_name, ".") == 0 ||
+			    strcmp(entry->d_name, "..") == 0) {
+				continue;
+			}
+
+			char* child = malloc(path_len + strlen(entry->d_name) + 2);
+			if (path_len > 0 && path[path_len - 1] == '/') {
+				sprintf(child, "%s%s", path, entry->d_name);
+			} else {
+				sprintf(child, "%s/%s", path, entry->d_name);
+			}
+			warm_add_path(state, child, depth + 1);
+			free(child);
+		}
+
+		closedir(dir);
+		return;
+	}
+
+	if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+		return;
+	}
+
+	if (state->num_files == state->cap) {
+		state->cap = state->cap == 0 ? 64 : state->cap * 2;
+		state->files = realloc(state->files,
+		                       state->cap * sizeof(struct WarmFile));
+	}
+
+	struct WarmFile* file = &state->files[state->num_files];
+	memset(file, 0, sizeof(*file));
+	file->path = malloc(strlen(path) + 1);
+	strcpy(file->path, path);
+	file->size = (uint64_t) st.st_size;
+	state->num_files++;
+	state->total_bytes += file->size;
+}
+
+/* Add the paths listed in the file at `paths_file` (relative to `data_dir`)
+ * to the files to warm. Returns false if the list can't be read.
+ */
+static bool warm_add_list(struct WarmState* state, const char* paths_file,
+                          const char* data_dir) {
+	FILE* list = fopen(paths_file, "r");
+	if (list == NULL) {
+		return false;
+	}
+
+	char line[4096];
+	while (fgets(line, sizeof(line), list) != NULL) {
+		/* Skip leading slashes, and trailing whitespace, empty lines and
+		 * comments
+		 */
+		char* path = line + strspn(line, "/");
+		path[strcspn(path, "\r\n")] = '\0';
+		if (*path == '\0' || *path == '#') {
+			continue;
+		}
+
+		char* file_path = malloc(strlen(data_dir) + strlen(path) + 1);
+		sprintf(file_path, "%s%s", data_dir, path);
+		warm_add_path(state, file_path, 0);
+		free(file_path);
+	}
+
+	fclose(list);
+	return true;
+}
+
+/* Read the file `file` into the page cache, locking it in memory if
+ * requested
+ */
+static void warm_file(struct WarmFile* file) {
+	int32_t fd = open(file->path, O_RDONLY);
+	if (fd < 0) {
+		return;
+	}
+
+	if (file->lock) {
+		/* Locking faults in every page, so it also reads the file */
+		void* addr = mmap(NULL, (size_t) file->size, PROT_READ, MAP_SHARED,
+		                  fd, 0);
+		if (addr != MAP_FAILED && mlock(addr, (size_t) file->size) == 0) {
+			file->mapping.addr = addr;
+			file->mapping.len = (size_t) file->size;
+			close(fd);
+			return;
+		}
+
+		if (addr != MAP_FAILED) {
+			munmap(addr, (size_t) file->size);
+		}
+		file->lock = false;
+	}
+
+	#ifdef __linux__
+	/* `readahead` only returns once the pages are read (or being read) */
+	if (readahead(fd, 0, (size_t) file->size) != 0) {
+		posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	}
+	#elif defined(POSIX_FADV_WILLNEED)
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	#endif
+
+	close(fd);
+}
+
+/* A warm-up thread, which warms files until none are left */
+static void* warm_thread(void* arg) {
+	struct WarmState* state = arg;
+
+	size_t i;
+	while ((i = __atomic_fetch_add(&state->next, 1, __ATOMIC_RELAXED)) <
+	       state->num_files) {
+		warm_file(&state->files[i]);
+
+		/* Log the progress every quarter of the bytes */
+		uint64_t warmed = __atomic_add_fetch(&state->warmed_bytes,
+		                                     state->files[i].size,
+		                                     __ATOMIC_RELAXED);
+		uint32_t quarter = (uint32_t) (warmed * 4 / state->total_bytes);
+		uint32_t reported = __atomic_load_n(&state->reported,
+		                                    __ATOMIC_RELAXED);
+		if (quarter > reported && quarter < 4 &&
+		    __atomic_compare_exchange_n(&state->reported, &reported, quarter,
+		                                false, __ATOMIC_RELAXED,
+		                                __ATOMIC_RELAXED)) {
+			char buf[96];
+			sprintf(buf, "Warmed %u%% of the page cache in %.2f seconds",
+			        (unsigned int) quarter * 25,
+			        (double) (monotonic_us() - state->start_us) / 1e6);
+			debug(buf);
+		}
+	}
+
+	return NULL;
+}
+
+void warm_page_cache(struct Warmup* warmup, const struct Config* config) {
+	struct WarmState state;
+	memset(&state, 0, sizeof(state));
+
+	/* Collect the files to warm, either from the list or from every
+	 * file-serving route
+	 */
+	size_t i;
+	if (warmup->paths_file != NULL) {
+		if (!warm_add_list(&state, warmup->paths_file, config->data_dir)) {
+			char* buf = malloc(40 + strlen(warmup->paths_file) + 1);
+			sprintf(buf, "Can't read the hot paths from '%s'",
+			        warmup->paths_file);
+			error(buf);
+			free(buf);
+			return;
+		}
+	} else {
+		for (i = 0; i < config->num_routes; i++) {
+			const struct Route* route = &config->routes[i];
+			if (route->handler != handle_files) {
+				continue;
+			}
+
+			/* Routes serving the same directory are warmed once */
+			size_t j;
+			for (j = 0; j < i; j++) {
+				if (config->routes[j].handler == handle_files &&
+				    strcmp(config->routes[j].root, route->root) == 0) {
+					break;
+				}
+			}
+			if (j == i) {
+				warm_add_path(&state, route->root, 0);
+			}
+		}
+	}
+
+	if (state.num_files == 0) {
+		warn("There are no files to warm the page cache with");
+		free(state.files);
+		return;
+	}
+
+	/* The hot set locked in memory is the first files, up to the limit */
+	uint64_t locked_bytes = 0;
+	for (i = 0; i < state.num_files; i++) {
+		if (locked_bytes + state.files[i].size > warmup->lock_bytes) {
+			break;
+		}
+		state.files[i].lock = true;
+		locked_bytes += state.files[i].size;
+	}
+
+	uint32_t num_threads = warmup->threads;
+	if (num_threads > state.num_files) {
+		num_threads = (uint32_t) state.num_files;
+	}
+
+	char buf[128];
+	sprintf(buf, "Warming the page cache with %lu files (%.1f MiB) using %u "
+	             "threads", (unsigned long) state.num_files,
+	        (double) state.total_bytes / (1024 * 1024),
+	        (unsigned int) num_threads);
+	info(buf);
+
+	/* The current thread is one of the warm-up threads */
+	state.start_us = monotonic_us();
+	pthread_t threads[SERV_WARM_MAX_THREADS];
+	uint32_t started = 0;
+
+	/* Signals are handled by the main thread (see `stats_signal_init`) */
+	sigset_t all;
+	sigset_t old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	while (started + 1 < num_threads &&
+	       pthread_create(&threads[started], NULL, warm_thread, &state) == 0) {
+		started++;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	warm_thread(&state);
+	uint32_t t;
+	for (t = 0; t < started; t++) {
+		pthread_join(threads[t], NULL);
+	}
+
+	/* Keep the locked mappings until the options are freed */
+	uint64_t locked = 0;
+	for (i = 0; i < state.num_files; i++) {
+		if (state.files[i].lock) {
+			warmup->mappings = realloc(warmup->mappings,
+			                           (warmup->num_mappings + 1) *
+			                           sizeof(struct WarmMapping));
+			warmup->mappings[warmup->num_mappings] = state.files[i].mapping;
+			warmup->num_mappings++;
+			locked += state.files[i].size;
+		}
+		free(state.files[i].path);
+	}
+	free(state.files);
+
+	sprintf(buf, "Warmed the page cache in %.2f seconds",
+	        (double) (monotonic_us() - state.start_us) / 1e6);
+	info(buf);
+
+	if (locked_bytes > 0) {
+		sprintf(buf, "Locked %lu files (%.1f MiB) in memory",
+		        (unsigned long) warmup->num_mappings,
+		        (double) locked / (1024 * 1024));
+		info(buf);
+	}
+	if (locked < locked_bytes) {
+		warn("Some files could not be locked in memory (see RLIMIT_MEMLOCK)");
+	}
+}
+
+void free_warmup(struct Warmup* warmup) {
+	size_t i;
+	for (i = 0; i < warmup->num_mappings; i++) {
+		munlock(warmup->mappings[i].addr, warmup->mappings[i].len);
+		munmap(warmup->mappings[i].addr, warmup->mappings[i].len);
+	}
+
+	free(warmup->mappings);
+	free(warmup->paths_file);
+	memset(warmup, 0, sizeof(*warmup));
+}
+
+#else
+
+void warm_page_cache(struct Warmup* warmup, const struct Config* config) {
+	warn("Warming the page cache is not supported on Windows");
+}
+
+void free_warmup(struct Warmup* warmup) {
+	free(warmup->paths_file);
+	memset(warmup, 0, sizeof(*warmup));
+}
+
+#endif
+
+void advise_sequential(FILE* file, uint64_t size) {
+	#ifdef __linux__
+	/* Doubles the readahead window of the file */
+	if (size >= SERV_WARM_SEQUENTIAL_MIN) {
+		posix_fadvise(fileno(file), 0, 0, POSIX_FADV_SEQUENTIAL);
+	}
+	#endif
+}
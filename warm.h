@@ -0,0 +1,72 @@
+/* Page cache warming. After a (re)start, the first requests for large files
+ * would stall on disk reads, so on startup (`-C`) the files that will be
+ * served are read into the page cache ahead of time by several threads in
+ * parallel, and a hot set of them can be locked in memory. Large files are
+ * also marked for sequential access when they are served, so that the kernel
+ * reads further ahead while they are streamed.
+ */
+
+#ifndef C_HTTP_SERVER_WARM_H
+#define C_HTTP_SERVER_WARM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* The maximum number of warm-up threads */
+#define SERV_WARM_MAX_THREADS 64
+
+/* The size from which served files are marked for sequential access */
+#define SERV_WARM_SEQUENTIAL_MIN (1024 * 1024)
+
+/* The server configuration, see `config.h` */
+struct Config;
+
+/* A file locked in memory */
+struct WarmMapping {
+	void* addr;
+	size_t len;
+};
+
+/* The page cache warming options (`-C`) */
+struct Warmup {
+	/* The file listing the hot paths (relative to the data directory) to
+	 * warm, one per line, or NULL to warm all file-serving routes
+	 */
+	char* paths_file;
+	/* The number of warm-up threads (default 4) */
+	uint32_t threads;
+	/* The maximum number of bytes locked in memory, starting from the first
+	 * file, or 0 to not lock any files
+	 */
+	uint64_t lock_bytes;
+
+	/* The files locked in memory */
+	struct WarmMapping* mappings;
+	size_t num_mappings;
+};
+
+/* Parse the page cache warming options from a string "[OPTION[,OPTION...]]",
+ * where the options are "paths=FILE" (warm only the paths listed in FILE
+ * instead of every file that is served), "threads=N" (warm with N threads)
+ * and "lock=MIB" (lock up to MIB mebibytes of the files in memory). Returns
+ * false if the string is invalid. The options should be freed with
+ * `free_warmup` after use.
+ */
+bool parse_warmup(const char* str, struct Warmup* warmup);
+
+/* Free the memory allocated by `parse_warmup`, unlocking any locked files */
+void free_warmup(struct Warmup* warmup);
+
+/* Read the files that will be served (see `struct Warmup`) into the page
+ * cache, logging the progress. Returns once every file has been read.
+ */
+void warm_page_cache(struct Warmup* warmup, const struct Config* config);
+
+/* Mark the opened file `file` of `size` bytes for sequential access if it is
+ * large
+ */
+void advise_sequential(FILE* file, uint64_t size);
+
+#endif
@@ -0,0 +1,469 @@
+/* Implementation of `worker.h`, see that file for documentation and types */
+
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+
+#include "worker.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+#include "log.h"
+#include "proxy.h"
+
+#include "alloc.h"
+
+bool parse_workers(const char* str, struct Workers* workers) {
+	memset(workers, 0, sizeof(*workers));
+
+	char* end;
+	unsigned long num_workers = strtoul(str, &end, 10);
+	if (end == str || num_workers == 0 || num_workers > SERV_MAX_WORKERS) {
+		return false;
+	}
+	workers->num_workers = (uint32_t) num_workers;
+
+	const char* option = end;
+	if (*option == ',') {
+		option++;
+	} else if (*option != '\0') {
+		return false;
+	}
+
+	while (*option != '\0') {
+		size_t len = strcspn(option, ",");
+
+		if (len == 3 && strncmp(option, "pin", 3) == 0) {
+			workers->pin = true;
+		} else if (len == 5 && strncmp(option, "rxcpu", 5) == 0) {
+			workers->pin = true;
+			workers->rx_cpu = true;
+		} else {
+			return false;
+		}
+
+		option += len;
+		if (*option == ',') {
+			option++;
+		}
+	}
+
+	return true;
+}
+
+#ifndef _WIN32
+
+/* An accepted connection waiting for a worker */
+struct WorkerConnection {
+	Socket sock;
+	uint64_t client;
+	bool allowed;
+	const struct Listener* listener;
+	struct Trace* trace;
+	/* The CPU that received the connection, or -1 if that's not known */
+	int32_t rx_cpu;
+};
+
+struct Worker {
+	struct Workers* workers;
+	uint32_t index;
+	pthread_t thread;
+	/* The CPU the worker is pinned to, or -1 if it isn't pinned */
+	int32_t cpu;
+
+	/* The queue of accepted connections, a ring buffer */
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	struct WorkerConnection queue[SERV_WORKER_QUEUE_SIZE];
+	size_t head;
+	/* Written under `lock`, but also read without it (for picking a worker
+	 * and the statistics), so always written atomically
+	 */
+	size_t len;
+	bool stopping;
+
+	/* The statistics, written by the worker and read by the main thread */
+	int32_t last_cpu;
+	uint64_t connections;
+	/* The connections received on another NUMA node */
+	uint64_t remote;
+	/* The number of times the worker was found on a different CPU */
+	uint64_t migrations;
+};
+
+/* Get the NUMA node of the CPU `cpu`, or 0 if that's not known */
+static int32_t worker_cpu_node(size_t cpu) {
+	char path[64];
+	sprintf(path, "/sys/devices/system/cpu/cpu%lu", (unsigned long) cpu);
+	DIR* dir = opendir(path);
+	if (dir == NULL) {
+		return 0;
+	}
+
+	int32_t node = 0;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (strncmp(entry->d_name, "node", 4) == 0 &&
+		    entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+			node = (int32_t) strtol(entry->d_name + 4, NULL, 10);
+			break;
+		}
+	}
+
+	closedir(dir);
+	return node;
+}
+
+/* Get the CPU the calling thread is running on, or -1 if that's not known */
+static int32_t worker_current_cpu(void) {
+	#ifdef __linux__
+	return (int32_t) sched_getcpu();
+	#else
+	return -1;
+	#endif
+}
+
+/* Get the node of `cpu` (which may be -1 for an unknown CPU) */
+static int32_t worker_node(const struct Workers* workers, int32_t cpu) {
+	if (cpu < 0 || (size_t) cpu >= workers->num_cpus) {
+		return 0;
+	}
+
+	return workers->cpu_nodes[cpu];
+}
+
+/* Assign a CPU to each worker, round-robin over the CPUs this process may
+ * run on
+ */
+static void worker_assign_cpus(struct Workers* workers) {
+	uint32_t i;
+	for (i = 0; i < workers->num_workers; i++) {
+		workers->workers[i].cpu = -1;
+	}
+
+	#ifdef __linux__
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if (!workers->pin ||
+	    sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+		return;
+	}
+
+	size_t cpu = 0;
+	for (i = 0; i < workers->num_workers; i++) {
+		size_t tries;
+		for (tries = 0; tries < workers->num_cpus &&
+		                !CPU_ISSET(cpu, &allowed); tries++) {
+			cpu = (cpu + 1) % workers->num_cpus;
+		}
+		workers->workers[i].cpu = (int32_t) cpu;
+		cpu = (cpu + 1) % workers->num_cpus;
+	}
+	#endif
+}
+
+/* Which workers `worker_find` considers */
+enum WorkerMatch {
+	/* Workers on the CPU */
+	WorkerMatchCpu,
+	/* Workers on the NUMA node of the CPU */
+	WorkerMatchNode,
+	/* All workers */
+	WorkerMatchAny
+};
+
+/* Find the next worker (round-robin) with room in its queue that matches the
+ * CPU `cpu` as given by `match`. Returns NULL if there is no such worker.
+ */
+static struct Worker* worker_find(struct Workers* workers, int32_t cpu,
+                                  enum WorkerMatch match) {
+	uint32_t i;
+	for (i = 0; i < workers->num_workers; i++) {
+		uint32_t index = (workers->next_worker + i) % workers->num_workers;
+		struct Worker* worker = &workers->workers[index];
+		bool matches = match == WorkerMatchAny ||
+		               (match == WorkerMatchNode ?
+		                worker_node(workers, worker->cpu) ==
+		                worker_node(workers, cpu) : worker->cpu == cpu);
+		if (matches && __atomic_load_n(&worker->len, __ATOMIC_RELAXED) <
+		               SERV_WORKER_QUEUE_SIZE) {
+			workers->next_worker = (index + 1) % workers->num_workers;
+			return worker;
+		}
+	}
+
+	return NULL;
+}
+
+/* Pin the calling worker to its CPU, if it has one */
+static void worker_pin(struct Worker* worker) {
+	if (worker->cpu < 0) {
+		return;
+	}
+
+	#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(worker->cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+		char buf[64];
+		sprintf(buf, "Could not pin worker %u to CPU %ld",
+		        (unsigned int) worker->index, (long) worker->cpu);
+		warn(buf);
+		worker->cpu = -1;
+	}
+	#endif
+}
+
+/* A worker thread, serving connections from its queue until it is stopped
+ * and the queue is empty
+ */
+static void* worker_thread(void* arg) {
+	struct Worker* worker = arg;
+	struct Workers* workers = worker->workers;
+
+	/* Pin the worker before it allocates anything, so that its memory is
+	 * allocated on its node
+	 */
+	worker_pin(worker);
+	__atomic_store_n(&worker->last_cpu, worker_current_cpu(),
+	                 __ATOMIC_RELAXED);
+
+	while (true) {
+		pthread_mutex_lock(&worker->lock);
+		while (worker->len == 0 && !worker->stopping) {
+			pthread_cond_wait(&worker->not_empty, &worker->lock);
+		}
+		if (worker->len == 0) {
+			pthread_mutex_unlock(&worker->lock);
+			break;
+		}
+
+		struct WorkerConnection conn = worker->queue[worker->head];
+		worker->head = (worker->head + 1) % SERV_WORKER_QUEUE_SIZE;
+		__atomic_store_n(&worker->len, worker->len - 1, __ATOMIC_RELAXED);
+		pthread_cond_signal(&worker->not_full);
+		pthread_mutex_unlock(&worker->lock);
+
+		int32_t cpu = worker_current_cpu();
+		if (cpu != __atomic_load_n(&worker->last_cpu, __ATOMIC_RELAXED)) {
+			__atomic_fetch_add(&worker->migrations, 1, __ATOMIC_RELAXED);
+			__atomic_store_n(&worker->last_cpu, cpu, __ATOMIC_RELAXED);
+		}
+		if (conn.rx_cpu >= 0 && worker_node(workers, conn.rx_cpu) !=
+		                        worker_node(workers, cpu)) {
+			__atomic_fetch_add(&worker->remote, 1, __ATOMIC_RELAXED);
+		}
+		__atomic_fetch_add(&worker->connections, 1, __ATOMIC_RELAXED);
+
+		workers->handler(conn.sock, conn.client, conn.allowed, conn.listener,
+		                 conn.trace, workers->config);
+	}
+
+	close_proxy_pool();
+	return NULL;
+}
+
+bool start_workers(struct Workers* workers, ConnectionHandler handler,
+                   const struct Config* config) {
+	workers->handler = handler;
+	workers->config = config;
+	workers->next_worker = 0;
+
+	long num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	workers->num_cpus = num_cpus > 0 ? (size_t) num_cpus : 1;
+	#ifdef __linux__
+	if (workers->num_cpus > CPU_SETSIZE) {
+		workers->num_cpus = CPU_SETSIZE;
+	}
+	#endif
+
+	workers->cpu_nodes = malloc(workers->num_cpus * sizeof(int32_t));
+	size_t cpu;
+	for (cpu = 0; cpu < workers->num_cpus; cpu++) {
+		workers->cpu_nodes[cpu] = worker_cpu_node(cpu);
+	}
+
+	workers->workers = calloc(workers->num_workers, sizeof(struct Worker));
+	worker_assign_cpus(workers);
+
+	/* Signals (`SIGUSR1`, `SIGUSR2` and `SIGHUP`) are handled by the main
+	 * thread, so they interrupt its `poll`
+	 */
+	sigset_t all;
+	sigset_t old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+
+	uint32_t i;
+	for (i = 0; i < workers->num_workers; i++) {
+		struct Worker* worker = &workers->workers[i];
+		worker->workers = workers;
+		worker->index = i;
+		worker->last_cpu = -1;
+		pthread_mutex_init(&worker->lock, NULL);
+		pthread_cond_init(&worker->not_empty, NULL);
+		pthread_cond_init(&worker->not_full, NULL);
+
+		if (pthread_create(&worker->thread, NULL, worker_thread, worker)) {
+			pthread_sigmask(SIG_SETMASK, &old, NULL);
+			error("Could not start the worker threads");
+			return false;
+		}
+
+		if (worker->cpu >= 0) {
+			char buf[64];
+			sprintf(buf, "Pinned worker %u to CPU %ld (node %ld)",
+			        (unsigned int) i, (long) worker->cpu,
+			        (long) worker_node(workers, worker->cpu));
+			debug(buf);
+		}
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	return true;
+}
+
+void dispatch_connection(struct Workers* workers, Socket sock,
+                         uint64_t client, bool allowed,
+                         const struct Listener* listener,
+                         struct Trace* trace) {
+	struct WorkerConnection conn;
+	conn.sock = sock;
+	conn.client = client;
+	conn.allowed = allowed;
+	conn.listener = listener;
+	conn.trace = trace;
+	conn.rx_cpu = -1;
+
+	#ifdef SO_INCOMING_CPU
+	if (workers->pin) {
+		int32_t rx_cpu;
+		socklen_t len = sizeof(rx_cpu);
+		if (getsockopt(sock, SOL_SOCKET, SO_INCOMING_CPU, &rx_cpu, &len) ==
+		    0) {
+			conn.rx_cpu = rx_cpu;
+		}
+	}
+	#endif
+
+	/* Prefer a worker on the receiving CPU, then one on its node, unless
+	 * they are busy, then any worker with room. Only when every queue is
+	 * full, wait for the next worker's queue.
+	 */
+	struct Worker* worker = NULL;
+	if (workers->rx_cpu && conn.rx_cpu >= 0) {
+		worker = worker_find(workers, conn.rx_cpu, WorkerMatchCpu);
+		if (worker == NULL) {
+			worker = worker_find(workers, conn.rx_cpu, WorkerMatchNode);
+		}
+	}
+	if (worker == NULL) {
+		worker = worker_find(workers, conn.rx_cpu, WorkerMatchAny);
+	}
+	if (worker == NULL) {
+		worker = &workers->workers[workers->next_worker];
+		workers->next_worker = (workers->next_worker + 1) %
+		                       workers->num_workers;
+	}
+
+	pthread_mutex_lock(&worker->lock);
+	while (worker->len == SERV_WORKER_QUEUE_SIZE) {
+		pthread_cond_wait(&worker->not_full, &worker->lock);
+	}
+	worker->queue[(worker->head + worker->len) % SERV_WORKER_QUEUE_SIZE] =
+		conn;
+	__atomic_store_n(&worker->len, worker->len + 1, __ATOMIC_RELAXED);
+	pthread_cond_signal(&worker->not_empty);
+	pthread_mutex_unlock(&worker->lock);
+}
+
+void log_worker_stats(const struct Workers* workers) {
+	uint32_t i;
+	for (i = 0; i < workers->num_workers; i++) {
+		struct Worker* worker = &workers->workers[i];
+		int32_t cpu = __atomic_load_n(&worker->last_cpu, __ATOMIC_RELAXED);
+
+		char buf[192];
+		sprintf(buf, "Worker %u: CPU %ld (node %ld%s), %lu connections (%lu "
+		             "received on another node), %lu migrations, %lu queued",
+		        (unsigned int) i, (long) cpu, (long) worker_node(workers, cpu),
+		        worker->cpu >= 0 ? ", pinned" : "",
+		        (unsigned long) __atomic_load_n(&worker->connections,
+		                                        __ATOMIC_RELAXED),
+		        (unsigned long) __atomic_load_n(&worker->remote,
+		                                        __ATOMIC_RELAXED),
+		        (unsigned long) __atomic_load_n(&worker->migrations,
+		                                        __ATOMIC_RELAXED),
+		        (unsigned long) __atomic_load_n(&worker->len,
+		                                        __ATOMIC_RELAXED));
+		info(buf);
+	}
+}
+
+void stop_workers(struct Workers* workers) {
+	uint32_t i;
+	for (i = 0; i < workers->num_workers; i++) {
+		struct Worker* worker = &workers->workers[i];
+		pthread_mutex_lock(&worker->lock);
+		worker->stopping = true;
+		pthread_cond_signal(&worker->not_empty);
+		pthread_mutex_unlock(&worker->lock);
+	}
+
+	for (i = 0; i < workers->num_workers; i++) {
+		pthread_join(workers->workers[i].thread, NULL);
+	}
+}
+
+void free_workers(struct Workers* workers) {
+	uint32_t i;
+	for (i = 0; i < workers->num_workers; i++) {
+		pthread_mutex_destroy(&workers->workers[i].lock);
+		pthread_cond_destroy(&workers->workers[i].not_empty);
+		pthread_cond_destroy(&workers->workers[i].not_full);
+	}
+
+	free(workers->workers);
+	free(workers->cpu_nodes);
+	memset(workers, 0, sizeof(*workers));
+}
+
+#else
+
+bool start_workers(struct Workers* workers, ConnectionHandler handler,
+                   const struct Config* config) {
+	error("Worker threads are not supported on Windows");
+	return false;
+}
+
+void dispatch_connection(struct Workers* workers, Socket sock,
+                         uint64_t client, bool allowed,
+                         const struct Listener* listener,
+                         struct Trace* trace) {
+	free(trace);
+	close_socket(sock);
+}
+
+void log_worker_stats(const struct Workers* workers) {}
+
+void stop_workers(struct Workers* workers) {}
+
+void free_workers(struct Workers* workers) {
+	memset(workers, 0, sizeof(*workers));
+}
+
+#endif
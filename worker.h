@@ -0,0 +1,100 @@
+/* Worker threads. With `-w`, connections are still accepted (and admitted
+ * and rate limited) by the main thread, but are then queued for one of a
+ * fixed set of worker threads, which serves them. Workers can be pinned to a
+ * CPU each, so that they don't migrate between CPUs and the memory they
+ * allocate (their stack, `malloc` arena, request buffers and proxy connection
+ * pool, all first touched by the worker itself) stays on their local NUMA
+ * node. Connections can also be queued for the worker on the CPU that
+ * received them from the network card (`SO_INCOMING_CPU`), or at least on its
+ * NUMA node, so that with the NIC's RX queue interrupts spread over the CPUs,
+ * a connection's packets never cross sockets.
+ */
+
+#ifndef C_HTTP_SERVER_WORKER_H
+#define C_HTTP_SERVER_WORKER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "socket.h"
+#include "trace.h"
+
+/* The maximum number of worker threads */
+#define SERV_MAX_WORKERS 256
+
+/* The number of accepted connections each worker can have queued before the
+ * main thread waits for it
+ */
+#define SERV_WORKER_QUEUE_SIZE 64
+
+/* The function serving an accepted connection from the client with the rate
+ * limiting key `client` on `listener`, with the trace `trace` (or NULL),
+ * closing it afterwards (see `serve_accepted` in `server.c`)
+ */
+typedef void (*ConnectionHandler)(Socket sock, uint64_t client, bool allowed,
+                                  const struct Listener* listener,
+                                  struct Trace* trace,
+                                  const struct Config* config);
+
+/* A worker thread, see `worker.c` */
+struct Worker;
+
+/* The worker threads (`-w`) */
+struct Workers {
+	uint32_t num_workers;
+	/* Whether each worker is pinned to a CPU */
+	bool pin;
+	/* Whether connections are queued for the worker on the CPU (or NUMA
+	 * node) that received them
+	 */
+	bool rx_cpu;
+
+	struct Worker* workers;
+	/* The worker that the next connection is queued for (round-robin) */
+	uint32_t next_worker;
+	/* The NUMA node of each CPU */
+	int32_t* cpu_nodes;
+	size_t num_cpus;
+
+	ConnectionHandler handler;
+	const struct Config* config;
+};
+
+/* Parse the worker options from a string "N[,OPTION...]", where N is the
+ * number of workers and the options are "pin" (pin each worker to a CPU,
+ * round-robin over the CPUs the server may run on) and "rxcpu" (queue each
+ * connection for the worker on the CPU that received it, which implies
+ * "pin"). Returns false if the string is invalid.
+ */
+bool parse_workers(const char* str, struct Workers* workers);
+
+/* Start the worker threads, which serve connections with `handler`. Returns
+ * false (and logs an error) if they couldn't be started.
+ */
+bool start_workers(struct Workers* workers, ConnectionHandler handler,
+                   const struct Config* config);
+
+/* Queue the accepted connection `sock` from `listener` for a worker with
+ * room in its queue, waiting only while every worker's queue is full
+ */
+void dispatch_connection(struct Workers* workers, Socket sock,
+                         uint64_t client, bool allowed,
+                         const struct Listener* listener,
+                         struct Trace* trace);
+
+/* Log the CPU and NUMA node each worker runs on, and the connections it
+ * served
+ */
+void log_worker_stats(const struct Workers* workers);
+
+/* Let the workers serve the connections still queued, and wait for them to
+ * exit
+ */
+void stop_workers(struct Workers* workers);
+
+/* Free the memory allocated by `start_workers` */
+void free_workers(struct Workers* workers);
+
+#endif